@@ -0,0 +1,1075 @@
+/**
+ * age_ntfs - Age an NTFS volume by replaying a synthetic file workload.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility ages a freshly formatted, unmounted NTFS volume (or volume
+ * image) to give allocator and runlist work realistic starting points.  It
+ * replays a random mix of file creations, appends, truncations and deletions
+ * through the ntfs library, keeping the volume around a target fill level, so
+ * that the free space fragments and files end up with many extents the way
+ * they do on a volume which has been in use for a long time.
+ *
+ * The workload only depends on the options and the random seed, which is
+ * printed with the resulting free extent and extents per file histograms, so
+ * replaying it on a copy of the same fresh volume produces the same aged
+ * volume.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+
+#include "types.h"
+#include "attrib.h"
+#include "dir.h"
+#include "index.h"
+#include "inode.h"
+#include "layout.h"
+#include "lcnalloc.h"
+#include "logging.h"
+#include "mft.h"
+#include "misc.h"
+#include "ntfstime.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "age_ntfs";
+
+/* Number of power of two buckets in a histogram. */
+#define AGE_NR_BUCKETS		64
+
+/* Size of the buffer file data is written from. */
+#define AGE_WRITE_BUF_SIZE	(1024 * 1024)
+
+/* Operations between checks of the extents per file target. */
+#define AGE_CHECK_INTERVAL	1024
+
+/* Free clusters never written to, so the library always has room. */
+#define AGE_RESERVED_CLUSTERS	1024
+
+/* All files are created with this time, for reproducible volumes. */
+#define AGE_TIME		1500000000
+
+/* The operations of the workload. */
+typedef enum {
+	AGE_CREATE,
+	AGE_APPEND,
+	AGE_TRUNCATE,
+	AGE_DELETE,
+	AGE_NR_OPS
+} age_op;
+
+static const char *const age_op_names[AGE_NR_OPS] = { "creates", "appends",
+		"truncates", "deletes" };
+
+/**
+ * struct age_file - a file created by the workload and not deleted yet
+ * @mref:	mft reference of the file
+ * @nr:		number the name of the file is made of
+ * @size:	byte size of the file
+ */
+typedef struct {
+	MFT_REF mref;
+	u32 nr;
+	s64 size;
+} age_file;
+
+static struct {
+	char *device;
+	s64 nr_ops;
+	s64 min_size;
+	s64 max_size;
+	int usage;
+	int weights[AGE_NR_OPS];
+	double target_extents;
+	u32 seed;
+	BOOL verbose;
+} opts = {
+	.nr_ops = 10000,
+	.min_size = 512,
+	.max_size = 16 * 1024 * 1024,
+	.usage = 75,
+	.weights = { 40, 30, 10, 20 },
+};
+
+/**
+ * struct age_ctx - state of the workload
+ * @vol:	the volume being aged
+ * @dir:	directory the files are created in
+ * @rand:	state of the random number generator
+ * @files:	the live files
+ * @nr_files:	number of @files
+ * @max_files:	number of @files allocated
+ * @next_nr:	number of the name of the next file created
+ * @nr_done:	number of each operation done
+ * @nr_full:	number of writes cut short because the volume was full
+ * @full:	the allocator ran out of space, delete until some is freed
+ * @buf:	data written to the files
+ */
+typedef struct {
+	ntfs_volume *vol;
+	ntfs_inode *dir;
+	u32 rand;
+	age_file *files;
+	s64 nr_files;
+	s64 max_files;
+	u32 next_nr;
+	s64 nr_done[AGE_NR_OPS];
+	s64 nr_full;
+	BOOL full;
+	u8 *buf;
+} age_ctx;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - age an NTFS volume with a synthetic "
+			"workload.\n\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-v] [-e extents] [-m bytes] [-M bytes] "
+			"[-n count] [-u percent]\n"
+			"                [-w create,append,truncate,delete] "
+			"[-x seed] <device>\n\n", EXEC_NAME);
+	fprintf(stderr, "    -e extents  Stop once files have this many "
+			"extents on average.\n");
+	fprintf(stderr, "    -m bytes    Smallest file or append (default "
+			"512).\n");
+	fprintf(stderr, "    -M bytes    Largest file or append (default "
+			"16 MiB).\n");
+	fprintf(stderr, "    -n count    Number of operations (default "
+			"10000).\n");
+	fprintf(stderr, "    -u percent  Fill level to keep the volume at "
+			"(default 75).\n");
+	fprintf(stderr, "    -v          Print every operation.\n");
+	fprintf(stderr, "    -w weights  Relative frequency of each operation "
+			"(default 40,30,10,20).\n");
+	fprintf(stderr, "    -x seed     Seed of the workload (default "
+			"random).\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * parse_number - parse a numeric option argument
+ *
+ * Return the value of @arg, exiting via usage() unless it is a number
+ * between @min and @max.
+ */
+static s64 parse_number(const char *arg, s64 min, s64 max)
+{
+	char *end;
+	long long n;
+
+	errno = 0;
+	n = strtoll(arg, &end, 0);
+	if (errno || *end || n < min || n > max)
+		usage();
+	return n;
+}
+
+/**
+ * parse_weights - parse the argument of the -w option
+ *
+ * Fill in @opts.weights from a comma separated list of four weights,
+ * exiting via usage() on invalid input.
+ */
+static void parse_weights(const char *arg)
+{
+	char *end;
+	long w;
+	int i, total = 0;
+
+	for (i = 0; i < AGE_NR_OPS; i++) {
+		errno = 0;
+		w = strtol(arg, &end, 10);
+		if (errno || end == arg || w < 0 || w > 1000)
+			usage();
+		if (*end != (i == AGE_NR_OPS - 1 ? '\0' : ','))
+			usage();
+		opts.weights[i] = w;
+		total += w;
+		arg = end + 1;
+	}
+	if (!opts.weights[AGE_CREATE] || !total)
+		usage();
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	BOOL have_seed = FALSE;
+	char *end;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "e:m:M:n:u:vw:x:")) != -1) {
+		switch (ch) {
+		case 'e':
+			errno = 0;
+			opts.target_extents = strtod(optarg, &end);
+			if (errno || *end || opts.target_extents < 1)
+				usage();
+			break;
+		case 'm':
+			opts.min_size = parse_number(optarg, 1, 1LL << 40);
+			break;
+		case 'M':
+			opts.max_size = parse_number(optarg, 1, 1LL << 40);
+			break;
+		case 'n':
+			opts.nr_ops = parse_number(optarg, 0, 1LL << 40);
+			break;
+		case 'u':
+			opts.usage = parse_number(optarg, 1, 99);
+			break;
+		case 'v':
+			opts.verbose = TRUE;
+			break;
+		case 'w':
+			parse_weights(optarg);
+			break;
+		case 'x':
+			opts.seed = parse_number(optarg, 1, 0xffffffff);
+			have_seed = TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || opts.min_size > opts.max_size)
+		usage();
+	opts.device = argv[0];
+	if (!have_seed) {
+		opts.seed = (u32)time(NULL) ^ ((u32)getpid() << 16);
+		if (!opts.seed)
+			opts.seed = 1;
+	}
+}
+
+/**
+ * age_rand - return the next number of the workload's random sequence
+ */
+static u32 age_rand(age_ctx *a)
+{
+	/* xorshift32, which must never be seeded with zero. */
+	a->rand ^= a->rand << 13;
+	a->rand ^= a->rand >> 17;
+	a->rand ^= a->rand << 5;
+	return a->rand;
+}
+
+/**
+ * age_rand_size - return a random size between the smallest and largest
+ *
+ * Sizes are distributed evenly over powers of two, so there are as many
+ * files of 1 to 2 kiB as of 1 to 2 MiB, as on real volumes.
+ */
+static s64 age_rand_size(age_ctx *a)
+{
+	int lo, hi, bits;
+	s64 size;
+
+	for (lo = 0; (opts.min_size >> (lo + 1)); lo++)
+		;
+	for (hi = 0; (opts.max_size >> (hi + 1)); hi++)
+		;
+	bits = lo + age_rand(a) % (hi - lo + 1);
+	size = (1LL << bits) + (((s64)age_rand(a) << 32 | age_rand(a)) &
+			((1LL << bits) - 1));
+	if (size < opts.min_size)
+		size = opts.min_size;
+	if (size > opts.max_size)
+		size = opts.max_size;
+	return size;
+}
+
+/**
+ * age_file_name - build the $FILE_NAME attribute value of a file
+ * @a:		state of the workload
+ * @nr:		number the name of the file is made of
+ * @len:	byte size of the value is returned here
+ *
+ * Return the value, to be freed by the caller, or NULL with errno set.
+ */
+static FILE_NAME_ATTR *age_file_name(age_ctx *a, u32 nr, int *len)
+{
+	struct timespec ts = { AGE_TIME, 0 };
+	FILE_NAME_ATTR *fn;
+	ntfschar *uname = NULL;
+	char name[16];
+	int uname_len;
+
+	snprintf(name, sizeof(name), "f%08u", nr);
+	uname_len = ntfs_mbstoucs(name, &uname);
+	if (uname_len < 0)
+		return NULL;
+	*len = sizeof(FILE_NAME_ATTR) + uname_len * sizeof(ntfschar);
+	fn = ntfs_calloc(*len);
+	if (!fn) {
+		free(uname);
+		return NULL;
+	}
+	fn->parent_directory = MK_LE_MREF(a->dir->mft_no,
+			le16_to_cpu(a->dir->mrec->sequence_number));
+	fn->creation_time = fn->last_data_change_time =
+			fn->last_mft_change_time = fn->last_access_time =
+			timespec2ntfs(ts);
+	fn->file_attributes = FILE_ATTR_ARCHIVE;
+	fn->file_name_length = uname_len;
+	fn->file_name_type = FILE_NAME_POSIX;
+	memcpy(fn->file_name, uname, uname_len * sizeof(ntfschar));
+	free(uname);
+	return fn;
+}
+
+/**
+ * age_create_dir - create the directory the files are created in
+ * @a:		state of the workload
+ *
+ * The directory is named after the seed, so a volume can be aged several
+ * times with different seeds.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_create_dir(age_ctx *a)
+{
+	struct timespec ts = { AGE_TIME, 0 };
+	const u32 ir_len = sizeof(INDEX_ROOT) + sizeof(INDEX_ENTRY_HEADER);
+	u8 buf[sizeof(INDEX_ROOT) + sizeof(INDEX_ENTRY_HEADER)];
+	INDEX_ROOT *ir = (INDEX_ROOT*)buf;
+	INDEX_ENTRY *ie = (INDEX_ENTRY*)(buf + sizeof(INDEX_ROOT));
+	ntfs_volume *vol = a->vol;
+	STANDARD_INFORMATION si;
+	FILE_NAME_ATTR *fn = NULL;
+	ntfs_inode *root, *ni = NULL;
+	ntfschar *uname = NULL;
+	char name[32];
+	MFT_REF mref;
+	int uname_len, fn_len;
+
+	snprintf(name, sizeof(name), "aged-%u", opts.seed);
+	root = ntfs_inode_open(vol, FILE_root);
+	if (!root)
+		goto err;
+	uname_len = ntfs_mbstoucs(name, &uname);
+	if (uname_len < 0)
+		goto err;
+	fn_len = sizeof(FILE_NAME_ATTR) + uname_len * sizeof(ntfschar);
+	fn = ntfs_calloc(fn_len);
+	if (!fn)
+		goto err;
+	fn->parent_directory = MK_LE_MREF(FILE_root,
+			le16_to_cpu(root->mrec->sequence_number));
+	fn->creation_time = fn->last_data_change_time =
+			fn->last_mft_change_time = fn->last_access_time =
+			timespec2ntfs(ts);
+	fn->file_attributes = FILE_ATTR_I30_INDEX_PRESENT;
+	fn->file_name_length = uname_len;
+	fn->file_name_type = FILE_NAME_POSIX;
+	memcpy(fn->file_name, uname, uname_len * sizeof(ntfschar));
+	ni = ntfs_mft_record_alloc(vol, NULL);
+	if (!ni)
+		goto err;
+	/* Keep the times of the $STANDARD_INFORMATION set below. */
+	set_nino_flag(ni, TimesSet);
+	memset(&si, 0, sizeof(si));
+	si.creation_time = si.last_data_change_time =
+			si.last_mft_change_time = si.last_access_time =
+			timespec2ntfs(ts);
+	if (ntfs_attr_add(ni, AT_STANDARD_INFORMATION, AT_UNNAMED, 0,
+			(u8*)&si, offsetof(STANDARD_INFORMATION, v1_end)))
+		goto err;
+	memset(buf, 0, sizeof(buf));
+	ir->type = AT_FILE_NAME;
+	ir->collation_rule = COLLATION_FILE_NAME;
+	ir->index_block_size = cpu_to_le32(vol->indx_record_size);
+	if (vol->cluster_size <= vol->indx_record_size)
+		ir->clusters_per_index_block = vol->indx_record_size >>
+				vol->cluster_size_bits;
+	else
+		ir->clusters_per_index_block = vol->indx_record_size >>
+				NTFS_BLOCK_SIZE_BITS;
+	ir->index.entries_offset = cpu_to_le32(sizeof(INDEX_HEADER));
+	ir->index.index_length = ir->index.allocated_size =
+			cpu_to_le32(sizeof(INDEX_HEADER) +
+			sizeof(INDEX_ENTRY_HEADER));
+	ie->length = cpu_to_le16(sizeof(INDEX_ENTRY_HEADER));
+	ie->ie_flags = INDEX_ENTRY_END;
+	if (ntfs_attr_add(ni, AT_INDEX_ROOT, NTFS_INDEX_I30, 4, buf, ir_len))
+		goto err;
+	ni->mrec->flags |= MFT_RECORD_IS_DIRECTORY;
+	if (ntfs_attr_add(ni, AT_FILE_NAME, AT_UNNAMED, 0, (u8*)fn, fn_len))
+		goto err;
+	mref = MK_MREF(ni->mft_no, le16_to_cpu(ni->mrec->sequence_number));
+	if (ntfs_index_add_filename(root, fn, mref)) {
+		if (errno == EEXIST)
+			ntfs_log_error("The volume was already aged with seed "
+					"%u.\n", opts.seed);
+		goto err;
+	}
+	ni->mrec->link_count = cpu_to_le16(1);
+	ntfs_inode_mark_dirty(ni);
+	/* Reopen the directory so the inodes created in it find it cached. */
+	if (ntfs_inode_close(ni)) {
+		ni = NULL;
+		goto err;
+	}
+	ni = NULL;
+	a->dir = ntfs_inode_open(vol, mref);
+	if (!a->dir)
+		goto err;
+	free(fn);
+	free(uname);
+	return ntfs_inode_close(root);
+err:
+	ntfs_log_perror("Failed to create /%s", name);
+	if (ni) {
+		if (ntfs_mft_record_free(vol, ni))
+			ntfs_inode_close(ni);
+	}
+	free(fn);
+	free(uname);
+	if (root)
+		ntfs_inode_close(root);
+	return -1;
+}
+
+/**
+ * age_fit - limit a write to the space left for the workload
+ * @a:		state of the workload
+ * @size:	byte size of the write
+ *
+ * The mft zone is counted as taken, since the allocator keeps it for the mft
+ * and data writes that would need its free clusters can fail anyway.
+ *
+ * Return @size, reduced so the write leaves the mft zone and the reserve of
+ * free clusters alone, or 0 if there is no room at all.
+ */
+static s64 age_fit(age_ctx *a, s64 size)
+{
+	ntfs_volume *vol = a->vol;
+	const s64 room = (vol->free_clusters - (vol->mft_zone_end -
+			vol->mft_zone_start) - AGE_RESERVED_CLUSTERS) <<
+			vol->cluster_size_bits;
+
+	if (room <= 0)
+		return 0;
+	return size > room ? room : size;
+}
+
+/**
+ * age_write - extend the data of a file
+ * @a:		state of the workload
+ * @na:		unnamed $DATA attribute of the file
+ * @pos:	byte position to write at, the current size of the file
+ * @size:	number of bytes to write
+ *
+ * The free clusters left may be too scattered, or sit in the mft zone, for
+ * the allocator to satisfy a write even though age_fit() let it through.
+ * Running out of space is part of aging a volume, so the write is then cut
+ * short and the workload deletes files until the allocator recovers.
+ *
+ * Return the number of bytes written on success and -1 with errno set on
+ * error.
+ */
+static s64 age_write(age_ctx *a, ntfs_attr *na, s64 pos, s64 size)
+{
+	s64 written = 0;
+
+	while (written < size) {
+		const s64 len = size - written > AGE_WRITE_BUF_SIZE ?
+				AGE_WRITE_BUF_SIZE : size - written;
+
+		if (ntfs_attr_pwrite(na, pos + written, len, a->buf) != len) {
+			if (errno == ENOSPC) {
+				a->nr_full++;
+				a->full = TRUE;
+				return na->data_size - pos;
+			}
+			if (!errno)
+				errno = EIO;
+			return -1;
+		}
+		written += len;
+	}
+	return written;
+}
+
+/**
+ * age_create - create a file of random size
+ * @a:		state of the workload
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_create(age_ctx *a)
+{
+	struct timespec ts = { AGE_TIME, 0 };
+	STANDARD_INFORMATION si;
+	FILE_NAME_ATTR *fn;
+	ntfs_inode *ni;
+	ntfs_attr *na = NULL;
+	age_file *f;
+	s64 size;
+	int fn_len;
+
+	if (a->nr_files == a->max_files) {
+		f = realloc(a->files, (a->max_files + 1024) * sizeof(*f));
+		if (!f) {
+			ntfs_log_perror("Failed to allocate memory");
+			return -1;
+		}
+		a->files = f;
+		a->max_files += 1024;
+	}
+	fn = age_file_name(a, a->next_nr, &fn_len);
+	if (!fn) {
+		ntfs_log_perror("Failed to build file name");
+		return -1;
+	}
+	ni = ntfs_mft_record_alloc(a->vol, NULL);
+	if (!ni)
+		goto err;
+	set_nino_flag(ni, TimesSet);
+	ni->flags = FILE_ATTR_ARCHIVE;
+	memset(&si, 0, sizeof(si));
+	si.creation_time = si.last_data_change_time =
+			si.last_mft_change_time = si.last_access_time =
+			timespec2ntfs(ts);
+	si.file_attributes = FILE_ATTR_ARCHIVE;
+	if (ntfs_attr_add(ni, AT_STANDARD_INFORMATION, AT_UNNAMED, 0,
+			(u8*)&si, offsetof(STANDARD_INFORMATION, v1_end)) ||
+			ntfs_attr_add(ni, AT_DATA, AT_UNNAMED, 0, NULL, 0) ||
+			ntfs_attr_add(ni, AT_FILE_NAME, AT_UNNAMED, 0,
+			(u8*)fn, fn_len))
+		goto err;
+	f = a->files + a->nr_files;
+	f->mref = MK_MREF(ni->mft_no, le16_to_cpu(ni->mrec->sequence_number));
+	f->nr = a->next_nr;
+	if (ntfs_index_add_filename(a->dir, fn, f->mref))
+		goto err;
+	ni->mrec->link_count = cpu_to_le16(1);
+	ntfs_inode_mark_dirty(ni);
+	free(fn);
+	fn = NULL;
+	a->nr_files++;
+	a->next_nr++;
+	/* Write the data through the inode cache like any other file. */
+	if (ntfs_inode_close(ni)) {
+		ni = NULL;
+		goto err;
+	}
+	ni = ntfs_inode_open(a->vol, f->mref);
+	if (!ni)
+		goto err;
+	size = age_fit(a, age_rand_size(a));
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na)
+		goto err;
+	size = age_write(a, na, 0, size);
+	if (size < 0)
+		goto err;
+	f->size = size;
+	if (opts.verbose)
+		printf("create f%08u: %lld bytes\n", f->nr, (long long)size);
+	ntfs_attr_close(na);
+	return ntfs_inode_close(ni);
+err:
+	ntfs_log_perror("Failed to create f%08u", a->next_nr);
+	if (na)
+		ntfs_attr_close(na);
+	if (ni)
+		ntfs_inode_close(ni);
+	free(fn);
+	return -1;
+}
+
+/**
+ * age_open - open the data of a live file
+ * @a:		state of the workload
+ * @f:		the file
+ * @na:		the unnamed $DATA attribute of the file is returned here
+ *
+ * Return the open inode of the file or NULL on error.
+ */
+static ntfs_inode *age_open(age_ctx *a, age_file *f, ntfs_attr **na)
+{
+	ntfs_inode *ni;
+
+	ni = ntfs_inode_open(a->vol, f->mref);
+	if (!ni) {
+		ntfs_log_perror("Failed to open f%08u", f->nr);
+		return NULL;
+	}
+	*na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!*na) {
+		ntfs_log_perror("Failed to open the data of f%08u", f->nr);
+		ntfs_inode_close(ni);
+		return NULL;
+	}
+	return ni;
+}
+
+/**
+ * age_append - append to a random file
+ * @a:		state of the workload
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_append(age_ctx *a)
+{
+	age_file *f = a->files + age_rand(a) % a->nr_files;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	s64 size;
+	int ret = 0;
+
+	ni = age_open(a, f, &na);
+	if (!ni)
+		return -1;
+	size = age_write(a, na, f->size, age_fit(a, age_rand_size(a)));
+	if (size < 0) {
+		ntfs_log_perror("Failed to append to f%08u", f->nr);
+		ret = -1;
+	} else {
+		f->size += size;
+		if (opts.verbose)
+			printf("append f%08u: %lld bytes\n", f->nr,
+					(long long)size);
+	}
+	ntfs_attr_close(na);
+	if (ntfs_inode_close(ni))
+		ret = -1;
+	return ret;
+}
+
+/**
+ * age_truncate - shrink a random file
+ * @a:		state of the workload
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_truncate(age_ctx *a)
+{
+	age_file *f = a->files + age_rand(a) % a->nr_files;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	s64 size;
+	int ret = 0;
+
+	ni = age_open(a, f, &na);
+	if (!ni)
+		return -1;
+	size = f->size ? (((s64)age_rand(a) << 32 | age_rand(a)) &
+			0x7fffffffffffffffLL) % f->size : 0;
+	if (ntfs_attr_truncate(na, size)) {
+		ntfs_log_perror("Failed to truncate f%08u", f->nr);
+		ret = -1;
+	} else {
+		if (opts.verbose)
+			printf("truncate f%08u: %lld to %lld bytes\n", f->nr,
+					(long long)f->size, (long long)size);
+		f->size = size;
+	}
+	ntfs_attr_close(na);
+	if (ntfs_inode_close(ni))
+		ret = -1;
+	return ret;
+}
+
+/**
+ * age_delete - delete a random file
+ * @a:		state of the workload
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_delete(age_ctx *a)
+{
+	const s64 i = age_rand(a) % a->nr_files;
+	age_file *f = a->files + i;
+	FILE_NAME_ATTR *fn;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	int fn_len;
+
+	fn = age_file_name(a, f->nr, &fn_len);
+	if (!fn) {
+		ntfs_log_perror("Failed to build file name");
+		return -1;
+	}
+	if (ntfs_index_remove(a->dir, fn, fn_len)) {
+		ntfs_log_perror("Failed to remove f%08u from the directory",
+				f->nr);
+		free(fn);
+		return -1;
+	}
+	free(fn);
+	ni = age_open(a, f, &na);
+	if (!ni)
+		return -1;
+	if (NAttrNonResident(na) && (ntfs_attr_map_whole_runlist(na) ||
+			ntfs_cluster_free(a->vol, na, 0, -1) < 0)) {
+		ntfs_log_perror("Failed to free the clusters of f%08u", f->nr);
+		ntfs_attr_close(na);
+		ntfs_inode_close(ni);
+		return -1;
+	}
+	ntfs_attr_close(na);
+	if (ntfs_mft_record_free(a->vol, ni)) {
+		ntfs_log_perror("Failed to free the mft record of f%08u",
+				f->nr);
+		ntfs_inode_close(ni);
+		return -1;
+	}
+	if (opts.verbose)
+		printf("delete f%08u: %lld bytes\n", f->nr, (long long)f->size);
+	a->files[i] = a->files[--a->nr_files];
+	a->full = FALSE;
+	return 0;
+}
+
+/**
+ * age_file_extents - count the extents of a file
+ * @a:		state of the workload
+ * @f:		the file
+ *
+ * Return the number of physically contiguous runs of clusters of the data
+ * of @f, 0 if it is resident, or -1 on error.
+ */
+static s64 age_file_extents(age_ctx *a, age_file *f)
+{
+	runlist_element *rl;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	s64 n = 0;
+	LCN next = -1;
+
+	ni = age_open(a, f, &na);
+	if (!ni)
+		return -1;
+	if (NAttrNonResident(na)) {
+		if (ntfs_attr_map_whole_runlist(na)) {
+			ntfs_log_perror("Failed to map f%08u", f->nr);
+			n = -1;
+		} else {
+			for (rl = na->rl; rl->length; rl++) {
+				if (rl->lcn < 0)
+					continue;
+				if (rl->lcn != next)
+					n++;
+				next = rl->lcn + rl->length;
+			}
+		}
+	}
+	ntfs_attr_close(na);
+	ntfs_inode_close(ni);
+	return n;
+}
+
+/**
+ * age_mean_extents - return the mean number of extents of the live files
+ * @a:		state of the workload
+ *
+ * Only files with clusters count, resident files have no extents.  Return
+ * -1 on error.
+ */
+static double age_mean_extents(age_ctx *a)
+{
+	s64 i, n, total = 0, nr_files = 0;
+
+	for (i = 0; i < a->nr_files; i++) {
+		n = age_file_extents(a, a->files + i);
+		if (n < 0)
+			return -1;
+		if (n) {
+			total += n;
+			nr_files++;
+		}
+	}
+	return nr_files ? (double)total / nr_files : 0;
+}
+
+/**
+ * age_pick - choose the next operation
+ * @a:		state of the workload
+ *
+ * Deletes are forced while the volume is fuller than the target fill level,
+ * so the workload keeps cycling clusters through the allocator around it,
+ * and after a write ran out of space.
+ */
+static age_op age_pick(age_ctx *a)
+{
+	ntfs_volume *vol = a->vol;
+	int total = 0, r, op;
+
+	if (!a->nr_files)
+		return AGE_CREATE;
+	if (a->full || (vol->nr_clusters - vol->free_clusters) * 100 >
+			vol->nr_clusters * opts.usage)
+		return AGE_DELETE;
+	for (op = 0; op < AGE_NR_OPS; op++)
+		total += opts.weights[op];
+	r = age_rand(a) % total;
+	for (op = 0; r >= opts.weights[op]; op++)
+		r -= opts.weights[op];
+	return op;
+}
+
+/**
+ * age_run - replay the workload
+ * @a:		state of the workload
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_run(age_ctx *a)
+{
+	static int (*const ops[AGE_NR_OPS])(age_ctx *a) = { age_create,
+			age_append, age_truncate, age_delete };
+	double mean;
+	s64 i;
+	age_op op;
+
+	for (i = 0; i < opts.nr_ops; i++) {
+		op = age_pick(a);
+		if (ops[op](a))
+			return -1;
+		a->nr_done[op]++;
+		if (opts.target_extents && !((i + 1) % AGE_CHECK_INTERVAL)) {
+			mean = age_mean_extents(a);
+			if (mean < 0)
+				return -1;
+			if (mean >= opts.target_extents) {
+				printf("Reached %.2f extents per file after "
+						"%lld operations.\n", mean,
+						(long long)i + 1);
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * age_histogram_print - print a power of two histogram
+ * @title:	heading to print above the histogram
+ * @unit:	what the histogram buckets
+ * @what:	what the histogram counts
+ * @counts:	number of items in each bucket
+ *
+ * Bucket i counts the items of 2^i to 2^(i+1) - 1 units.
+ */
+static void age_histogram_print(const char *title, const char *unit,
+		const char *what, const s64 *counts)
+{
+	s64 total = 0;
+	int i;
+
+	for (i = 0; i < AGE_NR_BUCKETS; i++)
+		total += counts[i];
+	printf("%s:\n", title);
+	printf("  %22s %12s %7s\n", unit, what, "%");
+	for (i = 0; i < AGE_NR_BUCKETS; i++) {
+		char range[48];
+
+		if (!counts[i])
+			continue;
+		snprintf(range, sizeof(range), "%lld - %lld", 1LL << i,
+				(1LL << i) + ((1LL << i) - 1));
+		printf("  %22s %12lld %6.1f%%\n", range, (long long)counts[i],
+				100.0 * counts[i] / total);
+	}
+}
+
+static int age_bucket(s64 n)
+{
+	int i;
+
+	for (i = 0; (n >> (i + 1)) && i < AGE_NR_BUCKETS - 1; i++)
+		;
+	return i;
+}
+
+/**
+ * age_report - print the fragmentation profile of the aged volume
+ * @a:		state of the workload
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int age_report(age_ctx *a)
+{
+	ntfs_volume *vol = a->vol;
+	s64 free_counts[AGE_NR_BUCKETS], file_counts[AGE_NR_BUCKETS];
+	s64 nr_free = 0, nr_extents = 0, largest = 0, most = 0, total = 0;
+	s64 i, n, nr_nonres = 0, nr_frag = 0, run = 0;
+	u8 *bm;
+	LCN lcn;
+
+	memset(free_counts, 0, sizeof(free_counts));
+	memset(file_counts, 0, sizeof(file_counts));
+	bm = ntfs_malloc((vol->nr_clusters + 7) >> 3);
+	if (!bm)
+		return -1;
+	if (ntfs_attr_pread(vol->lcnbmp_na, 0, (vol->nr_clusters + 7) >> 3,
+			bm) != (vol->nr_clusters + 7) >> 3) {
+		ntfs_log_perror("Failed to read $Bitmap");
+		free(bm);
+		return -1;
+	}
+	for (lcn = 0; lcn <= vol->nr_clusters; lcn++) {
+		if (lcn < vol->nr_clusters &&
+				!(bm[lcn >> 3] & (1 << (lcn & 7)))) {
+			run++;
+			continue;
+		}
+		if (!run)
+			continue;
+		free_counts[age_bucket(run)]++;
+		nr_free += run;
+		nr_extents++;
+		if (run > largest)
+			largest = run;
+		run = 0;
+	}
+	free(bm);
+	for (i = 0; i < a->nr_files; i++) {
+		n = age_file_extents(a, a->files + i);
+		if (n < 0)
+			return -1;
+		if (!n)
+			continue;
+		file_counts[age_bucket(n)]++;
+		total += n;
+		nr_nonres++;
+		nr_frag += n > 1;
+		if (n > most)
+			most = n;
+	}
+
+	age_histogram_print("Free space", "extent size (clusters)", "extents",
+			free_counts);
+	printf("  free clusters: %lld of %lld in %lld extents, largest "
+			"%lld\n", (long long)nr_free,
+			(long long)vol->nr_clusters, (long long)nr_extents,
+			(long long)largest);
+	age_histogram_print("Extents per file", "extents", "files",
+			file_counts);
+	printf("  files: %lld, %lld non-resident, %lld fragmented, %.2f "
+			"extents per non-resident file, most %lld\n",
+			(long long)a->nr_files, (long long)nr_nonres,
+			(long long)nr_frag, nr_nonres ? (double)total /
+			nr_nonres : 0.0, (long long)most);
+	return 0;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  Success, the volume was aged
+ *	    1  Error, something went wrong
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long mnt_flags;
+	age_ctx a;
+	int op, ret = EXIT_FAILURE;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	if (ntfs_check_if_mounted(opts.device, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	memset(&a, 0, sizeof(a));
+	a.rand = opts.seed;
+	a.buf = ntfs_malloc(AGE_WRITE_BUF_SIZE);
+	if (!a.buf)
+		return EXIT_FAILURE;
+	memset(a.buf, 0xa5, AGE_WRITE_BUF_SIZE);
+	a.vol = ntfs_mount(opts.device, 0);
+	if (!a.vol) {
+		ntfs_log_perror("Failed to mount %s", opts.device);
+		free(a.buf);
+		return EXIT_FAILURE;
+	}
+	printf("%s: %lld clusters of %u bytes.\n", opts.device,
+			(long long)a.vol->nr_clusters,
+			(unsigned)a.vol->cluster_size);
+	/* Everything needed to replay the workload. */
+	printf("Workload: %s -x %u -n %lld -u %d -w %d,%d,%d,%d -m %lld "
+			"-M %lld", EXEC_NAME, opts.seed,
+			(long long)opts.nr_ops, opts.usage,
+			opts.weights[AGE_CREATE], opts.weights[AGE_APPEND],
+			opts.weights[AGE_TRUNCATE], opts.weights[AGE_DELETE],
+			(long long)opts.min_size, (long long)opts.max_size);
+	if (opts.target_extents)
+		printf(" -e %g", opts.target_extents);
+	printf(" %s\n", opts.device);
+	fflush(stdout);
+	if (age_create_dir(&a))
+		goto umount;
+	if (!age_run(&a)) {
+		printf("Operations:");
+		for (op = 0; op < AGE_NR_OPS; op++)
+			printf(" %lld %s%s", (long long)a.nr_done[op],
+					age_op_names[op],
+					op < AGE_NR_OPS - 1 ? "," : ".\n");
+		if (a.nr_full)
+			printf("Writes cut short by a full volume: %lld.\n",
+					(long long)a.nr_full);
+		if (!age_report(&a))
+			ret = EXIT_SUCCESS;
+	}
+	if (ntfs_inode_close(a.dir))
+		ret = EXIT_FAILURE;
+umount:
+	if (ntfs_umount(a.vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.device);
+		ret = EXIT_FAILURE;
+	}
+	free(a.files);
+	free(a.buf);
+	return ret;
+}
@@ -0,0 +1,1920 @@
+/**
+ * bench_ntfs - Benchmark the NTFS library on a synthetic volume image.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility creates a volume image with the Boot Camp formatter,
+ * populates it through the ntfs library with a configurable mix of a huge
+ * flat directory, a deep directory tree, many small files, fragmented large
+ * files and compressed files, and then times the core algorithms of the
+ * library on it: index lookup, reading directories, path lookup, runlist
+ * decompression and mapping, reading fragmented files one by one and with the
+ * bulk reader, cluster allocation, decompression and the mst fixups.
+ *
+ * The content of the image only depends on the options and the random seed,
+ * so runs with the same options can be compared.  The results are printed as
+ * one JSON object per line and can be compared with those of an earlier run,
+ * in which case benchmarks which got slower make bench_ntfs fail.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <time.h>
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+#include <sys/wait.h>
+
+#include "types.h"
+#include "attrib.h"
+#include "bulkread.h"
+#include "dir.h"
+#include "index.h"
+#include "inode.h"
+#include "layout.h"
+#include "lcnalloc.h"
+#include "logging.h"
+#include "mft.h"
+#include "misc.h"
+#include "mst.h"
+#include "ntfstime.h"
+#include "runlist.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "bench_ntfs";
+
+/* Exit status. */
+#define BENCH_EXIT_OK		0	/* All benchmarks ran. */
+#define BENCH_EXIT_FAILED	1	/* An error occurred. */
+#define BENCH_EXIT_SLOWER	2	/* Some benchmarks regressed. */
+
+/* Version of the JSON output, bumped when the benchmarks change. */
+#define BENCH_FORMAT_VERSION	1
+
+#define BENCH_DEFAULT_FORMATTER	"BootCampFormatter"
+
+/* Number of files in each level of the deep tree. */
+#define BENCH_DEEP_FILES	8
+
+/* Largest small file in bytes. */
+#define BENCH_SMALL_MAX		3000
+
+/* Bytes written to each fragmented file at a time. */
+#define BENCH_FRAG_CHUNK	(64 * 1024)
+
+/* Bytes read from the fragmented files at a time. */
+#define BENCH_READ_SIZE		(1024 * 1024)
+
+/* Byte size of each compressed file. */
+#define BENCH_COMPRESSED_SIZE	(1024 * 1024)
+
+/* Operations timed per iteration of the lookup benchmarks. */
+#define BENCH_LOOKUPS		10000
+#define BENCH_VCN_LOOKUPS	100000
+#define BENCH_PATH_LOOKUPS	100
+#define BENCH_ALLOCATIONS	1000
+
+/* Byte size of a sub-block of a compression block. */
+#define BENCH_SB_SIZE		0x1000
+
+/* All files are created with this time, for reproducible images. */
+#define BENCH_TIME		1500000000
+
+static struct {
+	char *image;
+	char *formatter;
+	char *output;
+	char *baseline;
+	s64 size;
+	int iterations;
+	int threshold;
+	u32 seed;
+	int flat;
+	int depth;
+	int small;
+	int fragmented;
+	int frag_mib;
+	int compressed;
+	BOOL force;
+	BOOL reuse;
+} opts = {
+	.formatter = BENCH_DEFAULT_FORMATTER,
+	.size = 1024,
+	.iterations = 5,
+	.threshold = 10,
+	.seed = 1,
+	.flat = 20000,
+	.depth = 32,
+	.small = 5000,
+	.fragmented = 8,
+	.frag_mib = 8,
+	.compressed = 16,
+};
+
+/**
+ * struct bench_result - timings of a benchmark
+ * @name:	name of the benchmark
+ * @unit:	what an operation is
+ * @ops:	number of operations per iteration
+ * @ns:		duration of each iteration in nanoseconds
+ */
+typedef struct {
+	const char *name;
+	const char *unit;
+	s64 ops;
+	s64 *ns;
+} bench_result;
+
+/**
+ * struct bench_ctx - state of a benchmark run
+ * @vol:	the mounted image
+ * @rand:	state of the random number generator
+ * @out:	where the results go
+ * @nr_slower:	number of benchmarks slower than the baseline
+ */
+typedef struct {
+	ntfs_volume *vol;
+	u32 rand;
+	FILE *out;
+	int nr_slower;
+} bench_ctx;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - benchmark the NTFS library on a synthetic "
+			"volume image.\n\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-fr] [-b baseline] [-c count] [-d depth] "
+			"[-F formatter] [-i count]\n"
+			"                  [-l count] [-L MiB] [-n count] "
+			"[-o file] [-s count] [-S MiB]\n"
+			"                  [-t percent] [-x seed] <image>\n\n",
+			EXEC_NAME);
+	fprintf(stderr, "    -b baseline  Compare with the results of an "
+			"earlier run.\n");
+	fprintf(stderr, "    -c count     Number of compressed files "
+			"(default 16).\n");
+	fprintf(stderr, "    -d depth     Depth of the deep directory tree "
+			"(default 32).\n");
+	fprintf(stderr, "    -f           Overwrite an existing image.\n");
+	fprintf(stderr, "    -F formatter Path of the Boot Camp formatter.\n");
+	fprintf(stderr, "    -i count     Timed iterations of each benchmark "
+			"(default 5).\n");
+	fprintf(stderr, "    -l count     Number of fragmented files "
+			"(default 8).\n");
+	fprintf(stderr, "    -L MiB       Size of each fragmented file "
+			"(default 8).\n");
+	fprintf(stderr, "    -n count     Entries in the flat directory "
+			"(default 20000).\n");
+	fprintf(stderr, "    -o file      Write the results to file instead "
+			"of standard output.\n");
+	fprintf(stderr, "    -r           Reuse an image populated by an "
+			"earlier run.\n");
+	fprintf(stderr, "    -s count     Number of small files "
+			"(default 5000).\n");
+	fprintf(stderr, "    -S MiB       Size of the image (default 1024).\n");
+	fprintf(stderr, "    -t percent   Slowdown from the baseline "
+			"tolerated (default 10).\n");
+	fprintf(stderr, "    -x seed      Seed of the image content "
+			"(default 1).\n");
+	exit(BENCH_EXIT_FAILED);
+}
+
+/**
+ * parse_count - parse a numeric option argument
+ *
+ * Return the value of @arg, exiting via usage() unless it is a number
+ * between @min and @max.
+ */
+static long parse_count(const char *arg, long min, long max)
+{
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(arg, &end, 0);
+	if (errno || *end || n < min || n > max)
+		usage();
+	return n;
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "b:c:d:fF:i:l:L:n:o:rs:S:t:x:")) !=
+			-1) {
+		switch (ch) {
+		case 'b':
+			opts.baseline = optarg;
+			break;
+		case 'c':
+			opts.compressed = parse_count(optarg, 0, 100000);
+			break;
+		case 'd':
+			opts.depth = parse_count(optarg, 0, 500);
+			break;
+		case 'f':
+			opts.force = TRUE;
+			break;
+		case 'F':
+			opts.formatter = optarg;
+			break;
+		case 'i':
+			opts.iterations = parse_count(optarg, 1, 100000);
+			break;
+		case 'l':
+			opts.fragmented = parse_count(optarg, 0, 100000);
+			break;
+		case 'L':
+			opts.frag_mib = parse_count(optarg, 1, 1024 * 1024);
+			break;
+		case 'n':
+			opts.flat = parse_count(optarg, 0, 10000000);
+			break;
+		case 'o':
+			opts.output = optarg;
+			break;
+		case 'r':
+			opts.reuse = TRUE;
+			break;
+		case 's':
+			opts.small = parse_count(optarg, 0, 10000000);
+			break;
+		case 'S':
+			opts.size = parse_count(optarg, 16, 16 * 1024 * 1024);
+			break;
+		case 't':
+			opts.threshold = parse_count(optarg, 0, 100000);
+			break;
+		case 'x':
+			opts.seed = parse_count(optarg, 0, 0x7fffffff);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || (opts.force && opts.reuse))
+		usage();
+	opts.image = argv[0];
+}
+
+/**
+ * bench_rand - return the next number of a reproducible random sequence
+ */
+static u32 bench_rand(bench_ctx *b)
+{
+	/* xorshift32, which must never be seeded with zero. */
+	b->rand ^= b->rand << 13;
+	b->rand ^= b->rand >> 17;
+	b->rand ^= b->rand << 5;
+	return b->rand;
+}
+
+/**
+ * bench_fill - fill a buffer with reproducible file content
+ * @b:		state of the benchmark run
+ * @buf:	buffer to fill
+ * @len:	byte size of @buf
+ *
+ * The content is text made of random words, which compresses about as well
+ * as typical documents do.
+ */
+static void bench_fill(bench_ctx *b, u8 *buf, size_t len)
+{
+	static const char *const words[] = { "the", "volume", "cluster",
+			"index", "record", "of", "runlist", "and", "file",
+			"attribute", "a", "directory", "compression", "to",
+			"bitmap", "entry" };
+	size_t i = 0;
+
+	while (i < len) {
+		const char *w = words[bench_rand(b) & 15];
+
+		while (*w && i < len)
+			buf[i++] = *w++;
+		if (i < len)
+			buf[i++] = (bench_rand(b) & 7) ? ' ' : '\n';
+	}
+}
+
+/**
+ * bench_now - return the time of a monotonic clock in nanoseconds
+ */
+static s64 bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * bench_format - create the image and format it
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_format(void)
+{
+	char *argv[] = { opts.formatter, "-F", "-v", "bench", opts.image,
+			NULL };
+	int fd, status;
+	pid_t pid;
+
+	fd = open(opts.image, O_WRONLY | O_CREAT | O_TRUNC |
+			(opts.force ? 0 : O_EXCL), 0644);
+	if (fd == -1) {
+		ntfs_log_perror("Failed to create %s%s", opts.image,
+				errno == EEXIST ? " (use -f to overwrite it "
+				"or -r to reuse it)" : "");
+		return -1;
+	}
+	if (ftruncate(fd, opts.size << 20)) {
+		ntfs_log_perror("Failed to size %s", opts.image);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	pid = fork();
+	if (pid == -1) {
+		ntfs_log_perror("Failed to fork");
+		return -1;
+	}
+	if (!pid) {
+		execvp(opts.formatter, argv);
+		ntfs_log_perror("Failed to run %s", opts.formatter);
+		_exit(127);
+	}
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			ntfs_log_perror("Failed to wait for %s",
+					opts.formatter);
+			return -1;
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		ntfs_log_error("%s failed to format %s.\n", opts.formatter,
+				opts.image);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * bench_file_name - build the $FILE_NAME attribute value of a name
+ * @dir:	directory the name is in, or NULL for a lookup key
+ * @name:	the name
+ * @flags:	file attributes of the file
+ * @len:	byte size of the value is returned here
+ *
+ * Return the value, to be freed by the caller, or NULL with errno set.
+ */
+static FILE_NAME_ATTR *bench_file_name(ntfs_inode *dir, const char *name,
+		FILE_ATTR_FLAGS flags, int *len)
+{
+	struct timespec ts = { BENCH_TIME, 0 };
+	FILE_NAME_ATTR *fn;
+	ntfschar *uname = NULL;
+	int uname_len;
+
+	uname_len = ntfs_mbstoucs(name, &uname);
+	if (uname_len < 0)
+		return NULL;
+	*len = sizeof(FILE_NAME_ATTR) + uname_len * sizeof(ntfschar);
+	fn = ntfs_calloc(*len);
+	if (!fn) {
+		free(uname);
+		return NULL;
+	}
+	if (dir)
+		fn->parent_directory = MK_LE_MREF(dir->mft_no,
+				le16_to_cpu(dir->mrec->sequence_number));
+	fn->creation_time = fn->last_data_change_time =
+			fn->last_mft_change_time = fn->last_access_time =
+			timespec2ntfs(ts);
+	fn->file_attributes = flags;
+	fn->file_name_length = uname_len;
+	fn->file_name_type = FILE_NAME_POSIX;
+	memcpy(fn->file_name, uname, uname_len * sizeof(ntfschar));
+	free(uname);
+	return fn;
+}
+
+/**
+ * bench_create - create a file or directory
+ * @b:		state of the benchmark run
+ * @dir:	directory to create it in
+ * @name:	its name
+ * @is_dir:	TRUE to create a directory
+ *
+ * A file is created with an empty unnamed $DATA attribute.  The new inode
+ * is written out and reopened so it is in the inode cache, where the syncs
+ * of the inodes created in it look their parent up.
+ *
+ * Return the open inode on success and NULL on error.
+ */
+static ntfs_inode *bench_create(bench_ctx *b, ntfs_inode *dir,
+		const char *name, BOOL is_dir)
+{
+	struct timespec ts = { BENCH_TIME, 0 };
+	STANDARD_INFORMATION si;
+	FILE_NAME_ATTR *fn = NULL;
+	ntfs_inode *ni;
+	MFT_REF mref;
+	int fn_len;
+
+	ni = ntfs_mft_record_alloc(b->vol, NULL);
+	if (!ni)
+		goto err;
+	/* Keep the times of the $STANDARD_INFORMATION set below. */
+	set_nino_flag(ni, TimesSet);
+	ni->flags = is_dir ? 0 : FILE_ATTR_ARCHIVE;
+	memset(&si, 0, sizeof(si));
+	si.creation_time = si.last_data_change_time =
+			si.last_mft_change_time = si.last_access_time =
+			timespec2ntfs(ts);
+	si.file_attributes = is_dir ? 0 : FILE_ATTR_ARCHIVE;
+	if (ntfs_attr_add(ni, AT_STANDARD_INFORMATION, AT_UNNAMED, 0,
+			(u8*)&si, offsetof(STANDARD_INFORMATION, v1_end)))
+		goto err;
+	if (is_dir) {
+		const u32 ir_len = sizeof(INDEX_ROOT) +
+				sizeof(INDEX_ENTRY_HEADER);
+		u8 buf[sizeof(INDEX_ROOT) + sizeof(INDEX_ENTRY_HEADER)];
+		INDEX_ROOT *ir = (INDEX_ROOT*)buf;
+		INDEX_ENTRY *ie = (INDEX_ENTRY*)(buf + sizeof(INDEX_ROOT));
+
+		memset(buf, 0, sizeof(buf));
+		ir->type = AT_FILE_NAME;
+		ir->collation_rule = COLLATION_FILE_NAME;
+		ir->index_block_size = cpu_to_le32(b->vol->indx_record_size);
+		if (b->vol->cluster_size <= b->vol->indx_record_size)
+			ir->clusters_per_index_block =
+					b->vol->indx_record_size >>
+					b->vol->cluster_size_bits;
+		else
+			ir->clusters_per_index_block =
+					b->vol->indx_record_size >>
+					NTFS_BLOCK_SIZE_BITS;
+		ir->index.entries_offset = cpu_to_le32(sizeof(INDEX_HEADER));
+		ir->index.index_length = ir->index.allocated_size =
+				cpu_to_le32(sizeof(INDEX_HEADER) +
+				sizeof(INDEX_ENTRY_HEADER));
+		ie->length = cpu_to_le16(sizeof(INDEX_ENTRY_HEADER));
+		ie->ie_flags = INDEX_ENTRY_END;
+		if (ntfs_attr_add(ni, AT_INDEX_ROOT, NTFS_INDEX_I30, 4, buf,
+				ir_len))
+			goto err;
+		ni->mrec->flags |= MFT_RECORD_IS_DIRECTORY;
+	} else if (ntfs_attr_add(ni, AT_DATA, AT_UNNAMED, 0, NULL, 0))
+		goto err;
+	fn = bench_file_name(dir, name, is_dir ? FILE_ATTR_I30_INDEX_PRESENT :
+			FILE_ATTR_ARCHIVE, &fn_len);
+	if (!fn)
+		goto err;
+	if (ntfs_attr_add(ni, AT_FILE_NAME, AT_UNNAMED, 0, (u8*)fn, fn_len))
+		goto err;
+	mref = MK_MREF(ni->mft_no, le16_to_cpu(ni->mrec->sequence_number));
+	if (ntfs_index_add_filename(dir, fn, mref))
+		goto err;
+	ni->mrec->link_count = cpu_to_le16(1);
+	ntfs_inode_mark_dirty(ni);
+	free(fn);
+	fn = NULL;
+	if (ntfs_inode_close(ni)) {
+		ni = NULL;
+		goto err;
+	}
+	ni = ntfs_inode_open(b->vol, mref);
+	if (!ni)
+		goto err;
+	return ni;
+err:
+	ntfs_log_perror("Failed to create %s", name);
+	free(fn);
+	if (ni)
+		ntfs_inode_close(ni);
+	return NULL;
+}
+
+/**
+ * bench_write - create a file with some content
+ * @b:		state of the benchmark run
+ * @dir:	directory to create the file in
+ * @name:	name of the file
+ * @len:	byte size of the content
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_write(bench_ctx *b, ntfs_inode *dir, const char *name,
+		size_t len)
+{
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	u8 *buf;
+	int ret = -1;
+
+	ni = bench_create(b, dir, name, FALSE);
+	if (!ni)
+		return -1;
+	buf = ntfs_malloc(len + 1);
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (buf && na) {
+		bench_fill(b, buf, len);
+		if (ntfs_attr_pwrite(na, 0, len, buf) == (s64)len)
+			ret = 0;
+	}
+	if (ret)
+		ntfs_log_perror("Failed to write %s", name);
+	if (na)
+		ntfs_attr_close(na);
+	free(buf);
+	if (ntfs_inode_close(ni))
+		ret = -1;
+	return ret;
+}
+
+/**
+ * bench_compress_sb - compress a 4kiB sub-block of a compression block
+ * @dst:	destination, with room for BENCH_SB_SIZE + 2 bytes
+ * @src:	BENCH_SB_SIZE bytes to compress
+ *
+ * Greedy LZNT1 compression with a hash of the last position of each three
+ * byte sequence, the inverse of ntfs_decompress().  A sub-block which does
+ * not compress is stored.
+ *
+ * Return the byte size of the compressed sub-block including its header.
+ */
+static int bench_compress_sb(u8 *dst, const u8 *src)
+{
+	s16 last[4096];
+	u8 *tag = NULL, *p = dst + 2;
+	int pos = 0, token = 8;
+
+	memset(last, 0xff, sizeof(last));
+	while (pos < BENCH_SB_SIZE) {
+		int lg = 0, u, best_len = 0, best_ofs = 0, max_len, h;
+
+		if (token == 8) {
+			if (p + 17 > dst + BENCH_SB_SIZE)
+				goto store;
+			tag = p++;
+			*tag = 0;
+			token = 0;
+		}
+		if (pos) {
+			for (u = pos - 1; u >= 0x10; u >>= 1)
+				lg++;
+		}
+		max_len = (0xfff >> lg) + 3;
+		if (max_len > BENCH_SB_SIZE - pos)
+			max_len = BENCH_SB_SIZE - pos;
+		if (pos + 3 <= BENCH_SB_SIZE) {
+			h = ((src[pos] << 4) ^ (src[pos + 1] << 2) ^
+					src[pos + 2]) & 4095;
+			if (last[h] >= 0 && pos - last[h] <= 1 << (4 + lg)) {
+				const u8 *m = src + last[h];
+
+				while (best_len < max_len && m[best_len] ==
+						src[pos + best_len])
+					best_len++;
+				best_ofs = pos - last[h];
+			}
+			last[h] = pos;
+		}
+		if (best_len >= 3) {
+			const u16 pt = ((best_ofs - 1) << (12 - lg)) |
+					(best_len - 3);
+
+			*tag |= 1 << token;
+			*p++ = pt & 0xff;
+			*p++ = pt >> 8;
+			pos += best_len;
+		} else
+			*p++ = src[pos++];
+		token++;
+	}
+	dst[0] = (p - dst - 3) & 0xff;
+	dst[1] = (((p - dst - 3) >> 8) & 0x0f) | 0xb0;
+	return p - dst;
+store:
+	dst[0] = 0xff;
+	dst[1] = 0x3f;
+	memcpy(dst + 2, src, BENCH_SB_SIZE);
+	return BENCH_SB_SIZE + 2;
+}
+
+/**
+ * bench_rl_append - append a run to a runlist being built
+ * @rl:		runlist, reallocated as needed
+ * @count:	number of elements in @rl
+ * @vcn:	first vcn of the run
+ * @lcn:	first lcn of the run or LCN_HOLE
+ * @len:	length of the run
+ *
+ * Runs contiguous with the last one are merged into it.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int bench_rl_append(runlist_element **rl, int *count, VCN vcn,
+		LCN lcn, s64 len)
+{
+	runlist_element *r;
+
+	if (*count) {
+		r = *rl + *count - 1;
+		if (r->vcn + r->length == vcn && ((lcn == LCN_HOLE &&
+				r->lcn == LCN_HOLE) || (lcn >= 0 &&
+				r->lcn >= 0 && r->lcn + r->length == lcn))) {
+			r->length += len;
+			return 0;
+		}
+	}
+	r = realloc(*rl, (*count + 2) * sizeof(*r));
+	if (!r)
+		return -1;
+	*rl = r;
+	r += (*count)++;
+	r->vcn = vcn;
+	r->lcn = lcn;
+	r->length = len;
+	return 0;
+}
+
+/**
+ * bench_set_runlist - give a file a non-resident $DATA attribute
+ * @ni:		the file, with an empty $DATA attribute
+ * @rl:		runlist of the new attribute, freed by this function
+ * @size:	byte size of the attribute, a multiple of the cluster size
+ * @flags:	flags of the attribute
+ *
+ * The clusters in @rl must be allocated and hold the content of the file.
+ * This is how the content of files the library cannot lay out the way they
+ * are needed here is put in place.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int bench_set_runlist(ntfs_inode *ni, runlist_element *rl, s64 size,
+		ATTR_FLAGS flags)
+{
+	ntfs_attr_search_ctx *ctx;
+	ntfs_attr *na;
+	int ret = -1;
+
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na || ntfs_attr_rm(na))
+		goto out;
+	ntfs_attr_close(na);
+	na = NULL;
+	if (ntfs_non_resident_attr_record_add(ni, AT_DATA, AT_UNNAMED, 0, 0,
+			8, flags) < 0)
+		goto out;
+	/*
+	 * Set the sizes before opening the attribute, as ntfs_attr_open()
+	 * clears the compression flag of an empty $DATA attribute.
+	 */
+	ctx = ntfs_attr_get_search_ctx(ni, NULL);
+	if (!ctx)
+		goto out;
+	if (ntfs_attr_lookup(AT_DATA, AT_UNNAMED, 0, CASE_SENSITIVE, 0, NULL,
+			0, ctx)) {
+		ntfs_attr_put_search_ctx(ctx);
+		goto out;
+	}
+	ctx->attr->allocated_size = ctx->attr->data_size =
+			ctx->attr->initialized_size = cpu_to_sle64(size);
+	ntfs_inode_mark_dirty(ctx->ntfs_ino);
+	ntfs_attr_put_search_ctx(ctx);
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na)
+		goto out;
+	free(na->rl);
+	na->rl = rl;
+	rl = NULL;
+	NAttrSetFullyMapped(na);
+	if (!ntfs_attr_update_mapping_pairs(na, 0))
+		ret = 0;
+out:
+	if (na)
+		ntfs_attr_close(na);
+	free(rl);
+	return ret;
+}
+
+/**
+ * bench_write_compressed - create a compressed file
+ * @b:		state of the benchmark run
+ * @dir:	directory to create the file in
+ * @name:	name of the file
+ *
+ * The library can read but not write compressed attributes, so the
+ * compression blocks are compressed here, written to clusters allocated for
+ * them and described by a runlist laid out the way Windows does it: the
+ * clusters holding each compressed block followed by a hole to the end of
+ * the block.  The file is then read back through the library and compared.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_write_compressed(bench_ctx *b, ntfs_inode *dir,
+		const char *name)
+{
+	ntfs_volume *vol = b->vol;
+	const u32 cb_size = vol->cluster_size << STANDARD_COMPRESSION_UNIT;
+	const int nr_cbs = BENCH_COMPRESSED_SIZE / cb_size;
+	runlist_element *rl = NULL, *alloc = NULL, *arl;
+	ntfs_inode *ni;
+	ntfs_attr *na = NULL;
+	u8 *data, *comp, *check;
+	s64 *cb_len;
+	s64 arl_ofs = 0;
+	int i, nr_runs = 0, ret = -1;
+	s64 total = 0;
+
+	data = ntfs_malloc(BENCH_COMPRESSED_SIZE);
+	comp = ntfs_malloc(BENCH_COMPRESSED_SIZE + nr_cbs * cb_size);
+	check = ntfs_malloc(BENCH_COMPRESSED_SIZE);
+	cb_len = ntfs_calloc(nr_cbs * sizeof(*cb_len));
+	ni = bench_create(b, dir, name, FALSE);
+	if (!data || !comp || !check || !cb_len || !ni)
+		goto out;
+	bench_fill(b, data, BENCH_COMPRESSED_SIZE);
+	/* Compress each block, storing it if it does not save a cluster. */
+	for (i = 0; i < nr_cbs; i++) {
+		u8 *dst = comp + (s64)i * cb_size;
+		const u8 *src = data + (s64)i * cb_size;
+		u32 ofs = 0, sb;
+
+		for (sb = 0; sb < cb_size; sb += BENCH_SB_SIZE) {
+			u8 tmp[BENCH_SB_SIZE + 2];
+			int len = bench_compress_sb(tmp, src + sb);
+
+			if (ofs + len > cb_size - vol->cluster_size)
+				break;
+			memcpy(dst + ofs, tmp, len);
+			ofs += len;
+		}
+		if (sb < cb_size) {
+			memcpy(dst, src, cb_size);
+			cb_len[i] = cb_size >> vol->cluster_size_bits;
+		} else {
+			/* A zero header ends the compressed block. */
+			memset(dst + ofs, 0, cb_size - ofs);
+			cb_len[i] = (ofs + vol->cluster_size - 1) >>
+					vol->cluster_size_bits;
+		}
+		total += cb_len[i];
+	}
+	alloc = ntfs_cluster_alloc(vol, 0, total, -1, DATA_ZONE);
+	if (!alloc)
+		goto out;
+	/* Lay the blocks out onto the allocated clusters. */
+	arl = alloc;
+	for (i = 0; i < nr_cbs; i++) {
+		const VCN cb_vcn = (s64)i << STANDARD_COMPRESSION_UNIT;
+		s64 done = 0;
+
+		while (done < cb_len[i]) {
+			s64 len = arl->length - arl_ofs;
+
+			if (len > cb_len[i] - done)
+				len = cb_len[i] - done;
+			if (ntfs_pwrite(vol->dev, (arl->lcn + arl_ofs) <<
+					vol->cluster_size_bits,
+					len << vol->cluster_size_bits,
+					comp + (((s64)i * cb_size) +
+					(done << vol->cluster_size_bits))) !=
+					len << vol->cluster_size_bits)
+				goto out;
+			if (bench_rl_append(&rl, &nr_runs, cb_vcn + done,
+					arl->lcn + arl_ofs, len))
+				goto out;
+			done += len;
+			arl_ofs += len;
+			if (arl_ofs == arl->length) {
+				arl++;
+				arl_ofs = 0;
+			}
+		}
+		if (done < 1 << STANDARD_COMPRESSION_UNIT &&
+				bench_rl_append(&rl, &nr_runs, cb_vcn + done,
+				LCN_HOLE, (1 << STANDARD_COMPRESSION_UNIT) -
+				done))
+			goto out;
+	}
+	rl[nr_runs].vcn = (s64)nr_cbs << STANDARD_COMPRESSION_UNIT;
+	rl[nr_runs].lcn = LCN_ENOENT;
+	rl[nr_runs].length = 0;
+	if (bench_set_runlist(ni, rl, BENCH_COMPRESSED_SIZE,
+			ATTR_IS_COMPRESSED))
+		goto out;
+	rl = NULL;
+	ni->flags |= FILE_ATTR_COMPRESSED;
+	/* Reopen the attribute so it is read back as any other would be. */
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na || ntfs_attr_pread(na, 0, BENCH_COMPRESSED_SIZE, check) !=
+			BENCH_COMPRESSED_SIZE)
+		goto out;
+	if (memcmp(data, check, BENCH_COMPRESSED_SIZE)) {
+		ntfs_log_error("Compressed file %s reads back wrong.\n", name);
+		errno = EIO;
+		goto out;
+	}
+	ret = 0;
+out:
+	if (ret)
+		ntfs_log_perror("Failed to write compressed file %s", name);
+	if (na)
+		ntfs_attr_close(na);
+	if (ni && ntfs_inode_close(ni))
+		ret = -1;
+	free(alloc);
+	free(rl);
+	free(cb_len);
+	free(check);
+	free(comp);
+	free(data);
+	return ret;
+}
+
+/**
+ * bench_write_fragmented - create the fragmented files
+ * @b:		state of the benchmark run
+ * @dir:	directory to create the files in
+ *
+ * The cluster allocator keeps growing files contiguous where it can, so
+ * writing the files in turn does not fragment them.  Instead the clusters of
+ * the files are allocated a chunk at a time in turn, from a position which
+ * only moves forward, so the chunks of each file are separated by those of
+ * the other files.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_write_fragmented(bench_ctx *b, ntfs_inode *dir)
+{
+	ntfs_volume *vol = b->vol;
+	const s64 size = (s64)opts.frag_mib << 20;
+	const s64 chunk = BENCH_FRAG_CHUNK >> vol->cluster_size_bits;
+	runlist_element **rls, *alloc, *r;
+	int *nr_runs;
+	char name[64];
+	LCN next_lcn = 0;
+	VCN vcn;
+	u8 *buf;
+	int i, ret = -1;
+
+	rls = ntfs_calloc((opts.fragmented + 1) * sizeof(*rls));
+	nr_runs = ntfs_calloc((opts.fragmented + 1) * sizeof(*nr_runs));
+	buf = ntfs_malloc(BENCH_FRAG_CHUNK);
+	if (!rls || !nr_runs || !buf)
+		goto out;
+	for (vcn = 0; vcn << vol->cluster_size_bits < size; vcn += chunk) {
+		for (i = 0; i < opts.fragmented; i++) {
+			alloc = ntfs_cluster_alloc(vol, vcn, chunk, next_lcn,
+					DATA_ZONE);
+			if (!alloc)
+				goto out;
+			bench_fill(b, buf, BENCH_FRAG_CHUNK);
+			for (r = alloc; r->length; r++) {
+				const s64 ofs = (r->vcn - vcn) <<
+						vol->cluster_size_bits;
+				const s64 len = r->length <<
+						vol->cluster_size_bits;
+
+				if (ntfs_pwrite(vol->dev, r->lcn <<
+						vol->cluster_size_bits, len,
+						buf + ofs) != len ||
+						bench_rl_append(&rls[i],
+						&nr_runs[i], r->vcn, r->lcn,
+						r->length)) {
+					ntfs_cluster_free_from_rl(vol, alloc);
+					free(alloc);
+					goto out;
+				}
+				next_lcn = r->lcn + r->length;
+			}
+			free(alloc);
+		}
+	}
+	for (i = 0; i < opts.fragmented; i++) {
+		ntfs_inode *ni;
+
+		snprintf(name, sizeof(name), "frag%04d", i);
+		ni = bench_create(b, dir, name, FALSE);
+		if (!ni)
+			goto out;
+		rls[i][nr_runs[i]].vcn = vcn;
+		rls[i][nr_runs[i]].lcn = LCN_ENOENT;
+		rls[i][nr_runs[i]].length = 0;
+		if (bench_set_runlist(ni, rls[i], vcn <<
+				vol->cluster_size_bits, 0)) {
+			rls[i] = NULL;
+			ntfs_inode_close(ni);
+			goto out;
+		}
+		rls[i] = NULL;
+		if (ntfs_inode_close(ni))
+			goto out;
+	}
+	ret = 0;
+out:
+	if (ret)
+		ntfs_log_perror("Failed to write the fragmented files");
+	if (rls) {
+		for (i = 0; i < opts.fragmented; i++) {
+			if (rls[i]) {
+				rls[i][nr_runs[i]].length = 0;
+				ntfs_cluster_free_from_rl(vol, rls[i]);
+				free(rls[i]);
+			}
+		}
+	}
+	free(buf);
+	free(nr_runs);
+	free(rls);
+	return ret;
+}
+
+/**
+ * bench_populate - create the files and directories of the image
+ * @b:		state of the benchmark run
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_populate(bench_ctx *b)
+{
+	ntfs_volume *vol = b->vol;
+	ntfs_inode *root, *dir = NULL, *next;
+	char name[64];
+	u32 *order = NULL;
+	int i, j, ret = -1;
+
+	root = ntfs_inode_open(vol, FILE_root);
+	if (!root)
+		return -1;
+
+	/* A huge flat directory, its entries added in random order. */
+	fprintf(stderr, "Creating %d entries in /flat.\n", opts.flat);
+	dir = bench_create(b, root, "flat", TRUE);
+	order = ntfs_malloc((opts.flat + 1) * sizeof(*order));
+	if (!dir || !order)
+		goto out;
+	for (i = 0; i < opts.flat; i++)
+		order[i] = i;
+	for (i = opts.flat - 1; i > 0; i--) {
+		const u32 k = bench_rand(b) % (i + 1);
+		const u32 t = order[i];
+
+		order[i] = order[k];
+		order[k] = t;
+	}
+	for (i = 0; i < opts.flat; i++) {
+		snprintf(name, sizeof(name), "f%08u", order[i]);
+		next = bench_create(b, dir, name, FALSE);
+		if (!next || ntfs_inode_close(next))
+			goto out;
+	}
+	ntfs_inode_close(dir);
+
+	/* A deep tree, with a few small files at each level. */
+	fprintf(stderr, "Creating a tree of depth %d in /deep.\n",
+			opts.depth);
+	dir = bench_create(b, root, "deep", TRUE);
+	if (!dir)
+		goto out;
+	for (i = 1; i <= opts.depth; i++) {
+		for (j = 0; j < BENCH_DEEP_FILES; j++) {
+			snprintf(name, sizeof(name), "x%d", j);
+			if (bench_write(b, dir, name, bench_rand(b) %
+					BENCH_SMALL_MAX))
+				goto out;
+		}
+		snprintf(name, sizeof(name), "d%03d", i);
+		next = bench_create(b, dir, name, TRUE);
+		if (!next)
+			goto out;
+		ntfs_inode_close(dir);
+		dir = next;
+	}
+	ntfs_inode_close(dir);
+
+	/* Many small files, resident or just over a cluster. */
+	fprintf(stderr, "Creating %d small files in /small.\n", opts.small);
+	dir = bench_create(b, root, "small", TRUE);
+	if (!dir)
+		goto out;
+	for (i = 0; i < opts.small; i++) {
+		snprintf(name, sizeof(name), "s%08d", i);
+		if (bench_write(b, dir, name, bench_rand(b) % BENCH_SMALL_MAX))
+			goto out;
+	}
+	ntfs_inode_close(dir);
+
+	/* Large files with their clusters interleaved. */
+	fprintf(stderr, "Creating %d fragmented files of %d MiB in /frag.\n",
+			opts.fragmented, opts.frag_mib);
+	dir = bench_create(b, root, "frag", TRUE);
+	if (!dir || bench_write_fragmented(b, dir))
+		goto out;
+	ntfs_inode_close(dir);
+
+	/* Compressed files, only possible with clusters of up to 4kiB. */
+	dir = bench_create(b, root, "compressed", TRUE);
+	if (!dir)
+		goto out;
+	if (vol->cluster_size > 4096 && opts.compressed) {
+		ntfs_log_error("Clusters of %u bytes cannot be compressed, not "
+				"creating compressed files.\n",
+				(unsigned)vol->cluster_size);
+		opts.compressed = 0;
+	}
+	fprintf(stderr, "Creating %d compressed files in /compressed.\n",
+			opts.compressed);
+	for (i = 0; i < opts.compressed; i++) {
+		snprintf(name, sizeof(name), "c%04d", i);
+		if (bench_write_compressed(b, dir, name))
+			goto out;
+	}
+	ret = 0;
+out:
+	if (dir && ntfs_inode_close(dir))
+		ret = -1;
+	if (ntfs_inode_close(root))
+		ret = -1;
+	free(order);
+	return ret;
+}
+
+/**
+ * bench_lookup - look up a name in a directory
+ * @dir:	the directory
+ * @name:	the name
+ *
+ * Return the mft reference of the file, or 0 with errno set on error.
+ */
+static MFT_REF bench_lookup(ntfs_inode *dir, const char *name)
+{
+	ntfs_index_context *icx;
+	FILE_NAME_ATTR *fn;
+	MFT_REF mref = 0;
+	int len;
+
+	fn = bench_file_name(NULL, name, 0, &len);
+	if (!fn)
+		return 0;
+	icx = ntfs_index_ctx_get(dir, NTFS_INDEX_I30, 4);
+	if (icx) {
+		if (!ntfs_index_lookup(fn, len, icx))
+			mref = le64_to_cpu(icx->entry->indexed_file);
+		ntfs_index_ctx_put(icx);
+	}
+	free(fn);
+	return mref;
+}
+
+/**
+ * bench_open_path - open a file by its path from the root directory
+ * @vol:	volume to open the file on
+ * @path:	path of the file, components separated by slashes
+ *
+ * Return the open inode or NULL with errno set on error.
+ */
+static ntfs_inode *bench_open_path(ntfs_volume *vol, const char *path)
+{
+	char buf[4096], *p, *end;
+	ntfs_inode *ni, *next;
+	MFT_REF mref;
+
+	if (strlen(path) >= sizeof(buf)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	strcpy(buf, path);
+	ni = ntfs_inode_open(vol, FILE_root);
+	for (p = buf; ni && *p; p = end) {
+		end = strchr(p, '/');
+		if (end)
+			*end++ = '\0';
+		else
+			end = p + strlen(p);
+		mref = bench_lookup(ni, p);
+		next = mref ? ntfs_inode_open(vol, mref) : NULL;
+		ntfs_inode_close(ni);
+		ni = next;
+	}
+	return ni;
+}
+
+/**
+ * bench_report - summarize a benchmark and compare it with the baseline
+ * @b:		state of the benchmark run
+ * @r:		the benchmark, with all its iterations timed
+ * @baseline:	content of the baseline results, or NULL
+ */
+static void bench_report(bench_ctx *b, bench_result *r, const char *baseline)
+{
+	s64 min, max, median, t;
+	double per_op;
+	int i, j;
+	char key[128];
+	const char *p;
+
+	/* Insertion sort, there are only a few iterations. */
+	for (i = 1; i < opts.iterations; i++) {
+		t = r->ns[i];
+		for (j = i; j > 0 && r->ns[j - 1] > t; j--)
+			r->ns[j] = r->ns[j - 1];
+		r->ns[j] = t;
+	}
+	min = r->ns[0];
+	max = r->ns[opts.iterations - 1];
+	median = r->ns[opts.iterations / 2];
+	per_op = r->ops ? (double)median / r->ops : 0;
+	fprintf(b->out, "{\"benchmark\":\"%s\",\"unit\":\"%s\",\"ops\":%lld,"
+			"\"iterations\":%d,\"min_ns\":%lld,\"median_ns\":%lld,"
+			"\"max_ns\":%lld,\"ns_per_op\":%.3f}\n", r->name,
+			r->unit, (long long)r->ops, opts.iterations,
+			(long long)min, (long long)median, (long long)max,
+			per_op);
+	if (!baseline)
+		return;
+	snprintf(key, sizeof(key), "\"benchmark\":\"%s\"", r->name);
+	p = strstr(baseline, key);
+	if (p)
+		p = strstr(p, "\"ns_per_op\":");
+	if (!p) {
+		fprintf(stderr, "%s: not in the baseline.\n", r->name);
+		return;
+	}
+	{
+		const double old = strtod(p + strlen("\"ns_per_op\":"), NULL);
+
+		if (old > 0 && per_op > old * (100 + opts.threshold) / 100) {
+			fprintf(stderr, "%s: %.3f ns per %s, %.1f%% slower "
+					"than the baseline %.3f.\n", r->name,
+					per_op, r->unit, (per_op / old - 1) *
+					100, old);
+			b->nr_slower++;
+		}
+	}
+}
+
+typedef int (*bench_fn)(bench_ctx *b, void *data, s64 *ops);
+
+/**
+ * bench_run - run a benchmark
+ * @b:		state of the benchmark run
+ * @name:	name of the benchmark
+ * @unit:	what an operation is
+ * @fn:		runs one iteration, returning the number of operations
+ * @data:	passed to @fn
+ * @baseline:	content of the baseline results, or NULL
+ *
+ * Run @fn once to warm up and then the requested number of times timing
+ * each.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_run(bench_ctx *b, const char *name, const char *unit,
+		bench_fn fn, void *data, const char *baseline)
+{
+	bench_result r = { name, unit, 0, NULL };
+	int i;
+
+	r.ns = ntfs_malloc(opts.iterations * sizeof(*r.ns));
+	if (!r.ns)
+		return -1;
+	if (fn(b, data, &r.ops)) {
+		ntfs_log_error("Benchmark %s failed.\n", name);
+		free(r.ns);
+		return -1;
+	}
+	for (i = 0; i < opts.iterations; i++) {
+		s64 start = bench_now(), ops;
+
+		if (fn(b, data, &ops)) {
+			ntfs_log_error("Benchmark %s failed.\n", name);
+			free(r.ns);
+			return -1;
+		}
+		r.ns[i] = bench_now() - start;
+	}
+	bench_report(b, &r, baseline);
+	free(r.ns);
+	return 0;
+}
+
+/**
+ * struct bench_keys - lookup keys into a directory
+ * @dir:	the directory
+ * @keys:	$FILE_NAME values to look up
+ * @lens:	byte sizes of @keys
+ * @nr:		number of @keys
+ */
+typedef struct {
+	ntfs_inode *dir;
+	FILE_NAME_ATTR **keys;
+	int *lens;
+	int nr;
+} bench_keys;
+
+static int bench_index_lookup(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_keys *k = data;
+	int i;
+
+	for (i = 0; i < k->nr; i++) {
+		ntfs_index_context *icx;
+		int err;
+
+		icx = ntfs_index_ctx_get(k->dir, NTFS_INDEX_I30, 4);
+		if (!icx)
+			return -1;
+		err = ntfs_index_lookup(k->keys[i], k->lens[i], icx);
+		ntfs_index_ctx_put(icx);
+		if (err)
+			return -1;
+	}
+	*ops = k->nr;
+	return 0;
+}
+
+/**
+ * struct bench_dir - a directory being read
+ * @ni:		the directory
+ * @na:		its $INDEX_ALLOCATION, or NULL
+ * @block_size:	byte size of an index block
+ * @vcn_size_bits: log2 of the byte size of an index vcn
+ * @blocks:	a buffer for an index block at each depth
+ * @name:	the name of the current entry in the locale
+ * @buf:	storage for @name
+ */
+typedef struct {
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	u32 block_size;
+	u8 vcn_size_bits;
+	u8 *blocks[16];
+	char *name;
+	char buf[1024];
+} bench_dir;
+
+/**
+ * bench_readdir_node - read the entries of an index node in order
+ * @d:		the directory being read
+ * @ih:		index header of the node
+ * @depth:	depth of the node
+ * @count:	incremented for each entry
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int bench_readdir_node(bench_dir *d, INDEX_HEADER *ih, int depth,
+		s64 *count)
+{
+	INDEX_ENTRY *ie = (INDEX_ENTRY*)((u8*)ih +
+			le32_to_cpu(ih->entries_offset));
+
+	for (;; ie = (INDEX_ENTRY*)((u8*)ie + le16_to_cpu(ie->length))) {
+		if (ie->ie_flags & INDEX_ENTRY_NODE) {
+			const VCN vcn = ntfs_ie_get_vcn(ie);
+			INDEX_BLOCK *ib;
+
+			if (!d->na || depth + 1 >= (int)(sizeof(d->blocks) /
+					sizeof(*d->blocks))) {
+				errno = EIO;
+				return -1;
+			}
+			if (!d->blocks[depth + 1]) {
+				d->blocks[depth + 1] =
+						ntfs_malloc(d->block_size);
+				if (!d->blocks[depth + 1])
+					return -1;
+			}
+			ib = (INDEX_BLOCK*)d->blocks[depth + 1];
+			if (ntfs_attr_mst_pread(d->na, vcn << d->vcn_size_bits,
+					1, d->block_size, ib) != 1)
+				return -1;
+			if (bench_readdir_node(d, &ib->index, depth + 1,
+					count))
+				return -1;
+		}
+		if (ie->ie_flags & INDEX_ENTRY_END)
+			break;
+		if (ntfs_ucstombs(ie->key.file_name.file_name,
+				ie->key.file_name.file_name_length,
+				&d->name, sizeof(d->buf)) < 0)
+			return -1;
+		(*count)++;
+	}
+	return 0;
+}
+
+/**
+ * bench_readdir - read all the entries of a directory
+ * @d:		the directory to read, with @ni set
+ * @count:	number of entries is returned here
+ *
+ * The library has no directory reading interface, so this walks the index
+ * in order the way the kext's ntfs_readdir() does, reading index blocks with
+ * ntfs_attr_mst_pread() and converting every name to the locale.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int bench_readdir(bench_dir *d, s64 *count)
+{
+	INDEX_ROOT *ir;
+	s64 len;
+	int ret = -1;
+
+	*count = 0;
+	d->name = d->buf;
+	ir = ntfs_attr_readall(d->ni, AT_INDEX_ROOT, NTFS_INDEX_I30, 4, &len);
+	if (!ir)
+		return -1;
+	d->block_size = le32_to_cpu(ir->index_block_size);
+	d->vcn_size_bits = d->block_size >= d->ni->vol->cluster_size ?
+			d->ni->vol->cluster_size_bits : NTFS_BLOCK_SIZE_BITS;
+	d->na = ntfs_attr_open(d->ni, AT_INDEX_ALLOCATION, NTFS_INDEX_I30, 4);
+	if (d->na || errno == ENOENT)
+		ret = bench_readdir_node(d, &ir->index, 0, count);
+	if (d->na)
+		ntfs_attr_close(d->na);
+	d->na = NULL;
+	free(ir);
+	return ret;
+}
+
+static int bench_readdir_flat(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_dir *d = data;
+
+	if (bench_readdir(d, ops))
+		return -1;
+	if (*ops != opts.flat) {
+		ntfs_log_error("Read %lld entries from /flat, expected %d.\n",
+				(long long)*ops, opts.flat);
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_path_lookup(bench_ctx *b, void *data, s64 *ops)
+{
+	const char *path = data;
+	int i;
+
+	for (i = 0; i < BENCH_PATH_LOOKUPS; i++) {
+		ntfs_inode *ni = bench_open_path(b->vol, path);
+
+		if (!ni)
+			return -1;
+		ntfs_inode_close(ni);
+	}
+	*ops = (s64)BENCH_PATH_LOOKUPS * (opts.depth + 1);
+	return 0;
+}
+
+/**
+ * struct bench_files - open data attributes of a set of files
+ * @nas:	the attributes
+ * @nr:		number of @nas
+ * @vcns:	random vcns to map
+ * @mrefs:	mft references of the files
+ */
+typedef struct {
+	ntfs_attr **nas;
+	int nr;
+	VCN *vcns;
+	MFT_REF *mrefs;
+} bench_files;
+
+static int bench_rl_decompress(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_files *f = data;
+	int i;
+
+	for (i = 0; i < f->nr; i++) {
+		ntfs_attr *na = f->nas[i];
+
+		free(na->rl);
+		na->rl = NULL;
+		NAttrClearFullyMapped(na);
+		if (ntfs_attr_map_whole_runlist(na))
+			return -1;
+	}
+	*ops = f->nr;
+	return 0;
+}
+
+static int bench_rl_vcn_to_lcn(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_files *f = data;
+	int i;
+
+	for (i = 0; i < BENCH_VCN_LOOKUPS; i++) {
+		if (ntfs_rl_vcn_to_lcn(f->nas[i % f->nr]->rl, f->vcns[i]) < 0) {
+			errno = EIO;
+			return -1;
+		}
+	}
+	*ops = BENCH_VCN_LOOKUPS;
+	return 0;
+}
+
+static int bench_file_read(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_files *f = data;
+	s64 pos, br;
+	u8 *buf;
+	int i;
+
+	buf = ntfs_malloc(BENCH_READ_SIZE);
+	if (!buf)
+		return -1;
+	*ops = 0;
+	for (i = 0; i < f->nr; i++) {
+		for (pos = 0; pos < f->nas[i]->data_size; pos += br) {
+			br = ntfs_attr_pread(f->nas[i], pos, BENCH_READ_SIZE,
+					buf);
+			if (br <= 0) {
+				free(buf);
+				return -1;
+			}
+			*ops += br;
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+static int bench_bulk_read_piece(const ntfs_bulk_read_chunk *c, void *data)
+{
+	if (c->err) {
+		errno = c->err;
+		return -1;
+	}
+	*(s64*)data += c->len;
+	return 0;
+}
+
+static int bench_bulk_read(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_files *f = data;
+	ntfs_bulk_read_opts bulk_opts;
+
+	memset(&bulk_opts, 0, sizeof(bulk_opts));
+	bulk_opts.read_size = BENCH_READ_SIZE;
+	bulk_opts.ordered = TRUE;
+	bulk_opts.fn = bench_bulk_read_piece;
+	bulk_opts.data = ops;
+	*ops = 0;
+	return ntfs_bulk_read(b->vol, f->mrefs, f->nr, &bulk_opts, NULL);
+}
+
+static int bench_cluster_alloc(bench_ctx *b, void *data, s64 *ops)
+{
+	ntfs_volume *vol = b->vol;
+	runlist **rls = data;
+	int i, ret = 0;
+
+	for (i = 0; i < BENCH_ALLOCATIONS; i++) {
+		rls[i] = ntfs_cluster_alloc(vol, 0, 1 + bench_rand(b) % 64,
+				bench_rand(b) % vol->nr_clusters, DATA_ZONE);
+		if (!rls[i]) {
+			ret = -1;
+			break;
+		}
+	}
+	/*
+	 * Freeing is part of the timing as there is no other way to keep the
+	 * image unchanged between iterations.
+	 */
+	while (--i >= 0) {
+		if (ntfs_cluster_free_from_rl(vol, rls[i]))
+			ret = -1;
+		free(rls[i]);
+	}
+	*ops = BENCH_ALLOCATIONS;
+	return ret;
+}
+
+static int bench_decompress(bench_ctx *b, void *data, s64 *ops)
+{
+	bench_files *f = data;
+	u8 *buf;
+	int i;
+
+	buf = ntfs_malloc(BENCH_COMPRESSED_SIZE);
+	if (!buf)
+		return -1;
+	for (i = 0; i < f->nr; i++) {
+		if (ntfs_attr_pread(f->nas[i], 0, BENCH_COMPRESSED_SIZE, buf) !=
+				BENCH_COMPRESSED_SIZE) {
+			free(buf);
+			return -1;
+		}
+	}
+	free(buf);
+	*ops = (s64)f->nr * BENCH_COMPRESSED_SIZE;
+	return 0;
+}
+
+/**
+ * struct bench_mft - a copy of the mft as on disk
+ * @raw:	the mst protected records
+ * @work:	copy of @raw the fixups are applied to
+ * @size:	byte size of @raw
+ */
+typedef struct {
+	u8 *raw;
+	u8 *work;
+	s64 size;
+} bench_mft;
+
+static int bench_mst_fixup(bench_ctx *b, void *data, s64 *ops)
+{
+	const u32 rec_size = b->vol->mft_record_size;
+	bench_mft *m = data;
+	s64 pos;
+
+	*ops = 0;
+	memcpy(m->work, m->raw, m->size);
+	for (pos = 0; pos < m->size; pos += rec_size) {
+		NTFS_RECORD *r = (NTFS_RECORD*)(m->work + pos);
+
+		if (!ntfs_is_file_record(r->magic))
+			continue;
+		if (ntfs_mst_post_read_fixup_warn(r, rec_size, FALSE))
+			return -1;
+		(*ops)++;
+	}
+	return 0;
+}
+
+/**
+ * bench_open_files - open the data attributes of the files in a directory
+ * @b:		state of the benchmark run
+ * @f:		the attributes are returned here
+ * @fmt:	printf() format of the paths of the files, taking their number
+ * @nr:		number of files
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_open_files(bench_ctx *b, bench_files *f, const char *fmt,
+		int nr)
+{
+	char path[64];
+	int i;
+
+	memset(f, 0, sizeof(*f));
+	f->nas = ntfs_calloc((nr + 1) * sizeof(*f->nas));
+	if (!f->nas)
+		return -1;
+	for (i = 0; i < nr; i++) {
+		ntfs_inode *ni;
+
+		snprintf(path, sizeof(path), fmt, i);
+		ni = bench_open_path(b->vol, path);
+		if (!ni) {
+			ntfs_log_perror("Failed to open %s", path);
+			return -1;
+		}
+		f->nas[i] = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+		if (!f->nas[i] || ntfs_attr_map_whole_runlist(f->nas[i])) {
+			ntfs_log_perror("Failed to open the data of %s", path);
+			if (f->nas[i])
+				ntfs_attr_close(f->nas[i]);
+			f->nas[i] = NULL;
+			ntfs_inode_close(ni);
+			return -1;
+		}
+		f->nr++;
+	}
+	return 0;
+}
+
+static void bench_close_files(bench_files *f)
+{
+	int i;
+
+	for (i = 0; i < f->nr; i++) {
+		ntfs_inode *ni = f->nas[i]->ni;
+
+		ntfs_attr_close(f->nas[i]);
+		ntfs_inode_close(ni);
+	}
+	free(f->nas);
+	free(f->vcns);
+	free(f->mrefs);
+}
+
+/**
+ * bench_all - run all the benchmarks
+ * @b:		state of the benchmark run
+ * @baseline:	content of the baseline results, or NULL
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int bench_all(bench_ctx *b, const char *baseline)
+{
+	ntfs_volume *vol = b->vol;
+	bench_keys keys = { NULL, NULL, NULL, 0 };
+	bench_dir dir;
+	bench_files files;
+	bench_mft mft = { NULL, NULL, 0 };
+	runlist **rls = NULL;
+	char name[64], *path = NULL, *p;
+	s64 nr_runs = 0;
+	int i, ret = -1;
+
+	memset(&dir, 0, sizeof(dir));
+	memset(&files, 0, sizeof(files));
+	b->rand = opts.seed * 2654435761U + 1;
+
+	/* Index lookup and readdir in the flat directory. */
+	if (opts.flat) {
+		keys.dir = bench_open_path(vol, "flat");
+		keys.nr = BENCH_LOOKUPS;
+		keys.keys = ntfs_calloc(keys.nr * sizeof(*keys.keys));
+		keys.lens = ntfs_calloc(keys.nr * sizeof(*keys.lens));
+		if (!keys.dir || !keys.keys || !keys.lens)
+			goto out;
+		for (i = 0; i < keys.nr; i++) {
+			snprintf(name, sizeof(name), "f%08u",
+					bench_rand(b) % opts.flat);
+			keys.keys[i] = bench_file_name(NULL, name, 0,
+					&keys.lens[i]);
+			if (!keys.keys[i])
+				goto out;
+		}
+		if (bench_run(b, "index_lookup", "lookup", bench_index_lookup,
+				&keys, baseline))
+			goto out;
+		dir.ni = keys.dir;
+		if (bench_run(b, "readdir", "entry", bench_readdir_flat, &dir,
+				baseline))
+			goto out;
+	}
+
+	/* Path lookup down to the bottom of the deep tree. */
+	path = ntfs_malloc(8 + 8 * opts.depth);
+	if (!path)
+		goto out;
+	p = path + sprintf(path, "deep");
+	for (i = 1; i <= opts.depth; i++)
+		p += sprintf(p, "/d%03d", i);
+	if (opts.depth && bench_run(b, "path_lookup", "component",
+			bench_path_lookup, path, baseline))
+		goto out;
+
+	/* Runlist decompression and mapping of the fragmented files. */
+	if (opts.fragmented) {
+		if (bench_open_files(b, &files, "frag/frag%04d",
+				opts.fragmented))
+			goto out;
+		for (i = 0; i < files.nr; i++) {
+			runlist_element *rl;
+
+			for (rl = files.nas[i]->rl; rl->length; rl++)
+				nr_runs++;
+		}
+		fprintf(stderr, "The fragmented files have %lld runs.\n",
+				(long long)nr_runs);
+		files.vcns = ntfs_malloc(BENCH_VCN_LOOKUPS *
+				sizeof(*files.vcns));
+		if (!files.vcns)
+			goto out;
+		for (i = 0; i < BENCH_VCN_LOOKUPS; i++)
+			files.vcns[i] = bench_rand(b) % (((s64)opts.frag_mib <<
+					20) >> vol->cluster_size_bits);
+		if (bench_run(b, "runlist_decompress", "attribute",
+				bench_rl_decompress, &files, baseline) ||
+				bench_run(b, "runlist_vcn_to_lcn", "lookup",
+				bench_rl_vcn_to_lcn, &files, baseline))
+			goto out;
+		files.mrefs = ntfs_malloc(files.nr * sizeof(*files.mrefs));
+		if (!files.mrefs)
+			goto out;
+		for (i = 0; i < files.nr; i++) {
+			ntfs_inode *ni = files.nas[i]->ni;
+
+			files.mrefs[i] = MK_MREF(ni->mft_no,
+					le16_to_cpu(ni->mrec->sequence_number));
+		}
+		if (bench_run(b, "file_read", "byte", bench_file_read, &files,
+				baseline) || bench_run(b, "bulk_read", "byte",
+				bench_bulk_read, &files, baseline))
+			goto out;
+		bench_close_files(&files);
+		memset(&files, 0, sizeof(files));
+	}
+
+	/* Cluster allocation on the populated volume. */
+	rls = ntfs_calloc(BENCH_ALLOCATIONS * sizeof(*rls));
+	if (!rls || bench_run(b, "cluster_alloc", "allocation",
+			bench_cluster_alloc, rls, baseline))
+		goto out;
+
+	/* Decompression of the compressed files. */
+	if (opts.compressed) {
+		if (bench_open_files(b, &files, "compressed/c%04d",
+				opts.compressed))
+			goto out;
+		if (bench_run(b, "decompress", "byte", bench_decompress,
+				&files, baseline))
+			goto out;
+		bench_close_files(&files);
+		memset(&files, 0, sizeof(files));
+	}
+
+	/* The mst fixups of the whole mft. */
+	mft.size = vol->mft_na->initialized_size;
+	mft.raw = ntfs_malloc(mft.size);
+	mft.work = ntfs_malloc(mft.size);
+	if (!mft.raw || !mft.work)
+		goto out;
+	/* ntfs_attr_pread() does not apply the fixups, the records are raw. */
+	if (ntfs_attr_pread(vol->mft_na, 0, mft.size, mft.raw) != mft.size)
+		goto out;
+	if (bench_run(b, "mst_fixup", "record", bench_mst_fixup, &mft,
+			baseline))
+		goto out;
+	ret = 0;
+out:
+	if (ret)
+		ntfs_log_perror("Failed to run the benchmarks");
+	bench_close_files(&files);
+	for (i = 0; i < 16; i++)
+		free(dir.blocks[i]);
+	if (keys.keys) {
+		for (i = 0; i < keys.nr; i++)
+			free(keys.keys[i]);
+	}
+	free(keys.keys);
+	free(keys.lens);
+	if (keys.dir)
+		ntfs_inode_close(keys.dir);
+	free(rls);
+	free(path);
+	free(mft.raw);
+	free(mft.work);
+	return ret;
+}
+
+/**
+ * bench_read_baseline - read the results of an earlier run
+ *
+ * Return the content of the baseline file, to be freed by the caller, or
+ * NULL on error.
+ */
+static char *bench_read_baseline(void)
+{
+	FILE *f;
+	char *buf;
+	long len;
+
+	f = fopen(opts.baseline, "r");
+	if (!f) {
+		ntfs_log_perror("Failed to open %s", opts.baseline);
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+			fseek(f, 0, SEEK_SET)) {
+		ntfs_log_perror("Failed to read %s", opts.baseline);
+		fclose(f);
+		return NULL;
+	}
+	buf = ntfs_malloc(len + 1);
+	if (buf && fread(buf, 1, len, f) != (size_t)len) {
+		ntfs_log_perror("Failed to read %s", opts.baseline);
+		free(buf);
+		buf = NULL;
+	}
+	if (buf)
+		buf[len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  All the benchmarks ran
+ *	    1  Error, something went wrong
+ *	    2  Some benchmarks were slower than the baseline
+ */
+int main(int argc, char *argv[])
+{
+	bench_ctx b;
+	char *baseline = NULL;
+	int ret = BENCH_EXIT_FAILED;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	memset(&b, 0, sizeof(b));
+	b.rand = opts.seed * 2654435761U + 1;
+	b.out = stdout;
+	if (opts.baseline) {
+		baseline = bench_read_baseline();
+		if (!baseline)
+			return BENCH_EXIT_FAILED;
+	}
+
+	if (!opts.reuse) {
+		if (bench_format())
+			goto out;
+		b.vol = ntfs_mount(opts.image, 0);
+		if (!b.vol) {
+			ntfs_log_perror("Failed to mount %s", opts.image);
+			goto out;
+		}
+		if (bench_populate(&b)) {
+			ntfs_umount(b.vol, FALSE);
+			goto out;
+		}
+		if (ntfs_umount(b.vol, FALSE)) {
+			ntfs_log_perror("Failed to unmount %s", opts.image);
+			goto out;
+		}
+	}
+
+	/* Start from a cold library with the image populated. */
+	b.vol = ntfs_mount(opts.image, 0);
+	if (!b.vol) {
+		ntfs_log_perror("Failed to mount %s", opts.image);
+		goto out;
+	}
+	if (opts.output) {
+		b.out = fopen(opts.output, "w");
+		if (!b.out) {
+			ntfs_log_perror("Failed to create %s", opts.output);
+			ntfs_umount(b.vol, FALSE);
+			goto out;
+		}
+	}
+	fprintf(b.out, "{\"bench_ntfs\":%d,\"image_mib\":%lld,"
+			"\"cluster_size\":%u,\"mft_record_size\":%u,"
+			"\"seed\":%u,\"flat\":%d,\"depth\":%d,\"small\":%d,"
+			"\"fragmented\":%d,\"fragmented_mib\":%d,"
+			"\"compressed\":%d}\n", BENCH_FORMAT_VERSION,
+			(long long)opts.size, (unsigned)b.vol->cluster_size,
+			(unsigned)b.vol->mft_record_size, opts.seed,
+			opts.flat, opts.depth, opts.small, opts.fragmented,
+			opts.frag_mib, opts.compressed);
+	if (!bench_all(&b, baseline))
+		ret = b.nr_slower ? BENCH_EXIT_SLOWER : BENCH_EXIT_OK;
+	if (ntfs_umount(b.vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.image);
+		ret = BENCH_EXIT_FAILED;
+	}
+	if (b.out != stdout && fclose(b.out)) {
+		ntfs_log_perror("Failed to write %s", opts.output);
+		ret = BENCH_EXIT_FAILED;
+	}
+out:
+	free(baseline);
+	return ret;
+}
@@ -0,0 +1,1135 @@
+/**
+ * check_ntfs - Check the consistency of an unmounted NTFS volume.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility checks an unmounted NTFS volume (or volume image) without
+ * modifying it.  A single parallel scan of the mft (see newfs/mftscan.c)
+ * checks each mft record, records which clusters the runlists of all the
+ * non-resident attributes map and which mft records are in use, and walks
+ * the $I30 index of every directory.  The results are then compared with
+ * $Bitmap and the $MFT bitmap.
+ *
+ * To compare the directory indexes with the $FILE_NAME attributes without
+ * holding either in memory, every link is hashed into a bucket chosen by its
+ * directory, adding the hash for a $FILE_NAME attribute and subtracting it
+ * for an index entry.  Only if some bucket does not come out as zero is the
+ * mft scanned again, collecting the links of the directories in the bad
+ * buckets to find out exactly which links do not match.
+ *
+ * The memory used is one bit per cluster and two bits per mft record, plus
+ * the buckets, the index blocks being walked and the mft read buffers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STDARG_H
+#include <stdarg.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+#include <pthread.h>
+
+#include "types.h"
+#include "attrib.h"
+#include "dir.h"
+#include "inode.h"
+#include "layout.h"
+#include "logging.h"
+#include "mft.h"
+#include "mftscan.h"
+#include "misc.h"
+#include "mst.h"
+#include "runlist.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "check_ntfs";
+
+/* Exit status. */
+#define CHECK_EXIT_CLEAN	0	/* The volume is consistent. */
+#define CHECK_EXIT_ERRORS	1	/* Inconsistencies were found. */
+#define CHECK_EXIT_FAILED	2	/* The volume could not be checked. */
+
+/* Number of buckets the links between directories and files hash into. */
+#define CHECK_NR_BUCKETS	(1 << 20)
+
+/* Deepest an index b+tree is believed to get. */
+#define CHECK_MAX_INDEX_DEPTH	32
+
+/* Bytes of a bitmap compared at a time. */
+#define CHECK_BITMAP_CHUNK	(1024 * 1024)
+
+/* Number of bad ranges printed for each bitmap. */
+#define CHECK_MAX_RANGES	20
+
+/**
+ * struct check_link - a link between a directory and a file
+ * @parent:	mft reference of the directory
+ * @child:	mft reference of the file
+ * @hash:	hash of the link, see check_link_hash()
+ * @name:	the name of the file in the directory, in the locale
+ * @count:	number of $FILE_NAME attributes minus number of index entries
+ */
+typedef struct {
+	MFT_REF parent;
+	MFT_REF child;
+	u64 hash;
+	char *name;
+	int count;
+} check_link;
+
+/**
+ * struct check_ctx - state of a check
+ * @vol:		volume being checked
+ * @clusters:		bit per cluster, set for the clusters mapped by runlists
+ * @in_use:		bit per mft record, set for the records in use
+ * @corrupt:		bit per mft record, set for the corrupt records
+ * @nr_records:		number of mft records scanned
+ * @buckets:		sums of the hashes of the links, see above
+ * @bad_buckets:	bit per bucket, set for the buckets with a nonzero sum
+ *			during the second scan, NULL during the first one
+ * @lock:		protects the fields below
+ * @links:		links in bad buckets collected by the second scan
+ * @nr_links:		number of elements in @links
+ * @links_size:		allocated number of elements in @links
+ * @deferred:		directories whose index could not be walked from the
+ *			base mft record alone
+ * @nr_deferred:	number of elements in @deferred
+ * @deferred_size:	allocated number of elements in @deferred
+ * @nr_errors:		number of inconsistencies found
+ * @nr_warnings:	number of harmless inconsistencies found
+ * @nr_dirs:		number of directory indexes walked
+ * @nr_names:		number of $FILE_NAME attributes seen
+ */
+typedef struct {
+	ntfs_volume *vol;
+	u64 *clusters;
+	u8 *in_use;
+	u8 *corrupt;
+	s64 nr_records;
+	u64 *buckets;
+	u8 *bad_buckets;
+	pthread_mutex_t lock;
+	check_link *links;
+	s64 nr_links;
+	s64 links_size;
+	u64 *deferred;
+	s64 nr_deferred;
+	s64 deferred_size;
+	s64 nr_errors;
+	s64 nr_warnings;
+	s64 nr_dirs;
+	s64 nr_names;
+} check_ctx;
+
+/**
+ * struct check_index - a directory index being walked
+ * @ctx:		state of the check
+ * @out:		where to report problems, NULL for standard output
+ * @dir:		mft reference of the directory
+ * @block_size:		byte size of an index block
+ * @vcn_size_bits:	log2 of the byte size of an index vcn
+ * @alloc_size:		byte size of $INDEX_ALLOCATION, 0 if there is none
+ * @rl:			runlist of $INDEX_ALLOCATION when walking from the mft
+ *			record, read with ntfs_rl_pread()
+ * @na:			open $INDEX_ALLOCATION when walking through the
+ *			library, read with ntfs_attr_pread()
+ * @nr_blocks:		number of index blocks walked, to catch loops
+ */
+typedef struct {
+	check_ctx *ctx;
+	ntfs_mft_scan_out *out;
+	MFT_REF dir;
+	u32 block_size;
+	u8 vcn_size_bits;
+	s64 alloc_size;
+	runlist_element *rl;
+	ntfs_attr *na;
+	s64 nr_blocks;
+} check_index;
+
+static struct {
+	char *device;
+	int nr_threads;
+	BOOL verbose;
+} opts;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - check the consistency of an NTFS volume.\n\n",
+			EXEC_NAME);
+	fprintf(stderr, "usage: %s [-v] [-t threads] <device>\n\n",
+			EXEC_NAME);
+	fprintf(stderr, "    -t threads  Number of threads scanning the mft "
+			"(default one per cpu).\n");
+	fprintf(stderr, "    -v          Print the progress of the check.\n");
+	exit(CHECK_EXIT_FAILED);
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	char *end;
+	long n;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "t:v")) != -1) {
+		switch (ch) {
+		case 't':
+			errno = 0;
+			n = strtol(optarg, &end, 0);
+			if (errno || *end || n <= 0 || n > 1024)
+				usage();
+			opts.nr_threads = n;
+			break;
+		case 'v':
+			opts.verbose = TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	opts.device = argv[0];
+}
+
+/**
+ * check_report - report an inconsistency
+ * @ctx:	state of the check
+ * @out:	output of the mft chunk being checked, NULL for standard output
+ * @error:	TRUE for an error, FALSE for a harmless inconsistency
+ * @fmt:	printf() format of the message
+ *
+ * Count the inconsistency and print the message.  Messages found by the
+ * worker threads go through @out so that they come out in mft order.
+ */
+static void check_report(check_ctx *ctx, ntfs_mft_scan_out *out, BOOL error,
+		const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+static void check_report(check_ctx *ctx, ntfs_mft_scan_out *out, BOOL error,
+		const char *fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+	int len;
+
+	__sync_fetch_and_add(error ? &ctx->nr_errors : &ctx->nr_warnings, 1);
+	len = snprintf(buf, sizeof(buf), "%s: ", error ? "Error" : "Warning");
+	va_start(ap, fmt);
+	vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	va_end(ap);
+	if (!out)
+		printf("%s\n", buf);
+	else if (ntfs_mft_scan_write(out, buf, strlen(buf)) ||
+			ntfs_mft_scan_write(out, "\n", 1))
+		ntfs_log_perror("Failed to report '%s'", buf);
+}
+
+static inline void bit_set_atomic(u8 *bm, s64 bit)
+{
+	__sync_fetch_and_or(&bm[bit >> 3], 1 << (bit & 7));
+}
+
+static inline BOOL bit_test(const u8 *bm, s64 bit)
+{
+	return (bm[bit >> 3] >> (bit & 7)) & 1;
+}
+
+/**
+ * clusters_mark - mark a run of clusters as mapped
+ * @ctx:	state of the check
+ * @lcn:	first cluster of the run
+ * @len:	number of clusters in the run
+ *
+ * Return the number of clusters in the run which were mapped already.
+ */
+static s64 clusters_mark(check_ctx *ctx, LCN lcn, s64 len)
+{
+	s64 overlap = 0;
+
+	while (len > 0) {
+		const int bit = lcn & 63;
+		const int n = len < 64 - bit ? len : 64 - bit;
+		const u64 mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << bit;
+		u64 old;
+
+		old = __sync_fetch_and_or(&ctx->clusters[lcn >> 6], mask);
+		if (old & mask)
+			overlap += __builtin_popcountll(old & mask);
+		lcn += n;
+		len -= n;
+	}
+	return overlap;
+}
+
+/**
+ * check_runs - check and account for the runlist of an attribute
+ * @ctx:	state of the check
+ * @r:		mft record containing @a
+ * @a:		non-resident attribute record
+ * @out:	output of the mft chunk being checked
+ */
+static void check_runs(check_ctx *ctx, const ntfs_mft_scan_record *r,
+		const ATTR_RECORD *a, ntfs_mft_scan_out *out)
+{
+	ntfs_volume *vol = ctx->vol;
+	runlist_element *rl, *rle;
+
+	rl = ntfs_mapping_pairs_decompress(vol, a, NULL);
+	if (!rl) {
+		check_report(ctx, out, TRUE, "Record %llu: attribute 0x%x "
+				"has corrupt mapping pairs.",
+				(unsigned long long)r->mft_no,
+				(unsigned)le32_to_cpu(a->type));
+		return;
+	}
+	for (rle = rl; rle->length; rle++) {
+		s64 overlap;
+
+		if (rle->lcn < 0)
+			continue;
+		if (rle->lcn + rle->length > vol->nr_clusters) {
+			check_report(ctx, out, TRUE, "Record %llu: attribute "
+					"0x%x maps clusters %lld - %lld, beyond "
+					"the end of the volume.",
+					(unsigned long long)r->mft_no,
+					(unsigned)le32_to_cpu(a->type),
+					(long long)rle->lcn,
+					(long long)(rle->lcn + rle->length -
+					1));
+			continue;
+		}
+		overlap = clusters_mark(ctx, rle->lcn, rle->length);
+		if (overlap)
+			check_report(ctx, out, TRUE, "Record %llu: attribute "
+					"0x%x shares %lld of clusters %lld - "
+					"%lld with another attribute.",
+					(unsigned long long)r->mft_no,
+					(unsigned)le32_to_cpu(a->type),
+					(long long)overlap, (long long)rle->lcn,
+					(long long)(rle->lcn + rle->length -
+					1));
+	}
+	free(rl);
+}
+
+/**
+ * check_link_hash - hash a link between a directory and a file
+ * @parent:	mft reference of the directory
+ * @child:	mft reference of the file
+ * @fn:		$FILE_NAME attribute value or index key of the link
+ *
+ * FNV-1a over the references, the namespace and the name.
+ */
+static u64 check_link_hash(MFT_REF parent, MFT_REF child,
+		const FILE_NAME_ATTR *fn)
+{
+	const u8 *p = (const u8*)fn->file_name;
+	const u8 *end = p + fn->file_name_length * sizeof(ntfschar);
+	u64 h = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < 64; i += 8)
+		h = (h ^ ((parent >> i) & 0xff)) * 0x100000001b3ULL;
+	for (i = 0; i < 64; i += 8)
+		h = (h ^ ((child >> i) & 0xff)) * 0x100000001b3ULL;
+	h = (h ^ fn->file_name_type) * 0x100000001b3ULL;
+	while (p < end)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h;
+}
+
+/**
+ * check_link_add - account for a link between a directory and a file
+ * @ctx:	state of the check
+ * @parent:	mft reference of the directory
+ * @child:	mft reference of the file
+ * @fn:		$FILE_NAME attribute value or index key of the link
+ * @count:	1 for a $FILE_NAME attribute, -1 for an index entry
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int check_link_add(check_ctx *ctx, MFT_REF parent, MFT_REF child,
+		const FILE_NAME_ATTR *fn, int count)
+{
+	const u64 bucket = MREF(parent) % CHECK_NR_BUCKETS;
+	const u64 hash = check_link_hash(parent, child, fn);
+	check_link *l;
+	char *name = NULL;
+
+	if (!ctx->bad_buckets) {
+		__sync_fetch_and_add(&ctx->buckets[bucket],
+				count > 0 ? hash : -hash);
+		return 0;
+	}
+	if (!bit_test(ctx->bad_buckets, bucket))
+		return 0;
+	if (ntfs_ucstombs(fn->file_name, fn->file_name_length, &name, 0) < 0)
+		name = strdup("?");
+	if (!name)
+		return -1;
+	pthread_mutex_lock(&ctx->lock);
+	if (ctx->nr_links == ctx->links_size) {
+		s64 size = ctx->links_size ? 2 * ctx->links_size : 256;
+
+		l = realloc(ctx->links, size * sizeof(*l));
+		if (!l) {
+			pthread_mutex_unlock(&ctx->lock);
+			free(name);
+			errno = ENOMEM;
+			return -1;
+		}
+		ctx->links = l;
+		ctx->links_size = size;
+	}
+	l = ctx->links + ctx->nr_links++;
+	l->parent = parent;
+	l->child = child;
+	l->hash = hash;
+	l->name = name;
+	l->count = count;
+	pthread_mutex_unlock(&ctx->lock);
+	return 0;
+}
+
+static int check_index_node(check_index *ci, INDEX_HEADER *ih, u8 *end,
+		int depth);
+
+/**
+ * check_index_block - walk the subtree rooted at an index block
+ * @ci:		index being walked
+ * @vcn:	vcn of the index block
+ * @depth:	depth of the index block in the tree
+ *
+ * Return 0 on success, 1 if the index is corrupt (which has been reported)
+ * and -1 with errno set on error.
+ */
+static int check_index_block(check_index *ci, VCN vcn, int depth)
+{
+	const s64 pos = vcn << ci->vcn_size_bits;
+	INDEX_BLOCK *ib;
+	s64 br;
+	int ret = 1;
+
+	if (depth > CHECK_MAX_INDEX_DEPTH || ++ci->nr_blocks >
+			ci->alloc_size / ci->block_size || vcn < 0 ||
+			pos + ci->block_size > ci->alloc_size) {
+		check_report(ci->ctx, ci->out, TRUE, "Directory %llu: index "
+				"block at vcn %lld is out of bounds or loops.",
+				(unsigned long long)MREF(ci->dir),
+				(long long)vcn);
+		return 1;
+	}
+	ib = ntfs_malloc(ci->block_size);
+	if (!ib)
+		return -1;
+	if (ci->na)
+		br = ntfs_attr_pread(ci->na, pos, ci->block_size, ib);
+	else
+		br = ntfs_rl_pread(ci->ctx->vol, ci->rl, pos, ci->block_size,
+				ib);
+	if (br != ci->block_size) {
+		if (br >= 0)
+			errno = EIO;
+		ntfs_log_perror("Failed to read index block %lld of directory "
+				"%llu", (long long)vcn,
+				(unsigned long long)MREF(ci->dir));
+		ret = -1;
+		goto out;
+	}
+	if (!ntfs_is_indx_record(ib->magic) ||
+			ntfs_mst_post_read_fixup_warn((NTFS_RECORD*)ib,
+			ci->block_size, FALSE) ||
+			sle64_to_cpu(ib->index_block_vcn) != vcn) {
+		check_report(ci->ctx, ci->out, TRUE, "Directory %llu: index "
+				"block at vcn %lld is corrupt.",
+				(unsigned long long)MREF(ci->dir),
+				(long long)vcn);
+		goto out;
+	}
+	ret = check_index_node(ci, &ib->index, (u8*)ib + ci->block_size,
+			depth);
+out:
+	free(ib);
+	return ret;
+}
+
+/**
+ * check_index_node - walk the entries of an index node and their subtrees
+ * @ci:		index being walked
+ * @ih:		index header of the node
+ * @end:	end of the buffer containing the node
+ * @depth:	depth of the node in the tree
+ *
+ * Return 0 on success, 1 if the index is corrupt (which has been reported)
+ * and -1 with errno set on error.
+ */
+static int check_index_node(check_index *ci, INDEX_HEADER *ih, u8 *end,
+		int depth)
+{
+	u8 *p = (u8*)ih + le32_to_cpu(ih->entries_offset);
+	u8 *entries_end = (u8*)ih + le32_to_cpu(ih->index_length);
+	int err;
+
+	if (p < (u8*)ih + sizeof(INDEX_HEADER) || entries_end > end)
+		goto corrupt;
+	for (;;) {
+		INDEX_ENTRY *ie = (INDEX_ENTRY*)p;
+		const FILE_NAME_ATTR *fn = &ie->key.file_name;
+		u16 len;
+
+		if (p + sizeof(INDEX_ENTRY_HEADER) > entries_end)
+			goto corrupt;
+		len = le16_to_cpu(ie->length);
+		if (len < sizeof(INDEX_ENTRY_HEADER) || len & 7 ||
+				p + len > entries_end)
+			goto corrupt;
+		if (ie->ie_flags & INDEX_ENTRY_NODE) {
+			if (len < sizeof(INDEX_ENTRY_HEADER) + sizeof(VCN))
+				goto corrupt;
+			err = check_index_block(ci, sle64_to_cpu(*(sle64*)(p +
+					len - sizeof(VCN))), depth + 1);
+			if (err)
+				return err;
+		}
+		if (ie->ie_flags & INDEX_ENTRY_END)
+			break;
+		if (le16_to_cpu(ie->key_length) < sizeof(FILE_NAME_ATTR) ||
+				sizeof(INDEX_ENTRY_HEADER) +
+				le16_to_cpu(ie->key_length) > len ||
+				sizeof(FILE_NAME_ATTR) + fn->file_name_length *
+				sizeof(ntfschar) > le16_to_cpu(ie->key_length))
+			goto corrupt;
+		if (check_link_add(ci->ctx, ci->dir,
+				le64_to_cpu(ie->indexed_file), fn, -1))
+			return -1;
+		p += len;
+	}
+	return 0;
+corrupt:
+	check_report(ci->ctx, ci->out, TRUE, "Directory %llu: index entries "
+			"at depth %d are corrupt.",
+			(unsigned long long)MREF(ci->dir), depth);
+	return 1;
+}
+
+/**
+ * check_index_walk - walk a whole directory index
+ * @ci:		index being walked, with @block_size and @alloc_size set
+ * @ir:		the $INDEX_ROOT attribute value
+ * @ir_len:	byte size of @ir
+ *
+ * Return 0 on success, 1 if the index is corrupt (which has been reported)
+ * and -1 with errno set on error.
+ */
+static int check_index_walk(check_index *ci, INDEX_ROOT *ir, u32 ir_len)
+{
+	if (ir_len < sizeof(INDEX_ROOT) || ir->type != AT_FILE_NAME ||
+			ci->block_size < NTFS_BLOCK_SIZE ||
+			(ci->block_size & (ci->block_size - 1))) {
+		check_report(ci->ctx, ci->out, TRUE, "Directory %llu: index "
+				"root is corrupt.",
+				(unsigned long long)MREF(ci->dir));
+		return 1;
+	}
+	if ((ir->index.ih_flags & LARGE_INDEX) && !ci->alloc_size) {
+		check_report(ci->ctx, ci->out, TRUE, "Directory %llu: index "
+				"allocation is missing.",
+				(unsigned long long)MREF(ci->dir));
+		return 1;
+	}
+	ci->vcn_size_bits = ci->block_size >= ci->ctx->vol->cluster_size ?
+			ci->ctx->vol->cluster_size_bits : NTFS_BLOCK_SIZE_BITS;
+	__sync_fetch_and_add(&ci->ctx->nr_dirs, 1);
+	return check_index_node(ci, &ir->index, (u8*)ir + ir_len, 0);
+}
+
+static inline BOOL attr_is_i30(const ATTR_RECORD *a)
+{
+	return a->name_length == 4 && le16_to_cpu(a->name_offset) +
+			4 * sizeof(ntfschar) <= le32_to_cpu(a->length) &&
+			!memcmp((const u8*)a +
+			le16_to_cpu(a->name_offset), NTFS_INDEX_I30,
+			4 * sizeof(ntfschar));
+}
+
+/**
+ * check_dir - walk the index of a directory from its base mft record
+ * @ctx:	state of the check
+ * @r:		base mft record of the directory
+ * @out:	output of the mft chunk being checked
+ *
+ * If the runlist of $INDEX_ALLOCATION is not all in the base mft record, the
+ * directory is queued to be walked by check_deferred_dirs() instead.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int check_dir(check_ctx *ctx, const ntfs_mft_scan_record *r,
+		ntfs_mft_scan_out *out)
+{
+	const ntfs_volume *vol = ctx->vol;
+	const ATTR_RECORD *a, *ir_a = NULL, *ia_a = NULL;
+	BOOL has_attr_list = FALSE;
+	runlist_element *rl = NULL;
+	check_index ci;
+	int err;
+
+	for (a = (const ATTR_RECORD*)((const u8*)r->m +
+			le16_to_cpu(r->m->attrs_offset)); a->type != AT_END;
+			a = (const ATTR_RECORD*)((const u8*)a +
+			le32_to_cpu(a->length))) {
+		if (a->type == AT_ATTRIBUTE_LIST)
+			has_attr_list = TRUE;
+		else if (a->type == AT_INDEX_ROOT && attr_is_i30(a))
+			ir_a = a;
+		else if (a->type == AT_INDEX_ALLOCATION && attr_is_i30(a))
+			ia_a = a;
+	}
+	if (has_attr_list && (!ir_a || (ia_a && (ia_a->lowest_vcn ||
+			sle64_to_cpu(ia_a->highest_vcn) + 1 !=
+			sle64_to_cpu(ia_a->allocated_size) >>
+			vol->cluster_size_bits)))) {
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->nr_deferred == ctx->deferred_size) {
+			s64 size = ctx->deferred_size ?
+					2 * ctx->deferred_size : 64;
+			u64 *d = realloc(ctx->deferred, size * sizeof(*d));
+
+			if (!d) {
+				pthread_mutex_unlock(&ctx->lock);
+				errno = ENOMEM;
+				return -1;
+			}
+			ctx->deferred = d;
+			ctx->deferred_size = size;
+		}
+		ctx->deferred[ctx->nr_deferred++] = r->mft_no;
+		pthread_mutex_unlock(&ctx->lock);
+		return 0;
+	}
+	if (!ir_a || ir_a->non_resident || (ia_a && !ia_a->non_resident)) {
+		check_report(ctx, out, TRUE, "Directory %llu: $I30 index "
+				"attributes are missing or corrupt.",
+				(unsigned long long)r->mft_no);
+		return 0;
+	}
+	memset(&ci, 0, sizeof(ci));
+	ci.ctx = ctx;
+	ci.out = out;
+	ci.dir = MK_MREF(r->mft_no, r->seq_no);
+	ci.block_size = le32_to_cpu(((INDEX_ROOT*)((u8*)ir_a +
+			le16_to_cpu(ir_a->value_offset)))->index_block_size);
+	if (ia_a) {
+		rl = ntfs_mapping_pairs_decompress(vol, ia_a, NULL);
+		if (!rl) {
+			/* check_runs() reports it. */
+			return 0;
+		}
+		ci.alloc_size = sle64_to_cpu(ia_a->data_size);
+		ci.rl = rl;
+	}
+	err = check_index_walk(&ci, (INDEX_ROOT*)((u8*)ir_a +
+			le16_to_cpu(ir_a->value_offset)),
+			le32_to_cpu(ir_a->value_length));
+	free(rl);
+	return err < 0 ? -1 : 0;
+}
+
+/**
+ * check_record - check an mft record, called by the scanner
+ * @r:		the mft record
+ * @out:	output of the mft chunk @r belongs to
+ * @data:	state of the check
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int check_record(const ntfs_mft_scan_record *r,
+		ntfs_mft_scan_out *out, void *data)
+{
+	check_ctx *ctx = data;
+	const MFT_RECORD *m = r->m;
+	const ATTR_RECORD *a;
+	MFT_REF mref;
+	BOOL second_pass = ctx->bad_buckets != NULL;
+
+	if (r->corrupt) {
+		if (second_pass)
+			return 0;
+		bit_set_atomic(ctx->corrupt, r->mft_no);
+		check_report(ctx, out, TRUE, "Record %llu is corrupt.",
+				(unsigned long long)r->mft_no);
+		return 0;
+	}
+	if (!second_pass) {
+		bit_set_atomic(ctx->in_use, r->mft_no);
+		if (ntfs_mft_record_check(ctx->vol, r->mft_no,
+				(MFT_RECORD*)m)) {
+			check_report(ctx, out, TRUE, "Record %llu failed the "
+					"record check.",
+					(unsigned long long)r->mft_no);
+			return 0;
+		}
+		/* Records before NTFS 3.1 do not know their number. */
+		if (le16_to_cpu(m->usa_ofs) >= offsetof(MFT_RECORD,
+				mft_record_number) + sizeof(u32) &&
+				le32_to_cpu(m->mft_record_number) !=
+				(u32)r->mft_no)
+			check_report(ctx, out, TRUE, "Record %llu claims to "
+					"be record %u.",
+					(unsigned long long)r->mft_no,
+					(unsigned)le32_to_cpu(
+					m->mft_record_number));
+	}
+	mref = r->base_mref ? r->base_mref : MK_MREF(r->mft_no, r->seq_no);
+	for (a = (const ATTR_RECORD*)((const u8*)m +
+			le16_to_cpu(m->attrs_offset)); a->type != AT_END;
+			a = (const ATTR_RECORD*)((const u8*)a +
+			le32_to_cpu(a->length))) {
+		if (a->non_resident) {
+			if (!second_pass)
+				check_runs(ctx, r, a, out);
+			continue;
+		}
+		if (a->type != AT_FILE_NAME)
+			continue;
+		if (!second_pass)
+			__sync_fetch_and_add(&ctx->nr_names, 1);
+		if (check_link_add(ctx, le64_to_cpu(((const FILE_NAME_ATTR*)
+				((const u8*)a + le16_to_cpu(a->value_offset)))->
+				parent_directory), mref,
+				(const FILE_NAME_ATTR*)((const u8*)a +
+				le16_to_cpu(a->value_offset)), 1))
+			return -1;
+	}
+	if (!r->base_mref && (r->flags & MFT_RECORD_IS_DIRECTORY) &&
+			(!second_pass || bit_test(ctx->bad_buckets,
+			r->mft_no % CHECK_NR_BUCKETS)))
+		return check_dir(ctx, r, out);
+	return 0;
+}
+
+/**
+ * check_deferred_dirs - walk the directory indexes check_dir() deferred
+ * @ctx:	state of the check
+ *
+ * These have attribute lists, so they are walked through the library on the
+ * calling thread, reporting straight to standard output.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int check_deferred_dirs(check_ctx *ctx)
+{
+	s64 i;
+
+	for (i = 0; i < ctx->nr_deferred; i++) {
+		const u64 mft_no = ctx->deferred[i];
+		ntfs_inode *ni;
+		ntfs_attr *na = NULL;
+		INDEX_ROOT *ir;
+		check_index ci;
+		s64 ir_len;
+		int err;
+
+		if (ctx->bad_buckets && !bit_test(ctx->bad_buckets,
+				mft_no % CHECK_NR_BUCKETS))
+			continue;
+		ni = ntfs_inode_open(ctx->vol, mft_no);
+		if (!ni) {
+			check_report(ctx, NULL, TRUE, "Directory %llu: failed "
+					"to open it: %s.",
+					(unsigned long long)mft_no,
+					strerror(errno));
+			continue;
+		}
+		memset(&ci, 0, sizeof(ci));
+		ci.ctx = ctx;
+		ci.dir = MK_MREF(mft_no, le16_to_cpu(ni->mrec->sequence_number));
+		ir = ntfs_attr_readall(ni, AT_INDEX_ROOT, NTFS_INDEX_I30, 4,
+				&ir_len);
+		if (!ir) {
+			check_report(ctx, NULL, TRUE, "Directory %llu: $I30 "
+					"index root is missing.",
+					(unsigned long long)mft_no);
+			ntfs_inode_close(ni);
+			continue;
+		}
+		na = ntfs_attr_open(ni, AT_INDEX_ALLOCATION, NTFS_INDEX_I30, 4);
+		if (na) {
+			ci.alloc_size = na->data_size;
+			ci.na = na;
+		}
+		if (ir_len >= (s64)sizeof(INDEX_ROOT))
+			ci.block_size = le32_to_cpu(ir->index_block_size);
+		err = check_index_walk(&ci, ir, ir_len);
+		if (na)
+			ntfs_attr_close(na);
+		free(ir);
+		ntfs_inode_close(ni);
+		if (err < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int check_link_cmp(const void *p1, const void *p2)
+{
+	const check_link *l1 = p1, *l2 = p2;
+
+	if (l1->parent != l2->parent)
+		return l1->parent < l2->parent ? -1 : 1;
+	if (l1->child != l2->child)
+		return l1->child < l2->child ? -1 : 1;
+	if (l1->hash != l2->hash)
+		return l1->hash < l2->hash ? -1 : 1;
+	return 0;
+}
+
+/**
+ * check_links_report - report the links which do not match
+ * @ctx:	state of the check, with the links of the bad buckets collected
+ */
+static void check_links_report(check_ctx *ctx)
+{
+	s64 i, j;
+
+	qsort(ctx->links, ctx->nr_links, sizeof(*ctx->links), check_link_cmp);
+	for (i = 0; i < ctx->nr_links; i = j) {
+		const check_link *l = ctx->links + i;
+		int count = 0;
+
+		for (j = i; j < ctx->nr_links && !check_link_cmp(l,
+				ctx->links + j); j++)
+			count += ctx->links[j].count;
+		/* The index of a corrupt directory has been reported. */
+		if (count > 0 && MREF(l->parent) < (u64)ctx->nr_records &&
+				bit_test(ctx->corrupt, MREF(l->parent)))
+			continue;
+		if (count > 0)
+			check_report(ctx, NULL, TRUE, "Record %llu: name "
+					"\"%s\" in directory %llu is missing "
+					"from the index of the directory.",
+					(unsigned long long)MREF(l->child),
+					l->name,
+					(unsigned long long)MREF(l->parent));
+		else if (count < 0)
+			check_report(ctx, NULL, TRUE, "Directory %llu: index "
+					"entry \"%s\" refers to record %llu "
+					"(sequence %u), which has no such "
+					"name.",
+					(unsigned long long)MREF(l->parent),
+					l->name,
+					(unsigned long long)MREF(l->child),
+					(unsigned)MSEQNO(l->child));
+	}
+	for (i = 0; i < ctx->nr_links; i++)
+		free(ctx->links[i].name);
+	free(ctx->links);
+	ctx->links = NULL;
+	ctx->nr_links = ctx->links_size = 0;
+}
+
+/**
+ * check_range_report - report a range of bits which differ between bitmaps
+ * @ctx:	state of the check
+ * @nr_ranges:	number of ranges reported so far for this bitmap
+ * @error:	TRUE for an error, FALSE for a harmless inconsistency
+ * @what:	description of the range, taking the first and last bit
+ * @start:	first bit of the range
+ * @end:	first bit after the range
+ */
+static void check_range_report(check_ctx *ctx, s64 *nr_ranges, BOOL error,
+		const char *what, s64 start, s64 end)
+{
+	if (++*nr_ranges > CHECK_MAX_RANGES) {
+		__sync_fetch_and_add(error ? &ctx->nr_errors :
+				&ctx->nr_warnings, 1);
+		return;
+	}
+	check_report(ctx, NULL, error, what, (long long)start,
+			(long long)(end - 1));
+}
+
+/**
+ * check_bitmap - compare an on-disk bitmap with the one the scan built
+ * @ctx:	state of the check
+ * @na:		the on-disk bitmap attribute
+ * @found:	bitmap built by the scan
+ * @skip:	bits to ignore, or NULL
+ * @nr_bits:	number of bits in @found
+ * @missing:	message for bits set in @found but not in @na (an error)
+ * @extra:	message for bits set in @na but not in @found (a warning)
+ *
+ * The bits of @na past @nr_bits are ignored, mkntfs sets those of $Bitmap so
+ * they are never allocated.  @na is read CHECK_BITMAP_CHUNK bytes at a time
+ * and runs of differing bits are coalesced into ranges.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int check_bitmap(check_ctx *ctx, ntfs_attr *na, const u8 *found,
+		const u8 *skip, s64 nr_bits, const char *missing,
+		const char *extra)
+{
+	s64 nr_missing = 0, nr_extra = 0, start = 0, pos;
+	int state = 0;
+	u8 *buf;
+
+	buf = ntfs_malloc(CHECK_BITMAP_CHUNK);
+	if (!buf)
+		return -1;
+	for (pos = 0; pos < (nr_bits + 7) >> 3; pos += CHECK_BITMAP_CHUNK) {
+		s64 count = ((nr_bits + 7) >> 3) - pos, br, i;
+
+		if (count > CHECK_BITMAP_CHUNK)
+			count = CHECK_BITMAP_CHUNK;
+		/* A short bitmap reads as clear. */
+		memset(buf, 0, count);
+		br = ntfs_attr_pread(na, pos, count, buf);
+		if (br < 0) {
+			free(buf);
+			return -1;
+		}
+		for (i = 0; i < count; i++) {
+			const s64 byte = pos + i;
+			u8 disk = buf[i], mem = found[byte];
+			int b;
+
+			if (skip) {
+				disk &= ~skip[byte];
+				mem &= ~skip[byte];
+			}
+			if (disk == mem && !state)
+				continue;
+			for (b = 0; b < 8; b++) {
+				const s64 bit = (byte << 3) + b;
+				int s = 0;
+
+				if (bit >= nr_bits)
+					break;
+				if (((mem ^ disk) >> b) & 1)
+					s = (mem >> b) & 1 ? 1 : 2;
+				if (s == state)
+					continue;
+				if (state)
+					check_range_report(ctx, state == 1 ?
+							&nr_missing :
+							&nr_extra, state == 1,
+							state == 1 ? missing :
+							extra, start, bit);
+				state = s;
+				start = bit;
+			}
+		}
+	}
+	if (state)
+		check_range_report(ctx, state == 1 ? &nr_missing : &nr_extra,
+				state == 1, state == 1 ? missing : extra,
+				start, nr_bits);
+	if (nr_missing > CHECK_MAX_RANGES || nr_extra > CHECK_MAX_RANGES)
+		printf("(%lld and %lld ranges found, only the first %d of "
+				"each are listed)\n", (long long)nr_missing,
+				(long long)nr_extra, CHECK_MAX_RANGES);
+	free(buf);
+	return 0;
+}
+
+/**
+ * check_scan - run one parallel scan of the mft
+ * @ctx:	state of the check
+ * @stats:	statistics of the scan are returned here
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int check_scan(check_ctx *ctx, ntfs_mft_scan_stats *stats)
+{
+	ntfs_mft_scan_opts scan_opts;
+
+	memset(&scan_opts, 0, sizeof(scan_opts));
+	scan_opts.nr_threads = opts.nr_threads;
+	scan_opts.extents = TRUE;
+	scan_opts.corrupt = TRUE;
+	scan_opts.out_fd = STDOUT_FILENO;
+	scan_opts.fn = check_record;
+	scan_opts.data = ctx;
+	fflush(stdout);
+	if (ntfs_mft_scan(ctx->vol, &scan_opts, stats)) {
+		ntfs_log_perror("Failed to scan the mft");
+		return -1;
+	}
+	if (check_deferred_dirs(ctx)) {
+		ntfs_log_perror("Failed to check the directories with "
+				"attribute lists");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * check - check a volume
+ * @ctx:	state of the check, with @vol set
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int check(check_ctx *ctx)
+{
+	ntfs_volume *vol = ctx->vol;
+	ntfs_mft_scan_stats stats;
+	s64 i, nr_bad = 0;
+	int ret = -1;
+
+	ctx->nr_records = vol->mft_na->initialized_size >>
+			vol->mft_record_size_bits;
+	ctx->clusters = ntfs_calloc(((vol->nr_clusters + 63) >> 6) *
+			sizeof(u64));
+	ctx->in_use = ntfs_calloc((ctx->nr_records + 7) >> 3);
+	ctx->corrupt = ntfs_calloc((ctx->nr_records + 7) >> 3);
+	ctx->buckets = ntfs_calloc(CHECK_NR_BUCKETS * sizeof(u64));
+	if (!ctx->clusters || !ctx->in_use || !ctx->corrupt || !ctx->buckets)
+		goto out;
+
+	if (opts.verbose)
+		printf("Scanning the mft.\n");
+	if (check_scan(ctx, &stats))
+		goto out;
+	if (opts.verbose)
+		printf("Checked %lld records, %lld in use, %lld names, %lld "
+				"directories.\n", (long long)stats.nr_records,
+				(long long)stats.nr_in_use,
+				(long long)ctx->nr_names,
+				(long long)ctx->nr_dirs);
+
+	if (opts.verbose)
+		printf("Comparing the mft bitmap.\n");
+	if (check_bitmap(ctx, vol->mftbmp_na, ctx->in_use, ctx->corrupt,
+			ctx->nr_records, "Records %lld - %lld are in use but "
+			"marked free in the mft bitmap.", "Records %lld - %lld "
+			"are not in use but marked in use in the mft "
+			"bitmap.")) {
+		ntfs_log_perror("Failed to read the mft bitmap");
+		goto out;
+	}
+	if (opts.verbose)
+		printf("Comparing the cluster bitmap.\n");
+	if (check_bitmap(ctx, vol->lcnbmp_na, (const u8*)ctx->clusters, NULL,
+			vol->nr_clusters, "Clusters %lld - %lld are in use but "
+			"marked free in $Bitmap.", "Clusters %lld - %lld are "
+			"not in use but marked in use in $Bitmap.")) {
+		ntfs_log_perror("Failed to read $Bitmap");
+		goto out;
+	}
+	free(ctx->clusters);
+	ctx->clusters = NULL;
+
+	if (opts.verbose)
+		printf("Comparing the directory indexes with the file "
+				"names.\n");
+	ctx->bad_buckets = ntfs_calloc(CHECK_NR_BUCKETS / 8);
+	if (!ctx->bad_buckets)
+		goto out;
+	for (i = 0; i < CHECK_NR_BUCKETS; i++) {
+		if (ctx->buckets[i]) {
+			ctx->bad_buckets[i >> 3] |= 1 << (i & 7);
+			nr_bad++;
+		}
+	}
+	if (nr_bad) {
+		if (opts.verbose)
+			printf("Rescanning the mft for %lld groups of "
+					"directories.\n", (long long)nr_bad);
+		if (check_scan(ctx, &stats))
+			goto out;
+		check_links_report(ctx);
+	}
+	ret = 0;
+out:
+	free(ctx->clusters);
+	free(ctx->in_use);
+	free(ctx->corrupt);
+	free(ctx->buckets);
+	free(ctx->bad_buckets);
+	free(ctx->deferred);
+	return ret;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  The volume is consistent
+ *	    1  Inconsistencies were found
+ *	    2  Error, the volume could not be checked
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long mnt_flags;
+	check_ctx ctx;
+	int ret = CHECK_EXIT_FAILED;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	if (ntfs_check_if_mounted(opts.device, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.device);
+		return CHECK_EXIT_FAILED;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.device);
+		return CHECK_EXIT_FAILED;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.vol = ntfs_mount(opts.device, MS_RDONLY);
+	if (!ctx.vol) {
+		ntfs_log_perror("Failed to mount %s", opts.device);
+		return CHECK_EXIT_FAILED;
+	}
+	pthread_mutex_init(&ctx.lock, NULL);
+	if (!check(&ctx)) {
+		printf("%s: %lld errors, %lld warnings.\n", opts.device,
+				(long long)ctx.nr_errors,
+				(long long)ctx.nr_warnings);
+		ret = ctx.nr_errors ? CHECK_EXIT_ERRORS : CHECK_EXIT_CLEAN;
+	}
+	pthread_mutex_destroy(&ctx.lock);
+	if (ntfs_umount(ctx.vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.device);
+		ret = CHECK_EXIT_FAILED;
+	}
+	return ret;
+}
@@ -0,0 +1,836 @@
+/**
+ * clone_ntfs - Copy the allocated clusters of an unmounted NTFS volume.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility clones an unmounted NTFS volume (or volume image) onto another
+ * device or into a sparse image file, or saves it to or restores it from a
+ * compact stream, copying only the clusters $Bitmap marks as allocated.  The
+ * allocated clusters are copied in large sequential batches, reading through
+ * short runs of free clusters rather than seeking over them.
+ *
+ * The stream consists of a clone_header, the table of the nr_extents extents
+ * it contains as pairs of little endian 64-bit lcn and length in clusters,
+ * and then the data of the extents one after the other.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+
+#include "types.h"
+#include "attrib.h"
+#include "device.h"
+#include "device_io.h"
+#include "layout.h"
+#include "logging.h"
+#include "misc.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "clone_ntfs";
+
+/* Size of the buffer the clusters are copied through. */
+#define CLONE_BUF_SIZE		(8 * 1024 * 1024)
+
+/* Free runs shorter than this many bytes are copied rather than skipped. */
+#define CLONE_MAX_GAP		(64 * 1024)
+
+/* Magic at the start of a stream. */
+static const char CLONE_MAGIC[8] = "NTFSCLON";
+
+#define CLONE_VERSION		1
+
+/**
+ * struct clone_header - start of a stream
+ * @magic:		CLONE_MAGIC
+ * @version:		CLONE_VERSION
+ * @cluster_size:	byte size of a cluster of the volume
+ * @sector_size:	byte size of a sector of the volume
+ * @reserved:		zero
+ * @volume_size:	byte size of the volume including the backup boot
+ *			sector, i.e. the smallest device it can be restored to
+ * @nr_clusters:	number of clusters of the volume
+ * @nr_extents:		number of extents in the table following the header
+ * @nr_data_clusters:	number of clusters of data following the table
+ *
+ * All fields are little endian.
+ */
+typedef struct {
+	char magic[8];
+	le32 version;
+	le32 cluster_size;
+	le32 sector_size;
+	le32 reserved;
+	sle64 volume_size;
+	sle64 nr_clusters;
+	sle64 nr_extents;
+	sle64 nr_data_clusters;
+} __attribute__((__packed__)) clone_header;
+
+/**
+ * struct clone_extent - a run of clusters to copy
+ * @lcn:	first cluster
+ * @len:	number of clusters
+ */
+typedef struct {
+	LCN lcn;
+	s64 len;
+} clone_extent;
+
+/**
+ * struct clone_layout - what is copied
+ * @cluster_size:	byte size of a cluster
+ * @sector_size:	byte size of a sector
+ * @volume_size:	byte size of the volume including the backup boot sector
+ * @nr_clusters:	number of clusters of the volume
+ * @extents:		the runs of clusters copied, in ascending order
+ * @nr_extents:		number of elements in @extents
+ * @nr_data_clusters:	sum of the lengths of @extents
+ */
+typedef struct {
+	u32 cluster_size;
+	u32 sector_size;
+	s64 volume_size;
+	s64 nr_clusters;
+	clone_extent *extents;
+	s64 nr_extents;
+	s64 nr_data_clusters;
+} clone_layout;
+
+static struct {
+	char *source;
+	char *target;
+	BOOL save;
+	BOOL restore;
+	BOOL force;
+	BOOL verbose;
+} opts;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - copy the allocated clusters of an NTFS "
+			"volume.\n\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-fv] <device> <target>\n", EXEC_NAME);
+	fprintf(stderr, "       %s -s [-fv] <device> <stream|->\n", EXEC_NAME);
+	fprintf(stderr, "       %s -r [-fv] <stream|-> <target>\n\n",
+			EXEC_NAME);
+	fprintf(stderr, "    -f          Overwrite an existing target file.\n");
+	fprintf(stderr, "    -r          Restore a stream onto the target.\n");
+	fprintf(stderr, "    -s          Save the volume into a stream.\n");
+	fprintf(stderr, "    -v          Print what is being copied.\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "frsv")) != -1) {
+		switch (ch) {
+		case 'f':
+			opts.force = TRUE;
+			break;
+		case 'r':
+			opts.restore = TRUE;
+			break;
+		case 's':
+			opts.save = TRUE;
+			break;
+		case 'v':
+			opts.verbose = TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2 || (opts.save && opts.restore))
+		usage();
+	opts.source = argv[0];
+	opts.target = argv[1];
+}
+
+/**
+ * read_full - read exactly the requested number of bytes from a file
+ * @fd:		file descriptor to read from
+ * @buf:	destination buffer
+ * @count:	number of bytes to read
+ *
+ * Return 0 on success and -1 with errno set on error, EIO on a short file.
+ */
+static int read_full(int fd, void *buf, size_t count)
+{
+	while (count) {
+		ssize_t n = read(fd, buf, count);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!n) {
+			errno = EIO;
+			return -1;
+		}
+		buf = (u8*)buf + n;
+		count -= n;
+	}
+	return 0;
+}
+
+/**
+ * write_full - write exactly the requested number of bytes to a file
+ * @fd:		file descriptor to write to
+ * @buf:	data to write
+ * @count:	number of bytes to write
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int write_full(int fd, const void *buf, size_t count)
+{
+	while (count) {
+		ssize_t n = write(fd, buf, count);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const u8*)buf + n;
+		count -= n;
+	}
+	return 0;
+}
+
+/**
+ * lcn_bitmap_load - read the whole cluster bitmap into memory
+ * @vol:	mounted ntfs volume
+ *
+ * Return the bitmap, covering @vol->nr_clusters bits, or NULL on error with
+ * errno set.  The caller has to free() it.
+ */
+static u8 *lcn_bitmap_load(ntfs_volume *vol)
+{
+	s64 size, br;
+	u8 *bm;
+
+	size = (vol->nr_clusters + 7) >> 3;
+	bm = ntfs_malloc(size);
+	if (!bm)
+		return NULL;
+	br = ntfs_attr_pread(vol->lcnbmp_na, 0, size, bm);
+	if (br != size) {
+		if (br >= 0)
+			errno = EIO;
+		ntfs_log_perror("Failed to read $Bitmap");
+		free(bm);
+		return NULL;
+	}
+	return bm;
+}
+
+static inline BOOL lcn_is_free(const u8 *bm, LCN lcn)
+{
+	return !(bm[lcn >> 3] & (1 << (lcn & 7)));
+}
+
+/**
+ * lcn_next_run - find the next run of clusters in the same state
+ * @bm:		in memory cluster bitmap
+ * @nr_clusters: number of bits in @bm
+ * @lcn:	first cluster of the run
+ *
+ * Return the first cluster after @lcn whose allocation state differs from the
+ * one of @lcn, or @nr_clusters.  Whole bytes are skipped at a time.
+ */
+static LCN lcn_next_run(const u8 *bm, s64 nr_clusters, LCN lcn)
+{
+	const BOOL is_free = lcn_is_free(bm, lcn);
+	const u8 skip = is_free ? 0 : 0xff;
+
+	while (++lcn < nr_clusters) {
+		if (!(lcn & 7)) {
+			while (lcn + 8 <= nr_clusters && bm[lcn >> 3] == skip)
+				lcn += 8;
+			if (lcn >= nr_clusters)
+				break;
+		}
+		if (lcn_is_free(bm, lcn) != is_free)
+			break;
+	}
+	return lcn > nr_clusters ? nr_clusters : lcn;
+}
+
+/**
+ * layout_build - work out which clusters of a volume to copy
+ * @vol:	mounted ntfs volume
+ * @bm:		in memory cluster bitmap of @vol
+ * @l:		layout to fill in
+ *
+ * Collect the runs of allocated clusters of @vol, merging runs separated by
+ * less than CLONE_MAX_GAP bytes of free clusters so that they are copied with
+ * a single read and write.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int layout_build(ntfs_volume *vol, const u8 *bm, clone_layout *l)
+{
+	const s64 max_gap = CLONE_MAX_GAP >> vol->cluster_size_bits;
+	NTFS_BOOT_SECTOR bs;
+	s64 size = 0, br;
+	LCN lcn, next;
+
+	memset(l, 0, sizeof(*l));
+	l->cluster_size = vol->cluster_size;
+	l->sector_size = vol->sector_size;
+	l->nr_clusters = vol->nr_clusters;
+	br = ntfs_pread(vol->dev, 0, sizeof(bs), &bs);
+	if (br != sizeof(bs)) {
+		if (br >= 0)
+			errno = EIO;
+		return -1;
+	}
+	/* The backup boot sector is the sector after the volume proper. */
+	l->volume_size = (sle64_to_cpu(bs.number_of_sectors) + 1) *
+			vol->sector_size;
+	if (l->volume_size < (vol->nr_clusters << vol->cluster_size_bits) +
+			vol->sector_size) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (lcn = 0; lcn < vol->nr_clusters; lcn = next) {
+		clone_extent *e;
+
+		next = lcn_next_run(bm, vol->nr_clusters, lcn);
+		if (lcn_is_free(bm, lcn))
+			continue;
+		e = l->nr_extents ? l->extents + l->nr_extents - 1 : NULL;
+		if (e && lcn - (e->lcn + e->len) <= max_gap) {
+			l->nr_data_clusters += next - (e->lcn + e->len);
+			e->len = next - e->lcn;
+			continue;
+		}
+		if (l->nr_extents == size) {
+			size = size ? 2 * size : 1024;
+			e = realloc(l->extents, size * sizeof(*e));
+			if (!e) {
+				errno = ENOMEM;
+				return -1;
+			}
+			l->extents = e;
+		}
+		e = l->extents + l->nr_extents++;
+		e->lcn = lcn;
+		e->len = next - lcn;
+		l->nr_data_clusters += e->len;
+	}
+	return 0;
+}
+
+/**
+ * target_open - open the device or image file to clone onto
+ * @name:	path of the target
+ * @size:	byte size of the volume going onto it
+ *
+ * A regular file is created if need be, and truncated to @size so that the
+ * clusters not written remain holes.  An existing regular file is only
+ * overwritten with opts.force.  A device has to be at least @size bytes and
+ * must not be mounted.
+ *
+ * Return the open device or NULL on error.
+ */
+static struct ntfs_device *target_open(const char *name, s64 size)
+{
+	struct ntfs_device *dev;
+	unsigned long mnt_flags;
+	struct stat st;
+	s64 dev_size;
+	int fd;
+
+	if (stat(name, &st)) {
+		if (errno != ENOENT) {
+			ntfs_log_perror("Failed to access %s", name);
+			return NULL;
+		}
+		st.st_mode = S_IFREG;
+	} else if (S_ISREG(st.st_mode) && !opts.force) {
+		ntfs_log_error("%s exists, use -f to overwrite it.\n", name);
+		return NULL;
+	}
+	if (S_ISREG(st.st_mode)) {
+		fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, size)) {
+			ntfs_log_perror("Failed to create %s", name);
+			if (fd >= 0)
+				close(fd);
+			return NULL;
+		}
+		close(fd);
+	} else {
+		if (ntfs_check_if_mounted(name, &mnt_flags)) {
+			ntfs_log_perror("Failed to determine whether %s is "
+					"mounted", name);
+			return NULL;
+		}
+		if (mnt_flags & NTFS_MF_MOUNTED) {
+			ntfs_log_error("%s is mounted, unmount it first.\n",
+					name);
+			return NULL;
+		}
+	}
+	dev = ntfs_device_alloc(name, 0, &ntfs_device_default_io_ops, NULL);
+	if (!dev)
+		return NULL;
+	if (dev->d_ops->open(dev, O_RDWR)) {
+		ntfs_log_perror("Failed to open %s", name);
+		ntfs_device_free(dev);
+		return NULL;
+	}
+	dev_size = ntfs_device_size_get(dev, 1);
+	if (dev_size < size) {
+		/*
+		 * Shrinking the volume to fit would mean relocating data and
+		 * resizing $Bitmap, which is a job for a resizer.
+		 */
+		ntfs_log_error("%s is too small for the volume: %lld bytes "
+				"needed, %lld available.\n", name,
+				(long long)size, (long long)dev_size);
+		dev->d_ops->close(dev);
+		ntfs_device_free(dev);
+		return NULL;
+	}
+	return dev;
+}
+
+/**
+ * target_close - sync and close the device cloned onto
+ * @dev:	device returned by target_open()
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int target_close(struct ntfs_device *dev)
+{
+	int ret = 0;
+
+	if (ntfs_device_sync(dev)) {
+		ntfs_log_perror("Failed to sync %s", dev->d_name);
+		ret = -1;
+	}
+	if (dev->d_ops->close(dev)) {
+		ntfs_log_perror("Failed to close %s", dev->d_name);
+		ret = -1;
+	}
+	ntfs_device_free(dev);
+	return ret;
+}
+
+/**
+ * backup_boot_write - write the backup boot sector of a cloned volume
+ * @dev:	device the volume was cloned onto
+ * @l:		layout of the volume
+ * @buf:	buffer of at least one sector
+ *
+ * The backup boot sector lives in the last sector of the volume, after its
+ * last cluster, where no cluster copy reaches.  It is identical to the boot
+ * sector, so copy that, which has been cloned already.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int backup_boot_write(struct ntfs_device *dev, const clone_layout *l,
+		u8 *buf)
+{
+	if (ntfs_pread(dev, 0, l->sector_size, buf) != l->sector_size ||
+			ntfs_pwrite(dev, l->volume_size - l->sector_size,
+			l->sector_size, buf) != l->sector_size) {
+		ntfs_log_perror("Failed to write the backup boot sector");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * clone_copy - copy the clusters of a layout from a volume
+ * @vol:	mounted ntfs volume to copy from
+ * @l:		what to copy
+ * @dev:	device to copy onto at the same offsets, or NULL
+ * @fd:		stream to append the clusters to if @dev is NULL
+ * @buf:	buffer of CLONE_BUF_SIZE bytes
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int clone_copy(ntfs_volume *vol, const clone_layout *l,
+		struct ntfs_device *dev, int fd, u8 *buf)
+{
+	s64 i;
+
+	for (i = 0; i < l->nr_extents; i++) {
+		s64 pos = l->extents[i].lcn << vol->cluster_size_bits;
+		s64 end = pos + (l->extents[i].len << vol->cluster_size_bits);
+
+		if (opts.verbose)
+			fprintf(stderr, "Copying clusters %lld - %lld.\n",
+					(long long)l->extents[i].lcn,
+					(long long)(l->extents[i].lcn +
+					l->extents[i].len - 1));
+		while (pos < end) {
+			s64 count = end - pos;
+
+			if (count > CLONE_BUF_SIZE)
+				count = CLONE_BUF_SIZE;
+			if (ntfs_pread(vol->dev, pos, count, buf) != count) {
+				ntfs_log_perror("Failed to read %s at offset "
+						"%lld", opts.source,
+						(long long)pos);
+				return -1;
+			}
+			if (dev ? ntfs_pwrite(dev, pos, count, buf) != count :
+					write_full(fd, buf, count)) {
+				ntfs_log_perror("Failed to write %s",
+						opts.target);
+				return -1;
+			}
+			pos += count;
+		}
+	}
+	return 0;
+}
+
+/**
+ * stream_save - write a stream header and extent table
+ * @fd:		stream to write to
+ * @l:		layout of the volume
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int stream_save(int fd, const clone_layout *l)
+{
+	clone_header h;
+	sle64 run[2];
+	s64 i;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CLONE_MAGIC, sizeof(h.magic));
+	h.version = const_cpu_to_le32(CLONE_VERSION);
+	h.cluster_size = cpu_to_le32(l->cluster_size);
+	h.sector_size = cpu_to_le32(l->sector_size);
+	h.volume_size = cpu_to_sle64(l->volume_size);
+	h.nr_clusters = cpu_to_sle64(l->nr_clusters);
+	h.nr_extents = cpu_to_sle64(l->nr_extents);
+	h.nr_data_clusters = cpu_to_sle64(l->nr_data_clusters);
+	if (write_full(fd, &h, sizeof(h)))
+		return -1;
+	for (i = 0; i < l->nr_extents; i++) {
+		run[0] = cpu_to_sle64(l->extents[i].lcn);
+		run[1] = cpu_to_sle64(l->extents[i].len);
+		if (write_full(fd, run, sizeof(run)))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * stream_load - read and check a stream header and extent table
+ * @fd:		stream to read from
+ * @l:		layout to fill in
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int stream_load(int fd, clone_layout *l)
+{
+	clone_header h;
+	sle64 run[2];
+	s64 i, nr_data_clusters = 0;
+	LCN end = 0;
+
+	memset(l, 0, sizeof(*l));
+	if (read_full(fd, &h, sizeof(h)))
+		return -1;
+	if (memcmp(h.magic, CLONE_MAGIC, sizeof(h.magic)) ||
+			le32_to_cpu(h.version) != CLONE_VERSION) {
+		ntfs_log_error("%s is not a %s stream.\n", opts.source,
+				EXEC_NAME);
+		errno = EINVAL;
+		return -1;
+	}
+	l->cluster_size = le32_to_cpu(h.cluster_size);
+	l->sector_size = le32_to_cpu(h.sector_size);
+	l->volume_size = sle64_to_cpu(h.volume_size);
+	l->nr_clusters = sle64_to_cpu(h.nr_clusters);
+	l->nr_extents = sle64_to_cpu(h.nr_extents);
+	l->nr_data_clusters = sle64_to_cpu(h.nr_data_clusters);
+	if (l->cluster_size < NTFS_BLOCK_SIZE ||
+			(l->cluster_size & (l->cluster_size - 1)) ||
+			l->sector_size < NTFS_BLOCK_SIZE ||
+			l->sector_size > l->cluster_size ||
+			(l->sector_size & (l->sector_size - 1)) ||
+			l->nr_clusters <= 0 || l->nr_extents < 0 ||
+			l->nr_extents > l->nr_clusters ||
+			l->volume_size < l->nr_clusters * l->cluster_size +
+			l->sector_size || l->volume_size % l->sector_size)
+		goto corrupt;
+	l->extents = ntfs_malloc((l->nr_extents ? l->nr_extents : 1) *
+			sizeof(*l->extents));
+	if (!l->extents)
+		return -1;
+	for (i = 0; i < l->nr_extents; i++) {
+		if (read_full(fd, run, sizeof(run)))
+			return -1;
+		l->extents[i].lcn = sle64_to_cpu(run[0]);
+		l->extents[i].len = sle64_to_cpu(run[1]);
+		if (l->extents[i].lcn < end || l->extents[i].len <= 0 ||
+				l->extents[i].len > l->nr_clusters -
+				l->extents[i].lcn)
+			goto corrupt;
+		end = l->extents[i].lcn + l->extents[i].len;
+		nr_data_clusters += l->extents[i].len;
+	}
+	if (nr_data_clusters != l->nr_data_clusters)
+		goto corrupt;
+	return 0;
+corrupt:
+	ntfs_log_error("The header of %s is corrupt.\n", opts.source);
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * stream_restore - write the clusters in a stream onto a device
+ * @fd:		stream positioned at the start of the data
+ * @l:		layout of the stream
+ * @dev:	device to write to
+ * @buf:	buffer of CLONE_BUF_SIZE bytes
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int stream_restore(int fd, const clone_layout *l,
+		struct ntfs_device *dev, u8 *buf)
+{
+	s64 i;
+
+	for (i = 0; i < l->nr_extents; i++) {
+		s64 pos = l->extents[i].lcn * l->cluster_size;
+		s64 end = pos + l->extents[i].len * l->cluster_size;
+
+		if (opts.verbose)
+			fprintf(stderr, "Restoring clusters %lld - %lld.\n",
+					(long long)l->extents[i].lcn,
+					(long long)(l->extents[i].lcn +
+					l->extents[i].len - 1));
+		while (pos < end) {
+			s64 count = end - pos;
+
+			if (count > CLONE_BUF_SIZE)
+				count = CLONE_BUF_SIZE;
+			if (read_full(fd, buf, count)) {
+				ntfs_log_perror("Failed to read %s",
+						opts.source);
+				return -1;
+			}
+			if (ntfs_pwrite(dev, pos, count, buf) != count) {
+				ntfs_log_perror("Failed to write %s at offset "
+						"%lld", opts.target,
+						(long long)pos);
+				return -1;
+			}
+			pos += count;
+		}
+	}
+	return 0;
+}
+
+/**
+ * do_restore - restore a stream onto a device or image file
+ * @buf:	buffer of CLONE_BUF_SIZE bytes
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int do_restore(u8 *buf)
+{
+	struct ntfs_device *dev;
+	clone_layout l;
+	int fd = STDIN_FILENO, ret = -1;
+
+	if (strcmp(opts.source, "-")) {
+		fd = open(opts.source, O_RDONLY);
+		if (fd < 0) {
+			ntfs_log_perror("Failed to open %s", opts.source);
+			return -1;
+		}
+	}
+	if (stream_load(fd, &l)) {
+		if (errno != EINVAL)
+			ntfs_log_perror("Failed to read %s", opts.source);
+		goto out;
+	}
+	dev = target_open(opts.target, l.volume_size);
+	if (!dev)
+		goto out;
+	if (!stream_restore(fd, &l, dev, buf) &&
+			!backup_boot_write(dev, &l, buf))
+		ret = 0;
+	if (target_close(dev))
+		ret = -1;
+	if (!ret)
+		printf("Restored %lld of %lld clusters of %u bytes.\n",
+				(long long)l.nr_data_clusters,
+				(long long)l.nr_clusters,
+				(unsigned)l.cluster_size);
+out:
+	free(l.extents);
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return ret;
+}
+
+/**
+ * do_clone - clone a volume onto a device, image file or stream
+ * @buf:	buffer of CLONE_BUF_SIZE bytes
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int do_clone(u8 *buf)
+{
+	struct ntfs_device *dev = NULL;
+	unsigned long mnt_flags;
+	ntfs_volume *vol;
+	clone_layout l;
+	u8 *bm;
+	int fd = STDOUT_FILENO, ret = -1;
+
+	if (ntfs_check_if_mounted(opts.source, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.source);
+		return -1;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.source);
+		return -1;
+	}
+	vol = ntfs_mount(opts.source, MS_RDONLY);
+	if (!vol) {
+		ntfs_log_perror("Failed to mount %s", opts.source);
+		return -1;
+	}
+	memset(&l, 0, sizeof(l));
+	bm = lcn_bitmap_load(vol);
+	if (!bm)
+		goto umount;
+	if (layout_build(vol, bm, &l)) {
+		ntfs_log_perror("Failed to build the list of extents");
+		goto free_bm;
+	}
+	if (!opts.save) {
+		dev = target_open(opts.target, l.volume_size);
+		if (!dev)
+			goto free_bm;
+		if (!clone_copy(vol, &l, dev, -1, buf) &&
+				!backup_boot_write(dev, &l, buf))
+			ret = 0;
+		if (target_close(dev))
+			ret = -1;
+	} else {
+		if (strcmp(opts.target, "-")) {
+			fd = open(opts.target, O_WRONLY | O_CREAT | O_TRUNC |
+					(opts.force ? 0 : O_EXCL), 0644);
+			if (fd < 0) {
+				ntfs_log_perror("Failed to create %s",
+						opts.target);
+				goto free_bm;
+			}
+		}
+		if (stream_save(fd, &l))
+			ntfs_log_perror("Failed to write %s", opts.target);
+		else if (!clone_copy(vol, &l, NULL, fd, buf))
+			ret = 0;
+		if (fd != STDOUT_FILENO && close(fd)) {
+			ntfs_log_perror("Failed to close %s", opts.target);
+			ret = -1;
+		}
+	}
+	if (!ret)
+		fprintf(opts.save && fd == STDOUT_FILENO ? stderr : stdout,
+				"Copied %lld of %lld clusters of %u bytes in "
+				"%lld extents.\n",
+				(long long)l.nr_data_clusters,
+				(long long)l.nr_clusters,
+				(unsigned)l.cluster_size,
+				(long long)l.nr_extents);
+free_bm:
+	free(l.extents);
+	free(bm);
+umount:
+	if (ntfs_umount(vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.source);
+		ret = -1;
+	}
+	return ret;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  Success, the program worked
+ *	    1  Error, something went wrong
+ */
+int main(int argc, char *argv[])
+{
+	u8 *buf;
+	int err;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	buf = ntfs_malloc(CLONE_BUF_SIZE);
+	if (!buf)
+		return EXIT_FAILURE;
+	if (opts.restore)
+		err = do_restore(buf);
+	else
+		err = do_clone(buf);
+	free(buf);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,829 @@
+/**
+ * consolidate_ntfs - Free space consolidation tool for unmounted NTFS volumes.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility analyzes the fragmentation of the free space of an unmounted
+ * NTFS volume (or volume image) and packs it by moving small extents of user
+ * files out of the holes they fragment into the lowest free holes that fit
+ * them.  It can also move user data out of the mft zone so that $MFT can grow
+ * contiguously again.
+ *
+ * Moves are ordered so that an interruption at any point at worst leaks the
+ * clusters of the extent being moved, which chkdsk reclaims:  the data is
+ * copied first, then the new clusters are marked in use, the mapping pairs
+ * are written and only then are the old clusters released.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+
+#include "types.h"
+#include "attrib.h"
+#include "bitmap.h"
+#include "device.h"
+#include "inode.h"
+#include "layout.h"
+#include "logging.h"
+#include "misc.h"
+#include "runlist.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "consolidate_ntfs";
+
+/* Largest extent, in clusters, moved by default. */
+#define CONSOLIDATE_DEFAULT_MAX_EXTENT	64
+
+/* Size of the buffer used to copy the data of an extent. */
+#define CONSOLIDATE_COPY_BUF_SIZE	(1024 * 1024)
+
+/* Number of power of two buckets in a free space histogram. */
+#define CONSOLIDATE_NR_BUCKETS		64
+
+/**
+ * struct consolidate_extent - a physically contiguous part of an attribute
+ * @mft_no:	mft record number of the base inode owning the attribute
+ * @type:	type of the attribute
+ * @name:	name of the attribute (AT_UNNAMED if unnamed)
+ * @name_len:	length of @name in Unicode characters
+ * @vcn:	first vcn of the extent
+ * @lcn:	first lcn of the extent
+ * @len:	length of the extent in clusters
+ */
+typedef struct {
+	u64 mft_no;
+	ATTR_TYPES type;
+	ntfschar *name;
+	u32 name_len;
+	VCN vcn;
+	LCN lcn;
+	s64 len;
+} consolidate_extent;
+
+/**
+ * struct consolidate_hole - a run of free clusters usable as a destination
+ * @lcn:	first free cluster
+ * @len:	number of free clusters
+ */
+typedef struct {
+	LCN lcn;
+	s64 len;
+} consolidate_hole;
+
+static struct {
+	char *device;
+	s64 max_extent;
+	BOOL analyze_only;
+	BOOL evacuate_mft_zone;
+	BOOL verbose;
+} opts;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - consolidate the free space of an NTFS "
+			"volume.\n\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-nvz] [-s clusters] <device>\n\n",
+			EXEC_NAME);
+	fprintf(stderr, "    -n          Only analyze the free space, do not "
+			"move anything.\n");
+	fprintf(stderr, "    -s clusters Move extents of at most this many "
+			"clusters (default %d).\n",
+			CONSOLIDATE_DEFAULT_MAX_EXTENT);
+	fprintf(stderr, "    -v          Print every extent moved.\n");
+	fprintf(stderr, "    -z          Also move user data out of the mft "
+			"zone.\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	char *end;
+	int ch;
+
+	opts.max_extent = CONSOLIDATE_DEFAULT_MAX_EXTENT;
+	while ((ch = getopt(argc, argv, "ns:vz")) != -1) {
+		switch (ch) {
+		case 'n':
+			opts.analyze_only = TRUE;
+			break;
+		case 's':
+			errno = 0;
+			opts.max_extent = strtoll(optarg, &end, 0);
+			if (errno || *end || opts.max_extent <= 0)
+				usage();
+			break;
+		case 'v':
+			opts.verbose = TRUE;
+			break;
+		case 'z':
+			opts.evacuate_mft_zone = TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	opts.device = argv[0];
+}
+
+/**
+ * lcn_bitmap_load - read the whole cluster bitmap into memory
+ * @vol:	mounted ntfs volume
+ *
+ * Return the bitmap, covering @vol->nr_clusters bits, or NULL on error with
+ * errno set.  The caller has to free() it.
+ */
+static u8 *lcn_bitmap_load(ntfs_volume *vol)
+{
+	s64 size, br;
+	u8 *bm;
+
+	size = (vol->nr_clusters + 7) >> 3;
+	bm = ntfs_malloc(size);
+	if (!bm)
+		return NULL;
+	br = ntfs_attr_pread(vol->lcnbmp_na, 0, size, bm);
+	if (br != size) {
+		if (br >= 0)
+			errno = EIO;
+		ntfs_log_perror("Failed to read $Bitmap");
+		free(bm);
+		return NULL;
+	}
+	return bm;
+}
+
+static inline BOOL lcn_is_free(const u8 *bm, LCN lcn)
+{
+	return !(bm[lcn >> 3] & (1 << (lcn & 7)));
+}
+
+/**
+ * lcn_next_run - find the next run of clusters in the same state
+ * @bm:		in memory cluster bitmap
+ * @nr_clusters: number of bits in @bm
+ * @lcn:	first cluster of the run
+ *
+ * Return the first cluster after @lcn whose allocation state differs from the
+ * one of @lcn, or @nr_clusters.  Whole bytes are skipped at a time.
+ */
+static LCN lcn_next_run(const u8 *bm, s64 nr_clusters, LCN lcn)
+{
+	const BOOL is_free = lcn_is_free(bm, lcn);
+	const u8 skip = is_free ? 0 : 0xff;
+
+	while (++lcn < nr_clusters) {
+		if (!(lcn & 7)) {
+			while (lcn + 8 <= nr_clusters && bm[lcn >> 3] == skip)
+				lcn += 8;
+			if (lcn >= nr_clusters)
+				break;
+		}
+		if (lcn_is_free(bm, lcn) != is_free)
+			break;
+	}
+	return lcn > nr_clusters ? nr_clusters : lcn;
+}
+
+/**
+ * free_space_report - print the free extent histogram of a volume
+ * @vol:	mounted ntfs volume
+ * @bm:		in memory cluster bitmap of @vol
+ * @title:	heading to print above the histogram
+ *
+ * Bucket i of the histogram counts the free extents of 2^i to 2^(i+1) - 1
+ * clusters.  The free clusters inside the mft zone are reported separately
+ * as the cluster allocator only uses them once the rest of the volume is full.
+ */
+static void free_space_report(ntfs_volume *vol, const u8 *bm,
+		const char *title)
+{
+	s64 nr_extents[CONSOLIDATE_NR_BUCKETS];
+	s64 nr_clusters[CONSOLIDATE_NR_BUCKETS];
+	s64 total_extents, total_free, largest, zone_free;
+	LCN lcn, next;
+	int i;
+
+	memset(nr_extents, 0, sizeof(nr_extents));
+	memset(nr_clusters, 0, sizeof(nr_clusters));
+	total_extents = total_free = largest = zone_free = 0;
+	for (lcn = 0; lcn < vol->nr_clusters; lcn = next) {
+		s64 len;
+
+		next = lcn_next_run(bm, vol->nr_clusters, lcn);
+		if (!lcn_is_free(bm, lcn))
+			continue;
+		len = next - lcn;
+		for (i = 0; (len >> (i + 1)) && i < CONSOLIDATE_NR_BUCKETS - 1;
+				i++)
+			;
+		nr_extents[i]++;
+		nr_clusters[i] += len;
+		total_extents++;
+		total_free += len;
+		if (len > largest)
+			largest = len;
+		if (lcn < vol->mft_zone_end && next > vol->mft_zone_start)
+			zone_free += min(next, vol->mft_zone_end) -
+					max(lcn, vol->mft_zone_start);
+	}
+
+	printf("%s:\n", title);
+	printf("  %22s %12s %14s %7s\n", "extent size (clusters)", "extents",
+			"clusters", "free %");
+	for (i = 0; i < CONSOLIDATE_NR_BUCKETS; i++) {
+		char range[48];
+
+		if (!nr_extents[i])
+			continue;
+		snprintf(range, sizeof(range), "%lld - %lld", 1LL << i,
+				(1LL << i) + ((1LL << i) - 1));
+		printf("  %22s %12lld %14lld %6.1f%%\n", range,
+				(long long)nr_extents[i],
+				(long long)nr_clusters[i],
+				total_free ? 100.0 * nr_clusters[i] /
+				total_free : 0.0);
+	}
+	printf("  free clusters: %lld of %lld in %lld extents, largest "
+			"%lld\n", (long long)total_free,
+			(long long)vol->nr_clusters, (long long)total_extents,
+			(long long)largest);
+	printf("  mft zone: clusters %lld - %lld, %lld free\n",
+			(long long)vol->mft_zone_start,
+			(long long)vol->mft_zone_end - 1, (long long)zone_free);
+}
+
+/**
+ * holes_build - list the free clusters usable as move destinations
+ * @vol:	mounted ntfs volume
+ * @bm:		in memory cluster bitmap of @vol
+ * @nr_holes:	on return the number of entries in the returned array
+ *
+ * Return an array of the free runs of @vol sorted by lcn, with the mft zone
+ * cut out of them as it has to stay available to $MFT, or NULL on error.
+ */
+static consolidate_hole *holes_build(ntfs_volume *vol, const u8 *bm,
+		s64 *nr_holes)
+{
+	consolidate_hole *holes = NULL;
+	s64 nr = 0, size = 0;
+	LCN lcn, next;
+
+	for (lcn = 0; lcn < vol->nr_clusters; lcn = next) {
+		LCN start, end;
+		int part;
+
+		next = lcn_next_run(bm, vol->nr_clusters, lcn);
+		if (!lcn_is_free(bm, lcn))
+			continue;
+		/* Up to two parts remain after cutting out the mft zone. */
+		for (part = 0; part < 2; part++) {
+			start = part ? max(lcn, vol->mft_zone_end) : lcn;
+			end = part ? next : min(next, vol->mft_zone_start);
+			if (start >= end)
+				continue;
+			if (nr == size) {
+				consolidate_hole *h;
+
+				size = size ? size * 2 : 1024;
+				h = realloc(holes, size * sizeof(*holes));
+				if (!h) {
+					ntfs_log_perror("Failed to allocate "
+							"free space list");
+					free(holes);
+					return NULL;
+				}
+				holes = h;
+			}
+			holes[nr].lcn = start;
+			holes[nr].len = end - start;
+			nr++;
+		}
+	}
+	*nr_holes = nr;
+	if (!holes)
+		holes = ntfs_malloc(sizeof(*holes));
+	return holes;
+}
+
+/**
+ * extents_add_attr - add the extents of an attribute to the extent list
+ * @ni:		open base inode
+ * @a:		attribute record of the first extent of the attribute
+ * @extents:	extent array, reallocated as needed
+ * @nr:		number of entries in *@extents
+ * @size:	number of allocated entries of *@extents
+ *
+ * Each extent gets its own copy of the attribute name so that the list can
+ * be sorted and freed without tracking shared names.
+ *
+ * Return 0 on success and -1 on error with errno set.
+ */
+static int extents_add_attr(ntfs_inode *ni, ATTR_RECORD *a,
+		consolidate_extent **extents, s64 *nr, s64 *size)
+{
+	ntfschar *name = AT_UNNAMED;
+	runlist_element *rl;
+	ntfs_attr *na;
+	int ret = -1;
+
+	if (a->name_length)
+		name = (ntfschar*)((u8*)a + le16_to_cpu(a->name_offset));
+	na = ntfs_attr_open(ni, a->type, name, a->name_length);
+	if (!na) {
+		ntfs_log_perror("Failed to open attribute 0x%x of inode "
+				"%lld", le32_to_cpu(a->type),
+				(long long)ni->mft_no);
+		return -1;
+	}
+	if (ntfs_attr_map_whole_runlist(na)) {
+		ntfs_log_perror("Failed to map runlist of attribute 0x%x of "
+				"inode %lld", le32_to_cpu(a->type),
+				(long long)ni->mft_no);
+		goto out;
+	}
+	for (rl = na->rl; rl->length; rl++) {
+		consolidate_extent *e;
+
+		if (rl->lcn < 0)
+			continue;
+		if (*nr == *size) {
+			*size = *size ? *size * 2 : 4096;
+			e = realloc(*extents, *size * sizeof(**extents));
+			if (!e)
+				goto out;
+			*extents = e;
+		}
+		e = *extents + *nr;
+		e->name = AT_UNNAMED;
+		if (a->name_length) {
+			e->name = ntfs_ucsndup(name, a->name_length);
+			if (!e->name)
+				goto out;
+		}
+		e->mft_no = ni->mft_no;
+		e->type = a->type;
+		e->name_len = a->name_length;
+		e->vcn = rl->vcn;
+		e->lcn = rl->lcn;
+		e->len = rl->length;
+		(*nr)++;
+	}
+	ret = 0;
+out:
+	ntfs_attr_close(na);
+	return ret;
+}
+
+/**
+ * extents_free - free an extent array and the names it references
+ * @extents:	extent array to free
+ * @nr:		number of entries in @extents
+ */
+static void extents_free(consolidate_extent *extents, s64 nr)
+{
+	s64 i;
+
+	for (i = 0; i < nr; i++)
+		if (extents[i].name != AT_UNNAMED)
+			free(extents[i].name);
+	free(extents);
+}
+
+/**
+ * extents_collect - list the movable extents of all user files
+ * @vol:	mounted ntfs volume
+ * @nr_extents:	on return the number of entries in the returned array
+ *
+ * Walk all in use base mft records from the first user file on and list the
+ * physically contiguous extents of their non-resident attributes.  Compressed
+ * and encrypted attributes are left alone.
+ *
+ * Return the extent array or NULL on error with errno set.
+ */
+static consolidate_extent *extents_collect(ntfs_volume *vol, s64 *nr_extents)
+{
+	consolidate_extent *extents = NULL;
+	s64 nr = 0, size = 0, nr_records, mft_no;
+	u8 *mft_bm;
+	s64 br;
+
+	nr_records = vol->mft_na->initialized_size >>
+			vol->mft_record_size_bits;
+	mft_bm = ntfs_malloc((nr_records + 7) >> 3);
+	if (!mft_bm)
+		return NULL;
+	br = ntfs_attr_pread(vol->mftbmp_na, 0, (nr_records + 7) >> 3, mft_bm);
+	if (br != (nr_records + 7) >> 3) {
+		if (br >= 0)
+			errno = EIO;
+		ntfs_log_perror("Failed to read $MFT/$BITMAP");
+		free(mft_bm);
+		return NULL;
+	}
+	for (mft_no = FILE_first_user; mft_no < nr_records; mft_no++) {
+		ntfs_attr_search_ctx *ctx;
+		ntfs_inode *ni;
+
+		if (!(mft_bm[mft_no >> 3] & (1 << (mft_no & 7))))
+			continue;
+		ni = ntfs_inode_open(vol, mft_no);
+		if (!ni) {
+			ntfs_log_perror("Failed to open inode %lld, skipping "
+					"it", (long long)mft_no);
+			continue;
+		}
+		if (ni->mrec->base_mft_record ||
+				!(ni->mrec->flags & MFT_RECORD_IN_USE)) {
+			ntfs_inode_close(ni);
+			continue;
+		}
+		ctx = ntfs_attr_get_search_ctx(ni, NULL);
+		if (!ctx) {
+			ntfs_inode_close(ni);
+			goto err;
+		}
+		while (!ntfs_attr_lookup(AT_UNUSED, NULL, 0, 0, 0, NULL, 0,
+				ctx)) {
+			ATTR_RECORD *a = ctx->attr;
+
+			if (!a->non_resident || a->lowest_vcn ||
+					a->flags & (ATTR_COMPRESSION_MASK |
+					ATTR_IS_ENCRYPTED))
+				continue;
+			if (extents_add_attr(ni, a, &extents, &nr, &size)) {
+				ntfs_attr_put_search_ctx(ctx);
+				ntfs_inode_close(ni);
+				goto err;
+			}
+		}
+		ntfs_attr_put_search_ctx(ctx);
+		ntfs_inode_close(ni);
+	}
+	free(mft_bm);
+	*nr_extents = nr;
+	if (!extents)
+		extents = ntfs_malloc(sizeof(*extents));
+	return extents;
+err:
+	free(mft_bm);
+	extents_free(extents, nr);
+	return NULL;
+}
+
+static int extent_lcn_cmp_desc(const void *p1, const void *p2)
+{
+	const consolidate_extent *e1 = p1, *e2 = p2;
+
+	if (e1->lcn == e2->lcn)
+		return 0;
+	return e1->lcn < e2->lcn ? 1 : -1;
+}
+
+/**
+ * lcn_range_is_free - check on disk that a cluster range is unallocated
+ * @vol:	mounted ntfs volume
+ * @lcn:	first cluster of the range
+ * @len:	number of clusters in the range
+ *
+ * Updating mapping pairs can allocate clusters behind our back, e.g. for a
+ * growing attribute list, so destinations are verified against $Bitmap
+ * itself before anything is written to them.
+ *
+ * Return 1 if free, 0 if not and -1 on error with errno set.
+ */
+static int lcn_range_is_free(ntfs_volume *vol, LCN lcn, s64 len)
+{
+	u8 buf[NTFS_BUF_SIZE];
+	s64 start, end, br, i;
+
+	start = lcn >> 3;
+	end = (lcn + len + 7) >> 3;
+	while (start < end) {
+		s64 cnt = min(end - start, (s64)sizeof(buf));
+
+		br = ntfs_attr_pread(vol->lcnbmp_na, start, cnt, buf);
+		if (br != cnt) {
+			if (br >= 0)
+				errno = EIO;
+			return -1;
+		}
+		for (i = 0; i < cnt << 3; i++) {
+			LCN cur = ((start << 3) + i);
+
+			if (cur < lcn || cur >= lcn + len)
+				continue;
+			if (!lcn_is_free(buf, i))
+				return 0;
+		}
+		start += cnt;
+	}
+	return 1;
+}
+
+/**
+ * extent_copy - copy the data of an extent to its new location
+ * @vol:	mounted ntfs volume
+ * @from:	first cluster to copy
+ * @to:		first cluster to copy to
+ * @len:	number of clusters to copy
+ * @buf:	copy buffer of CONSOLIDATE_COPY_BUF_SIZE bytes
+ *
+ * Return 0 on success and -1 on error with errno set.
+ */
+static int extent_copy(ntfs_volume *vol, LCN from, LCN to, s64 len, u8 *buf)
+{
+	const s64 buf_clusters = CONSOLIDATE_COPY_BUF_SIZE >>
+			vol->cluster_size_bits;
+
+	while (len > 0) {
+		const s64 cnt = min(len, buf_clusters);
+		const s64 bytes = cnt << vol->cluster_size_bits;
+
+		if (ntfs_pread(vol->dev, from << vol->cluster_size_bits, bytes,
+				buf) != bytes) {
+			ntfs_log_perror("Failed to read clusters %lld - %lld",
+					(long long)from,
+					(long long)(from + cnt - 1));
+			return -1;
+		}
+		if (ntfs_pwrite(vol->dev, to << vol->cluster_size_bits, bytes,
+				buf) != bytes) {
+			ntfs_log_perror("Failed to write clusters %lld - %lld",
+					(long long)to,
+					(long long)(to + cnt - 1));
+			return -1;
+		}
+		from += cnt;
+		to += cnt;
+		len -= cnt;
+	}
+	return 0;
+}
+
+/**
+ * extent_move - move an extent of an attribute to a new location
+ * @vol:	mounted ntfs volume
+ * @e:		extent to move
+ * @dest:	first cluster of the free run to move @e to
+ * @buf:	copy buffer of CONSOLIDATE_COPY_BUF_SIZE bytes
+ *
+ * Return 0 on success, 1 if @e no longer matches the runlist and was left
+ * alone, and -1 on error with errno set.
+ */
+static int extent_move(ntfs_volume *vol, const consolidate_extent *e,
+		LCN dest, u8 *buf)
+{
+	runlist_element *rl;
+	ntfs_inode *ni;
+	ntfs_attr *na = NULL;
+	int ret = -1;
+
+	ni = ntfs_inode_open(vol, e->mft_no);
+	if (!ni) {
+		ntfs_log_perror("Failed to open inode %lld",
+				(long long)e->mft_no);
+		return -1;
+	}
+	na = ntfs_attr_open(ni, e->type, e->name, e->name_len);
+	if (!na || ntfs_attr_map_whole_runlist(na)) {
+		ntfs_log_perror("Failed to open attribute 0x%x of inode %lld",
+				le32_to_cpu(e->type), (long long)e->mft_no);
+		goto out;
+	}
+	for (rl = na->rl; rl->length; rl++)
+		if (rl->vcn == e->vcn)
+			break;
+	if (rl->vcn != e->vcn || rl->lcn != e->lcn || rl->length != e->len) {
+		ret = 1;
+		goto out;
+	}
+	if (extent_copy(vol, e->lcn, dest, e->len, buf))
+		goto out;
+	if (ntfs_bitmap_set_run(vol->lcnbmp_na, dest, e->len)) {
+		ntfs_log_perror("Failed to allocate clusters %lld - %lld",
+				(long long)dest, (long long)(dest + e->len - 1));
+		goto out;
+	}
+	rl->lcn = dest;
+	if (ntfs_attr_update_mapping_pairs(na, 0) || ntfs_inode_sync(ni)) {
+		ntfs_log_perror("Failed to update mapping pairs of inode %lld",
+				(long long)e->mft_no);
+		/*
+		 * The mapping pairs may or may not have been written, leave
+		 * both copies allocated rather than risk a cross link.
+		 */
+		goto out;
+	}
+	if (ntfs_bitmap_clear_run(vol->lcnbmp_na, e->lcn, e->len)) {
+		ntfs_log_perror("Failed to free clusters %lld - %lld",
+				(long long)e->lcn, (long long)(e->lcn +
+				e->len - 1));
+		goto out;
+	}
+	ret = 0;
+out:
+	if (na)
+		ntfs_attr_close(na);
+	if (ntfs_inode_close(ni) && !ret) {
+		ntfs_log_perror("Failed to close inode %lld",
+				(long long)e->mft_no);
+		ret = -1;
+	}
+	return ret;
+}
+
+/**
+ * consolidate - pack the free space of a volume
+ * @vol:	mounted ntfs volume
+ * @bm:		in memory cluster bitmap of @vol
+ *
+ * Going from the end of the volume towards its start, move each extent of at
+ * most opts.max_extent clusters into the lowest free hole outside the mft
+ * zone it fits into, as long as that is lower on the volume.  This packs the
+ * data towards the start, merging the holes left behind into large free runs
+ * at the end.  With opts.evacuate_mft_zone extents inside the mft zone are
+ * moved out of it to wherever they fit.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int consolidate(ntfs_volume *vol, const u8 *bm)
+{
+	consolidate_extent *extents;
+	consolidate_hole *holes;
+	s64 nr_extents, nr_holes, first_hole, i, nr_moved, moved_clusters;
+	u8 *buf;
+	int ret = -1;
+
+	extents = extents_collect(vol, &nr_extents);
+	if (!extents)
+		return -1;
+	holes = holes_build(vol, bm, &nr_holes);
+	buf = ntfs_malloc(CONSOLIDATE_COPY_BUF_SIZE);
+	if (!holes || !buf)
+		goto out;
+	qsort(extents, nr_extents, sizeof(*extents), extent_lcn_cmp_desc);
+
+	first_hole = nr_moved = moved_clusters = 0;
+	for (i = 0; i < nr_extents; i++) {
+		consolidate_extent *e = extents + i;
+		BOOL in_zone;
+		s64 h;
+		int err;
+
+		if (e->len > opts.max_extent)
+			continue;
+		in_zone = e->lcn < vol->mft_zone_end &&
+				e->lcn + e->len > vol->mft_zone_start;
+		if (in_zone && !opts.evacuate_mft_zone)
+			continue;
+		while (first_hole < nr_holes && !holes[first_hole].len)
+			first_hole++;
+retry:
+		for (h = first_hole; h < nr_holes; h++) {
+			if (!in_zone && holes[h].lcn >= e->lcn) {
+				h = nr_holes;
+				break;
+			}
+			if (holes[h].len >= e->len)
+				break;
+		}
+		if (h >= nr_holes)
+			continue;
+		err = lcn_range_is_free(vol, holes[h].lcn, e->len);
+		if (err < 0) {
+			ntfs_log_perror("Failed to read $Bitmap");
+			goto out;
+		}
+		if (!err) {
+			/* Taken by the library meanwhile, forget this hole. */
+			holes[h].len = 0;
+			goto retry;
+		}
+		if (opts.verbose)
+			printf("inode %lld attribute 0x%x vcn %lld: moving %lld "
+					"clusters from %lld to %lld\n",
+					(long long)e->mft_no,
+					le32_to_cpu(e->type),
+					(long long)e->vcn, (long long)e->len,
+					(long long)e->lcn,
+					(long long)holes[h].lcn);
+		err = extent_move(vol, e, holes[h].lcn, buf);
+		if (err < 0)
+			goto out;
+		if (err)
+			continue;
+		holes[h].lcn += e->len;
+		holes[h].len -= e->len;
+		nr_moved++;
+		moved_clusters += e->len;
+	}
+	printf("Moved %lld extents, %lld clusters.\n", (long long)nr_moved,
+			(long long)moved_clusters);
+	ret = 0;
+out:
+	extents_free(extents, nr_extents);
+	free(holes);
+	free(buf);
+	return ret;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  Success, the program worked
+ *	    1  Error, something went wrong
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long mnt_flags;
+	ntfs_volume *vol;
+	u8 *bm;
+	int ret = EXIT_FAILURE;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	if (ntfs_check_if_mounted(opts.device, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	vol = ntfs_mount(opts.device, opts.analyze_only ? MS_RDONLY : 0);
+	if (!vol) {
+		ntfs_log_perror("Failed to mount %s", opts.device);
+		return EXIT_FAILURE;
+	}
+	printf("%s: %lld clusters of %u bytes.\n", opts.device,
+			(long long)vol->nr_clusters, (unsigned)vol->cluster_size);
+	bm = lcn_bitmap_load(vol);
+	if (!bm)
+		goto umount;
+	free_space_report(vol, bm, opts.analyze_only ? "Free space" :
+			"Free space before");
+	if (!opts.analyze_only) {
+		if (consolidate(vol, bm))
+			goto free_bm;
+		/* Reload, the library may have allocated clusters, too. */
+		free(bm);
+		bm = lcn_bitmap_load(vol);
+		if (!bm)
+			goto umount;
+		free_space_report(vol, bm, "Free space after");
+	}
+	ret = EXIT_SUCCESS;
+free_bm:
+	free(bm);
+umount:
+	if (ntfs_umount(vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.device);
+		ret = EXIT_FAILURE;
+	}
+	return ret;
+}
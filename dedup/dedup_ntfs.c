@@ -0,0 +1,1679 @@
+/**
+ * dedup_ntfs - Report the duplicate data of an unmounted NTFS volume.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility measures how much of the file data of an unmounted NTFS volume
+ * (or volume image) is duplicated.  A scan of the mft (see newfs/mftscan.c)
+ * collects the runlists of all the non-resident $DATA attributes, which are
+ * then read straight from the device, one after the other in the order of
+ * their first cluster, so the disk is read mostly sequentially.  Holes are
+ * skipped, compressed attributes are read through the library and encrypted
+ * ones are left out.
+ *
+ * The calling thread cuts the data into content defined or fixed size chunks
+ * and worker threads hash them with SHA-256.  The chunk hashes are spilled to
+ * temporary files partitioned by hash, each of which is small enough to be
+ * sorted in memory afterwards to count the duplicates, so the memory used
+ * does not grow with the amount of data.  The hashes of the chunks of each
+ * stream are hashed again to find whole streams with identical content.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+#include <pthread.h>
+
+#include "types.h"
+#include "attrib.h"
+#include "device.h"
+#include "inode.h"
+#include "layout.h"
+#include "logging.h"
+#include "mftscan.h"
+#include "runlist.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "dedup_ntfs";
+
+/* Bytes of data cut into chunks and hashed as one job. */
+#define DEDUP_JOB_SIZE		(8 * 1024 * 1024)
+
+/* Size of the blocks of the arena the runlists are kept in. */
+#define DEDUP_BLOCK_SIZE	(16 * 1024 * 1024)
+
+/* Most partitions the chunk hashes are spilled to. */
+#define DEDUP_MAX_PARTITIONS	200
+
+/* Bytes of a chunk hash kept, a truncated SHA-256. */
+#define DEDUP_HASH_SIZE		16
+
+/* Room for a stream name converted to UTF-8. */
+#define DEDUP_NAME_BUF_SIZE	(4 * 255 + 1)
+
+/* Streams printed of each group of identical streams. */
+#define DEDUP_GROUP_FILES	8
+
+/**
+ * struct dedup_sha256 - state of a SHA-256 computation
+ * @h:		the intermediate hash
+ * @len:	number of bytes hashed so far
+ * @buf:	bytes not yet hashed, less than a block
+ */
+typedef struct {
+	u32 h[8];
+	u64 len;
+	u8 buf[64];
+} dedup_sha256;
+
+/**
+ * struct dedup_extent - a non-resident $DATA attribute record from the mft
+ * @owner:		mft reference of the base mft record of the file
+ * @lowest_vcn:		first vcn the runs describe
+ * @data_size:		sizes of the attribute, valid if @lowest_vcn is 0
+ * @initialized_size:
+ * @nr_runs:		number of runs following the name
+ * @flags:		ATTR_FLAGS of the attribute, in cpu order
+ * @name_len:		length of the name following the extent, in Unicode
+ *			characters
+ *
+ * The name is padded to a multiple of 8 bytes and followed by @nr_runs pairs
+ * of lcn (LCN_HOLE for a hole) and length in clusters.
+ */
+typedef struct {
+	u64 owner;
+	s64 lowest_vcn;
+	s64 data_size;
+	s64 initialized_size;
+	u32 nr_runs;
+	u16 flags;
+	u8 name_len;
+	u8 reserved;
+} dedup_extent;
+
+/**
+ * struct dedup_block - a block of the arena
+ * @next:	next block
+ * @len:	bytes of extents in @data
+ * @size:	byte size of @data
+ * @data:	the extents
+ */
+typedef struct dedup_block {
+	struct dedup_block *next;
+	size_t len;
+	size_t size;
+	u64 data[];
+} dedup_block;
+
+/**
+ * struct dedup_stream - a $DATA attribute to read
+ * @ext:	its extents, sorted by lowest vcn
+ * @nr_ext:	number of elements in @ext
+ * @first_lcn:	first cluster of its data, -1 if it has none
+ */
+typedef struct {
+	const dedup_extent **ext;
+	u32 nr_ext;
+	LCN first_lcn;
+} dedup_stream;
+
+/**
+ * struct dedup_digest - the content of a whole stream
+ * @hash:	hash of the hashes and sizes of its chunks and holes
+ * @bytes:	bytes of data in it, not counting holes
+ * @stream:	index of the stream in dedup_ctx.streams
+ */
+typedef struct {
+	u8 hash[DEDUP_HASH_SIZE];
+	s64 bytes;
+	s64 stream;
+} dedup_digest;
+
+/**
+ * struct dedup_record - a chunk as spilled to a partition
+ * @hash:	the hash of the chunk
+ * @len:	byte size of the chunk
+ */
+typedef struct {
+	u8 hash[DEDUP_HASH_SIZE];
+	le32 len;
+} __attribute__((__packed__)) dedup_record;
+
+/* States of a job. */
+typedef enum {
+	DEDUP_JOB_FREE,		/* Available for filling. */
+	DEDUP_JOB_READY,	/* Filled, waiting for a worker. */
+	DEDUP_JOB_BUSY,		/* A worker is hashing the chunks. */
+	DEDUP_JOB_DONE,		/* Hashed, waiting to be accounted for. */
+} dedup_job_state;
+
+/**
+ * struct dedup_job - a piece of a stream to hash
+ * @state:	where in its life cycle the job is
+ * @stream:	index of the stream the data belongs to
+ * @first:	the job starts the stream
+ * @last:	the job ends the stream
+ * @hole:	bytes of holes before the data
+ * @hole_after:	bytes of holes after the data
+ * @buf:	the data
+ * @len:	bytes of data in @buf
+ * @nr_chunks:	number of chunks @buf is cut into
+ * @chunk_len:	byte size of each chunk, in order
+ * @hashes:	hash of each chunk, filled in by a worker
+ */
+typedef struct {
+	dedup_job_state state;
+	s64 stream;
+	BOOL first;
+	BOOL last;
+	s64 hole;
+	s64 hole_after;
+	u8 *buf;
+	u32 len;
+	u32 nr_chunks;
+	u32 *chunk_len;
+	u8 (*hashes)[DEDUP_HASH_SIZE];
+} dedup_job;
+
+/**
+ * struct dedup_reader - position of the calling thread in the streams
+ * @stream:	index of the stream being read, in dedup_ctx.order
+ * @rl:		runlist of the stream, NULL if it is read through @na
+ * @ni:		inode of a compressed stream
+ * @na:		attribute of a compressed stream
+ * @pos:	byte position in the stream
+ * @data_end:	end of the initialized data of the stream
+ * @size:	data size of the stream
+ * @open:	a stream is being read
+ * @first:	nothing of the stream has gone into a job yet
+ * @carry:	bytes at the end of the last job not cut into chunks yet
+ * @carry_len:	number of bytes in @carry
+ */
+typedef struct {
+	s64 stream;
+	runlist_element *rl;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	s64 pos;
+	s64 data_end;
+	s64 size;
+	BOOL open;
+	BOOL first;
+	u8 *carry;
+	u32 carry_len;
+} dedup_reader;
+
+/**
+ * struct dedup_ctx - state of the report
+ * @vol:		the volume
+ * @blocks:		the arena
+ * @last:		last block of @blocks
+ * @extents:		all the extents, sorted by owner, name and lowest vcn
+ *			once the scan is done
+ * @nr_extents:		number of elements in @extents
+ * @extents_size:	allocated number of elements in @extents
+ * @streams:		the streams made out of @extents
+ * @nr_streams:		number of elements in @streams
+ * @order:		indexes of @streams in the order they are read
+ * @lock:		protects the job states and @stop
+ * @cond:		broadcast whenever a job changes state
+ * @jobs:		ring of jobs, job number n is @jobs[n % @nr_jobs]
+ * @nr_jobs:		number of elements in @jobs
+ * @nr_filled:		number of jobs filled so far
+ * @next:		number of the next job for a worker
+ * @stop:		set when there is nothing left for the workers to do
+ * @reader:		position in the streams
+ * @gear:		random values of the content defined chunking
+ * @parts:		the partitions the chunk hashes are spilled to
+ * @nr_parts:		number of elements in @parts
+ * @file_hash:		hash of the stream whose jobs are being accounted for
+ * @file_bytes:		bytes of data of that stream so far
+ * @digests:		content of each stream read
+ * @nr_digests:		number of elements in @digests
+ * @nr_chunks:		number of chunks
+ * @nr_unique:		number of distinct chunks
+ * @data_bytes:		bytes of data hashed
+ * @unique_bytes:	bytes of data in distinct chunks
+ * @sparse_bytes:	bytes of holes and uninitialized data skipped
+ * @nr_compressed:	number of compressed streams
+ * @nr_encrypted:	number of encrypted streams left out
+ * @nr_failed:		number of streams which could not be read
+ */
+typedef struct {
+	ntfs_volume *vol;
+	dedup_block *blocks;
+	dedup_block *last;
+	const dedup_extent **extents;
+	s64 nr_extents;
+	s64 extents_size;
+	dedup_stream *streams;
+	s64 nr_streams;
+	s64 *order;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	dedup_job *jobs;
+	int nr_jobs;
+	s64 nr_filled;
+	s64 next;
+	BOOL stop;
+	dedup_reader reader;
+	u64 gear[256];
+	FILE **parts;
+	int nr_parts;
+	dedup_sha256 file_hash;
+	s64 file_bytes;
+	dedup_digest *digests;
+	s64 nr_digests;
+	s64 nr_chunks;
+	s64 nr_unique;
+	s64 data_bytes;
+	s64 unique_bytes;
+	s64 sparse_bytes;
+	s64 nr_compressed;
+	s64 nr_encrypted;
+	s64 nr_failed;
+} dedup_ctx;
+
+static struct {
+	char *device;
+	char *tmpdir;
+	u32 chunk_size;
+	BOOL fixed;
+	int nr_groups;
+	s64 memory;
+	int nr_threads;
+	BOOL verbose;
+} opts = {
+	.chunk_size = 64 * 1024,
+	.nr_groups = 10,
+	.memory = 256 * 1024 * 1024,
+};
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - report the duplicate data of an NTFS volume."
+			"\n\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-fv] [-b bytes] [-g groups] [-m MiB] "
+			"[-t threads] [-T dir] <device>\n\n", EXEC_NAME);
+	fprintf(stderr, "    -b bytes    Average chunk size, a power of two "
+			"(default 65536).\n");
+	fprintf(stderr, "    -f          Cut the data into fixed size chunks."
+			"\n");
+	fprintf(stderr, "    -g groups   Number of duplicate file groups to "
+			"print (default 10).\n");
+	fprintf(stderr, "    -m MiB      Memory for sorting the chunk hashes "
+			"(default 256).\n");
+	fprintf(stderr, "    -t threads  Number of threads hashing (default "
+			"one per cpu).\n");
+	fprintf(stderr, "    -T dir      Directory for the temporary files "
+			"(default $TMPDIR or /tmp).\n");
+	fprintf(stderr, "    -v          Print every stream read.\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * parse_number - parse a numeric option argument
+ *
+ * Return the value of @arg, exiting via usage() unless it is a number
+ * between @min and @max.
+ */
+static s64 parse_number(const char *arg, s64 min, s64 max)
+{
+	char *end;
+	long long n;
+
+	errno = 0;
+	n = strtoll(arg, &end, 0);
+	if (errno || *end || n < min || n > max)
+		usage();
+	return n;
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "b:fg:m:t:T:v")) != -1) {
+		switch (ch) {
+		case 'b':
+			opts.chunk_size = parse_number(optarg, 4096,
+					1024 * 1024);
+			if (opts.chunk_size & (opts.chunk_size - 1))
+				usage();
+			break;
+		case 'f':
+			opts.fixed = TRUE;
+			break;
+		case 'g':
+			opts.nr_groups = parse_number(optarg, 0, 1000000);
+			break;
+		case 'm':
+			opts.memory = parse_number(optarg, 1, 1024 * 1024) *
+					1024 * 1024;
+			break;
+		case 't':
+			opts.nr_threads = parse_number(optarg, 1, 1024);
+			break;
+		case 'T':
+			opts.tmpdir = optarg;
+			break;
+		case 'v':
+			opts.verbose = TRUE;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	opts.device = argv[0];
+	if (!opts.tmpdir)
+		opts.tmpdir = getenv("TMPDIR");
+	if (!opts.tmpdir)
+		opts.tmpdir = "/tmp";
+}
+
+static const u32 dedup_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * dedup_sha256_block - hash a 64 byte block into a SHA-256 state
+ */
+static void dedup_sha256_block(dedup_sha256 *s, const u8 *p)
+{
+	u32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (u32)p[4 * i] << 24 | (u32)p[4 * i + 1] << 16 |
+				(u32)p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (; i < 64; i++)
+		w[i] = w[i - 16] + (ROR32(w[i - 15], 7) ^
+				ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+				w[i - 7] + (ROR32(w[i - 2], 17) ^
+				ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+	a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+	e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+				((e & f) ^ (~e & g)) + dedup_sha256_k[i] + w[i];
+		t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+				((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+	s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void dedup_sha256_init(dedup_sha256 *s)
+{
+	static const u32 h0[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+			0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+			0x5be0cd19 };
+
+	memcpy(s->h, h0, sizeof(h0));
+	s->len = 0;
+}
+
+static void dedup_sha256_update(dedup_sha256 *s, const void *data,
+		size_t len)
+{
+	const u8 *p = data;
+	size_t used = s->len & 63;
+
+	s->len += len;
+	if (used) {
+		size_t n = 64 - used < len ? 64 - used : len;
+
+		memcpy(s->buf + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		dedup_sha256_block(s, s->buf);
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		dedup_sha256_block(s, p);
+	memcpy(s->buf, p, len);
+}
+
+/**
+ * dedup_sha256_final - finish a SHA-256 computation
+ * @s:		the state
+ * @hash:	the first DEDUP_HASH_SIZE bytes of the hash are returned here
+ */
+static void dedup_sha256_final(dedup_sha256 *s, u8 *hash)
+{
+	const u64 bits = s->len << 3;
+	u8 pad[72];
+	size_t n = 64 - ((s->len + 8) & 63);
+	int i;
+
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+		pad[n + i] = bits >> (56 - 8 * i);
+	dedup_sha256_update(s, pad, n + 8);
+	for (i = 0; i < DEDUP_HASH_SIZE; i++)
+		hash[i] = s->h[i / 4] >> (24 - 8 * (i & 3));
+}
+
+/**
+ * dedup_scan - collect the non-resident $DATA attributes of an mft record,
+ *		called by the scanner
+ * @r:		the mft record
+ * @out:	output of the chunk of mft records @r belongs to
+ * @data:	state of the report
+ *
+ * The system files are left out, as they are not user data.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_scan(const ntfs_mft_scan_record *r, ntfs_mft_scan_out *out,
+		void *data)
+{
+	static const u8 zero[8];
+	dedup_ctx *ctx = data;
+	const MFT_RECORD *m = r->m;
+	const ATTR_RECORD *a;
+	const MFT_REF owner = r->base_mref ? r->base_mref :
+			MK_MREF(r->mft_no, r->seq_no);
+
+	if (MREF(owner) < FILE_first_user)
+		return 0;
+	for (a = (const ATTR_RECORD*)((const u8*)m +
+			le16_to_cpu(m->attrs_offset)); a->type != AT_END;
+			a = (const ATTR_RECORD*)((const u8*)a +
+			le32_to_cpu(a->length))) {
+		runlist_element *rl, *rle;
+		dedup_extent e;
+		u32 name_size;
+
+		if (a->type != AT_DATA || !a->non_resident)
+			continue;
+		if (le16_to_cpu(a->name_offset) + a->name_length *
+				sizeof(ntfschar) > le32_to_cpu(a->length))
+			continue;
+		rl = ntfs_mapping_pairs_decompress(ctx->vol, a, NULL);
+		if (!rl) {
+			ntfs_log_error("Failed to decompress the runlist of "
+					"record %llu.\n",
+					(unsigned long long)r->mft_no);
+			continue;
+		}
+		memset(&e, 0, sizeof(e));
+		e.owner = owner;
+		e.lowest_vcn = sle64_to_cpu(a->lowest_vcn);
+		if (!e.lowest_vcn) {
+			e.data_size = sle64_to_cpu(a->data_size);
+			e.initialized_size = sle64_to_cpu(
+					a->initialized_size);
+		}
+		e.flags = le16_to_cpu(a->flags);
+		e.name_len = a->name_length;
+		/* Skip the runs of the extents before this one. */
+		for (rle = rl; rle->length && rle->vcn < e.lowest_vcn; rle++)
+			;
+		while (rle[e.nr_runs].length)
+			e.nr_runs++;
+		name_size = e.name_len * sizeof(ntfschar);
+		if (ntfs_mft_scan_write(out, &e, sizeof(e)) ||
+				ntfs_mft_scan_write(out, (const u8*)a +
+				le16_to_cpu(a->name_offset), name_size) ||
+				ntfs_mft_scan_write(out, zero,
+				(8 - (name_size & 7)) & 7)) {
+			free(rl);
+			return -1;
+		}
+		for (; rle->length; rle++) {
+			s64 run[2];
+
+			run[0] = rle->lcn < 0 ? LCN_HOLE : rle->lcn;
+			run[1] = rle->length;
+			if (ntfs_mft_scan_write(out, run, sizeof(run))) {
+				free(rl);
+				return -1;
+			}
+		}
+		free(rl);
+	}
+	return 0;
+}
+
+/**
+ * dedup_extent_size - byte size of an extent, including its name and runs
+ */
+static inline size_t dedup_extent_size(const dedup_extent *e)
+{
+	return sizeof(*e) + ((e->name_len * sizeof(ntfschar) + 7) & ~7) +
+			e->nr_runs * 2 * sizeof(s64);
+}
+
+static inline const ntfschar *dedup_extent_name(const dedup_extent *e)
+{
+	return (const ntfschar*)(e + 1);
+}
+
+/**
+ * dedup_extent_runs - the runs of an extent, pairs of lcn and length
+ */
+static inline const s64 *dedup_extent_runs(const dedup_extent *e)
+{
+	return (const s64*)((const u8*)(e + 1) + ((e->name_len *
+			sizeof(ntfschar) + 7) & ~7));
+}
+
+/**
+ * dedup_out - copy the extents of a chunk of mft records into the arena,
+ *	       called by the scanner
+ * @out:	output of the chunk
+ * @data:	state of the report
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_out(const ntfs_mft_scan_out *out, void *data)
+{
+	dedup_ctx *ctx = data;
+	dedup_block *b = ctx->last;
+	const u8 *p, *end;
+
+	if (!out->len)
+		return 0;
+	if (!b || b->size - b->len < out->len) {
+		size_t size = out->len > DEDUP_BLOCK_SIZE ? out->len :
+				DEDUP_BLOCK_SIZE;
+
+		b = malloc(sizeof(*b) + size);
+		if (!b) {
+			errno = ENOMEM;
+			return -1;
+		}
+		b->next = NULL;
+		b->len = 0;
+		b->size = size;
+		if (ctx->last)
+			ctx->last->next = b;
+		else
+			ctx->blocks = b;
+		ctx->last = b;
+	}
+	p = (const u8*)b->data + b->len;
+	memcpy((u8*)b->data + b->len, out->buf, out->len);
+	b->len += out->len;
+	for (end = (const u8*)b->data + b->len; p < end;
+			p += dedup_extent_size((const dedup_extent*)p)) {
+		if (ctx->nr_extents == ctx->extents_size) {
+			s64 size = ctx->extents_size ? 2 * ctx->extents_size :
+					1024;
+			const dedup_extent **e;
+
+			e = realloc(ctx->extents, size * sizeof(*e));
+			if (!e) {
+				errno = ENOMEM;
+				return -1;
+			}
+			ctx->extents = e;
+			ctx->extents_size = size;
+		}
+		ctx->extents[ctx->nr_extents++] = (const dedup_extent*)p;
+	}
+	return 0;
+}
+
+/**
+ * dedup_extent_cmp - order extents by file, attribute name and lowest vcn
+ */
+static int dedup_extent_cmp(const void *p1, const void *p2)
+{
+	const dedup_extent *e1 = *(const dedup_extent**)p1;
+	const dedup_extent *e2 = *(const dedup_extent**)p2;
+	int cmp;
+
+	if (MREF(e1->owner) != MREF(e2->owner))
+		return MREF(e1->owner) < MREF(e2->owner) ? -1 : 1;
+	if (MSEQNO(e1->owner) != MSEQNO(e2->owner))
+		return MSEQNO(e1->owner) < MSEQNO(e2->owner) ? -1 : 1;
+	if (e1->name_len != e2->name_len)
+		return e1->name_len < e2->name_len ? -1 : 1;
+	cmp = memcmp(dedup_extent_name(e1), dedup_extent_name(e2),
+			e1->name_len * sizeof(ntfschar));
+	if (cmp)
+		return cmp;
+	if (e1->lowest_vcn != e2->lowest_vcn)
+		return e1->lowest_vcn < e2->lowest_vcn ? -1 : 1;
+	return 0;
+}
+
+static dedup_ctx *dedup_sort_ctx;
+
+/**
+ * dedup_order_cmp - order streams by their first cluster
+ *
+ * Streams without any clusters, with a first_lcn of -1, go last as the
+ * comparison is unsigned.
+ */
+static int dedup_order_cmp(const void *p1, const void *p2)
+{
+	const s64 i1 = *(const s64*)p1, i2 = *(const s64*)p2;
+	const u64 lcn1 = dedup_sort_ctx->streams[i1].first_lcn;
+	const u64 lcn2 = dedup_sort_ctx->streams[i2].first_lcn;
+
+	if (lcn1 != lcn2)
+		return lcn1 < lcn2 ? -1 : 1;
+	return i1 < i2 ? -1 : i1 > i2;
+}
+
+/**
+ * dedup_streams_build - put the streams together from the extents
+ * @ctx:	state of the report
+ * @bytes:	the number of bytes of clusters the streams use is returned
+ *		here
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_streams_build(dedup_ctx *ctx, s64 *bytes)
+{
+	s64 i, j;
+
+	qsort(ctx->extents, ctx->nr_extents, sizeof(*ctx->extents),
+			dedup_extent_cmp);
+	ctx->streams = malloc((ctx->nr_extents + 1) *
+			sizeof(*ctx->streams));
+	ctx->order = malloc((ctx->nr_extents + 1) * sizeof(*ctx->order));
+	if (!ctx->streams || !ctx->order) {
+		errno = ENOMEM;
+		return -1;
+	}
+	*bytes = 0;
+	for (i = 0; i < ctx->nr_extents; i = j) {
+		dedup_stream *st = ctx->streams + ctx->nr_streams;
+		s64 k;
+
+		for (j = i + 1; j < ctx->nr_extents && ctx->extents[j]->owner ==
+				ctx->extents[i]->owner &&
+				ctx->extents[j]->name_len ==
+				ctx->extents[i]->name_len &&
+				!memcmp(dedup_extent_name(ctx->extents[j]),
+				dedup_extent_name(ctx->extents[i]),
+				ctx->extents[i]->name_len *
+				sizeof(ntfschar)); j++)
+			;
+		st->ext = ctx->extents + i;
+		st->nr_ext = j - i;
+		st->first_lcn = -1;
+		for (k = i; k < j; k++) {
+			const dedup_extent *e = ctx->extents[k];
+			const s64 *run = dedup_extent_runs(e);
+			u32 n;
+
+			for (n = 0; n < e->nr_runs; n++) {
+				if (run[2 * n] < 0)
+					continue;
+				if (st->first_lcn < 0)
+					st->first_lcn = run[2 * n];
+				*bytes += run[2 * n + 1] <<
+						ctx->vol->cluster_size_bits;
+			}
+		}
+		ctx->order[ctx->nr_streams] = ctx->nr_streams;
+		ctx->nr_streams++;
+	}
+	dedup_sort_ctx = ctx;
+	qsort(ctx->order, ctx->nr_streams, sizeof(*ctx->order),
+			dedup_order_cmp);
+	return 0;
+}
+
+/**
+ * dedup_stream_rl - build the runlist of a stream from its extents
+ * @ctx:	state of the report
+ * @st:		the stream
+ *
+ * Return the runlist on success and NULL with errno set on error.
+ */
+static runlist_element *dedup_stream_rl(dedup_ctx *ctx,
+		const dedup_stream *st)
+{
+	runlist_element *rl;
+	s64 nr = 0, vcn = 0;
+	u32 i, n;
+
+	for (i = 0; i < st->nr_ext; i++)
+		nr += st->ext[i]->nr_runs;
+	rl = malloc((nr + 1) * sizeof(*rl));
+	if (!rl) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	nr = 0;
+	for (i = 0; i < st->nr_ext; i++) {
+		const dedup_extent *e = st->ext[i];
+		const s64 *run = dedup_extent_runs(e);
+
+		if (e->lowest_vcn != vcn) {
+			free(rl);
+			errno = EIO;
+			return NULL;
+		}
+		for (n = 0; n < e->nr_runs; n++, nr++) {
+			rl[nr].vcn = vcn;
+			rl[nr].lcn = run[2 * n];
+			rl[nr].length = run[2 * n + 1];
+			vcn += rl[nr].length;
+		}
+	}
+	rl[nr].vcn = vcn;
+	rl[nr].lcn = LCN_ENOENT;
+	rl[nr].length = 0;
+	return rl;
+}
+
+/**
+ * dedup_stream_name - print the name of a stream
+ * @st:		the stream
+ * @f:		where to print it
+ *
+ * A stream is named after the mft record of its file, followed by a colon
+ * and its name if it is a named stream.
+ */
+static void dedup_stream_name(const dedup_stream *st, FILE *f)
+{
+	const dedup_extent *e = st->ext[0];
+	char buf[DEDUP_NAME_BUF_SIZE], *name = buf;
+
+	fprintf(f, "%llu", (unsigned long long)MREF(e->owner));
+	if (!e->name_len)
+		return;
+	if (ntfs_ucstombs(dedup_extent_name(e), e->name_len, &name,
+			sizeof(buf)) < 0)
+		strcpy(buf, "?");
+	fprintf(f, ":%s", buf);
+}
+
+/**
+ * dedup_stream_open - start reading the next stream
+ * @ctx:	state of the report
+ *
+ * Return 0 if the stream can be read, 1 if it is to be skipped and -1 with
+ * errno set on error.
+ */
+static int dedup_stream_open(dedup_ctx *ctx)
+{
+	dedup_reader *r = &ctx->reader;
+	const dedup_stream *st = ctx->streams + ctx->order[r->stream];
+	const dedup_extent *e = st->ext[0];
+
+	if (e->lowest_vcn) {
+		ntfs_log_error("Stream %llu misses its first extent.\n",
+				(unsigned long long)MREF(e->owner));
+		ctx->nr_failed++;
+		return 1;
+	}
+	if (e->flags & le16_to_cpu(ATTR_IS_ENCRYPTED)) {
+		ctx->nr_encrypted++;
+		return 1;
+	}
+	r->size = e->data_size;
+	r->data_end = e->initialized_size < e->data_size ?
+			e->initialized_size : e->data_size;
+	r->pos = 0;
+	r->first = TRUE;
+	if (e->flags & le16_to_cpu(ATTR_COMPRESSION_MASK)) {
+		/* Compressed runs are decompressed by the library. */
+		r->ni = ntfs_inode_open(ctx->vol, e->owner);
+		if (r->ni)
+			r->na = ntfs_attr_open(r->ni, AT_DATA,
+					(ntfschar*)dedup_extent_name(e),
+					e->name_len);
+		if (!r->na) {
+			ntfs_log_perror("Failed to open stream %llu",
+					(unsigned long long)MREF(e->owner));
+			if (r->ni)
+				ntfs_inode_close(r->ni);
+			r->ni = NULL;
+			ctx->nr_failed++;
+			return 1;
+		}
+		r->data_end = r->size;
+		ctx->nr_compressed++;
+	} else {
+		r->rl = dedup_stream_rl(ctx, st);
+		if (!r->rl) {
+			if (errno != EIO)
+				return -1;
+			ntfs_log_error("Stream %llu has a gap in its "
+					"runlist.\n",
+					(unsigned long long)MREF(e->owner));
+			ctx->nr_failed++;
+			return 1;
+		}
+	}
+	r->open = TRUE;
+	return 0;
+}
+
+/**
+ * dedup_stream_close - finish reading a stream
+ * @ctx:	state of the report
+ */
+static void dedup_stream_close(dedup_ctx *ctx)
+{
+	dedup_reader *r = &ctx->reader;
+
+	free(r->rl);
+	r->rl = NULL;
+	if (r->na)
+		ntfs_attr_close(r->na);
+	r->na = NULL;
+	if (r->ni)
+		ntfs_inode_close(r->ni);
+	r->ni = NULL;
+	r->open = FALSE;
+	r->stream++;
+}
+
+/**
+ * dedup_read - read data of the current stream
+ * @ctx:	state of the report
+ * @buf:	buffer to read into
+ * @count:	most bytes to read
+ * @hole:	if the data at the current position is a hole, its byte size is
+ *		returned here, else 0
+ *
+ * Reads go straight to the device, one run at a time, and never cross into a
+ * hole.  The position is not advanced.
+ *
+ * Return the number of bytes read into @buf and -1 with errno set on error.
+ */
+static s64 dedup_read(dedup_ctx *ctx, u8 *buf, s64 count, s64 *hole)
+{
+	dedup_reader *r = &ctx->reader;
+	const u8 bits = ctx->vol->cluster_size_bits;
+	const runlist_element *rle;
+	s64 end, br;
+
+	*hole = 0;
+	if (count > r->data_end - r->pos)
+		count = r->data_end - r->pos;
+	if (r->na) {
+		br = ntfs_attr_pread(r->na, r->pos, count, buf);
+		if (br != count)
+			goto err;
+		return br;
+	}
+	for (rle = r->rl; rle->length && (rle->vcn + rle->length) << bits <=
+			r->pos; rle++)
+		;
+	/* Data past the last run is as good as a hole. */
+	if (!rle->length || rle->lcn < 0) {
+		end = rle->length ? (rle->vcn + rle->length) << bits :
+				r->data_end;
+		*hole = (end < r->data_end ? end : r->data_end) - r->pos;
+		return 0;
+	}
+	end = (rle->vcn + rle->length) << bits;
+	if (count > end - r->pos)
+		count = end - r->pos;
+	br = ntfs_pread(ctx->vol->dev, (rle->lcn << bits) + r->pos -
+			(rle->vcn << bits), count, buf);
+	if (br == count)
+		return br;
+err:
+	if (br >= 0)
+		errno = EIO;
+	ntfs_log_perror("Failed to read stream %llu at offset %lld",
+			(unsigned long long)MREF(ctx->streams[ctx->order[
+			r->stream]].ext[0]->owner), (long long)r->pos);
+	return -1;
+}
+
+/**
+ * dedup_chunk_len - find the end of the chunk at the start of some data
+ * @ctx:	state of the report
+ * @p:		the data
+ * @len:	bytes of data at @p
+ * @final:	no data follows @p + @len
+ *
+ * Content defined chunks end where a gear hash of the last bytes has enough
+ * zero bits, after at least half and at most four times the average size.
+ *
+ * Return the byte size of the chunk, or 0 if more data is needed to find its
+ * end.
+ */
+static u32 dedup_chunk_len(dedup_ctx *ctx, const u8 *p, u32 len,
+		BOOL final)
+{
+	const u32 avg = opts.chunk_size, max = 4 * avg;
+	const u64 mask = avg / 2 - 1;
+	u32 i, n;
+	u64 h = 0;
+
+	if (opts.fixed) {
+		if (len >= avg)
+			return avg;
+		return final ? len : 0;
+	}
+	n = len < max ? len : max;
+	for (i = avg / 2; i < n; i++) {
+		h = (h << 1) + ctx->gear[p[i]];
+		if (!(h & mask))
+			return i + 1;
+	}
+	if (n == max || final)
+		return n;
+	return 0;
+}
+
+/**
+ * dedup_fill - fill a job with the next piece of data
+ * @ctx:	state of the report
+ * @job:	the job
+ *
+ * A job holds data of a single stream, up to the next hole.  The data is cut
+ * into chunks, and whatever is left after the last whole chunk is carried
+ * over to the next job.
+ *
+ * Return 1 if @job was filled, 0 if there is no data left and -1 with errno
+ * set on error.
+ */
+static int dedup_fill(dedup_ctx *ctx, dedup_job *job)
+{
+	dedup_reader *r = &ctx->reader;
+	BOOL seg_end = FALSE;
+	u32 done, n;
+	int err;
+
+	while (!r->open) {
+		if (r->stream >= ctx->nr_streams)
+			return 0;
+		err = dedup_stream_open(ctx);
+		if (err < 0)
+			return -1;
+		if (err)
+			r->stream++;
+	}
+	job->stream = ctx->order[r->stream];
+	job->first = r->first;
+	job->last = FALSE;
+	job->hole = job->hole_after = 0;
+	r->first = FALSE;
+	memcpy(job->buf, r->carry, r->carry_len);
+	job->len = r->carry_len;
+	r->carry_len = 0;
+	while (job->len < DEDUP_JOB_SIZE && r->pos < r->data_end) {
+		s64 br, hole;
+
+		br = dedup_read(ctx, job->buf + job->len, DEDUP_JOB_SIZE -
+				job->len, &hole);
+		if (br < 0)
+			return -1;
+		if (hole) {
+			/* A hole ends the data of a job. */
+			if (job->len) {
+				seg_end = TRUE;
+				break;
+			}
+			job->hole += hole;
+			r->pos += hole;
+			continue;
+		}
+		job->len += br;
+		r->pos += br;
+	}
+	if (r->pos >= r->data_end) {
+		seg_end = TRUE;
+		job->last = TRUE;
+		job->hole_after = r->size - r->data_end;
+	}
+	job->nr_chunks = 0;
+	for (done = 0; done < job->len; done += n) {
+		n = dedup_chunk_len(ctx, job->buf + done, job->len - done,
+				seg_end);
+		if (!n)
+			break;
+		job->chunk_len[job->nr_chunks++] = n;
+	}
+	r->carry_len = job->len - done;
+	memcpy(r->carry, job->buf + done, r->carry_len);
+	job->len = done;
+	if (job->last)
+		dedup_stream_close(ctx);
+	return 1;
+}
+
+/**
+ * dedup_worker - body of a worker thread
+ * @arg:	state of the report
+ *
+ * Hash the chunks of the jobs in the order they were filled until told to
+ * stop.
+ */
+static void *dedup_worker(void *arg)
+{
+	dedup_ctx *ctx = arg;
+	dedup_job *job;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (;;) {
+		u32 i, ofs;
+
+		while (!ctx->stop && ctx->next == ctx->nr_filled)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		if (ctx->next == ctx->nr_filled)
+			break;
+		job = &ctx->jobs[ctx->next++ % ctx->nr_jobs];
+		job->state = DEDUP_JOB_BUSY;
+		pthread_mutex_unlock(&ctx->lock);
+		for (i = ofs = 0; i < job->nr_chunks; ofs +=
+				job->chunk_len[i++]) {
+			dedup_sha256 s;
+
+			dedup_sha256_init(&s);
+			dedup_sha256_update(&s, job->buf + ofs,
+					job->chunk_len[i]);
+			dedup_sha256_final(&s, job->hashes[i]);
+		}
+		pthread_mutex_lock(&ctx->lock);
+		job->state = DEDUP_JOB_DONE;
+		pthread_cond_broadcast(&ctx->cond);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
+}
+
+/**
+ * dedup_hash_hole - add a hole to the hash of the current stream
+ * @ctx:	state of the report
+ * @len:	byte size of the hole
+ */
+static void dedup_hash_hole(dedup_ctx *ctx, s64 len)
+{
+	u8 entry[DEDUP_HASH_SIZE + sizeof(le64)];
+	const le64 l = cpu_to_le64(len);
+
+	memset(entry, 0, DEDUP_HASH_SIZE);
+	memcpy(entry + DEDUP_HASH_SIZE, &l, sizeof(l));
+	dedup_sha256_update(&ctx->file_hash, entry, sizeof(entry));
+	ctx->sparse_bytes += len;
+}
+
+/**
+ * dedup_account - account for the chunks of a hashed job
+ * @ctx:	state of the report
+ * @job:	the job
+ *
+ * Called for the jobs in the order they were filled.  Spills the chunk
+ * hashes to their partitions and adds them to the hash of the stream.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_account(dedup_ctx *ctx, dedup_job *job)
+{
+	u32 i;
+
+	if (job->first) {
+		dedup_sha256_init(&ctx->file_hash);
+		ctx->file_bytes = 0;
+	}
+	if (job->hole)
+		dedup_hash_hole(ctx, job->hole);
+	for (i = 0; i < job->nr_chunks; i++) {
+		u8 entry[DEDUP_HASH_SIZE + sizeof(le64)];
+		const le64 l = cpu_to_le64(job->chunk_len[i]);
+		dedup_record rec;
+		FILE *part;
+
+		memcpy(rec.hash, job->hashes[i], DEDUP_HASH_SIZE);
+		rec.len = cpu_to_le32(job->chunk_len[i]);
+		part = ctx->parts[(rec.hash[0] | rec.hash[1] << 8) %
+				ctx->nr_parts];
+		if (fwrite(&rec, sizeof(rec), 1, part) != 1)
+			return -1;
+		memcpy(entry, rec.hash, DEDUP_HASH_SIZE);
+		memcpy(entry + DEDUP_HASH_SIZE, &l, sizeof(l));
+		dedup_sha256_update(&ctx->file_hash, entry, sizeof(entry));
+		ctx->file_bytes += job->chunk_len[i];
+	}
+	ctx->nr_chunks += job->nr_chunks;
+	if (job->hole_after)
+		dedup_hash_hole(ctx, job->hole_after);
+	if (job->last) {
+		dedup_digest *d = ctx->digests + ctx->nr_digests++;
+
+		dedup_sha256_final(&ctx->file_hash, d->hash);
+		d->bytes = ctx->file_bytes;
+		d->stream = job->stream;
+		ctx->data_bytes += ctx->file_bytes;
+		if (opts.verbose) {
+			dedup_stream_name(ctx->streams + job->stream, stdout);
+			printf(": %lld bytes\n", (long long)d->bytes);
+		}
+	}
+	return 0;
+}
+
+/**
+ * dedup_read_all - read and hash all the streams
+ * @ctx:	state of the report
+ * @nr_threads:	number of worker threads to hash on
+ *
+ * The calling thread fills the jobs and accounts for them once hashed, the
+ * workers hash them.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_read_all(dedup_ctx *ctx, int nr_threads)
+{
+	pthread_t *threads;
+	s64 nr_done = 0;
+	BOOL eof = FALSE;
+	int nr_started, err = 0;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (nr_started = 0; nr_started < nr_threads; nr_started++) {
+		err = pthread_create(&threads[nr_started], NULL,
+				dedup_worker, ctx);
+		if (err) {
+			ntfs_log_error("Failed to start worker thread: %s\n",
+					strerror(err));
+			break;
+		}
+	}
+	/* Carry on with fewer workers if at least one started. */
+	if (nr_started)
+		err = 0;
+	pthread_mutex_lock(&ctx->lock);
+	while (!err) {
+		dedup_job *job = &ctx->jobs[nr_done % ctx->nr_jobs];
+		int ret;
+
+		if (nr_done < ctx->nr_filled &&
+				job->state == DEDUP_JOB_DONE) {
+			pthread_mutex_unlock(&ctx->lock);
+			if (dedup_account(ctx, job))
+				err = errno ? errno : EIO;
+			pthread_mutex_lock(&ctx->lock);
+			job->state = DEDUP_JOB_FREE;
+			nr_done++;
+			continue;
+		}
+		if (eof && nr_done == ctx->nr_filled)
+			break;
+		job = &ctx->jobs[ctx->nr_filled % ctx->nr_jobs];
+		if (eof || job->state != DEDUP_JOB_FREE) {
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+			continue;
+		}
+		/* Only this thread touches free jobs, fill unlocked. */
+		pthread_mutex_unlock(&ctx->lock);
+		ret = dedup_fill(ctx, job);
+		pthread_mutex_lock(&ctx->lock);
+		if (ret < 0)
+			err = errno ? errno : EIO;
+		else if (!ret)
+			eof = TRUE;
+		else {
+			job->state = DEDUP_JOB_READY;
+			ctx->nr_filled++;
+			pthread_cond_broadcast(&ctx->cond);
+		}
+	}
+	ctx->stop = TRUE;
+	/* On error, make sure the workers do not pick up any more jobs. */
+	if (err)
+		ctx->nr_filled = ctx->next;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+	while (nr_started > 0)
+		pthread_join(threads[--nr_started], NULL);
+	free(threads);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+static int dedup_record_cmp(const void *p1, const void *p2)
+{
+	return memcmp(p1, p2, sizeof(dedup_record));
+}
+
+/**
+ * dedup_count - count the duplicate chunks
+ * @ctx:	state of the report
+ *
+ * Each partition in turn is read back and sorted by hash.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_count(dedup_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->nr_parts; i++) {
+		FILE *part = ctx->parts[i];
+		dedup_record *recs;
+		s64 nr, j, k;
+		off_t size;
+
+		if (fflush(part) || fseeko(part, 0, SEEK_END))
+			return -1;
+		size = ftello(part);
+		if (size <= 0)
+			continue;
+		nr = size / sizeof(*recs);
+		recs = malloc(size);
+		if (!recs) {
+			errno = ENOMEM;
+			return -1;
+		}
+		rewind(part);
+		if (fread(recs, sizeof(*recs), nr, part) != (size_t)nr) {
+			if (!errno)
+				errno = EIO;
+			free(recs);
+			return -1;
+		}
+		qsort(recs, nr, sizeof(*recs), dedup_record_cmp);
+		for (j = 0; j < nr; j = k) {
+			for (k = j + 1; k < nr && !dedup_record_cmp(recs + j,
+					recs + k); k++)
+				;
+			ctx->nr_unique++;
+			ctx->unique_bytes += le32_to_cpu(recs[j].len);
+		}
+		free(recs);
+	}
+	return 0;
+}
+
+static int dedup_digest_cmp(const void *p1, const void *p2)
+{
+	const dedup_digest *d1 = p1, *d2 = p2;
+	int cmp = memcmp(d1->hash, d2->hash, DEDUP_HASH_SIZE);
+
+	if (cmp)
+		return cmp;
+	if (d1->bytes != d2->bytes)
+		return d1->bytes < d2->bytes ? -1 : 1;
+	return d1->stream < d2->stream ? -1 : d1->stream > d2->stream;
+}
+
+/**
+ * struct dedup_group - streams with identical content
+ * @first:	index of the first of them in dedup_ctx.digests
+ * @nr:		number of them
+ * @wasted:	bytes taken up by all but one of them
+ */
+typedef struct {
+	s64 first;
+	s64 nr;
+	s64 wasted;
+} dedup_group;
+
+static int dedup_group_cmp(const void *p1, const void *p2)
+{
+	const dedup_group *g1 = p1, *g2 = p2;
+
+	if (g1->wasted != g2->wasted)
+		return g1->wasted > g2->wasted ? -1 : 1;
+	return g1->first < g2->first ? -1 : g1->first > g2->first;
+}
+
+/**
+ * dedup_report - print what was found
+ * @ctx:	state of the report
+ * @secs:	seconds the streams took to read
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_report(dedup_ctx *ctx, double secs)
+{
+	const s64 dup_bytes = ctx->data_bytes - ctx->unique_bytes;
+	dedup_group *groups;
+	s64 nr_groups = 0, wasted = 0, i, j;
+
+	qsort(ctx->digests, ctx->nr_digests, sizeof(*ctx->digests),
+			dedup_digest_cmp);
+	groups = malloc((ctx->nr_digests / 2 + 1) * sizeof(*groups));
+	if (!groups) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < ctx->nr_digests; i = j) {
+		for (j = i + 1; j < ctx->nr_digests && !memcmp(
+				ctx->digests[i].hash, ctx->digests[j].hash,
+				DEDUP_HASH_SIZE) && ctx->digests[i].bytes ==
+				ctx->digests[j].bytes; j++)
+			;
+		if (j - i < 2 || !ctx->digests[i].bytes)
+			continue;
+		groups[nr_groups].first = i;
+		groups[nr_groups].nr = j - i;
+		groups[nr_groups].wasted = (j - i - 1) *
+				ctx->digests[i].bytes;
+		wasted += groups[nr_groups++].wasted;
+	}
+	qsort(groups, nr_groups, sizeof(*groups), dedup_group_cmp);
+
+	printf("Streams: %lld read, %lld compressed, %lld encrypted left out, "
+			"%lld failed.\n", (long long)ctx->nr_digests,
+			(long long)ctx->nr_compressed,
+			(long long)ctx->nr_encrypted,
+			(long long)ctx->nr_failed);
+	printf("Data: %lld bytes in %lld %s chunks of %u bytes on average, "
+			"%lld bytes of holes skipped.\n",
+			(long long)ctx->data_bytes, (long long)ctx->nr_chunks,
+			opts.fixed ? "fixed size" : "content defined",
+			ctx->nr_chunks ? (unsigned)(ctx->data_bytes /
+			ctx->nr_chunks) : 0, (long long)ctx->sparse_bytes);
+	printf("Unique: %lld bytes in %lld chunks.\n",
+			(long long)ctx->unique_bytes,
+			(long long)ctx->nr_unique);
+	printf("Duplicate: %lld bytes, %.1f%% of the data.\n",
+			(long long)dup_bytes, ctx->data_bytes ? 100.0 *
+			dup_bytes / ctx->data_bytes : 0.0);
+	printf("Identical streams: %lld groups, %lld bytes in all but one "
+			"stream of each.\n", (long long)nr_groups,
+			(long long)wasted);
+	for (i = 0; i < nr_groups && i < opts.nr_groups; i++) {
+		const dedup_group *g = groups + i;
+
+		printf("  %lld bytes: %lld streams of %lld bytes:",
+				(long long)g->wasted, (long long)g->nr,
+				(long long)ctx->digests[g->first].bytes);
+		for (j = 0; j < g->nr && j < DEDUP_GROUP_FILES; j++) {
+			putchar(' ');
+			dedup_stream_name(ctx->streams +
+					ctx->digests[g->first + j].stream,
+					stdout);
+		}
+		if (g->nr > DEDUP_GROUP_FILES)
+			printf(" and %lld more", (long long)(g->nr -
+					DEDUP_GROUP_FILES));
+		putchar('\n');
+	}
+	printf("Read %lld bytes in %.3f seconds", (long long)ctx->data_bytes,
+			secs);
+	if (secs > 0)
+		printf(", %.1f MiB/s", ctx->data_bytes / secs /
+				(1024 * 1024));
+	printf(".\n");
+	free(groups);
+	return 0;
+}
+
+/**
+ * dedup_parts_open - create the partitions the chunk hashes are spilled to
+ * @ctx:	state of the report
+ * @bytes:	bytes of clusters the streams use
+ *
+ * There are enough partitions for each to fit into the memory given with
+ * -m, counting the smallest chunks possible.  The files are unlinked right
+ * away, so they go away however the program ends.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_parts_open(dedup_ctx *ctx, s64 bytes)
+{
+	const u32 min = opts.fixed ? opts.chunk_size : opts.chunk_size / 2;
+	const s64 nr_recs = bytes / min + ctx->nr_streams;
+	char path[PATH_MAX];
+	int fd;
+
+	ctx->nr_parts = nr_recs * (s64)sizeof(dedup_record) / opts.memory + 1;
+	if (ctx->nr_parts > DEDUP_MAX_PARTITIONS)
+		ctx->nr_parts = DEDUP_MAX_PARTITIONS;
+	ctx->parts = calloc(ctx->nr_parts, sizeof(*ctx->parts));
+	if (!ctx->parts) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (fd = 0; fd < ctx->nr_parts; fd++) {
+		int tfd;
+
+		snprintf(path, sizeof(path), "%s/%s.XXXXXX", opts.tmpdir,
+				EXEC_NAME);
+		tfd = mkstemp(path);
+		if (tfd < 0) {
+			ntfs_log_perror("Failed to create a file in %s",
+					opts.tmpdir);
+			return -1;
+		}
+		unlink(path);
+		ctx->parts[fd] = fdopen(tfd, "w+");
+		if (!ctx->parts[fd]) {
+			close(tfd);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * dedup_jobs_alloc - allocate the ring of jobs
+ * @ctx:	state of the report
+ * @nr_threads:	number of worker threads
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int dedup_jobs_alloc(dedup_ctx *ctx, int nr_threads)
+{
+	const u32 min = opts.fixed ? opts.chunk_size : opts.chunk_size / 2;
+	const u32 nr_chunks = DEDUP_JOB_SIZE / min + 1;
+	int i;
+
+	/* Two jobs per worker keep the reads ahead of the hashing. */
+	ctx->nr_jobs = 2 * nr_threads + 1;
+	ctx->jobs = calloc(ctx->nr_jobs, sizeof(*ctx->jobs));
+	ctx->reader.carry = malloc(4 * opts.chunk_size);
+	ctx->digests = malloc((ctx->nr_streams + 1) * sizeof(*ctx->digests));
+	if (!ctx->jobs || !ctx->reader.carry || !ctx->digests) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < ctx->nr_jobs; i++) {
+		dedup_job *job = ctx->jobs + i;
+
+		job->buf = malloc(DEDUP_JOB_SIZE);
+		job->chunk_len = malloc(nr_chunks * sizeof(*job->chunk_len));
+		job->hashes = malloc(nr_chunks * sizeof(*job->hashes));
+		if (!job->buf || !job->chunk_len || !job->hashes) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * dedup_gear_init - fill in the random values of the chunking
+ * @ctx:	state of the report
+ *
+ * The values are fixed, so the same data is always cut the same way.
+ */
+static void dedup_gear_init(dedup_ctx *ctx)
+{
+	u64 x = 0x9e3779b97f4a7c15ULL;
+	int i;
+
+	/* splitmix64 */
+	for (i = 0; i < 256; i++) {
+		u64 z = (x += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		ctx->gear[i] = z ^ (z >> 31);
+	}
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  Success, the program worked
+ *	    1  Error, something went wrong
+ */
+int main(int argc, char *argv[])
+{
+	ntfs_mft_scan_opts scan_opts;
+	struct timeval start, end;
+	unsigned long mnt_flags;
+	dedup_ctx ctx;
+	dedup_block *b;
+	s64 bytes;
+	int i, nr_threads, ret = EXIT_FAILURE;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	if (ntfs_check_if_mounted(opts.device, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	nr_threads = opts.nr_threads;
+	if (!nr_threads) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_threads = cpus > 0 ? cpus : 1;
+	}
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	dedup_gear_init(&ctx);
+	ctx.vol = ntfs_mount(opts.device, MS_RDONLY);
+	if (!ctx.vol) {
+		ntfs_log_perror("Failed to mount %s", opts.device);
+		goto free;
+	}
+	memset(&scan_opts, 0, sizeof(scan_opts));
+	scan_opts.nr_threads = nr_threads;
+	scan_opts.extents = TRUE;
+	scan_opts.out_fd = -1;
+	scan_opts.fn = dedup_scan;
+	scan_opts.out_fn = dedup_out;
+	scan_opts.data = &ctx;
+	if (ntfs_mft_scan(ctx.vol, &scan_opts, NULL)) {
+		ntfs_log_perror("Failed to scan the mft of %s", opts.device);
+		goto umount;
+	}
+	if (dedup_streams_build(&ctx, &bytes) ||
+			dedup_jobs_alloc(&ctx, nr_threads) ||
+			dedup_parts_open(&ctx, bytes)) {
+		ntfs_log_perror("Failed to set up");
+		goto umount;
+	}
+	gettimeofday(&start, NULL);
+	if (dedup_read_all(&ctx, nr_threads)) {
+		ntfs_log_perror("Failed to read the data");
+		goto umount;
+	}
+	gettimeofday(&end, NULL);
+	if (dedup_count(&ctx)) {
+		ntfs_log_perror("Failed to count the duplicate chunks");
+		goto umount;
+	}
+	if (dedup_report(&ctx, (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1000000.0)) {
+		ntfs_log_perror("Failed to report");
+		goto umount;
+	}
+	ret = EXIT_SUCCESS;
+umount:
+	if (ctx.reader.open)
+		dedup_stream_close(&ctx);
+	if (ntfs_umount(ctx.vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.device);
+		ret = EXIT_FAILURE;
+	}
+free:
+	for (i = 0; i < ctx.nr_parts; i++)
+		if (ctx.parts[i])
+			fclose(ctx.parts[i]);
+	free(ctx.parts);
+	for (i = 0; ctx.jobs && i < ctx.nr_jobs; i++) {
+		free(ctx.jobs[i].buf);
+		free(ctx.jobs[i].chunk_len);
+		free(ctx.jobs[i].hashes);
+	}
+	free(ctx.jobs);
+	free(ctx.reader.carry);
+	free(ctx.digests);
+	free(ctx.order);
+	free(ctx.streams);
+	free(ctx.extents);
+	while (ctx.blocks) {
+		b = ctx.blocks;
+		ctx.blocks = b->next;
+		free(b);
+	}
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+	return ret;
+}
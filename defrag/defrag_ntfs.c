@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code as
+ * defined in and that are subject to the Apple Public Source License Version
+ * 2.0 (the 'License'). You may not use this file except in compliance with the
+ * License.
+ *
+ * Please obtain a copy of the License at http://www.opensource.apple.com/apsl/
+ * and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT. Please see the
+ * License for the specific language governing rights and limitations under the
+ * License.
+ */
+
+#include <sys/fsctl.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "ntfs.h"
+#include "ntfs_types.h"
+
+static void usage(const char *progname) __attribute__((noreturn));
+static void usage(const char *progname)
+{
+	errx(EX_USAGE, "usage: %s [-nq] file ...", progname);
+}
+
+/**
+ * defrag_file - defragment a single file
+ * @path:	path of the file to defragment
+ * @flags:	NTFS_DEFRAG_* flags to pass to the kernel
+ * @quiet:	if true do not print anything on success
+ *
+ * Ask the kernel to defragment the file @path, which must reside on a mounted
+ * ntfs volume, and print the number of extents before and after.
+ *
+ * Return 0 on success and -1 on error.
+ */
+static int defrag_file(const char *path, u32 flags, int quiet)
+{
+	struct statfs sfs;
+	ntfs_defrag_args args;
+
+	if (statfs(path, &sfs)) {
+		warn("%s", path);
+		return -1;
+	}
+	if (strcmp(sfs.f_fstypename, "ntfs")) {
+		warnx("%s: not on an NTFS volume", path);
+		return -1;
+	}
+	memset(&args, 0, sizeof(args));
+	args.flags = flags;
+	if (fsctl(path, NTFS_IOC_DEFRAG, &args, 0)) {
+		warn("%s", path);
+		return -1;
+	}
+	if (quiet)
+		return 0;
+	if (flags & NTFS_DEFRAG_COUNT_ONLY)
+		printf("%s: %u extent%s\n", path, args.nr_extents,
+				args.nr_extents == 1 ? "" : "s");
+	else if (args.new_nr_extents == args.nr_extents)
+		printf("%s: %u extent%s, unchanged\n", path, args.nr_extents,
+				args.nr_extents == 1 ? "" : "s");
+	else
+		printf("%s: %u extents -> %u extent%s\n", path,
+				args.nr_extents, args.new_nr_extents,
+				args.new_nr_extents == 1 ? "" : "s");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *progname;
+	u32 flags = 0;
+	int ch, quiet = 0, ret = 0;
+
+	progname = argv[0];
+	while ((ch = getopt(argc, argv, "nq")) != -1) {
+		switch (ch) {
+		case 'n':
+			flags |= NTFS_DEFRAG_COUNT_ONLY;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage(progname);
+	for (; argc > 0; argc--, argv++) {
+		if (defrag_file(*argv, flags, quiet))
+			ret = 1;
+	}
+	exit(ret);
+}
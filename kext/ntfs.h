@@ -165,4 +165,98 @@ typedef struct {
 	// TODO: Add NTFS specific mount options here.
 } __attribute__((__packed__)) ntfs_mount_options_1_0;
 
+#include <sys/ioccom.h>
+
+/*
+ * The argument of the NTFS_IOC_DEFRAG fsctl which defragments the data of a
+ * regular file or named stream.
+ */
+typedef struct {
+	u32 flags;		/* NTFS_DEFRAG_* flags (in). */
+	u32 nr_extents;		/* Number of extents beforehand (out). */
+	u32 new_nr_extents;	/* Number of extents afterwards (out). */
+	u32 reserved;		/* Must be zero. */
+} ntfs_defrag_args;
+
+/*
+ * The currently defined flags for the ntfs_defrag_args structure.
+ */
+enum {
+	/* Only report the number of extents, do not move any data. */
+	NTFS_DEFRAG_COUNT_ONLY	= 0x00000001,
+};
+
+/*
+ * A single extent as returned by the NTFS_IOC_GET_EXTENTS fsctl.  All
+ * offsets and lengths are in bytes.  @physical is the byte offset on the
+ * volume or -1 if the extent has no physical location, i.e. it is sparse or
+ * resident.
+ */
+typedef struct {
+	s64 logical;		/* Byte offset in the file. */
+	s64 physical;		/* Byte offset on the volume or -1. */
+	s64 length;		/* Length of the extent in bytes. */
+	u32 flags;		/* NTFS_EXTENT_* flags. */
+	u32 reserved;		/* Zero. */
+} ntfs_extent;
+
+/*
+ * The currently defined flags for the ntfs_extent structure.
+ */
+enum {
+	/* This is the last extent of the file. */
+	NTFS_EXTENT_LAST	= 0x00000001,
+	/* Sparse region, no clusters are allocated and it reads as zeroes. */
+	NTFS_EXTENT_SPARSE	= 0x00000002,
+	/*
+	 * The clusters belong to a compressed attribute thus they may contain
+	 * compressed data and cannot be accessed directly.
+	 */
+	NTFS_EXTENT_COMPRESSED	= 0x00000004,
+	/* The clusters contain encrypted data. */
+	NTFS_EXTENT_ENCRYPTED	= 0x00000008,
+	/*
+	 * The clusters are allocated but lie beyond the initialized size thus
+	 * the region reads as zeroes whatever is on disk.
+	 */
+	NTFS_EXTENT_UNWRITTEN	= 0x00000010,
+	/* The data is resident in the mft record. */
+	NTFS_EXTENT_RESIDENT	= 0x00000020,
+};
+
+/*
+ * The argument of the NTFS_IOC_GET_EXTENTS fsctl which returns the physical
+ * layout of the data of a file in a single call.
+ *
+ * The extents overlapping the byte range starting at @start and @length
+ * bytes long are copied to the array of @extent_count ntfs_extent structures
+ * at the user space address @extents and their number is returned in
+ * @nr_extents.  If @extent_count is zero, the extents are only counted and
+ * @extents is ignored.  If the array is too small, call again with @start set
+ * to the end of the last returned extent.
+ */
+typedef struct {
+	s64 start;		/* Byte offset to start at (in). */
+	s64 length;		/* Number of bytes to map (in). */
+	u32 flags;		/* NTFS_EXTENTS_* flags (in). */
+	u32 extent_count;	/* Number of elements in @extents (in). */
+	u32 nr_extents;		/* Number of extents returned (out). */
+	u32 reserved;		/* Must be zero. */
+	u64 extents;		/* User space address of the array (in). */
+} ntfs_extents_args;
+
+/*
+ * The currently defined flags for the ntfs_extents_args structure.
+ */
+enum {
+	/* Write out dirty cached data before returning the extents. */
+	NTFS_EXTENTS_SYNC	= 0x00000001,
+};
+
+/*
+ * The NTFS specific fsctls, see fsctl(2).
+ */
+#define NTFS_IOC_DEFRAG		_IOWR('n', 1, ntfs_defrag_args)
+#define NTFS_IOC_GET_EXTENTS	_IOWR('n', 2, ntfs_extents_args)
+
 #endif /* !_OSX_NTFS_H */
@@ -909,6 +909,135 @@ errno_t ntfs_attr_find_in_mft_record(const ATTR_TYPE type,
 	return EIO;
 }
 
+/**
+ * ntfs_attr_list_index_cmp - compare an attribute list entry to a search key
+ * @vol:	ntfs volume the attribute list belongs to
+ * @al_entry:	attribute list entry to compare
+ * @type:	attribute type of the search key
+ * @name:	attribute name of the search key
+ * @name_len:	attribute name length of the search key
+ *
+ * Compare the type and the name, ignoring case, of the attribute list entry
+ * @al_entry to the search key @type, @name, and @name_len in the order in
+ * which attribute list entries are sorted.
+ *
+ * Return -1 if the search key collates before @al_entry, 0 if it matches, 1 if
+ * it collates after @al_entry, and 2 if @name contains characters which are
+ * invalid in names and thus the key cannot be collated.
+ */
+static int ntfs_attr_list_index_cmp(ntfs_volume *vol,
+		const ATTR_LIST_ENTRY *al_entry, const ATTR_TYPE type,
+		const ntfschar *name, const u32 name_len)
+{
+	if (al_entry->type != type)
+		return le32_to_cpu(type) < le32_to_cpu(al_entry->type) ? -1 : 1;
+	return ntfs_collate_names(name, name_len, (ntfschar*)((u8*)al_entry +
+			al_entry->name_offset), al_entry->name_length, 2, FALSE,
+			vol->upcase, vol->upcase_len);
+}
+
+/**
+ * ntfs_attr_list_index_find - find where to start an attribute list search
+ * @base_ni:	base ntfs inode whose attribute list to search
+ * @type:	attribute type to find
+ * @name:	attribute name to find
+ * @name_len:	attribute name length
+ * @lowest_vcn:	lowest vcn to find
+ *
+ * Use the index of the attribute list entries of the base ntfs inode @base_ni
+ * to binary search for the attribute list entry from which a linear search
+ * for the attribute @type, @name, @name_len, @lowest_vcn will find the same
+ * entry as a linear search from the start of the attribute list would.
+ *
+ * That is the first entry whose type and name, ignoring case, do not collate
+ * before the search key.  And if all the entries with that type and name
+ * have the exact same name, as is the case unless there are several named
+ * streams whose names only differ in case, the last of those whose lowest
+ * vcn is not greater than @lowest_vcn.
+ *
+ * Return the attribute list entry at which to start the search or NULL if the
+ * attribute list is too small to have an index or the index could not be
+ * built in which case the search should start at the beginning.
+ *
+ * Locking: Caller must have mapped the base mft record of @base_ni.
+ */
+static ATTR_LIST_ENTRY *ntfs_attr_list_index_find(ntfs_inode *base_ni,
+		const ATTR_TYPE type, const ntfschar *name, const u32 name_len,
+		const VCN lowest_vcn)
+{
+	ntfs_volume *vol = base_ni->vol;
+	ATTR_LIST_ENTRY *first, *last;
+	u8 *al = base_ni->attr_list;
+	u32 *idx;
+	unsigned lo, hi, mid, start, end;
+	int rc;
+
+	if (base_ni->attr_list_size < NTFS_ATTR_LIST_INDEX_MIN_SIZE)
+		return NULL;
+	if (!base_ni->attr_list_index_nr &&
+			ntfs_attr_list_index_build(base_ni))
+		return NULL;
+	idx = base_ni->attr_list_index;
+#define AL_ENTRY(i)	((ATTR_LIST_ENTRY*)(al + idx[i]))
+	/* Find the first entry not collating before the search key. */
+	lo = 0;
+	hi = base_ni->attr_list_index_nr;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		rc = ntfs_attr_list_index_cmp(vol, AL_ENTRY(mid), type, name,
+				name_len);
+		if (rc == 2)
+			return NULL;
+		if (rc > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	start = lo;
+	if (start == base_ni->attr_list_index_nr)
+		return (ATTR_LIST_ENTRY*)(al + base_ni->attr_list_size);
+	/* Find the first entry collating after the search key. */
+	hi = base_ni->attr_list_index_nr;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		rc = ntfs_attr_list_index_cmp(vol, AL_ENTRY(mid), type, name,
+				name_len);
+		if (rc == 2)
+			return NULL;
+		if (rc >= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	end = lo;
+	if (end - start < 2 || !lowest_vcn)
+		return AL_ENTRY(start);
+	/*
+	 * Only skip ahead by lowest vcn if all the matching entries have the
+	 * same name, i.e. they are all extents of the same attribute.
+	 */
+	first = AL_ENTRY(start);
+	last = AL_ENTRY(end - 1);
+	if (first->name_length != last->name_length || bcmp((u8*)first +
+			first->name_offset, (u8*)last + last->name_offset,
+			first->name_length << NTFSCHAR_SIZE_SHIFT))
+		return first;
+	/* Find the last entry whose lowest vcn is not above @lowest_vcn. */
+	lo = start;
+	hi = end;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sle64_to_cpu(AL_ENTRY(mid)->lowest_vcn) <= lowest_vcn)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > start)
+		lo--;
+	return AL_ENTRY(lo);
+#undef AL_ENTRY
+}
+
 /**
  * ntfs_attr_find_in_attribute_list - find an attribute in the attribute list
  * @type:	attribute type to find
@@ -1005,8 +1134,19 @@ static errno_t ntfs_attr_find_in_attribute_list(const ATTR_TYPE type,
 		goto not_found;
 	al_start = base_ni->attr_list;
 	al_end = al_start + base_ni->attr_list_size;
-	if (!ctx->al_entry)
-		ctx->al_entry = (ATTR_LIST_ENTRY*)al_start;
+	if (!ctx->al_entry) {
+		/*
+		 * When starting a search for a specific attribute, use the
+		 * attribute list index, if there is one, to skip all the
+		 * entries which cannot match.
+		 */
+		if (ctx->is_first && name)
+			ctx->al_entry = ntfs_attr_list_index_find(base_ni,
+					type, name, name == AT_UNNAMED ? 0 :
+					name_len, lowest_vcn);
+		if (!ctx->al_entry)
+			ctx->al_entry = (ATTR_LIST_ENTRY*)al_start;
+	}
 	/*
 	 * Iterate over entries in attribute list starting at @ctx->al_entry,
 	 * or the entry following that, depending on the value of
@@ -2696,6 +2836,7 @@ retry:
 				ni->attr_list_size - ((u8*)al_entry -
 				ni->attr_list));
 	ni->attr_list_size = new_al_size;
+	ntfs_attr_list_index_invalidate(ni);
 	/* Set up the attribute list entry. */
 	al_entry->type = type;
 	al_entry->length = cpu_to_le16(al_entry_len);
@@ -3987,8 +4128,6 @@ errno_t ntfs_attr_set_initialized_size(ntfs_inode *ni, s64 new_init_size)
 				a->value_length = cpu_to_le32(new_init_size);
 			}
 			data_size_updated = TRUE;
-			if (ni == base_ni && !S_ISDIR(ni->mode))
-				NInoSetDirtySizes(ni);
 		}
 		ni->initialized_size = new_init_size;
 	} else {
@@ -4005,6 +4144,13 @@ errno_t ntfs_attr_set_initialized_size(ntfs_inode *ni, s64 new_init_size)
 		a->initialized_size = cpu_to_sle64(new_init_size);
 	}
 	lck_spin_unlock(&ni->size_lock);
+	/*
+	 * Setting the DirtySizes flag puts the inode on the dirty inode list
+	 * which takes a mutex so do it only now that we have dropped the size
+	 * lock.
+	 */
+	if (data_size_updated && ni == base_ni && !S_ISDIR(ni->mode))
+		NInoSetDirtySizes(ni);
 	/*
 	 * If this is a directory B+tree index allocation attribute also update
 	 * the sizes in the base inode.
@@ -4933,6 +5079,7 @@ is_compressed:
 				base_ni->attr_list_size - ((u8*)al_entry -
 				base_ni->attr_list));
 	base_ni->attr_list_size = new_al_size;
+	ntfs_attr_list_index_invalidate(base_ni);
 	/* Set up the attribute extent and the attribute list entry. */
 	al_entry->type = a->type = ni->type;
 	al_entry->length = cpu_to_le16(al_entry_len);
@@ -5416,9 +5563,8 @@ map_vcn:
 		 * guaranteed as no-one knows about the allocated clusters yet
 		 * as we have not merged the runlists yet.
 		 *
-		 * FIXME: TODO: It may be worth restricting ntfs_rl_set() to
-		 * only operate up to the initialized size as it could
-		 * otherwise do a lot of unneeded extra work.
+		 * Only the part inside the initialized size needs zeroing as
+		 * the rest is never read from disk.
 		 */
 		if (vcn << vol->cluster_size_shift < initialized_size) {
 			ntfs_debug("Zeroing instantiated hole inside the "
@@ -5427,7 +5573,9 @@ map_vcn:
 				panic("%s(): !runlist.elements || "
 						"!runlist.alloc\n",
 						__FUNCTION__);
-			err = ntfs_rl_set(vol, runlist.rl, 0);
+			err = ntfs_rl_set(vol, runlist.rl, (initialized_size +
+					vol->cluster_size_mask) >>
+					vol->cluster_size_shift, 0);
 			if (err) {
 				ntfs_error(vol->mp, "Failed to zero newly "
 						"allocated space (error %d).",
@@ -7116,6 +7264,7 @@ skip_mpa_build:
 					base_ni->attr_list_size -
 					((u8*)al_entry - base_ni->attr_list));
 		base_ni->attr_list_size = new_al_size;
+		ntfs_attr_list_index_invalidate(base_ni);
 		/* Set up the attribute extent and the attribute list entry. */
 		al_entry->type = a->type = ni->type;
 		al_entry->length = cpu_to_le16(al_entry_len);
@@ -8783,6 +8932,94 @@ err:
 	return err;
 }
 
+/**
+ * ntfs_attr_set_direct - fill whole pages of an attribute directly on disk
+ * @ni:		ntfs inode describing the attribute to fill
+ * @ofs:	[IN/OUT] page aligned offset inside the attribute to start at
+ * @end:	page aligned offset inside the attribute at which to stop
+ * @val:	the unsigned 8-bit value with which to fill the attribute
+ *
+ * Fill the region from *@ofs to @end of the non-resident attribute described
+ * by the ntfs inode @ni with the constant byte @val by writing it straight to
+ * the clusters on disk via ntfs_dev_set(), i.e. without bringing any of the
+ * pages into the UBC.  Any pages of the region already cached in the UBC are
+ * discarded both before the write, so that no dirty page can be written on
+ * top of the filled clusters later, and after the write, so that no page
+ * read in whilst the write was in progress can be left stale.
+ *
+ * The attribute must not be compressed or encrypted as the clusters of such
+ * attributes do not hold the data as is.
+ *
+ * Sparse regions are skipped when @val is zero as they read as zero anyway.
+ *
+ * On return *@ofs is set to the offset up to which the attribute has been
+ * filled.  If this is not @end, the caller has to fill the remainder via the
+ * UBC.  This happens when a sparse region is encountered and @val is not zero
+ * as then clusters have to be allocated.
+ *
+ * Return 0 on success and errno on error.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @ni.
+ *	    - Caller must hold @ni->lock for reading or writing.
+ *	    - The runlist lock of @ni must not be held by the caller.
+ */
+static errno_t ntfs_attr_set_direct(ntfs_inode *ni, s64 *ofs, const s64 end,
+		const u8 val)
+{
+	s64 pos = *ofs;
+	ntfs_volume *vol = ni->vol;
+	errno_t err = 0;
+
+	ntfs_debug("Entering for ofs 0x%llx, end 0x%llx, val 0x%x.",
+			(unsigned long long)pos, (unsigned long long)end,
+			(unsigned)val);
+	if (NInoCompressed(ni) || NInoEncrypted(ni))
+		panic("%s(): Called for compressed or encrypted attribute.\n",
+				__FUNCTION__);
+	if (ubc_msync(ni->vn, pos, end, NULL, UBC_INVALIDATE))
+		ntfs_warning(vol->mp, "Failed to invalidate cached pages.");
+	lck_rw_lock_shared(&ni->rl.lock);
+	while (pos < end) {
+		s64 clusters, size;
+		LCN lcn;
+
+		lcn = ntfs_attr_vcn_to_lcn_nolock(ni, pos >>
+				vol->cluster_size_shift, FALSE, &clusters);
+		if (lcn < LCN_HOLE) {
+			err = (lcn == LCN_ENOMEM) ? ENOMEM : EIO;
+			ntfs_error(vol->mp, "Failed to map runlist (ofs "
+					"0x%llx, error %d).",
+					(unsigned long long)pos, err);
+			break;
+		}
+		size = (clusters << vol->cluster_size_shift) -
+				(pos & vol->cluster_size_mask);
+		if (size > end - pos)
+			size = end - pos;
+		if (lcn == LCN_HOLE) {
+			/* A hole needs allocating unless we are zeroing. */
+			if (val)
+				break;
+		} else {
+			OSIncrementAtomic(&ni->data_write_gen);
+			err = ntfs_dev_set(vol, (lcn <<
+					vol->cluster_size_shift) +
+					(pos & vol->cluster_size_mask), size,
+					val);
+			if (err)
+				break;
+		}
+		pos += size;
+	}
+	lck_rw_unlock_shared(&ni->rl.lock);
+	if (pos > *ofs && ubc_msync(ni->vn, *ofs, pos, NULL, UBC_INVALIDATE))
+		ntfs_warning(vol->mp, "Failed to invalidate cached pages.");
+	*ofs = pos;
+	ntfs_debug("Done (ofs 0x%llx, error %d).", (unsigned long long)pos,
+			err);
+	return err;
+}
+
 /**
  * ntfs_attr_set - fill (a part of) an attribute with a byte
  * @ni:		ntfs inode describing the attribute to fill
@@ -8794,10 +9031,15 @@ err:
  * byte offset @ofs inside the attribute with the constant byte @val.
  *
  * This function is effectively like memset() applied to an ntfs attribute.
- * Note this function actually only operates on the page cache pages belonging
- * to the ntfs attribute and it marks them dirty after doing the memset().
- * Thus it relies on the vm dirty page write code paths to cause the modified
- * pages to be written to the mft record/disk.
+ * Note this function mostly operates on the page cache pages belonging to the
+ * ntfs attribute and it marks them dirty after doing the memset().  Thus it
+ * relies on the vm dirty page write code paths to cause the modified pages to
+ * be written to the mft record/disk.
+ *
+ * The exception are large runs of whole pages of non-resident, non-mst
+ * protected, non-compressed, and non-encrypted attributes inside the
+ * initialized size.  These are written straight to disk by
+ * ntfs_attr_set_direct() bypassing the page cache.
  *
  * Return 0 on success and errno on error.  An error code of ESPIPE means that
  * @ofs + @cnt were outside the end of the attribute and no write was
@@ -8874,17 +9116,35 @@ errno_t ntfs_attr_set(ntfs_inode *ni, s64 ofs, const s64 cnt, const u8 val)
 			goto done;
 	}
 	/*
-	 * Do the whole pages the fast way.
-	 *
-	 * TODO: It may be possible to optimize this loop by creating a
-	 * sequence of large page lists by hand, mapping them, then running the
-	 * memset, then unmapping them and committing them.  This incurs a
-	 * higher cpu time because of the larger mapping required but incurs
-	 * many fewer calls into the ubc thus less locks will need to be taken
-	 * which may well speed things up a lot.  It will need to be
-	 * benchmarked to determine which is actually faster so leaving it the
-	 * easier way for now.
+	 * If there is a large enough run of whole pages inside the initialized
+	 * size, write it directly to disk.  Whatever cannot be done that way,
+	 * i.e. the part outside the initialized size or a part that needs
+	 * holes filling in, is done via the UBC below.  Compressed and
+	 * encrypted attributes are excluded as their clusters do not hold the
+	 * data as is.
 	 */
+	if (NInoNonResident(ni) && !NInoMstProtected(ni) &&
+			!NInoCompressed(ni) && !NInoEncrypted(ni) &&
+			end - ofs >= NTFS_ATTR_SET_DIRECT_MIN) {
+		s64 direct_end;
+
+		lck_spin_lock(&ni->size_lock);
+		direct_end = ni->initialized_size & ~PAGE_MASK_64;
+		lck_spin_unlock(&ni->size_lock);
+		if (direct_end > end)
+			direct_end = end;
+		if (direct_end - ofs >= NTFS_ATTR_SET_DIRECT_MIN) {
+			err = ntfs_attr_set_direct(ni, &ofs, direct_end, val);
+			if (err) {
+				ntfs_error(vol->mp, "Failed to fill "
+						"attribute directly on disk "
+						"(ofs 0x%llx, error %d).",
+						(unsigned long long)ofs, err);
+				return err;
+			}
+		}
+	}
+	/* Do the remaining whole pages the fast way. */
 	for (; ofs < end; ofs += PAGE_SIZE) {
 		/* Find or create the current page. */
 		err = ntfs_page_grab(ni, ofs, &upl, &pl, &kaddr, TRUE);
@@ -9096,3 +9356,802 @@ unm_err:
 err:
 	return err;
 }
+
+/**
+ * ntfs_rl_count_extents - count the physically contiguous extents of a runlist
+ * @rl:		runlist whose extents to count (can be NULL)
+ *
+ * Return the number of physically contiguous extents described by the runlist
+ * @rl, i.e. the number of times the data has to jump to a different position
+ * on disk.  Adjacent runs which happen to be contiguous on disk count as one
+ * extent and holes are not counted at all.
+ *
+ * Locking: The runlist must be locked on entry.
+ */
+static u32 ntfs_rl_count_extents(const ntfs_rl_element *rl)
+{
+	LCN next_lcn = LCN_HOLE;
+	u32 nr_extents = 0;
+
+	if (!rl)
+		return 0;
+	for (; rl->length; rl++) {
+		if (rl->lcn < 0)
+			continue;
+		if (rl->lcn != next_lcn)
+			nr_extents++;
+		next_lcn = rl->lcn + rl->length;
+	}
+	return nr_extents;
+}
+
+/**
+ * ntfs_attr_defrag_io - transfer a range of clusters described by a runlist
+ * @vol:	ntfs volume the clusters are on
+ * @rl:		cursor into the runlist describing the clusters
+ * @vcn:	first vcn to transfer
+ * @count:	number of clusters to transfer
+ * @buf:	buffer of at least @count clusters to transfer to/from
+ * @is_read:	if true read the clusters into @buf, otherwise write them
+ *
+ * Read or write the @count clusters starting at @vcn of the attribute
+ * described by the runlist cursor *@rl directly from/to disk.  *@rl must point
+ * to a runlist element at or before the one containing @vcn and is advanced so
+ * that a sequential pass over the attribute does not rescan the runlist from
+ * the start for every chunk.
+ *
+ * Return 0 on success and errno on error.
+ *
+ * Locking: The runlist must be fully mapped and must not change whilst we are
+ *	    running, i.e. it must either be locked or be a private copy.
+ */
+static errno_t ntfs_attr_defrag_io(ntfs_volume *vol, ntfs_rl_element **rl,
+		VCN vcn, s64 count, u8 *buf, const BOOL is_read)
+{
+	ntfs_rl_element *r = *rl;
+	errno_t err;
+
+	while (count > 0) {
+		s64 pos, size, clusters;
+
+		while (r->length && r[1].vcn <= vcn)
+			r++;
+		clusters = r->length - (vcn - r->vcn);
+		if (r->lcn < 0 || clusters <= 0)
+			panic("%s(): Unmapped or unallocated vcn 0x%llx.\n",
+					__FUNCTION__, (unsigned long long)vcn);
+		if (clusters > count)
+			clusters = count;
+		pos = (r->lcn + (vcn - r->vcn)) << vol->cluster_size_shift;
+		size = clusters << vol->cluster_size_shift;
+		if (is_read)
+			err = ntfs_dev_read(vol, pos, size, buf);
+		else
+			err = ntfs_dev_write(vol, pos, size, buf);
+		if (err)
+			return err;
+		buf += size;
+		vcn += clusters;
+		count -= clusters;
+	}
+	*rl = r;
+	return 0;
+}
+
+/**
+ * ntfs_attr_defrag - defragment a non-resident attribute
+ * @ni:			ntfs inode of the attribute to defragment
+ * @count_only:		if true only count the extents, do not move any data
+ * @nr_extents:		destination for the number of extents beforehand
+ * @new_nr_extents:	destination for the number of extents afterwards
+ *
+ * Move the data of the non-resident attribute described by the ntfs inode @ni
+ * into a freshly allocated, less fragmented set of clusters and release the
+ * old clusters.  On success *@nr_extents is set to the number of physically
+ * contiguous extents the attribute occupied beforehand and *@new_nr_extents to
+ * the number it occupies now.  If @count_only is true, or the attribute is not
+ * fragmented, or the allocator could not find a less fragmented set of free
+ * clusters, nothing is moved and both are the same.
+ *
+ * The data is copied in chunks of NTFS_DEFRAG_BUF_SIZE bytes with uncached
+ * device i/o (see ntfs_dev_read() and ntfs_dev_write()) which is fine as any
+ * dirty pages are pushed out first and the pages cached in the UBC remain
+ * valid as the data does not change.  Only the initialized part of the data
+ * is copied.  The copy is done without holding @ni->lock or the runlist lock,
+ * working off a private copy of the runlist, so that reads and pageins are not
+ * blocked for the duration.  Once it is done the locks are retaken and if the
+ * attribute was deleted, resized, its runlist changed, or its clusters were
+ * written to in the mean time (see @ni->data_write_gen) the new clusters are
+ * released and we return EAGAIN.
+ *
+ * The new runlist is then written into the base attribute extent, all other
+ * attribute extents are deleted, which in turn frees extent mft records that
+ * become empty and removes the attribute list attribute altogether when it is
+ * no longer needed, and finally the old clusters are released.  We cannot use
+ * ntfs_attr_mapping_pairs_update() for this as it is not implemented yet, so
+ * we build the mapping pairs array in place as ntfs_attr_resize() does.  The
+ * new array may well be larger than the part of the old one held in the base
+ * attribute extent, e.g. when the attribute used to span several extents, so
+ * if the base mft record does not have enough space for it we give up before
+ * modifying any metadata and return ENOSPC.
+ *
+ * Only normal attributes are supported at present, i.e. not compressed, not
+ * encrypted, and not sparse.  For those we return ENOTSUP unless @count_only
+ * is true.
+ *
+ * Return 0 on success and errno on error.
+ *
+ * Locking: Caller must not hold @ni->lock, @ni->rl.lock, or the mft record of
+ *	    the base inode as we need to call ubc_msync().  This function takes
+ *	    @ni->lock for writing (for reading if @count_only is true) and the
+ *	    runlist lock for writing, dropping both whilst copying the data.
+ */
+errno_t ntfs_attr_defrag(ntfs_inode *ni, const BOOL count_only,
+		u32 *nr_extents, u32 *new_nr_extents)
+{
+	VCN vcn, end_vcn, init_vcn;
+	s64 count, clusters, nr_freed;
+	ntfs_inode *base_ni;
+	ntfs_volume *vol = ni->vol;
+	ntfs_rl_element *old_rl, *src_rl, *dst_rl;
+	ntfs_attr_search_ctx *ctx;
+	MFT_RECORD *m;
+	ATTR_RECORD *a;
+	s8 *mp;
+	u8 *buf;
+	ntfs_rl_element *src_rl_copy;
+	ntfs_runlist runlist;
+	s64 allocated_size, initialized_size, data_size;
+	unsigned mp_size, old_alloc_count, src_elements;
+	errno_t err, err2;
+	LCN lcn;
+	u32 nr, new_nr;
+	SInt32 write_gen;
+	BOOL changed;
+	static const char es[] = "  Leaving inconsistent metadata.  Unmount "
+			"and run chkdsk.";
+
+	ntfs_debug("Entering for mft_no 0x%llx, type 0x%x%s.",
+			(unsigned long long)ni->mft_no,
+			(unsigned)le32_to_cpu(ni->type),
+			count_only ? ", counting only" : "");
+	base_ni = ni;
+	if (NInoAttr(ni))
+		base_ni = ni->base_ni;
+	*nr_extents = *new_nr_extents = nr = new_nr = 0;
+	if (!count_only) {
+		/*
+		 * Push out all dirty pages so the data on disk is current.
+		 * This cannot be done with the inode lock held.
+		 */
+		err = ubc_msync(ni->vn, 0, ubc_getsize(ni->vn), NULL,
+				UBC_PUSHDIRTY | UBC_SYNC);
+		if (err) {
+			ntfs_error(vol->mp, "ubc_msync() of data for mft_no "
+					"0x%llx failed (error %d).",
+					(unsigned long long)ni->mft_no, err);
+			return err;
+		}
+		/*
+		 * Taking the inode lock for writing excludes all writers as
+		 * well as pageout whilst we set up the copy.  We still need to
+		 * wait for any pageouts that raced with the above ubc_msync()
+		 * and are still in flight.  Writes that happen once we drop
+		 * the lock for the copy are caught by the data write
+		 * generation check below.
+		 */
+		lck_rw_lock_exclusive(&ni->lock);
+		vnode_waitforwrites(ni->vn, 0, 0, 0, "ntfs_attr_defrag");
+	} else
+		lck_rw_lock_shared(&ni->lock);
+	/* Do not allow messing with the inode once it has been deleted. */
+	if (NInoDeleted(ni)) {
+		err = ENOENT;
+		goto unl_done;
+	}
+	err = 0;
+	/* A resident attribute does not occupy any clusters. */
+	if (!NInoNonResident(ni))
+		goto unl_done;
+	if (!count_only && (NInoCompressed(ni) || NInoEncrypted(ni) ||
+			NInoSparse(ni))) {
+		ntfs_debug("Cannot defragment compressed, encrypted, or "
+				"sparse attributes.");
+		err = ENOTSUP;
+		goto unl_done;
+	}
+	lck_spin_lock(&ni->size_lock);
+	end_vcn = ni->allocated_size >> vol->cluster_size_shift;
+	init_vcn = (ni->initialized_size + vol->cluster_size_mask) >>
+			vol->cluster_size_shift;
+	lck_spin_unlock(&ni->size_lock);
+	lck_rw_lock_exclusive(&ni->rl.lock);
+	/* Map the whole runlist, checking for holes as we go. */
+	for (vcn = 0; vcn < end_vcn; vcn += clusters) {
+		lcn = LCN_RL_NOT_MAPPED;
+		if (ni->rl.elements)
+			lcn = ntfs_rl_vcn_to_lcn(ni->rl.rl, vcn, &clusters);
+		if (lcn == LCN_RL_NOT_MAPPED) {
+			err = ntfs_map_runlist_nolock(ni, vcn, NULL);
+			if (err) {
+				ntfs_error(vol->mp, "Failed to map runlist "
+						"fragment of mft_no 0x%llx "
+						"(error %d).", (unsigned long long)
+						ni->mft_no, err);
+				goto rl_unl_done;
+			}
+			clusters = 0;
+			continue;
+		}
+		if (lcn < LCN_HOLE || (lcn == LCN_HOLE && !count_only)) {
+			ntfs_error(vol->mp, "Runlist of mft_no 0x%llx is "
+					"corrupt.  Run chkdsk.",
+					(unsigned long long)ni->mft_no);
+			err = EIO;
+			goto rl_unl_done;
+		}
+	}
+	nr = new_nr = ntfs_rl_count_extents(ni->rl.elements ? ni->rl.rl :
+			NULL);
+	if (count_only || nr <= 1)
+		goto rl_unl_done;
+	/*
+	 * Allocate the new clusters.  The allocator gives us the fewest
+	 * extents it can find thus if that is no better than what we already
+	 * have give up without moving anything.
+	 */
+	runlist.rl = NULL;
+	runlist.alloc_count = runlist.elements = 0;
+	err = ntfs_cluster_alloc(vol, 0, end_vcn, -1, DATA_ZONE, TRUE,
+			&runlist);
+	if (err) {
+		if (err != ENOSPC)
+			ntfs_error(vol->mp, "Failed to allocate clusters to "
+					"defragment mft_no 0x%llx (error %d).",
+					(unsigned long long)ni->mft_no, err);
+		goto rl_unl_done;
+	}
+	new_nr = ntfs_rl_count_extents(runlist.rl);
+	if (new_nr >= nr) {
+		ntfs_debug("Could not find less fragmented free space (%u "
+				"extents vs %u).", (unsigned)new_nr,
+				(unsigned)nr);
+		new_nr = nr;
+		goto free_err;
+	}
+	/*
+	 * Build the new mapping pairs array now, so the only thing left to do
+	 * after the data has been copied is to copy it into place.
+	 */
+	err = ntfs_get_size_for_mapping_pairs(vol, runlist.rl, 0, -1,
+			&mp_size);
+	if (err) {
+		ntfs_error(vol->mp, "Failed to get size for mapping pairs "
+				"array (error %d).", err);
+		goto free_err;
+	}
+	mp = IOMallocData(mp_size);
+	if (!mp) {
+		err = ENOMEM;
+		goto free_err;
+	}
+	err = ntfs_mapping_pairs_build(vol, mp, mp_size, runlist.rl, 0, -1,
+			NULL);
+	if (err) {
+		ntfs_error(vol->mp, "Failed to build mapping pairs array "
+				"(error %d).", err);
+		goto mp_err;
+	}
+	/*
+	 * Take a private copy of the current runlist and remember the sizes
+	 * and the data write generation so we can copy the data without
+	 * holding the locks and check afterwards whether anything changed
+	 * under our feet.
+	 */
+	buf = IOMallocData(NTFS_DEFRAG_BUF_SIZE);
+	if (!buf) {
+		err = ENOMEM;
+		goto mp_err;
+	}
+	src_elements = ni->rl.elements;
+	src_rl_copy = IONew(ntfs_rl_element, src_elements);
+	if (!src_rl_copy) {
+		IOFreeData(buf, NTFS_DEFRAG_BUF_SIZE);
+		err = ENOMEM;
+		goto mp_err;
+	}
+	memcpy(src_rl_copy, ni->rl.rl, src_elements * sizeof(ntfs_rl_element));
+	lck_spin_lock(&ni->size_lock);
+	allocated_size = ni->allocated_size;
+	initialized_size = ni->initialized_size;
+	data_size = ni->data_size;
+	lck_spin_unlock(&ni->size_lock);
+	write_gen = ni->data_write_gen;
+	lck_rw_unlock_exclusive(&ni->rl.lock);
+	lck_rw_unlock_exclusive(&ni->lock);
+	/*
+	 * Copy the initialized part of the data over to the new clusters.
+	 * The new clusters are ours alone and the old ones cannot be freed
+	 * or reused whilst they are still in the runlist, which we verify
+	 * below before switching over, thus no locks are needed.
+	 */
+	src_rl = src_rl_copy;
+	dst_rl = runlist.rl;
+	for (vcn = 0; vcn < init_vcn; vcn += count) {
+		count = NTFS_DEFRAG_BUF_SIZE >> vol->cluster_size_shift;
+		if (count > init_vcn - vcn)
+			count = init_vcn - vcn;
+		err = ntfs_attr_defrag_io(vol, &src_rl, vcn, count, buf, TRUE);
+		if (!err)
+			err = ntfs_attr_defrag_io(vol, &dst_rl, vcn, count,
+					buf, FALSE);
+		if (err)
+			break;
+	}
+	IOFreeData(buf, NTFS_DEFRAG_BUF_SIZE);
+	lck_rw_lock_exclusive(&ni->lock);
+	lck_rw_lock_exclusive(&ni->rl.lock);
+	if (err) {
+		IODelete(src_rl_copy, ntfs_rl_element, src_elements);
+		ntfs_error(vol->mp, "Failed to copy data of mft_no 0x%llx "
+				"(error %d).", (unsigned long long)ni->mft_no,
+				err);
+		goto mp_err;
+	}
+	/*
+	 * Now that we hold the locks again, make sure nobody deleted,
+	 * truncated, extended, or wrote to the attribute whilst we were
+	 * copying.  If anything changed, the copy may be stale so give up.
+	 */
+	changed = (NInoDeleted(ni) || ni->data_write_gen != write_gen ||
+			ni->rl.elements != src_elements || memcmp(ni->rl.rl,
+			src_rl_copy, src_elements * sizeof(ntfs_rl_element)));
+	IODelete(src_rl_copy, ntfs_rl_element, src_elements);
+	if (!changed) {
+		lck_spin_lock(&ni->size_lock);
+		changed = (ni->allocated_size != allocated_size ||
+				ni->initialized_size != initialized_size ||
+				ni->data_size != data_size);
+		lck_spin_unlock(&ni->size_lock);
+	}
+	if (changed) {
+		ntfs_debug("Attribute changed whilst copying its data, "
+				"aborting.");
+		err = EAGAIN;
+		goto mp_err;
+	}
+	/* Write the new mapping pairs array into the base attribute extent. */
+	err = ntfs_mft_record_map(base_ni, &m);
+	if (err) {
+		ntfs_error(vol->mp, "Failed to map mft record for mft_no "
+				"0x%llx (error %d).",
+				(unsigned long long)base_ni->mft_no, err);
+		goto mp_err;
+	}
+	ctx = ntfs_attr_search_ctx_get(base_ni, m);
+	if (!ctx) {
+		err = ENOMEM;
+		goto unm_err;
+	}
+	err = ntfs_attr_lookup(ni->type, ni->name, ni->name_len, 0, NULL, 0,
+			ctx);
+	if (err) {
+		if (err == ENOENT) {
+			ntfs_error(vol->mp, "Open attribute is missing from "
+					"mft record.  Inode 0x%llx is "
+					"corrupt.  Run chkdsk.",
+					(unsigned long long)ni->mft_no);
+			err = EIO;
+		} else
+			ntfs_error(vol->mp, "Failed to lookup attribute "
+					"(error %d).", err);
+		goto put_err;
+	}
+	a = ctx->a;
+	if (!a->non_resident || a->lowest_vcn)
+		panic("%s(): !a->non_resident || a->lowest_vcn\n",
+				__FUNCTION__);
+	/*
+	 * This is the last point at which we can back out.  The resize does
+	 * not modify anything if there is not enough space in the mft record.
+	 */
+	err = ntfs_attr_record_resize(ctx->m, a,
+			le16_to_cpu(a->mapping_pairs_offset) + mp_size);
+	if (err) {
+		ntfs_debug("Not enough space in mft record for new mapping "
+				"pairs array.");
+		goto put_err;
+	}
+	memcpy((u8*)a + le16_to_cpu(a->mapping_pairs_offset), mp, mp_size);
+	a->highest_vcn = cpu_to_sle64(end_vcn - 1);
+	NInoSetMrecNeedsDirtying(ctx->ni);
+	IOFreeData(mp, mp_size);
+	/* Switch the inode over to the new runlist. */
+	old_rl = ni->rl.rl;
+	old_alloc_count = ni->rl.alloc_count;
+	ni->rl.rl = runlist.rl;
+	ni->rl.elements = runlist.elements;
+	ni->rl.alloc_count = runlist.alloc_count;
+	/*
+	 * Delete all other attribute extents starting with the last one.  The
+	 * attribute list lookup finds the extent by the lowest vcn in its
+	 * attribute list entry thus the stale extents are still found even
+	 * though the base extent now covers the whole attribute.
+	 */
+	do {
+		ntfs_attr_search_ctx_reinit(ctx);
+		err = ntfs_attr_lookup(ni->type, ni->name, ni->name_len,
+				end_vcn - 1, NULL, 0, ctx);
+		if (err)
+			break;
+		if (!ctx->a->lowest_vcn)
+			break;
+		err = ntfs_attr_record_delete(base_ni, ctx);
+	} while (!err);
+	ntfs_attr_search_ctx_put(ctx);
+	ntfs_mft_record_unmap(base_ni);
+	if (err) {
+		/*
+		 * Stale extents still reference the old clusters so do not
+		 * free them as that would cross link them.
+		 */
+		ntfs_error(vol->mp, "Failed to delete attribute extent of "
+				"mft_no 0x%llx (error %d).%s",
+				(unsigned long long)ni->mft_no, err, es);
+		NVolSetErrors(vol);
+		err = EIO;
+	} else {
+		/* Release the old clusters. */
+		err = ntfs_cluster_free_from_rl(vol, old_rl, 0, -1, &nr_freed);
+		if (err) {
+			ntfs_error(vol->mp, "Failed to release cluster(s) "
+					"(error %d).  Unmount and run chkdsk "
+					"to recover the lost cluster(s).",
+					err);
+			NVolSetErrors(vol);
+			err = 0;
+		}
+	}
+	IODelete(old_rl, ntfs_rl_element, old_alloc_count);
+	goto rl_unl_done;
+put_err:
+	ntfs_attr_search_ctx_put(ctx);
+unm_err:
+	ntfs_mft_record_unmap(base_ni);
+mp_err:
+	IOFreeData(mp, mp_size);
+free_err:
+	err2 = ntfs_cluster_free_from_rl(vol, runlist.rl, 0, -1, NULL);
+	if (err2) {
+		ntfs_error(vol->mp, "Failed to release allocated cluster(s) in "
+				"error code path (error %d).  Run chkdsk to "
+				"recover the lost space.", err2);
+		NVolSetErrors(vol);
+	}
+	IODelete(runlist.rl, ntfs_rl_element, runlist.alloc_count);
+	new_nr = nr;
+rl_unl_done:
+	lck_rw_unlock_exclusive(&ni->rl.lock);
+	if (!err) {
+		*nr_extents = nr;
+		*new_nr_extents = new_nr;
+	}
+unl_done:
+	if (!count_only)
+		lck_rw_unlock_exclusive(&ni->lock);
+	else
+		lck_rw_unlock_shared(&ni->lock);
+	ntfs_debug("Done (error %d).", err);
+	return err;
+}
+
+/**
+ * ntfs_attr_extents_get - get the physical layout of an attribute
+ * @ni:		ntfs inode of the attribute whose extents to get
+ * @ofs:	byte offset at which to start (in) and to continue from (out)
+ * @end:	byte offset at which to stop
+ * @ext:	destination array for the extents or NULL to only count them
+ * @max_nr:	number of elements in the array @ext
+ * @nr:		destination for the number of extents found
+ *
+ * Describe the data of the attribute described by the ntfs inode @ni from
+ * byte offset *@ofs up to byte offset @end as an array of extents, which are
+ * taken straight from the runlist, i.e. we return one extent per run rather
+ * than walking the attribute block by block.  Unmapped parts of the runlist
+ * are mapped as we go.  The range is clipped to the data size.
+ *
+ * Holes are returned as NTFS_EXTENT_SPARSE extents.  A run of allocated
+ * clusters which straddles the initialized size is split in two and the part
+ * beyond the initialized size is marked NTFS_EXTENT_UNWRITTEN.  All runs of
+ * compressed and encrypted attributes are marked NTFS_EXTENT_COMPRESSED and
+ * NTFS_EXTENT_ENCRYPTED, respectively, as their clusters cannot be accessed
+ * directly.  This includes the sparse tails of compressed compression blocks,
+ * which are returned without a physical location but are not holes.  A
+ * resident attribute is returned as a single extent marked
+ * NTFS_EXTENT_RESIDENT.
+ *
+ * If @ext is NULL the extents are only counted and @max_nr is ignored.
+ * Otherwise at most @max_nr extents are returned.  In both cases *@ofs is set
+ * to the byte offset following the last extent so that the caller can call us
+ * again to continue from there.  If fewer than @max_nr extents are returned,
+ * the end has been reached.
+ *
+ * Return 0 on success and errno on error.  On error *@ofs and *@nr describe
+ * the extents returned up to the point of failure.
+ *
+ * Locking: Caller must not hold @ni->lock or @ni->rl.lock.  This function
+ *	    takes @ni->lock and the runlist lock for reading and switches the
+ *	    latter to writing only for as long as it takes to map a runlist
+ *	    fragment.
+ */
+errno_t ntfs_attr_extents_get(ntfs_inode *ni, s64 *ofs, s64 end,
+		ntfs_extent *ext, const u32 max_nr, u32 *nr)
+{
+	VCN vcn, mapped_vcn;
+	s64 pos, run_end, seg_end, cb_end, data_size, init_size;
+	ntfs_volume *vol = ni->vol;
+	ntfs_rl_element *rl;
+	u32 n, flags, rl_flags, cb_clusters;
+	errno_t err;
+	BOOL write_locked;
+
+	ntfs_debug("Entering for mft_no 0x%llx, type 0x%x, ofs 0x%llx, end "
+			"0x%llx%s.", (unsigned long long)ni->mft_no,
+			(unsigned)le32_to_cpu(ni->type),
+			(unsigned long long)*ofs, (unsigned long long)end,
+			ext ? "" : ", counting only");
+	n = 0;
+	pos = *ofs;
+	lck_rw_lock_shared(&ni->lock);
+	/* Do not allow messing with the inode once it has been deleted. */
+	if (NInoDeleted(ni)) {
+		err = ENOENT;
+		goto unl_done;
+	}
+	err = 0;
+	lck_spin_lock(&ni->size_lock);
+	data_size = ni->data_size;
+	init_size = ni->initialized_size;
+	lck_spin_unlock(&ni->size_lock);
+	if (end > data_size)
+		end = data_size;
+	if (pos >= end)
+		goto unl_done;
+	if (!NInoNonResident(ni)) {
+		if (ext && max_nr) {
+			ext->logical = pos;
+			ext->physical = -1;
+			ext->length = end - pos;
+			ext->flags = NTFS_EXTENT_RESIDENT;
+			if (end == data_size)
+				ext->flags |= NTFS_EXTENT_LAST;
+			ext->reserved = 0;
+		}
+		if (!ext || max_nr) {
+			n = 1;
+			pos = end;
+		}
+		goto unl_done;
+	}
+	rl_flags = 0;
+	cb_clusters = 0;
+	if (NInoCompressed(ni)) {
+		rl_flags |= NTFS_EXTENT_COMPRESSED;
+		cb_clusters = ni->compression_block_clusters;
+	}
+	if (NInoEncrypted(ni))
+		rl_flags |= NTFS_EXTENT_ENCRYPTED;
+	lck_rw_lock_shared(&ni->rl.lock);
+	write_locked = FALSE;
+	mapped_vcn = -1;
+	rl = NULL;
+	while (pos < end) {
+		if (!rl) {
+			vcn = pos >> vol->cluster_size_shift;
+			rl = ntfs_rl_find_vcn_nolock(ni->rl.elements ?
+					ni->rl.rl : NULL, vcn);
+			if (rl && !rl->length) {
+				/*
+				 * The runlist ends before the data size which
+				 * means it is corrupt.
+				 */
+				goto corrupt;
+			}
+			if (!rl) {
+				/*
+				 * If we mapped the runlist fragment containing
+				 * @vcn already and still cannot find it the
+				 * runlist is corrupt.
+				 */
+				if (vcn == mapped_vcn)
+					goto corrupt;
+				if (!write_locked) {
+					write_locked = TRUE;
+					/*
+					 * If converting the lock from shared
+					 * to exclusive fails, need to take the
+					 * lock for writing and retry in case
+					 * the racing process did the mapping
+					 * for us.
+					 */
+					if (!lck_rw_lock_shared_to_exclusive(
+							&ni->rl.lock)) {
+						lck_rw_lock_exclusive(
+								&ni->rl.lock);
+						continue;
+					}
+				}
+				err = ntfs_map_runlist_nolock(ni, vcn, NULL);
+				if (err) {
+					if (err == ENOENT)
+						goto corrupt;
+					ntfs_error(vol->mp, "Failed to map "
+							"runlist fragment of "
+							"mft_no 0x%llx (error "
+							"%d).",
+							(unsigned long long)
+							ni->mft_no, err);
+					break;
+				}
+				mapped_vcn = vcn;
+				lck_rw_lock_exclusive_to_shared(&ni->rl.lock);
+				write_locked = FALSE;
+				continue;
+			}
+		}
+		run_end = rl[1].vcn << vol->cluster_size_shift;
+		if (run_end > end)
+			run_end = end;
+		while (pos < run_end) {
+			if (ext && n >= max_nr)
+				goto full;
+			seg_end = run_end;
+			flags = rl_flags;
+			if (rl->lcn == LCN_HOLE) {
+				flags = NTFS_EXTENT_SPARSE;
+				/*
+				 * In a compressed attribute, a compression
+				 * block is only sparse if its first cluster is
+				 * sparse (see ntfs_get_cb_type()).  Thus a hole
+				 * which does not start on a compression block
+				 * boundary begins with the sparse tail of a
+				 * compressed compression block which is part
+				 * of the data of that block rather than a
+				 * hole.
+				 */
+				if (cb_clusters) {
+					cb_end = ((rl->vcn + cb_clusters - 1) &
+							~(cb_clusters - 1)) <<
+							vol->cluster_size_shift;
+					if (pos < cb_end) {
+						flags = rl_flags;
+						if (seg_end > cb_end)
+							seg_end = cb_end;
+					}
+				}
+			}
+			if (!(flags & NTFS_EXTENT_SPARSE)) {
+				if (pos >= init_size)
+					flags |= NTFS_EXTENT_UNWRITTEN;
+				else if (seg_end > init_size)
+					seg_end = init_size;
+			}
+			if (seg_end >= data_size)
+				flags |= NTFS_EXTENT_LAST;
+			if (ext) {
+				ext[n].logical = pos;
+				ext[n].physical = -1;
+				if (rl->lcn >= 0)
+					ext[n].physical = (rl->lcn <<
+							vol->cluster_size_shift)
+							+ pos - (rl->vcn <<
+							vol->cluster_size_shift);
+				ext[n].length = seg_end - pos;
+				ext[n].flags = flags;
+				ext[n].reserved = 0;
+			}
+			n++;
+			pos = seg_end;
+		}
+		/*
+		 * Move on to the next run.  If it is not mapped or we have
+		 * reached the end of the runlist, look it up afresh which will
+		 * map it or detect the corruption, respectively.
+		 */
+		rl++;
+		if (rl->lcn < LCN_HOLE)
+			rl = NULL;
+	}
+	goto full;
+corrupt:
+	ntfs_error(vol->mp, "Runlist of mft_no 0x%llx is corrupt.  Run "
+			"chkdsk.", (unsigned long long)ni->mft_no);
+	NVolSetErrors(vol);
+	err = EIO;
+full:
+	if (write_locked)
+		lck_rw_unlock_exclusive(&ni->rl.lock);
+	else
+		lck_rw_unlock_shared(&ni->rl.lock);
+unl_done:
+	lck_rw_unlock_shared(&ni->lock);
+	*ofs = pos;
+	*nr = n;
+	ntfs_debug("Done (error %d, %u extents).", err, (unsigned)n);
+	return err;
+}
+
+/**
+ * ntfs_attr_seek_data_hole - find the next data or hole in an attribute
+ * @ni:		ntfs inode of the attribute to search
+ * @ofs:	byte offset at which to start searching (in) and result (out)
+ * @data:	if true find the next data and if false find the next hole
+ *
+ * Find the first byte offset at or after *@ofs in the attribute described by
+ * the ntfs inode @ni which is in a region containing data if @data is true or
+ * which is in a hole if @data is false and return it in *@ofs.  This
+ * implements lseek(2) with SEEK_DATA and SEEK_HOLE, respectively.
+ *
+ * The search is done on the extents returned by ntfs_attr_extents_get(), i.e.
+ * straight from the runlist and without reading any data.  Sparse runs and
+ * sparse compression blocks are holes as is the region between the
+ * initialized size and the data size as it reads as zeroes.  There is always
+ * an implicit hole at the end of the attribute.
+ *
+ * Return 0 on success and errno on error.  If *@ofs is at or beyond the data
+ * size or @data is true and there is no more data after *@ofs, return ENXIO.
+ *
+ * Locking: Caller must not hold @ni->lock or @ni->rl.lock.  Both are taken
+ *	    for reading while the extents are being looked up.
+ */
+errno_t ntfs_attr_seek_data_hole(ntfs_inode *ni, s64 *ofs, const BOOL data)
+{
+	s64 pos, next;
+	ntfs_extent ext[NTFS_SEEK_EXTENTS];
+	unsigned i;
+	u32 nr;
+	errno_t err;
+	BOOL is_hole;
+
+	ntfs_debug("Entering for mft_no 0x%llx, ofs 0x%llx, seeking %s.",
+			(unsigned long long)ni->mft_no,
+			(unsigned long long)*ofs, data ? "data" : "hole");
+	if (*ofs < 0)
+		return EINVAL;
+	pos = next = *ofs;
+	do {
+		err = ntfs_attr_extents_get(ni, &next, NTFS_MAX_ATTRIBUTE_SIZE,
+				ext, NTFS_SEEK_EXTENTS, &nr);
+		if (err)
+			goto done;
+		for (i = 0; i < nr; i++) {
+			is_hole = (ext[i].flags & (NTFS_EXTENT_SPARSE |
+					NTFS_EXTENT_UNWRITTEN)) ? TRUE : FALSE;
+			if (is_hole != data) {
+				*ofs = ext[i].logical;
+				goto done;
+			}
+		}
+		/*
+		 * If there are no extents at all the offset is at or beyond
+		 * the end of the attribute.
+		 */
+		if (!nr && next == *ofs) {
+			err = ENXIO;
+			goto done;
+		}
+		pos = next;
+	} while (nr == NTFS_SEEK_EXTENTS);
+	/*
+	 * We reached the end of the attribute.  There is no more data but
+	 * there is an implicit hole at the end.
+	 */
+	if (data)
+		err = ENXIO;
+	else
+		*ofs = pos;
+done:
+	ntfs_debug("Done (error %d, ofs 0x%llx).", err,
+			(unsigned long long)*ofs);
+	return err;
+}
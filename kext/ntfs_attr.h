@@ -43,6 +43,7 @@
 /* Forward declaration. */
 typedef struct _ntfs_attr_search_ctx ntfs_attr_search_ctx;
 
+#include "ntfs.h"
 #include "ntfs_endian.h"
 #include "ntfs_index.h"
 #include "ntfs_inode.h"
@@ -233,9 +234,43 @@ __private_extern__ errno_t ntfs_attr_extend_allocation(ntfs_inode *ni,
 __private_extern__ errno_t ntfs_attr_resize(ntfs_inode *ni, s64 new_size,
 		int ioflags, ntfs_index_context *ictx);
 
+/*
+ * Minimum number of bytes of whole pages for which ntfs_attr_set() bypasses
+ * the page cache and writes directly to disk.
+ */
+#define NTFS_ATTR_SET_DIRECT_MIN	(64 * 1024)
+
 __private_extern__ errno_t ntfs_attr_set(ntfs_inode *ni, s64 ofs,
 		const s64 cnt, const u8 val);
 
+/*
+ * Size of the buffer through which ntfs_attr_defrag() copies the data of the
+ * attribute to its new location.
+ */
+#define NTFS_DEFRAG_BUF_SIZE	(2 * 1024 * 1024)
+
+__private_extern__ errno_t ntfs_attr_defrag(ntfs_inode *ni,
+		const BOOL count_only, u32 *nr_extents, u32 *new_nr_extents);
+
+/*
+ * Maximum number of extents the NTFS_IOC_GET_EXTENTS fsctl gathers with a
+ * single call to ntfs_attr_extents_get() before copying them out to user
+ * space.
+ */
+#define NTFS_EXTENTS_BATCH	128
+
+__private_extern__ errno_t ntfs_attr_extents_get(ntfs_inode *ni, s64 *ofs,
+		s64 end, ntfs_extent *ext, const u32 max_nr, u32 *nr);
+
+/*
+ * Number of extents ntfs_attr_seek_data_hole() looks up at a time.  They live
+ * on the kernel stack so keep this small.
+ */
+#define NTFS_SEEK_EXTENTS	8
+
+__private_extern__ errno_t ntfs_attr_seek_data_hole(ntfs_inode *ni,
+		s64 *ofs, const BOOL data);
+
 __private_extern__ errno_t ntfs_resident_attr_read(ntfs_inode *ni,
 		const s64 ofs, const u32 cnt, u8 *buf);
 __private_extern__ errno_t ntfs_resident_attr_write(ntfs_inode *ni, u8 *buf,
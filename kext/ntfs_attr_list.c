@@ -56,6 +56,70 @@
 #include "ntfs_unistr.h"
 #include "ntfs_volume.h"
 
+/**
+ * ntfs_attr_list_index_build - build the index of the attribute list entries
+ * @ni:		base ntfs inode whose attribute list to index
+ *
+ * Walk the attribute list attribute cached in the base ntfs inode @ni and
+ * record the byte offset of each entry in @ni->attr_list_index.  As attribute
+ * list entries are sorted by type, name, and lowest vcn this allows
+ * ntfs_attr_find_in_attribute_list() to binary search the attribute list
+ * rather than walking it from the start on each lookup, which matters for
+ * heavily fragmented files which can have tens of thousands of entries.
+ *
+ * The index remains valid until ntfs_attr_list_index_invalidate() is called.
+ *
+ * Return 0 on success and errno on error.  EIO means the attribute list is
+ * corrupt in which case the caller should fall back to a linear search which
+ * will report the corruption.
+ *
+ * Locking: Caller must have mapped the base mft record of @ni.
+ */
+errno_t ntfs_attr_list_index_build(ntfs_inode *ni)
+{
+	ATTR_LIST_ENTRY *al_entry;
+	u32 *idx;
+	unsigned ofs, len, nr, alloc;
+
+	ntfs_debug("Entering for mft_no 0x%llx, attr_list_size 0x%x.",
+			(unsigned long long)ni->mft_no, ni->attr_list_size);
+	/* Count the entries first so we know how much memory we need. */
+	for (nr = ofs = 0; ofs < ni->attr_list_size; nr++, ofs += len) {
+		al_entry = (ATTR_LIST_ENTRY*)(ni->attr_list + ofs);
+		if (ofs + offsetof(ATTR_LIST_ENTRY, name) > ni->attr_list_size)
+			return EIO;
+		len = le16_to_cpu(al_entry->length);
+		if (len < offsetof(ATTR_LIST_ENTRY, name) ||
+				ofs + len > ni->attr_list_size ||
+				al_entry->name_offset +
+				((unsigned)al_entry->name_length <<
+				NTFSCHAR_SIZE_SHIFT) > len)
+			return EIO;
+	}
+	if (!nr)
+		return EIO;
+	alloc = nr * sizeof(u32);
+	if (alloc > ni->attr_list_index_alloc) {
+		idx = IOMallocData(alloc);
+		if (!idx)
+			return ENOMEM;
+		if (ni->attr_list_index_alloc)
+			IOFreeData(ni->attr_list_index,
+					ni->attr_list_index_alloc);
+		ni->attr_list_index = idx;
+		ni->attr_list_index_alloc = alloc;
+	}
+	idx = ni->attr_list_index;
+	for (nr = ofs = 0; ofs < ni->attr_list_size; ofs += len) {
+		idx[nr++] = ofs;
+		len = le16_to_cpu(((ATTR_LIST_ENTRY*)(ni->attr_list +
+				ofs))->length);
+	}
+	ni->attr_list_index_nr = nr;
+	ntfs_debug("Done (%u entries).", nr);
+	return 0;
+}
+
 /**
  * ntfs_attr_list_is_needed - check if attribute list attribute is still needed
  * @ni:				base ntfs inode to check
@@ -187,6 +251,7 @@ errno_t ntfs_attr_list_delete(ntfs_inode *ni, ntfs_attr_search_ctx *ctx)
 	NInoSetMrecNeedsDirtying(ni);
 	/* Update the in-memory base inode and free memory. */
 	ni->attr_list_size = 0;
+	ntfs_attr_list_index_invalidate(ni);
 	IOFree(ni->attr_list, ni->attr_list_alloc);
 	ni->attr_list_alloc = 0;
 	NInoClearAttrList(ni);
@@ -825,6 +890,7 @@ done:
 	base_ni->attr_list = al;
 	base_ni->attr_list_size = al_size;
 	base_ni->attr_list_alloc = al_alloc;
+	ntfs_attr_list_index_invalidate(base_ni);
 	NInoSetAttrList(base_ni);
 	lck_rw_unlock_exclusive(&base_ni->attr_list_rl.lock);
 	/*
@@ -2197,6 +2263,7 @@ void ntfs_attr_list_entries_delete(ntfs_inode *ni,
 	 * attribute.
 	 */
 	ni->attr_list_size -= to_delete;
+	ntfs_attr_list_index_invalidate(ni);
 	new_alloc = (ni->attr_list_size + NTFS_ALLOC_BLOCK - 1) &
 			~(NTFS_ALLOC_BLOCK - 1);
 	/*
@@ -47,6 +47,30 @@
 #include "ntfs_layout.h"
 #include "ntfs_types.h"
 
+/*
+ * Attribute lists smaller than this are searched linearly and do not get an
+ * index (see ntfs_attr_list_index_build()).
+ */
+#define NTFS_ATTR_LIST_INDEX_MIN_SIZE	4096
+
+__private_extern__ errno_t ntfs_attr_list_index_build(ntfs_inode *ni);
+
+/**
+ * ntfs_attr_list_index_invalidate - invalidate the attribute list index
+ * @ni:		base ntfs inode whose attribute list index to invalidate
+ *
+ * Mark the index of the attribute list entries of the base ntfs inode @ni as
+ * stale so it is rebuilt the next time it is needed.  This must be called
+ * whenever entries are inserted into or deleted from @ni->attr_list or it is
+ * otherwise resized or replaced.  The buffer is kept for reuse.
+ *
+ * Locking: Caller must have mapped the base mft record of @ni.
+ */
+static inline void ntfs_attr_list_index_invalidate(ntfs_inode *ni)
+{
+	ni->attr_list_index_nr = 0;
+}
+
 __private_extern__ errno_t ntfs_attr_list_is_needed(ntfs_inode *ni,
 		ATTR_LIST_ENTRY *skip_entry, BOOL *attr_list_is_needed);
 
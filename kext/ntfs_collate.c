@@ -55,23 +55,10 @@ static int ntfs_collate_binary(ntfs_volume *vol __attribute__((unused)),
 		const void *data1, const int data1_len,
 		const void *data2, const int data2_len)
 {
-	int len, rc;
+	int rc;
 
 	ntfs_debug("Entering.");
-	len = data1_len;
-	if (data2_len < data1_len)
-		len = data2_len;
-	rc = memcmp(data1, data2, len);
-	if (!rc && (data1_len != data2_len)) {
-		/*
-		 * If @len equals @data1_len this implies that @data1_len is
-		 * smaller than @data2_len.
-		 */
-		if (len == data1_len)
-			rc = -1;
-		else
-			rc = 1;
-	}
+	rc = ntfs_collate_binary_keys(data1, data1_len, data2, data2_len);
 	ntfs_debug("Done (returning %d).", rc);
 	return rc;
 }
@@ -79,7 +66,8 @@ static int ntfs_collate_binary(ntfs_volume *vol __attribute__((unused)),
 /**
  * ntfs_collate_filename - filename collation
  *
- * Used for COLLATION_FILENAME.
+ * Used for COLLATION_FILENAME.  Also called directly by the index lookup code
+ * to avoid the indirection through ntfs_collate().
  *
  * Note: This only performs exact matching as it is only intended to be used
  * when looking up a particular name that is already known to exist and we just
@@ -88,7 +76,7 @@ static int ntfs_collate_binary(ntfs_volume *vol __attribute__((unused)),
  * does not exist in the index so we just want to locate the correct index
  * entry in front of which we need to insert the name.
  */
-static int ntfs_collate_filename(ntfs_volume *vol,
+int ntfs_collate_filename(ntfs_volume *vol,
 		const void *data1, const int data1_len,
 		const void *data2, const int data2_len)
 {
@@ -132,37 +120,14 @@ static int ntfs_collate_ntofs_ulongs(ntfs_volume *vol __attribute__((unused)),
 		const void *data1, const int data1_len,
 		const void *data2, const int data2_len)
 {
-	const le32 *p1 = data1;
-	const le32 *p2 = data2;
-	int min_len, i, rc;
+	int rc;
 
 	ntfs_debug("Entering.");
 	if (data1_len & (sizeof(u32) - 1))
 		panic("%s(): data1_len & (sizeof(u32) - 1)\n", __FUNCTION__);
 	if (data2_len & (sizeof(u32) - 1))
 		panic("%s(): data2_len & (sizeof(u32) - 1)\n", __FUNCTION__);
-	min_len = data1_len;
-	if (min_len > data2_len)
-		min_len = data2_len;
-	min_len >>= 2;
-	for (i = 0; i < min_len; i++) {
-		const u32 u1 = le32_to_cpu(p1[i]);
-		const u32 u2 = le32_to_cpu(p2[i]);
-		if (u1 > u2) {
-			rc = 1;
-			goto out;
-		}
-		if (u1 < u2) {
-			rc = -1;
-			goto out;
-		}
-	}
-	rc = 1;
-	if (data1_len < data2_len)
-		rc = -1;
-	else if (data1_len == data2_len)
-		rc = 0;
-out:
+	rc = ntfs_collate_ulongs_keys(data1, data1_len, data2, data2_len);
 	ntfs_debug("Done (returning %d).", rc);
 	return rc;
 }
@@ -38,6 +38,9 @@
 #ifndef _OSX_NTFS_COLLATE_H
 #define _OSX_NTFS_COLLATE_H
 
+#include <string.h>
+
+#include "ntfs_endian.h"
 #include "ntfs_layout.h"
 #include "ntfs_types.h"
 #include "ntfs_volume.h"
@@ -58,6 +61,57 @@ static inline BOOL ntfs_is_collation_rule_supported(COLLATION_RULE cr) {
 	return FALSE;
 }
 
+/**
+ * ntfs_collate_binary_keys - byte by byte binary collation of two keys
+ *
+ * Used for COLLATION_BINARY and COLLATION_NTOFS_SID.  This is the inline core
+ * of ntfs_collate() for these rules so that index searches can use it without
+ * going through the collation function table.
+ */
+static inline int ntfs_collate_binary_keys(const void *data1,
+		const int data1_len, const void *data2, const int data2_len)
+{
+	int rc;
+
+	rc = memcmp(data1, data2, data1_len < data2_len ? data1_len :
+			data2_len);
+	if (rc)
+		return rc < 0 ? -1 : 1;
+	return (data1_len > data2_len) - (data1_len < data2_len);
+}
+
+/**
+ * ntfs_collate_ulongs_keys - le32 by le32 collation of two keys
+ *
+ * Used for COLLATION_NTOFS_ULONG, COLLATION_NTOFS_ULONGS, and
+ * COLLATION_NTOFS_SECURITY_HASH.  This is the inline core of ntfs_collate()
+ * for these rules so that index searches can use it without going through the
+ * collation function table.  The keys of these indexes are one to three le32
+ * so the loop is short.
+ *
+ * The caller must ensure both lengths are multiples of sizeof(u32).
+ */
+static inline int ntfs_collate_ulongs_keys(const void *data1,
+		const int data1_len, const void *data2, const int data2_len)
+{
+	const le32 *p1 = data1;
+	const le32 *p2 = data2;
+	int min_len, i;
+
+	min_len = (data1_len < data2_len ? data1_len : data2_len) >> 2;
+	for (i = 0; i < min_len; i++) {
+		const u32 u1 = le32_to_cpu(p1[i]);
+		const u32 u2 = le32_to_cpu(p2[i]);
+		if (u1 != u2)
+			return u1 < u2 ? -1 : 1;
+	}
+	return (data1_len > data2_len) - (data1_len < data2_len);
+}
+
+__private_extern__ int ntfs_collate_filename(ntfs_volume *vol,
+		const void *data1, const int data1_len,
+		const void *data2, const int data2_len);
+
 __private_extern__ int ntfs_collate(ntfs_volume *vol, COLLATION_RULE cr,
 		const void *data1, const int data1_len,
 		const void *data2, const int data2_len);
@@ -787,6 +787,70 @@ err:
 	return err;
 }
 
+/*
+ * Define the search kernels for view indexes whose keys are collated with the
+ * inline key collation function @collate, i.e. ntfs_index_search_ulongs() and
+ * ntfs_index_search_binary().
+ *
+ * ntfs_index_search_##name - search the keys of an index node
+ * @entries:	index entries of the node excluding the end entry
+ * @nr:		number of entries in @entries
+ * @key:	key to search for
+ * @key_len:	length of @key in bytes
+ * @is_match:	set to true if the returned entry matches @key
+ *
+ * Return the position in @entries of the first entry whose key does not
+ * collate before @key.  This is the matching entry if there is one and
+ * otherwise the entry whose sub-node to descend into or in front of which to
+ * insert @key.  It is @nr, i.e. the end entry, if @key collates after all the
+ * keys.
+ *
+ * The keys of these indexes are small so the comparisons are cheap and the
+ * cost of the search is dominated by mispredicted branches.  Thus we narrow
+ * down the range without branching on the comparison result, which allows the
+ * compiler to use a conditional move, and only check for a match at the end.
+ */
+#define DEFINE_NTFS_INDEX_SEARCH(name, collate)				\
+static inline unsigned ntfs_index_search_##name(INDEX_ENTRY **entries,	\
+		unsigned nr, const void *key, const int key_len,	\
+		BOOL *is_match)						\
+{									\
+	INDEX_ENTRY *ie;						\
+	unsigned base, half, n;						\
+	int rc;								\
+									\
+	*is_match = FALSE;						\
+	if (!nr)							\
+		return 0;						\
+	base = 0;							\
+	for (n = nr; n > 1; n -= half) {				\
+		half = n >> 1;						\
+		ie = entries[base + half];				\
+		base = (collate(&ie->key, le16_to_cpu(ie->key_length),	\
+				key, key_len) < 0) ? base + half : base; \
+	}								\
+	/*								\
+	 * @base is now the last entry collating before @key or, if there \
+	 * is none, the first entry.					\
+	 */								\
+	ie = entries[base];						\
+	rc = collate(&ie->key, le16_to_cpu(ie->key_length), key, key_len); \
+	if (rc < 0) {							\
+		if (++base == nr)					\
+			return base;					\
+		ie = entries[base];					\
+		rc = collate(&ie->key, le16_to_cpu(ie->key_length),	\
+				key, key_len);				\
+	}								\
+	*is_match = !rc;						\
+	return base;							\
+}
+
+/* $SII, $Q, $SDH, and $R, i.e. all keys are made up of le32s. */
+DEFINE_NTFS_INDEX_SEARCH(ulongs, ntfs_collate_ulongs_keys)
+/* $O (COLLATION_NTOFS_SID) and COLLATION_BINARY indexes. */
+DEFINE_NTFS_INDEX_SEARCH(binary, ntfs_collate_binary_keys)
+
 /**
  * ntfs_index_lookup_in_node - search for an entry in an index node
  * @ictx:		index context in which to search for the entry
@@ -809,6 +873,13 @@ err:
  * and @match_key_len.  For view indexes @match_key and @match_key_len are the
  * same as @key and @key_len respectively.
  *
+ * The search is specialized by the collation rule of the index which is fixed
+ * when the index inode is loaded.  View indexes with integer or binary keys
+ * use ntfs_index_search_ulongs() and ntfs_index_search_binary(), respectively,
+ * which collate inline.  Filename indexes check for an exact match of the name
+ * before each full blown collation as that is expensive and call
+ * ntfs_collate_filename() directly rather than via ntfs_collate().
+ *
  * Return 0 on success and errno on error.
  *
  * Locking: - Caller must hold @ictx->idx_ni->lock on the index inode.
@@ -822,7 +893,7 @@ static errno_t ntfs_index_lookup_in_node(ntfs_index_context *ictx,
 	INDEX_ENTRY *ie, **entries;
 	unsigned min_left, max_right, cur_entry;
 	int rc;
-	BOOL is_view;
+	BOOL is_view, is_match;
 
 	ntfs_debug("Entering.");
 	idx_ni = ictx->idx_ni;
@@ -839,6 +910,34 @@ static errno_t ntfs_index_lookup_in_node(ntfs_index_context *ictx,
 		cur_entry = 0;
 		goto not_found;
 	}
+	/*
+	 * View indexes with integer or binary keys use the specialized search
+	 * kernels.  Note we exclude the end entry from the search as it does
+	 * not include a key we can compare.
+	 */
+	switch (idx_ni->collation_rule) {
+	case COLLATION_NTOFS_ULONG:
+	case COLLATION_NTOFS_ULONGS:
+	case COLLATION_NTOFS_SECURITY_HASH:
+		cur_entry = ntfs_index_search_ulongs(entries,
+				ictx->nr_entries - 1, key, key_len, &is_match);
+		break;
+	case COLLATION_BINARY:
+	case COLLATION_NTOFS_SID:
+		cur_entry = ntfs_index_search_binary(entries,
+				ictx->nr_entries - 1, key, key_len, &is_match);
+		break;
+	default:
+		goto filename;
+	}
+	if (!is_match)
+		goto not_found;
+	ictx->entry = entries[cur_entry];
+	ictx->entry_nr = cur_entry;
+	ictx->is_match = 1;
+	ntfs_debug("Done (found).");
+	return 0;
+filename:
 	/*
 	 * Now do a binary search through the index entries looking for the
 	 * correct entry or if not found for the index entry whose sub-node
@@ -882,8 +981,8 @@ found:
 		 * Not a perfect match, need to do full blown collation so we
 		 * know which way in the B+tree we have to go.
 		 */
-		rc = ntfs_collate(idx_ni->vol, idx_ni->collation_rule, key,
-				key_len, &ie->key, le16_to_cpu(ie->key_length));
+		rc = ntfs_collate_filename(idx_ni->vol, key, key_len,
+				&ie->key, le16_to_cpu(ie->key_length));
 		/*
 		 * If @key collates before the key of the current entry, need
 		 * to search on the left.
@@ -1717,6 +1816,7 @@ retry:
 				ni->attr_list_size - ((u8*)al_entry -
 				ni->attr_list));
 	ni->attr_list_size = new_al_size;
+	ntfs_attr_list_index_invalidate(ni);
 	/* Set up the attribute list entry. */
 	al_entry->type = AT_INDEX_ALLOCATION;
 	al_entry->length = cpu_to_le16(al_entry_len);
@@ -61,6 +61,7 @@
 
 #include "ntfs.h"
 #include "ntfs_attr.h"
+#include "ntfs_collate.h"
 #include "ntfs_debug.h"
 #include "ntfs_dir.h"
 #include "ntfs_hash.h"
@@ -147,6 +148,7 @@ static inline void __ntfs_inode_init(ntfs_volume *vol, ntfs_inode *ni)
 	ni->block_size_shift = vol->sector_size_shift;
 	lck_spin_init(&ni->size_lock, ntfs_lock_grp, ntfs_lock_attr);
 	ni->allocated_size = ni->data_size = ni->initialized_size = 0;
+	ni->data_write_gen = 0;
 	ni->seq_no = 0;
 	ni->link_count = 0;
 	ni->uid = vol->uid;
@@ -170,6 +172,9 @@ static inline void __ntfs_inode_init(ntfs_volume *vol, ntfs_inode *ni)
 	ni->attr_list_alloc = 0;
 	ni->attr_list = NULL;
 	ntfs_rl_init(&ni->attr_list_rl);
+	ni->attr_list_index = NULL;
+	ni->attr_list_index_nr = 0;
+	ni->attr_list_index_alloc = 0;
 	ni->last_set_bit = -1;
 	ni->vcn_size = 0;
 	ni->collation_rule = 0;
@@ -1604,6 +1609,12 @@ errno_t ntfs_inode_afpinfo_write(ntfs_inode *ni)
 		 * removal.
 		 */
 		afp_ni->link_count = 0;
+		/*
+		 * The cached backup time and Finder info are the defaults which
+		 * is exactly what a missing AfpInfo means so they are in sync.
+		 */
+		NInoClearDirtyBackupTime(ni);
+		NInoClearDirtyFinderInfo(ni);
 		/*
 		 * Update the last_mft_change_time (ctime) in the inode as
 		 * named stream/extended attribute semantics expect on OS X.
@@ -1696,6 +1707,75 @@ err:
 	return err;
 }
 
+/**
+ * ntfs_inode_afpinfo_update - write back the AfpInfo now or at the next sync
+ * @ni:		base ntfs inode whose cached AfpInfo has been modified
+ *
+ * The caller has modified the cached backup time and/or Finder info of the
+ * base ntfs inode @ni and marked them dirty.  Arrange for the AfpInfo
+ * attribute to be brought up to date.
+ *
+ * If the AfpInfo attribute exists, is resident, and there is no attribute
+ * inode loaded for it (which could have the old data cached), we leave the
+ * cache dirty and ntfs_inode_sync() will update the attribute value in place
+ * in the mft record when it syncs the standard information attribute.  This
+ * means that the usual Finder info and backup time updates do not instantiate
+ * an attribute inode and vnode for the AFP_AfpInfo named stream of every file
+ * touched and that repeated updates are coalesced.
+ *
+ * Otherwise, i.e. if the attribute needs to be created, deleted, or resized,
+ * or if it is non-resident, we call ntfs_inode_afpinfo_write() to update it
+ * now as ntfs_inode_sync() cannot obtain attribute inodes when called from
+ * VNOP_RECLAIM().
+ *
+ * Return 0 on success and errno on error.
+ *
+ * Locking: Caller must hold @ni->lock for writing.
+ */
+errno_t ntfs_inode_afpinfo_update(ntfs_inode *ni)
+{
+	ntfs_inode *afp_ni;
+	MFT_RECORD *m;
+	ntfs_attr_search_ctx *actx;
+	BOOL defer;
+
+	ntfs_debug("Entering for mft_no 0x%llx.",
+			(unsigned long long)ni->mft_no);
+	if (NInoEncrypted(ni) || !NInoValidBackupTime(ni) ||
+			!NInoValidFinderInfo(ni) ||
+			(ntfs_utc2ad(ni->backup_time) ==
+			const_cpu_to_sle32(INT32_MIN) &&
+			ntfs_finder_info_is_unused(ni)))
+		return ntfs_inode_afpinfo_write(ni);
+	if (!ntfs_attr_inode_lookup(ni, AT_DATA, NTFS_SFM_AFPINFO_NAME, 11,
+			FALSE, &afp_ni)) {
+		(void)vnode_put(afp_ni->vn);
+		return ntfs_inode_afpinfo_write(ni);
+	}
+	/*
+	 * Any failure here simply means we cannot defer the update so leave it
+	 * to ntfs_inode_afpinfo_write() to do the work and report errors.
+	 */
+	if (ntfs_mft_record_map(ni, &m))
+		return ntfs_inode_afpinfo_write(ni);
+	defer = FALSE;
+	actx = ntfs_attr_search_ctx_get(ni, m);
+	if (actx) {
+		if (!ntfs_attr_lookup(AT_DATA, NTFS_SFM_AFPINFO_NAME, 11, 0,
+				NULL, 0, actx) && !actx->a->non_resident &&
+				!(actx->a->flags & ATTR_IS_ENCRYPTED) &&
+				le32_to_cpu(actx->a->value_length) >=
+				sizeof(AFPINFO))
+			defer = TRUE;
+		ntfs_attr_search_ctx_put(actx);
+	}
+	ntfs_mft_record_unmap(ni);
+	if (!defer)
+		return ntfs_inode_afpinfo_write(ni);
+	ntfs_debug("Done (deferred to ntfs_inode_sync()).");
+	return 0;
+}
+
 /**
  * ntfs_inode_read - read an inode from its device
  * @ni:		ntfs inode to read
@@ -2210,11 +2290,11 @@ no_data_attr_special_case:
 			goto err;
 		}
 		/*
-		 * The attribute is non-resident.  If this is a regular file
-		 * inode and its data size is less than or equal to
-		 * MAXPATHLEN it could actually be a symbolic link.  In this
-		 * case we need to read the AFP_AfpInfo attribute now.
-		 * Otherwise postpone it till later when it is actually needed.
+		 * The attribute is non-resident.  Read it now anyway so that
+		 * the backup time and Finder info are always cached, both
+		 * because a small regular file could actually be a symbolic
+		 * link and because VNOP_GETATTR() wants them for every file
+		 * when the Finder lists a directory.
 		 *
 		 * We read it in by hand as it will likely not be modified so
 		 * no point in wasting system resources by instantiating an
@@ -2222,8 +2302,6 @@ no_data_attr_special_case:
 		 * base inode yet thus cannot obtain an attribute inode at this
 		 * point in time even if we wanted to.
 		 */
-		if (!S_ISREG(ni->mode) || ni->data_size > MAXPATHLEN)
-			goto done;
 		/*
 		 * We only need the AFPINFO structure so ignore any further
 		 * data there may be.
@@ -3146,6 +3224,33 @@ err:
 	return err;
 }
 
+/**
+ * ntfs_inode_dirty_list_add - put an ntfs inode on the dirty inode list
+ * @ni:		ntfs inode to add
+ *
+ * Add the ntfs inode @ni to the tail of the dirty inode list of its volume
+ * unless it is on the list already.  ntfs_sync() only syncs the inodes on the
+ * list thus this has to be called whenever the metadata or the data of @ni is
+ * modified.  The Dirty* flag setters do this implicitly.
+ *
+ * Locking: Caller must not hold the dirty_inodes_lock of the volume nor any
+ *	    spin lock, e.g. @ni->size_lock, as we may block on the mutex.
+ */
+void ntfs_inode_dirty_list_add(ntfs_inode *ni)
+{
+	ntfs_volume *vol = ni->vol;
+
+	if (NInoOnDirtyList(ni))
+		return;
+	lck_mtx_lock(&vol->dirty_inodes_lock);
+	if (!NInoOnDirtyList(ni) && !NInoReclaim(ni)) {
+		NInoSetOnDirtyList(ni);
+		TAILQ_INSERT_TAIL(&vol->dirty_inodes, ni, dirty);
+		vol->nr_dirty_inodes++;
+	}
+	lck_mtx_unlock(&vol->dirty_inodes_lock);
+}
+
 /**
  * ntfs_inode_free - free an ntfs inode
  * @ni:		ntfs inode to free
@@ -3203,6 +3308,8 @@ static inline void ntfs_inode_free(ntfs_inode *ni)
 		IODelete(ni->rl.rl, ntfs_rl_element, ni->rl.alloc_count);
 	if (ni->attr_list_alloc)
 		IOFree(ni->attr_list, ni->attr_list_alloc);
+	if (ni->attr_list_index_alloc)
+		IOFreeData(ni->attr_list_index, ni->attr_list_index_alloc);
 	if (ni->attr_list_rl.alloc_count)
 		IODelete(ni->attr_list_rl.rl, ntfs_rl_element, ni->attr_list_rl.alloc_count);
 	ntfs_dirhints_put(ni, 0);
@@ -3210,6 +3317,14 @@ static inline void ntfs_inode_free(ntfs_inode *ni)
 			ni->name != NTFS_SFM_RESOURCEFORK_NAME &&
 			ni->name != NTFS_SFM_AFPINFO_NAME)
 		IOFree(ni->name, (ni->name_len + 1) * sizeof(ntfschar));
+	/* Remove the inode from the dirty inode list of the volume. */
+	lck_mtx_lock(&vol->dirty_inodes_lock);
+	if (NInoOnDirtyList(ni)) {
+		NInoClearOnDirtyList(ni);
+		TAILQ_REMOVE(&vol->dirty_inodes, ni, dirty);
+		vol->nr_dirty_inodes--;
+	}
+	lck_mtx_unlock(&vol->dirty_inodes_lock);
 	/* Remove the inode from the list of inodes in the volume. */
 	lck_mtx_lock(&vol->inodes_lock);
 	LIST_REMOVE(ni, inodes);
@@ -3453,24 +3568,420 @@ static errno_t ntfs_inode_data_sync(ntfs_inode *ni, const int ioflags)
 	return err;
 }
 
-struct fn_list_entry;
-
+/*
+ * A pending update of the directory index entry of one of the filenames of an
+ * inode (see ntfs_inode_sync_to_mft_record()).  The filename attribute value
+ * is copied into @fn which is followed by the variable length filename.
+ */
 typedef struct {
-    SLIST_ENTRY(fn_list_entry) list_entry;
-    unsigned size;
-} fn_list_entry_hdr_t;
+	ntfs_inode *ni;			/* Inode the filename belongs to. */
+	sle64 creation_time;		/* New times if @dirty_times. */
+	sle64 last_data_change_time;
+	sle64 last_mft_change_time;
+	sle64 last_access_time;
+	sle64 allocated_size;		/* New sizes if @dirty_sizes. */
+	sle64 data_size;
+	FILE_ATTR_FLAGS file_attributes;/* New file attributes if
+					   @dirty_file_attributes. */
+	BOOL dirty_times;
+	BOOL dirty_file_attributes;
+	BOOL dirty_sizes;
+	unsigned size;			/* Size of @fn in bytes. */
+} ntfs_dirent_update_hdr;
 
-typedef struct fn_list_entry {
-    fn_list_entry_hdr_t hdr;
+struct _ntfs_dirent_update {
+	ntfs_dirent_update_hdr hdr;
 	FILENAME_ATTR fn;
-} fn_list_entry_t;
+};
+
+/**
+ * ntfs_dirent_update_free - free a pending directory index entry update
+ * @u:		update to free
+ */
+static void ntfs_dirent_update_free(ntfs_dirent_update *u)
+{
+	// A separate var is needed since IODelete is a macro and could have future check on the type
+	ntfs_dirent_update_hdr *hdr = &u->hdr;
+
+	IODelete(hdr, ntfs_dirent_update_hdr, u8, hdr->size);
+}
+
+/**
+ * ntfs_dirent_update_batch_add - add an update to a batch of updates
+ * @batch:	batch to add the update to
+ * @u:		update to add
+ *
+ * Append the pending directory index entry update @u to @batch, growing the
+ * array of updates as needed.
+ *
+ * Return 0 on success and ENOMEM if the array could not be grown.
+ */
+static errno_t ntfs_dirent_update_batch_add(ntfs_dirent_update_batch *batch,
+		ntfs_dirent_update *u)
+{
+	if (batch->nr == batch->alloc) {
+		ntfs_dirent_update **tmp;
+		unsigned new_alloc;
+
+		new_alloc = batch->alloc ? batch->alloc * 2 : 16;
+		tmp = IONew(ntfs_dirent_update*, new_alloc);
+		if (!tmp)
+			return ENOMEM;
+		if (batch->nr)
+			memcpy(tmp, batch->updates, batch->nr *
+					sizeof(ntfs_dirent_update*));
+		if (batch->alloc)
+			IODelete(batch->updates, ntfs_dirent_update*,
+					batch->alloc);
+		batch->updates = tmp;
+		batch->alloc = new_alloc;
+	}
+	batch->updates[batch->nr++] = u;
+	return 0;
+}
+
+/**
+ * ntfs_dirent_update_batch_truncate - discard updates at the end of a batch
+ * @batch:	batch to truncate
+ * @nr:		number of updates to keep
+ */
+static void ntfs_dirent_update_batch_truncate(ntfs_dirent_update_batch *batch,
+		const unsigned nr)
+{
+	while (batch->nr > nr)
+		ntfs_dirent_update_free(batch->updates[--batch->nr]);
+}
+
+/**
+ * ntfs_dirent_update_batch_free - free a batch of updates
+ * @batch:	batch to free
+ *
+ * Discard all updates still in @batch and free its array of updates leaving
+ * @batch empty and ready for reuse.
+ */
+void ntfs_dirent_update_batch_free(ntfs_dirent_update_batch *batch)
+{
+	ntfs_dirent_update_batch_truncate(batch, 0);
+	if (batch->alloc)
+		IODelete(batch->updates, ntfs_dirent_update*, batch->alloc);
+	batch->updates = NULL;
+	batch->alloc = 0;
+}
+
+/**
+ * ntfs_dirent_update_redirty - mark an inode dirty again after a failed update
+ * @u:		update which failed
+ *
+ * Set the Dirty* flags of the inode of @u that the update was meant to write
+ * to the directory index so that the update is retried at the next sync.
+ */
+static void ntfs_dirent_update_redirty(ntfs_dirent_update *u)
+{
+	if (u->hdr.dirty_times)
+		NInoSetDirtyTimes(u->hdr.ni);
+	if (u->hdr.dirty_file_attributes)
+		NInoSetDirtyFileAttributes(u->hdr.ni);
+	if (u->hdr.dirty_sizes)
+		NInoSetDirtySizes(u->hdr.ni);
+}
+
+/*
+ * Sort pending updates by parent directory and then in the collation order of
+ * the directory index so that each directory is visited once and its index is
+ * walked from left to right.
+ */
+static int ntfs_dirent_update_cmp(const void *a, const void *b)
+{
+	const ntfs_dirent_update *ua = *(ntfs_dirent_update* const*)a;
+	const ntfs_dirent_update *ub = *(ntfs_dirent_update* const*)b;
+	const MFT_REF pa = MREF_LE(ua->fn.parent_directory);
+	const MFT_REF pb = MREF_LE(ub->fn.parent_directory);
+
+	if (pa != pb)
+		return (pa > pb) - (pa < pb);
+	return ntfs_collate(ua->hdr.ni->vol, COLLATION_FILENAME, &ua->fn,
+			ua->hdr.size, &ub->fn, ub->hdr.size);
+}
+
+/**
+ * ntfs_dirent_update_batch_apply - update directory index entries in bulk
+ * @vol:	ntfs volume the updates belong to
+ * @batch:	batch of updates to apply
+ *
+ * Write the new times, sizes, and file attributes recorded in the pending
+ * updates in @batch into the matching directory index entries.  The updates
+ * are sorted by parent directory and then by filename collation so that each
+ * parent directory is opened and locked once and so that names following each
+ * other in the same leaf node of the directory index are found by stepping
+ * forward from the previous name instead of by a new lookup from the root of
+ * the B+tree.
+ *
+ * Names and directories that have been unlinked since the updates were
+ * gathered are skipped.  As explained in ntfs_inode_sync_to_mft_record(),
+ * failing to update an index entry is not fatal so on error the inode is
+ * marked dirty again so that the update is retried at the next sync.  The
+ * exception is a failure to look up a name in a directory index which is
+ * reported as an error and causes the volume to be marked as containing
+ * errors.
+ *
+ * All updates are freed, leaving @batch empty.
+ *
+ * Return 0 on success and the first lookup error on error.
+ *
+ * Locking: - Caller must not hold any inode locks.
+ *	    - Caller must ensure the inodes of the updates in @batch do not go
+ *	      away, e.g. by holding an iocount reference on their vnodes.
+ */
+errno_t ntfs_dirent_update_batch_apply(ntfs_volume *vol,
+		ntfs_dirent_update_batch *batch)
+{
+	ino64_t dir_mft_no;
+	ntfs_index_context *ictx;
+	ntfs_inode *ni, *dir_ni, *dir_ia_ni;
+	ntfs_dirent_update *u;
+	FILENAME_ATTR *fn;
+	unsigned i;
+	errno_t err, dir_err, ret;
+	BOOL have_dir, have_entry, modified;
+	static const char ies[] = "Failed to update directory index entry(ies) "
+			"of inode 0x%llx because %s (error %d).  Run chkdsk "
+			"or touch the inode again to retry the update.";
+
+	if (!batch->nr)
+		return 0;
+	ntfs_debug("Entering for %u updates.", batch->nr);
+	ictx = ntfs_index_ctx_alloc();
+	if (!ictx) {
+		ntfs_debug("Not enough memory to allocate an index context.  "
+				"Marking inodes dirty again, so that we try "
+				"again later.");
+		for (i = 0; i < batch->nr; i++)
+			ntfs_dirent_update_redirty(batch->updates[i]);
+		ntfs_dirent_update_batch_truncate(batch, 0);
+		return 0;
+	}
+	qsort(batch->updates, batch->nr, sizeof(ntfs_dirent_update*),
+			ntfs_dirent_update_cmp);
+	ret = 0;
+	dir_mft_no = 0;
+	dir_ni = dir_ia_ni = NULL;
+	dir_err = 0;
+	have_dir = have_entry = FALSE;
+	for (i = 0; i < batch->nr; i++) {
+		u = batch->updates[i];
+		ni = u->hdr.ni;
+		fn = &u->fn;
+		/*
+		 * Obtain the inode of the parent directory in which the
+		 * current name is indexed if we do not have it already.
+		 */
+		if (!have_dir || dir_mft_no != MREF_LE(fn->parent_directory)) {
+			if (have_entry) {
+				ntfs_index_ctx_put_reuse(ictx);
+				have_entry = FALSE;
+			}
+			if (dir_ni) {
+				lck_rw_unlock_exclusive(&dir_ia_ni->lock);
+				lck_rw_unlock_exclusive(&dir_ni->lock);
+				(void)vnode_put(dir_ia_ni->vn);
+				(void)vnode_put(dir_ni->vn);
+				dir_ni = NULL;
+			}
+			have_dir = TRUE;
+			dir_mft_no = MREF_LE(fn->parent_directory);
+			dir_err = ntfs_inode_get(vol, dir_mft_no, FALSE,
+					LCK_RW_TYPE_EXCLUSIVE, &dir_ni, NULL,
+					NULL);
+			if (dir_err) {
+				dir_ni = NULL;
+				/*
+				 * ENOENT means someone deleted the directory
+				 * (and possibly recreated a new inode) under
+				 * our feet.  This is not an error so simply
+				 * skip all names in the directory.
+				 */
+				if (dir_err == ENOENT)
+					dir_err = 0;
+				else
+					ntfs_error(vol->mp, ies,
+							(unsigned long long)
+							ni->mft_no, "opening "
+							"the parent directory "
+							"inode failed",
+							dir_err);
+			} else {
+				dir_err = ntfs_index_inode_get(dir_ni, I30, 4,
+						FALSE, &dir_ia_ni);
+				if (dir_err) {
+					ntfs_debug(ies, (unsigned long long)
+							ni->mft_no, "opening "
+							"the parent directory "
+							"index inode failed",
+							dir_err);
+					lck_rw_unlock_exclusive(&dir_ni->lock);
+					(void)vnode_put(dir_ni->vn);
+					dir_ni = NULL;
+				} else
+					lck_rw_lock_exclusive(&dir_ia_ni->lock);
+			}
+		}
+		if (!dir_ni) {
+			if (dir_err)
+				ntfs_dirent_update_redirty(u);
+			else
+				ntfs_debug("Skipping name as it and its "
+						"parent directory were "
+						"unlinked under our feet.");
+			continue;
+		}
+		/*
+		 * If the directory has changed identity it has been deleted
+		 * and recreated which means the directory entry we want to
+		 * update has been removed so skip this name.
+		 */
+		if (dir_ni->seq_no != MSEQNO_LE(fn->parent_directory)) {
+			ntfs_debug("Skipping name as it and its parent "
+					"directory were unlinked under our "
+					"feet.");
+			continue;
+		}
+		/*
+		 * If the previous name is in a leaf node, step forward through
+		 * the leaf until we reach the current name or a name which
+		 * collates after it, in which case the current name is not in
+		 * the index as a leaf has no sub-nodes.  If we run off the end
+		 * of the leaf or the previous name is in an index node, look
+		 * up the current name from the top.
+		 */
+		if (have_entry) {
+			int rc;
+
+			rc = ntfs_collate(vol, COLLATION_FILENAME, fn,
+					u->hdr.size, &ictx->entry->key,
+					le16_to_cpu(ictx->entry->key_length));
+			while (rc > 0 && !(ictx->entry->flags &
+					INDEX_ENTRY_NODE) && ictx->entry_nr <
+					ictx->nr_entries - 2) {
+				/* This cannot fail within the same leaf. */
+				(void)ntfs_index_lookup_next(&ictx);
+				rc = ntfs_collate(vol, COLLATION_FILENAME, fn,
+						u->hdr.size, &ictx->entry->key,
+						le16_to_cpu(ictx->entry->
+						key_length));
+			}
+			if (rc < 0) {
+				ntfs_debug("Skipping name as it was unlinked "
+						"under our feet.");
+				continue;
+			}
+			if (rc > 0) {
+				ntfs_index_ctx_put_reuse(ictx);
+				have_entry = FALSE;
+			}
+		}
+		if (!have_entry) {
+			ntfs_index_ctx_init(ictx, dir_ia_ni);
+			/* Get the index entry matching the current filename. */
+			err = ntfs_index_lookup(fn, u->hdr.size, &ictx);
+			if (err) {
+				ntfs_index_ctx_put_reuse(ictx);
+				/*
+				 * Someone unlinked the name (and possibly
+				 * recreated a new inode) under our feet.  This
+				 * is not an error so simply ignore this name
+				 * and continue to the next one.
+				 */
+				if (err == ENOENT) {
+					ntfs_debug("Skipping name as it was "
+							"unlinked under our "
+							"feet.");
+					continue;
+				}
+				ntfs_error(vol->mp, ies,
+						(unsigned long long)ni->mft_no,
+						"looking up the name in the "
+						"parent directory inode "
+						"failed", err);
+				if (err == ENOMEM)
+					ntfs_dirent_update_redirty(u);
+				else {
+					NVolSetErrors(vol);
+					if (!ret)
+						ret = err;
+				}
+				continue;
+			}
+			have_entry = TRUE;
+		}
+		if (ictx->entry->indexed_file !=
+				MK_LE_MREF(ni->mft_no, ni->seq_no)) {
+			ntfs_debug("Skipping name as it was unlinked under "
+					"our feet.");
+			continue;
+		}
+		/* Update the found index entry. */
+		fn = &ictx->entry->key.filename;
+		modified = FALSE;
+		if (u->hdr.dirty_file_attributes && fn->file_attributes !=
+				u->hdr.file_attributes) {
+			fn->file_attributes = u->hdr.file_attributes;
+			modified = TRUE;
+		}
+		if (u->hdr.dirty_times && (fn->creation_time !=
+				u->hdr.creation_time ||
+				fn->last_data_change_time !=
+				u->hdr.last_data_change_time ||
+				fn->last_mft_change_time !=
+				u->hdr.last_mft_change_time ||
+				fn->last_access_time !=
+				u->hdr.last_access_time)) {
+			fn->creation_time = u->hdr.creation_time;
+			fn->last_data_change_time =
+					u->hdr.last_data_change_time;
+			fn->last_mft_change_time = u->hdr.last_mft_change_time;
+			fn->last_access_time = u->hdr.last_access_time;
+			modified = TRUE;
+		}
+		if (u->hdr.dirty_sizes && (fn->allocated_size !=
+				u->hdr.allocated_size ||
+				fn->data_size != u->hdr.data_size)) {
+			fn->allocated_size = u->hdr.allocated_size;
+			fn->data_size = u->hdr.data_size;
+			modified = TRUE;
+		}
+		/*
+		 * If we changed anything, ensure the updates are written to
+		 * disk.
+		 */
+		if (modified)
+			ntfs_index_entry_mark_dirty(ictx);
+	}
+	if (have_entry)
+		ntfs_index_ctx_put_reuse(ictx);
+	if (dir_ni) {
+		lck_rw_unlock_exclusive(&dir_ia_ni->lock);
+		lck_rw_unlock_exclusive(&dir_ni->lock);
+		(void)vnode_put(dir_ia_ni->vn);
+		(void)vnode_put(dir_ni->vn);
+	}
+	ntfs_index_ctx_free(ictx);
+	ntfs_dirent_update_batch_truncate(batch, 0);
+	ntfs_debug("Done.");
+	return ret;
+}
 
 /**
  * ntfs_inode_sync_to_mft_record - update metadata with changes to ntfs inode
  * @ni:		ntfs inode the changes of which to update the metadata with
+ * @batch:	batch to defer the directory index entry updates to or NULL
  *
  * Sync all dirty cached data belonging/related to the ntfs inode @ni.
  *
+ * If @batch is NULL the directory index entries pointing to @ni are updated
+ * before returning.  Otherwise the updates are added to @batch and the caller
+ * applies them together with those of other inodes by calling
+ * ntfs_dirent_update_batch_apply().
+ *
  * Note: When called from reclaim (via VNOP_FSYNC() and hence ntfs_vnop_fsync()
  *	 and ntfs_inode_sync(), the vnode has a zero v_iocount and v_usecount
  *	 and vnode_isrecycled() is true.  Thus we cannot obtain any
@@ -3481,20 +3992,18 @@ typedef struct fn_list_entry {
  *
  * Return 0 on success and the error code on error.
  */
-static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni)
+static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni,
+		ntfs_dirent_update_batch *batch)
 {
 	sle64 creation_time, last_data_change_time, last_mft_change_time,
 			last_access_time, allocated_size, data_size;
-	ino64_t dir_mft_no;
 	ntfs_volume *vol = ni->vol;
 	MFT_RECORD *m;
 	ntfs_attr_search_ctx *actx;
 	ATTR_RECORD *a;
-	SLIST_HEAD(, fn_list_entry) fn_list;
-	struct fn_list_entry *next;
-	ntfs_index_context *ictx;
-	ntfs_inode *dir_ni, *dir_ia_ni;
-	FILENAME_ATTR *fn;
+	ntfs_dirent_update_batch local_batch;
+	ntfs_dirent_update *u;
+	unsigned batch_nr;
 	errno_t err;
 	FILE_ATTR_FLAGS file_attributes = 0;
 	BOOL ignore_errors, dirty_times, dirty_file_attributes, dirty_sizes;
@@ -3533,6 +4042,41 @@ static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni)
 	if (S_ISDIR(ni->mode))
 		dirty_sizes = FALSE;
 	dirty_set_file_bits = NInoTestClearDirtySetFileBits(ni);
+	/*
+	 * If the backup time and/or Finder info are dirty, update the AfpInfo
+	 * attribute in place.  ntfs_inode_afpinfo_update() only defers the
+	 * update to us when the attribute is resident so if it is not there
+	 * or not resident any more it has been deleted or rewritten since and
+	 * there is nothing left for us to do.
+	 */
+	if (NInoDirtyBackupTime(ni) || NInoDirtyFinderInfo(ni)) {
+		err = ntfs_attr_lookup(AT_DATA, NTFS_SFM_AFPINFO_NAME, 11, 0,
+				NULL, 0, actx);
+		if (err && err != ENOENT)
+			goto err;
+		a = actx->a;
+		if (!err && !a->non_resident &&
+				le32_to_cpu(a->value_length) >=
+				sizeof(AFPINFO)) {
+			ntfs_inode_afpinfo_sync((AFPINFO*)((u8*)a +
+					le16_to_cpu(a->value_offset)),
+					le32_to_cpu(a->value_length), ni);
+			NInoSetMrecNeedsDirtying(actx->ni);
+			/*
+			 * Syncing the Finder info can set FILE_ATTR_HIDDEN in
+			 * the file attributes.
+			 */
+			if (NInoTestClearDirtyFileAttributes(ni))
+				dirty_file_attributes = TRUE;
+		} else {
+			ntfs_debug("AfpInfo of inode 0x%llx is not resident "
+					"in the mft record, not updating it.",
+					(unsigned long long)ni->mft_no);
+			NInoClearDirtyBackupTime(ni);
+			NInoClearDirtyFinderInfo(ni);
+		}
+		ntfs_attr_search_ctx_reinit(actx);
+	}
 	/*
 	 * Update the access times/file attributes in the standard information
 	 * attribute.
@@ -3687,7 +4231,11 @@ static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni)
 		lck_rw_unlock_shared(&ni->lock);
 		goto done;
 	}
-	ictx = NULL;
+	if (!batch) {
+		local_batch = (ntfs_dirent_update_batch) { NULL, 0, 0 };
+		batch = &local_batch;
+	}
+	batch_nr = batch->nr;
 	ignore_errors = TRUE;
 	/*
 	 * Enumerate all filename attributes.  We do not reset the search
@@ -3712,15 +4260,17 @@ static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni)
 	 * it is in locked already due to the mapped mft record(s) of the file.
 	 *
 	 * Thus we go over all the filename attributes and copy them one by one
-	 * into a temporary buffer, then release the mft record of the file and
-	 * only then do the index lookups for each copied filename attribute.
+	 * into pending directory index entry updates together with the new
+	 * values, then release the mft record of the file and only then do the
+	 * index lookups in ntfs_dirent_update_batch_apply().
 	 * 
 	 * This is ugly but still a lot more efficient than having to drop and
 	 * re-map the mft record for the file for each filename!  And it does
-	 * have one advantage and that is that the root directory "." update
-	 * does not need to be treated specially.
+	 * have two advantages.  The root directory "." update does not need to
+	 * be treated specially.  And when syncing many inodes at once, e.g. in
+	 * ntfs_sync(), the updates of all the inodes can be gathered into one
+	 * batch and applied in directory and index order.
 	 */
-	SLIST_INIT(&fn_list);
 	do {
 		err = ntfs_attr_lookup(AT_FILENAME, AT_UNNAMED, 0, 0, NULL, 0,
 				actx);
@@ -3748,13 +4298,13 @@ static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni)
 			goto list_err;
 		}
 		/*
-		 * Allocate a new list entry, copy the current filename
-		 * attribute value into it, and attach it to the end of the
-		 * list.
+		 * Allocate a new update, copy the current filename attribute
+		 * value and the new values into it, and add it to the batch.
 		 */
 		unsigned size = le32_to_cpu(a->value_length);
-		next = (fn_list_entry_t*)IONew(fn_list_entry_hdr_t, u8, size);
-		if (!next) {
+		u = (ntfs_dirent_update*)IONew(ntfs_dirent_update_hdr, u8,
+				size);
+		if (!u) {
 			ntfs_error(vol->mp, ies, 
 					(unsigned long long)ni->mft_no,
 					"there was not enough memory to "
@@ -3763,208 +4313,60 @@ static errno_t ntfs_inode_sync_to_mft_record(ntfs_inode *ni)
 			err = ENOMEM;
 			goto list_err;
 		}
-		next->hdr.size = size;
-		memcpy(&next->fn, (u8*)a + le16_to_cpu(a->value_offset), size);
-		/*
-		 * It makes no difference in what order we process the names so
-		 * we just insert them all the the list head thus effectively
-		 * processing them in LIFO order.
-		 */
-		SLIST_INSERT_HEAD(&fn_list, next, hdr.list_entry);
+		u->hdr = (ntfs_dirent_update_hdr) {
+			.ni = ni,
+			.creation_time = creation_time,
+			.last_data_change_time = last_data_change_time,
+			.last_mft_change_time = last_mft_change_time,
+			.last_access_time = last_access_time,
+			.allocated_size = allocated_size,
+			.data_size = data_size,
+			.file_attributes = file_attributes,
+			.dirty_times = dirty_times,
+			.dirty_file_attributes = dirty_file_attributes,
+			.dirty_sizes = dirty_sizes,
+			.size = size,
+		};
+		memcpy(&u->fn, (u8*)a + le16_to_cpu(a->value_offset), size);
+		err = ntfs_dirent_update_batch_add(batch, u);
+		if (err) {
+			ntfs_dirent_update_free(u);
+			ntfs_error(vol->mp, ies,
+					(unsigned long long)ni->mft_no,
+					"there was not enough memory to "
+					"grow the batch of updates", err);
+			goto list_err;
+		}
 	} while (1);
 	/* We are done with the mft record so release it. */
 	ntfs_attr_search_ctx_put(actx);
 	ntfs_mft_record_unmap(ni);
 	lck_rw_unlock_shared(&ni->lock);
-	actx = NULL;
-	m = NULL;
 	/*
-	 * We have now gathered all the filenames into the @fn_list list and
-	 * are ready to start looking up each filename in its parent directory
-	 * index and updating the matching directory entry.
+	 * If the caller is batching the updates, they will apply them later.
+	 * Otherwise look up each filename in its parent directory index and
+	 * update the matching directory entry now.
 	 *
 	 * Note that because we currently hold no locks any of the filenames
 	 * we gathered can be unlinked() before we try to update them.  And
 	 * they can even be re-created with a different target mft record or
-	 * even with the same one but with an incremented sequence number.  We
-	 * need to take this into consideration when handling errors below.
-	 *
-	 * Start by allocating an index context for doing the index lookups.
+	 * even with the same one but with an incremented sequence number.
+	 * ntfs_dirent_update_batch_apply() takes this into consideration.
 	 */
-	ictx = ntfs_index_ctx_alloc();
-	if (!ictx) {
-		ntfs_debug(ies, (unsigned long long)ni->mft_no, "there was "
-				"not enough memory to allocate an index "
-				"context", ENOMEM);
-		err = ENOMEM;
-		goto list_err;
-	}
-	/*
-	 * We cannot use SLIST_FOREACH() as that is not safe wrt to removal of
-	 * the current element and we want to free each element as we go along
-	 * so we do not have to traverse the list a second time just to do the
-	 * freeing.
-	 */
-	dir_ni = NULL;
-	while (!SLIST_EMPTY(&fn_list)) {
-		next = SLIST_FIRST(&fn_list);
-		/*
-		 * We now have the next filename in @next->fn and
-		 * @next->size.
-		 */
-		fn = &next->fn;
-		dir_mft_no = MREF_LE(fn->parent_directory);
-		/*
-		 * Obtain the inode of the parent directory in which the
-		 * current name is indexed if we do not have it already.
-		 */
-		if (!dir_ni || dir_ni->mft_no != dir_mft_no) {
-			if (dir_ni) {
-				lck_rw_unlock_exclusive(&dir_ia_ni->lock);
-				lck_rw_unlock_exclusive(&dir_ni->lock);
-				(void)vnode_put(dir_ia_ni->vn);
-				(void)vnode_put(dir_ni->vn);
-			}
-			err = ntfs_inode_get(vol, dir_mft_no, FALSE,
-					LCK_RW_TYPE_EXCLUSIVE, &dir_ni, NULL,
-					NULL);
-			if (err) {
-				if (err != ENOENT) {
-					ntfs_error(vol->mp, ies,
-							(unsigned long long)
-							ni->mft_no, "opening "
-							"the parent directory "
-							"inode failed", err);
-					goto list_err;
-				}
-				/*
-				 * Someone deleted the directory (and possibly
-				 * recreated a new inode) under our feet.
-				 * This is not an error so simply ignore this
-				 * name and continue to the next one.
-				 */
-do_skip_name:
-				ntfs_debug("Skipping name as it and its "
-						"parent directory were "
-						"unlinked under our feet.");
-				dir_ni = NULL;
-				goto skip_name;
-			}
-			/*
-			 * If the directory has changed identity it has been
-			 * deleted and recreated which means the directory
-			 * entry we want to update has been removed so skip
-			 * this name.
-			 */
-			if (dir_ni->seq_no != MSEQNO_LE(fn->parent_directory)) {
-				lck_rw_unlock_exclusive(&dir_ni->lock);
-				vnode_put(dir_ni->vn);
-				goto do_skip_name;
-			}
-			err = ntfs_index_inode_get(dir_ni, I30, 4, FALSE,
-					&dir_ia_ni);
-			if (err) {
-				ntfs_debug(ies, (unsigned long long)ni->mft_no,
-						"opening the parent directory "
-						"index inode failed", err);
-				lck_rw_unlock_exclusive(&dir_ni->lock);
-				(void)vnode_put(dir_ni->vn);
-				goto list_err;
-			}
-			lck_rw_lock_exclusive(&dir_ia_ni->lock);
-		}
-		ntfs_index_ctx_init(ictx, dir_ia_ni);
-		/* Get the index entry matching the current filename. */
-		err = ntfs_index_lookup(fn, next->hdr.size, &ictx);
-		if (err || ictx->entry->indexed_file !=
-				MK_LE_MREF(ni->mft_no, ni->seq_no)) {
-			if (err && err != ENOENT) {
-				ntfs_error(vol->mp, ies,
-						(unsigned long long)ni->mft_no,
-						"looking up the name in the "
-						"parent directory inode "
-						"failed", err);
-				if (err != ENOMEM)
-					ignore_errors = FALSE;
-				ntfs_index_ctx_put_reuse(ictx);
-				lck_rw_unlock_exclusive(&dir_ia_ni->lock);
-				lck_rw_unlock_exclusive(&dir_ni->lock);
-				(void)vnode_put(dir_ia_ni->vn);
-				(void)vnode_put(dir_ni->vn);
-				goto list_err;
-			}
-			/*
-			 * Someone unlinked the name (and possibly recreated a
-			 * new inode) under our feet.  This is not an error so
-			 * simply ignore this name and continue to the next
-			 * one.
-			 */
-			ntfs_debug("Skipping name as it was unlinked under "
-					"our feet.");
-			goto put_skip_name;
-		}
-		/* Update the found index entry. */
-		fn = &ictx->entry->key.filename;
-		modified = FALSE;
-		if (dirty_file_attributes && fn->file_attributes !=
-				file_attributes) {
-			fn->file_attributes = file_attributes;
-			modified = TRUE;
-		}
-		if (dirty_times && (fn->creation_time != creation_time ||
-				fn->last_data_change_time !=
-				last_data_change_time ||
-				fn->last_mft_change_time !=
-				last_mft_change_time ||
-				fn->last_access_time != last_access_time)) {
-			fn->creation_time = creation_time;
-			fn->last_data_change_time = last_data_change_time;
-			fn->last_mft_change_time = last_mft_change_time;
-			fn->last_access_time = last_access_time;
-			modified = TRUE;
-		}
-		if (dirty_sizes && (fn->allocated_size != allocated_size ||
-				fn->data_size != data_size)) {
-			fn->allocated_size = allocated_size;
-			fn->data_size = data_size;
-			modified = TRUE;
-		}
-		/*
-		 * If we changed anything, ensure the updates are written to
-		 * disk.
-		 */
-		if (modified)
-			ntfs_index_entry_mark_dirty(ictx);
-put_skip_name:
-		ntfs_index_ctx_put_reuse(ictx);
-skip_name:
-		SLIST_REMOVE_HEAD(&fn_list, hdr.list_entry);
-
-        // A separate var is needed since IODelete is a macro and could have future check on the type
-        fn_list_entry_hdr_t* hdr = &next->hdr;
-        IODelete(hdr, fn_list_entry_hdr_t, u8, hdr->size);
-	}
-	if (dir_ni) {
-		lck_rw_unlock_exclusive(&dir_ia_ni->lock);
-		lck_rw_unlock_exclusive(&dir_ni->lock);
-		(void)vnode_put(dir_ia_ni->vn);
-		(void)vnode_put(dir_ni->vn);
+	if (batch == &local_batch) {
+		err = ntfs_dirent_update_batch_apply(vol, batch);
+		ntfs_dirent_update_batch_free(batch);
+		if (err)
+			return err;
 	}
-	ntfs_index_ctx_free(ictx);
 done:
 	ntfs_debug("Done.");
 	return 0;
 list_err:
-	/* Free all the copied filenames. */
-	while (!SLIST_EMPTY(&fn_list)) {
-		next = SLIST_FIRST(&fn_list);
-		SLIST_REMOVE_HEAD(&fn_list, hdr.list_entry);
-
-        fn_list_entry_hdr_t* hdr = &next->hdr;
-        IODelete(hdr, fn_list_entry_hdr_t, u8, hdr->size);
-	}
-	if (ictx)
-		ntfs_index_ctx_free(ictx);
+	/* Free all the updates we added to the batch. */
+	ntfs_dirent_update_batch_truncate(batch, batch_nr);
+	if (batch == &local_batch)
+		ntfs_dirent_update_batch_free(batch);
 err:
 	if (actx)
 		ntfs_attr_search_ctx_put(actx);
@@ -3997,9 +4399,16 @@ err:
  * @ni:				ntfs inode to synchronize to disk
  * @ioflags:			flags describing the i/o request
  * @skip_mft_record_sync:	do not sync the mft record(s) to disk
+ * @batch:			batch to defer directory index updates to or NULL
  *
  * Write all dirty cached data belonging/related to the ntfs inode @ni to disk.
  *
+ * If @batch is not NULL, the updates of the directory index entries pointing
+ * to @ni are added to @batch instead of being done immediately and the caller
+ * must apply them with ntfs_dirent_update_batch_apply() whilst the inode is
+ * still pinned.  This is what ntfs_sync() does to update the directory entries
+ * of all the inodes it syncs in directory and index order.
+ *
  * If @ioflags has the IO_SYNC bit set, wait for all i/o to complete before
  * returning.
  *
@@ -4025,8 +4434,10 @@ err:
  * TODO:/FIXME: For symbolic link vnodes this currently does not sync much.  We
  * really need to sync the raw vnode for symbolic links.
  *
- * TODO:/FIXME: At present we do not sync the AFP_AfpInfo named stream inode
- * when syncing the base inode.
+ * Note the AFP_AfpInfo named stream is only updated here when it is resident
+ * in which case its value is updated in the mft record directly from the
+ * cached backup time and Finder info (see ntfs_inode_afpinfo_update()).  All
+ * other updates of it happen immediately via ntfs_inode_afpinfo_write().
  *
  * TODO:/FIXME: In general when a vnode is being synced we should ensure that
  * all associated (loaded) vnodes are synced also, i.e. not just the extent
@@ -4054,6 +4465,12 @@ err:
  * have no mechanism for determining whether file data is dirty or not and thus
  * we have to unconditionally perform an msync() on the entire file data.
  *
+ * What we do track is which inodes may need syncing at all: setting any of
+ * the Dirty* flags, writing to or dirtying pages of an inode, and mapping an
+ * inode writable all put the inode on the dirty inode list of the volume (see
+ * ntfs_inode_dirty_list_add()) and ntfs_sync() only calls ntfs_inode_sync()
+ * for the inodes on that list rather than for every vnode of the volume.
+ *
  * The msync() can in turn cause the mft record containing the attribute to be
  * dirtied, for example because the attribute is resident and the msync()
  * caused the data to go from the VM page cache into the mft record thus
@@ -4090,7 +4507,7 @@ err:
  * $MFT.
  */
 errno_t ntfs_inode_sync(ntfs_inode *ni, const int ioflags,
-		const BOOL skip_mft_record_sync)
+		const BOOL skip_mft_record_sync, ntfs_dirent_update_batch *batch)
 {
 	ntfs_inode *base_ni;
 	errno_t err;
@@ -4155,7 +4572,7 @@ errno_t ntfs_inode_sync(ntfs_inode *ni, const int ioflags,
 	 * modified.
 	 */
 	if (ni == base_ni && NInoDirty(ni)) {
-		err = ntfs_inode_sync_to_mft_record(ni);
+		err = ntfs_inode_sync_to_mft_record(ni, batch);
 		if (err)
 			return err;
 	}
@@ -4168,35 +4585,12 @@ errno_t ntfs_inode_sync(ntfs_inode *ni, const int ioflags,
 		return 0;
 	}
 	/*
-	 * If this inode does not have an attribute list attribute there is
-	 * only one mft record associated with the inode thus we can write it
-	 * now if it is dirty and we are finished if not.
-	 *
-	 * If the inode does have an attribute list attribute then we need to
-	 * go through all loaded mft records, starting with the base inode and
-	 * looking at all its attached extent inodes and we need to write the
-	 * ones that have dirty mft records out one by one.
+	 * Write the base mft record and, if the inode has an attribute list
+	 * attribute, all loaded extent mft records if they are dirty.  This
+	 * is group committed together with any concurrent callers so that
+	 * many concurrent fsync()s result in one sorted batch of $MFT writes.
 	 */
-	err = ntfs_mft_record_sync(base_ni);
-	if (NInoAttrList(base_ni)) {
-		int nr_extents;
-
-		lck_mtx_lock(&base_ni->extent_lock);
-		nr_extents = base_ni->nr_extents;
-		if (nr_extents > 0) {
-			ntfs_inode **extent_nis = base_ni->extent_nis;
-			errno_t err2;
-			int i;
-
-			ntfs_debug("Syncing %d extent inodes.", nr_extents);
-			for (i = 0; i < nr_extents; i++) {
-				err2 = ntfs_mft_record_sync(extent_nis[i]);
-				if (err2 && (!err || err == ENOMEM))
-					err = err2;
-			}
-		}
-		lck_mtx_unlock(&base_ni->extent_lock);
-	}
+	err = ntfs_mft_records_group_sync(base_ni);
 	if (!err) {
 		ntfs_debug("Done.");
 		return 0;
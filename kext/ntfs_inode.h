@@ -62,6 +62,8 @@ struct _ntfs_dirhint;
 /* Structures associated with ntfs inode caching. */
 typedef LIST_HEAD(, _ntfs_inode) ntfs_inode_list_head;
 typedef LIST_ENTRY(_ntfs_inode) ntfs_inode_list_entry;
+typedef TAILQ_HEAD(, _ntfs_inode) ntfs_inode_tailq_head;
+typedef TAILQ_ENTRY(_ntfs_inode) ntfs_inode_tailq_entry;
 
 #include "ntfs_layout.h"
 #include "ntfs_runlist.h"
@@ -102,6 +104,11 @@ struct _ntfs_inode {
 	s64 allocated_size;	/* Copy from the attribute record. */
 	s64 data_size;		/* Copy from the attribute record. */
 	s64 initialized_size;	/* Copy from the attribute record. */
+	SInt32 data_write_gen;	/* Incremented atomically each time data is
+				   about to be written to the clusters of the
+				   attribute.  Used by ntfs_attr_defrag() to
+				   detect writes whilst it copies the data
+				   without holding the inode lock. */
 	u32 flags;		/* NTFS specific flags describing this inode.
 				   See ntfs_inode_flags_shift below. */
 	ino64_t mft_no;		/* Number of the mft record / inode. */
@@ -218,6 +225,15 @@ struct _ntfs_inode {
 				   buffer. */
 	u8 *attr_list;		/* Attribute list value itself. */
 	ntfs_runlist attr_list_rl; /* Run list for the attribute list value. */
+	u32 *attr_list_index;	/* Byte offsets of the entries in @attr_list,
+				   built on demand for large attribute lists
+				   so they can be binary searched.  Like
+				   @attr_list itself this is protected by the
+				   base mft record being mapped. */
+	u32 attr_list_index_nr;	/* Number of offsets in @attr_list_index or
+				   zero if the index needs to be (re)built. */
+	u32 attr_list_index_alloc; /* Number of bytes allocated for the
+				   @attr_list_index buffer. */
 	union {
 		struct { /* It is a directory, $MFT, or an index inode. */
 			s64 last_set_bit;	/* The last bit that is set in
@@ -289,6 +305,9 @@ struct _ntfs_inode {
 	};
 	ntfs_inode_list_entry inodes;	/* List of ntfs inodes attached to the
 					   ntfs volume. */
+	ntfs_inode_tailq_entry dirty;	/* List of ntfs inodes of the ntfs
+					   volume that need syncing, valid
+					   whilst NInoOnDirtyList() is true. */
 };
 
 /*
@@ -379,6 +398,13 @@ typedef enum {
 				      info that needs to be writte to the
 				      AFP_AfpInfo stream (after creating it
 				      if it does not exist already) (f, d). */
+	NI_OnDirtyList,		/* 1: Ntfs inode is on the dirty inode list of
+				      the ntfs volume (see ntfs_sync()). */
+	NI_MmapWritable,	/* 1: Vnode of the ntfs inode is mapped
+				      writable so its pages can be dirtied
+				      without us noticing and the inode has to
+				      stay on the dirty inode list until it is
+				      unmapped (f, a). */
 } ntfs_inode_flags_shift;
 
 /*
@@ -416,6 +442,43 @@ static inline u32 NInoTestClear##flag(ntfs_inode *ni)			\
 			(UInt32*)&ni->flags) >> NI_##flag) & 1;		\
 }
 
+__private_extern__ void ntfs_inode_dirty_list_add(ntfs_inode *ni);
+
+/*
+ * As DEFINE_NINO_BIT_OPS() and DEFINE_NINO_TEST_AND_SET_BIT_OPS() combined
+ * but setting the bit also puts the ntfs inode on the dirty inode list of its
+ * volume so that ntfs_sync() gets to write it out.  As that takes a mutex the
+ * setters must not be called with a spin lock held.
+ */
+#define DEFINE_NINO_DIRTY_BIT_OPS(flag)					\
+static inline u32 NIno##flag(ntfs_inode *ni)				\
+{									\
+	return (ni->flags >> NI_##flag) & 1;				\
+}									\
+static inline void NInoSet##flag(ntfs_inode *ni)			\
+{									\
+	(void)OSBitOrAtomic((u32)1 << NI_##flag, (UInt32*)&ni->flags);	\
+	ntfs_inode_dirty_list_add(ni);					\
+}									\
+static inline void NInoClear##flag(ntfs_inode *ni)			\
+{									\
+	(void)OSBitAndAtomic(~((u32)1 << NI_##flag), (UInt32*)&ni->flags); \
+}									\
+static inline u32 NInoTestSet##flag(ntfs_inode *ni)			\
+{									\
+	u32 old;							\
+									\
+	old = ((u32)OSBitOrAtomic((u32)1 << NI_##flag,			\
+			(UInt32*)&ni->flags) >> NI_##flag) & 1;		\
+	ntfs_inode_dirty_list_add(ni);					\
+	return old;							\
+}									\
+static inline u32 NInoTestClear##flag(ntfs_inode *ni)			\
+{									\
+	return ((u32)OSBitAndAtomic(~((u32)1 << NI_##flag),		\
+			(UInt32*)&ni->flags) >> NI_##flag) & 1;		\
+}
+
 /* Emit the ntfs inode bitops functions. */
 DEFINE_NINO_BIT_OPS(Locked)
 DEFINE_NINO_BIT_OPS(Alloc)
@@ -443,20 +506,16 @@ DEFINE_NINO_TEST_AND_SET_BIT_OPS(NotMrecPageOwner)
 DEFINE_NINO_BIT_OPS(MrecNeedsDirtying)
 DEFINE_NINO_TEST_AND_SET_BIT_OPS(MrecNeedsDirtying)
 DEFINE_NINO_BIT_OPS(Raw)
-DEFINE_NINO_BIT_OPS(DirtyTimes)
-DEFINE_NINO_TEST_AND_SET_BIT_OPS(DirtyTimes)
-DEFINE_NINO_BIT_OPS(DirtyFileAttributes)
-DEFINE_NINO_TEST_AND_SET_BIT_OPS(DirtyFileAttributes)
-DEFINE_NINO_BIT_OPS(DirtySizes)
-DEFINE_NINO_TEST_AND_SET_BIT_OPS(DirtySizes)
-DEFINE_NINO_BIT_OPS(DirtySetFileBits)
-DEFINE_NINO_TEST_AND_SET_BIT_OPS(DirtySetFileBits)
+DEFINE_NINO_DIRTY_BIT_OPS(DirtyTimes)
+DEFINE_NINO_DIRTY_BIT_OPS(DirtyFileAttributes)
+DEFINE_NINO_DIRTY_BIT_OPS(DirtySizes)
+DEFINE_NINO_DIRTY_BIT_OPS(DirtySetFileBits)
 DEFINE_NINO_BIT_OPS(ValidBackupTime)
-DEFINE_NINO_BIT_OPS(DirtyBackupTime)
-DEFINE_NINO_TEST_AND_SET_BIT_OPS(DirtyBackupTime)
+DEFINE_NINO_DIRTY_BIT_OPS(DirtyBackupTime)
 DEFINE_NINO_BIT_OPS(ValidFinderInfo)
-DEFINE_NINO_BIT_OPS(DirtyFinderInfo)
-DEFINE_NINO_TEST_AND_SET_BIT_OPS(DirtyFinderInfo)
+DEFINE_NINO_DIRTY_BIT_OPS(DirtyFinderInfo)
+DEFINE_NINO_BIT_OPS(OnDirtyList)
+DEFINE_NINO_BIT_OPS(MmapWritable)
 
 /* Function to bulk check all the Dirty* flags at once. */
 static inline u32 NInoDirty(ntfs_inode *ni)
@@ -678,12 +737,41 @@ __private_extern__ errno_t ntfs_inode_afpinfo_read(ntfs_inode *ni);
 
 __private_extern__ errno_t ntfs_inode_afpinfo_write(ntfs_inode *ni);
 
+__private_extern__ errno_t ntfs_inode_afpinfo_update(ntfs_inode *ni);
+
 __private_extern__ errno_t ntfs_inode_inactive(ntfs_inode *ni);
 
 __private_extern__ errno_t ntfs_inode_reclaim(ntfs_inode *ni);
 
+/*
+ * Pending directory index entry updates gathered by ntfs_inode_sync() (see
+ * ntfs_inode.c).
+ */
+typedef struct _ntfs_dirent_update ntfs_dirent_update;
+
+/**
+ * ntfs_dirent_update_batch - a batch of directory index entry updates
+ * @updates:	array of pending updates
+ * @nr:		number of updates in @updates
+ * @alloc:	number of elements allocated for @updates
+ *
+ * Initialize to all zeroes before use.
+ */
+typedef struct {
+	ntfs_dirent_update **updates;
+	unsigned nr;
+	unsigned alloc;
+} ntfs_dirent_update_batch;
+
+__private_extern__ errno_t ntfs_dirent_update_batch_apply(ntfs_volume *vol,
+		ntfs_dirent_update_batch *batch);
+
+__private_extern__ void ntfs_dirent_update_batch_free(
+		ntfs_dirent_update_batch *batch);
+
 __private_extern__ errno_t ntfs_inode_sync(ntfs_inode *ni, const int sync,
-		const BOOL skip_mft_record_sync);
+		const BOOL skip_mft_record_sync,
+		ntfs_dirent_update_batch *batch);
 
 __private_extern__ errno_t ntfs_inode_get_name_and_parent_mref(ntfs_inode *ni,
 		BOOL have_parent, MFT_REF *mref, const char *name);
@@ -151,11 +151,12 @@ errno_t ntfs_cluster_alloc(ntfs_volume *vol, const VCN start_vcn,
 	ntfs_rl_element *rl = NULL;
 	upl_t upl = NULL;
 	upl_page_info_array_t pl;
-	u8 *b, *byte;
+	u8 *kaddr, *b, *byte;
+	u64 dirty_pages = 0;
 	int rlpos, rlcount, bsize;
+	u32 map_size = 0;
 	errno_t err;
 	u8 pass, done_zones, search_zone, bit;
-	BOOL need_writeback = FALSE;
 
 	ntfs_debug("Entering for start_vcn 0x%llx, count 0x%llx, start_lcn "
 			"0x%llx, zone %s_ZONE.", (unsigned long long)start_vcn,
@@ -293,41 +294,45 @@ errno_t ntfs_cluster_alloc(ntfs_volume *vol, const VCN start_vcn,
 			goto zone_pass_done;
 		}
 		if (upl) {
-			ntfs_page_unmap(lcnbmp_ni, upl, pl, need_writeback);
-			if (need_writeback) {
-				ntfs_debug("Marking page dirty.");
-				need_writeback = FALSE;
-			}
+			ntfs_page_unmap_range_ext(lcnbmp_ni, upl, pl,
+					map_size, FALSE, dirty_pages);
+			dirty_pages = 0;
 		}
-		err = ntfs_page_map(lcnbmp_ni, last_read_pos & ~PAGE_MASK_64,
-				&upl, &pl, &b, TRUE);
+		/*
+		 * Map a window of the bitmap rather than a single page so we
+		 * do not have to set up a page list for every page we scan.
+		 */
+		map_size = NTFS_PAGE_WINDOW_SIZE;
+		err = ntfs_page_map_range(lcnbmp_ni, last_read_pos &
+				~PAGE_MASK_64, &map_size, &upl, &pl, &kaddr,
+				TRUE);
 		if (err) {
 			ntfs_error(vol->mp, "Failed to map page.");
 			upl = NULL;
 			goto out;
 		}
 		bsize = last_read_pos & PAGE_MASK;
-		b += bsize;
-		bsize = PAGE_SIZE - bsize;
+		b = kaddr + bsize;
+		bsize = map_size - bsize;
 		if (last_read_pos + bsize > data_size)
 			bsize = data_size - last_read_pos;
 		bsize <<= 3;
 		lcn = bmp_pos & 7;
 		bmp_pos &= ~(LCN)7;
 		ntfs_debug("Before inner while loop: bsize %d, lcn 0x%llx, "
-				"bmp_pos 0x%llx, need_writeback is %s.", bsize,
+				"bmp_pos 0x%llx, dirty_pages 0x%llx.", bsize,
 				(unsigned long long)lcn,
 				(unsigned long long)bmp_pos,
-				need_writeback ? "true" : "false");
+				(unsigned long long)dirty_pages);
 		while (lcn < bsize && lcn + bmp_pos < zone_end) {
 			byte = b + (lcn >> 3);
 			ntfs_debug("In inner while loop: bsize %d, lcn "
 					"0x%llx, bmp_pos 0x%llx, "
-					"need_writeback is %s, byte ofs 0x%x, "
+					"dirty_pages 0x%llx, byte ofs 0x%x, "
 					"*byte 0x%x.", bsize,
 					(unsigned long long)lcn,
 					(unsigned long long)bmp_pos,
-					need_writeback ? "true" : "false",
+					(unsigned long long)dirty_pages,
 					(unsigned)(lcn >> 3), (unsigned)*byte);
 			/* Skip full bytes. */
 			if (*byte == 0xff) {
@@ -374,10 +379,14 @@ errno_t ntfs_cluster_alloc(ntfs_volume *vol, const VCN start_vcn,
 			vol->nr_free_clusters--;
 			if (vol->nr_free_clusters < 0)
 				vol->nr_free_clusters = 0;
-			/* We need to write this bitmap page to disk. */
-			need_writeback = TRUE;
-			ntfs_debug("*byte 0x%x, need_writeback is set.",
-					(unsigned)*byte);
+			/*
+			 * We need to write this bitmap page, and only this
+			 * one, of the mapped window to disk.
+			 */
+			dirty_pages |= 1ULL << ((byte - kaddr) >> PAGE_SHIFT);
+			ntfs_debug("*byte 0x%x, dirty_pages 0x%llx.",
+					(unsigned)*byte,
+					(unsigned long long)dirty_pages);
 			/*
 			 * Coalesce with previous run if adjacent LCNs.
 			 * Otherwise, append a new run.
@@ -515,10 +524,10 @@ errno_t ntfs_cluster_alloc(ntfs_volume *vol, const VCN start_vcn,
 		}
 		bmp_pos += bsize;
 		ntfs_debug("After inner while loop: bsize 0x%x, lcn 0x%llx, "
-				"bmp_pos 0x%llx, need_writeback is %s.", bsize,
+				"bmp_pos 0x%llx, dirty_pages 0x%llx.", bsize,
 				(unsigned long long)lcn,
 				(unsigned long long)bmp_pos,
-				need_writeback ? "true" : "false");
+				(unsigned long long)dirty_pages);
 		if (bmp_pos < zone_end) {
 			ntfs_debug("Continuing outer while loop, "
 					"bmp_pos 0x%llx, zone_end 0x%llx.",
@@ -765,11 +774,9 @@ out:
 		rl[rlpos].length = 0;
 	}
 	if (upl) {
-		ntfs_page_unmap(lcnbmp_ni, upl, pl, need_writeback);
-		if (need_writeback) {
-			ntfs_debug("Marking page dirty.");
-			need_writeback = FALSE;
-		}
+		ntfs_page_unmap_range_ext(lcnbmp_ni, upl, pl, map_size, FALSE,
+				dirty_pages);
+		dirty_pages = 0;
 	}
 	if (!err) {
 		/*
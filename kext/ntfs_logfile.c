@@ -38,6 +38,7 @@
 #include <sys/errno.h>
 #include <sys/ucred.h>
 #include <sys/ubc.h>
+#include <sys/vnode.h>
 
 #include <string.h>
 
@@ -56,6 +57,7 @@
 #include "ntfs_logfile.h"
 #include "ntfs_mst.h"
 #include "ntfs_page.h"
+#include "ntfs_runlist.h"
 #include "ntfs_types.h"
 #include "ntfs_volume.h"
 
@@ -783,12 +785,162 @@ BOOL ntfs_logfile_is_clean(ntfs_inode *ni, const RESTART_PAGE_HEADER *rp)
 	return TRUE;
 }
 
+/**
+ * ntfs_logfile_fill_direct - fill a part of $LogFile on disk bypassing the UBC
+ * @ni:		ntfs inode of loaded $LogFile journal to fill
+ * @ofs:	byte offset in @ni at which to start filling
+ * @cnt:	number of bytes to fill
+ *
+ * Fill the @cnt bytes starting at byte offset @ofs in $LogFile @ni with 0xff
+ * bytes, bypassing the page cache and writing each physically contiguous
+ * part with a single call to ntfs_dev_set().
+ *
+ * @ofs and @cnt must be multiples of the device sector size.
+ *
+ * Return 0 on success and errno on error.  ENOTSUP means that the runlist
+ * describes a sparse region in which case the caller needs to fall back to
+ * filling $LogFile via the UBC.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @ni.
+ *	    - Caller must hold @ni->lock for reading or writing.
+ *	    - The runlist lock of @ni must not be held by the caller.
+ */
+static errno_t ntfs_logfile_fill_direct(ntfs_inode *ni, s64 ofs, s64 cnt)
+{
+	ntfs_volume *vol = ni->vol;
+	errno_t err = 0;
+
+	ntfs_debug("Entering for ofs 0x%llx, cnt 0x%llx.",
+			(unsigned long long)ofs, (unsigned long long)cnt);
+	lck_rw_lock_shared(&ni->rl.lock);
+	while (cnt > 0) {
+		s64 clusters, size;
+		LCN lcn;
+
+		lcn = ntfs_attr_vcn_to_lcn_nolock(ni, ofs >>
+				vol->cluster_size_shift, FALSE, &clusters);
+		if (lcn < 0) {
+			if (lcn == LCN_HOLE)
+				err = ENOTSUP;
+			else if (lcn == LCN_ENOMEM)
+				err = ENOMEM;
+			else
+				err = EIO;
+			ntfs_error(vol->mp, "Failed to map $LogFile offset "
+					"0x%llx (error %d).",
+					(unsigned long long)ofs, err);
+			break;
+		}
+		/*
+		 * Work out the number of bytes that are physically contiguous
+		 * starting at @ofs.
+		 */
+		size = (clusters << vol->cluster_size_shift) -
+				(ofs & vol->cluster_size_mask);
+		if (size > cnt)
+			size = cnt;
+		err = ntfs_dev_set(vol, (lcn << vol->cluster_size_shift) +
+				(ofs & vol->cluster_size_mask), size, 0xff);
+		if (err) {
+			ntfs_error(vol->mp, "Failed to write $LogFile at "
+					"offset 0x%llx (error %d).",
+					(unsigned long long)ofs, err);
+			break;
+		}
+		ofs += size;
+		cnt -= size;
+	}
+	lck_rw_unlock_shared(&ni->rl.lock);
+	ntfs_debug("Done (error %d).", err);
+	return err;
+}
+
+/**
+ * ntfs_logfile_reset - reset $LogFile so that it is considered empty
+ * @ni:		ntfs inode of loaded $LogFile journal to reset
+ * @data_size:	data size of @ni
+ *
+ * Overwrite the restart pages, the first log record pages, and every other
+ * position at which ntfs_logfile_check() and Windows look for a restart page
+ * with 0xff bytes directly on disk.
+ *
+ * This is sufficient for the $LogFile to be considered empty both by us, when
+ * it is checked at the next mount, and by Windows, which will reinitialize
+ * the journal from scratch when it does not find a valid restart page, the
+ * same way it does for a $LogFile filled completely with 0xff bytes by chkdsk
+ * or by the formatter.  Any stale log record pages left further into the
+ * journal cannot be reached without a restart area pointing at them.
+ *
+ * Return 0 on success and errno on error.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @ni.
+ *	    - Caller must hold @ni->lock for reading or writing.
+ */
+static errno_t ntfs_logfile_reset(ntfs_inode *ni, s64 data_size)
+{
+	s64 size, pos, end;
+	ntfs_volume *vol = ni->vol;
+	unsigned log_page_size;
+	errno_t err;
+
+	ntfs_debug("Entering.");
+	size = data_size;
+	if (size > (s64)NtfsMaxLogFileSize)
+		size = NtfsMaxLogFileSize;
+	/* Use the same log page size as ntfs_logfile_check(). */
+	if (PAGE_SIZE >= NtfsDefaultLogPageSize &&
+			PAGE_SIZE <= NtfsDefaultLogPageSize * 2)
+		log_page_size = NtfsDefaultLogPageSize;
+	else
+		log_page_size = PAGE_SIZE;
+	if (log_page_size < vol->sector_size)
+		log_page_size = vol->sector_size;
+	size &= ~(s64)(log_page_size - 1);
+	/*
+	 * The window at the start of $LogFile that is filled completely covers
+	 * both restart pages for the largest system page size we may encounter
+	 * followed by the minimum number of log record pages.
+	 */
+	end = NtfsMaxLogSystemPageSize * 2 +
+			(s64)NtfsMinLogRecordPages * log_page_size;
+	if (end > size)
+		end = size;
+	/*
+	 * Write out any dirty cached pages and throw away all cached pages so
+	 * they cannot be written on top of the reset $LogFile later and so the
+	 * next read of $LogFile sees what is on disk.
+	 */
+	err = ubc_msync(ni->vn, 0, data_size, NULL, UBC_PUSHDIRTY | UBC_SYNC |
+			UBC_INVALIDATE);
+	if (err) {
+		ntfs_error(vol->mp, "Failed to write out and invalidate cached "
+				"pages of $LogFile (error %d).", err);
+		return err;
+	}
+	err = ntfs_logfile_fill_direct(ni, 0, end);
+	/*
+	 * Fill one log page at every power of two offset beyond the window as
+	 * that is where ntfs_logfile_check() looks for restart pages.
+	 */
+	for (pos = NTFS_BLOCK_SIZE; !err && pos < size; pos <<= 1) {
+		if (pos < end)
+			continue;
+		err = ntfs_logfile_fill_direct(ni, pos, log_page_size);
+	}
+	ntfs_debug("Done (error %d).", err);
+	return err;
+}
+
 /**
  * ntfs_logfile_empty - empty the contents of the $LogFile journal
  * @ni:		ntfs inode of loaded $LogFile journal to empty
  *
  * Empty the contents of the $LogFile journal @ni.
  *
+ * If ntfs_logfile_check() found the $LogFile to already be empty there is
+ * nothing to do.  Otherwise only the restart pages and a small window of log
+ * record pages are overwritten directly on disk (see ntfs_logfile_reset()).
+ *
  * Return 0 on success and errno on error.
  *
  * This function assumes that the $LogFile journal has already been consistency
@@ -814,7 +966,17 @@ errno_t ntfs_logfile_empty(ntfs_inode *ni)
 		lck_spin_lock(&ni->size_lock);
 		data_size = ni->data_size;
 		lck_spin_unlock(&ni->size_lock);
-		err = ntfs_attr_set(ni, 0, data_size, 0xff);
+		/*
+		 * Try the cheap reset first which only overwrites the parts of
+		 * $LogFile that matter.  If that fails for any reason fall back
+		 * to filling the whole of $LogFile via the UBC.
+		 */
+		err = ntfs_logfile_reset(ni, data_size);
+		if (err) {
+			ntfs_debug("Cheap reset of $LogFile failed (error "
+					"%d), filling it completely.", err);
+			err = ntfs_attr_set(ni, 0, data_size, 0xff);
+		}
 		lck_rw_unlock_shared(&ni->lock);
 		(void)vnode_put(ni->vn);
 		if (err) {
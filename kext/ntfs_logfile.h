@@ -75,6 +75,7 @@
 #define NtfsMaxLogFileSize	0x100000000ULL
 #define NtfsDefaultLogPageSize	4096
 #define NtfsMinLogRecordPages	48
+#define NtfsMaxLogSystemPageSize	0x10000
 
 /*
  * Log file restart page header (begins the restart area).
@@ -655,6 +655,332 @@ errno_t ntfs_mft_record_sync(ntfs_inode *ni)
 	return err;
 }
 
+/*
+ * A caller of ntfs_mft_records_group_sync() waiting for the mft records of its
+ * inode to be committed to disk.  These live on the stack of the caller and
+ * are queued on the volume in ntfs_volume->mft_sync_queue.
+ */
+struct _ntfs_mft_sync_waiter {
+	ntfs_mft_sync_waiter *next;	/* Next waiter in the queue. */
+	ntfs_inode *base_ni;		/* Base inode whose records to write. */
+	errno_t err;			/* Result of writing the records of
+					   @base_ni. */
+	BOOL done;			/* True once the commit has finished. */
+};
+
+/*
+ * The asynchronous writes issued by one ntfs_mft_records_commit().  @pending
+ * is the number of writes still in flight and is protected by @lock as it is
+ * decremented from the i/o completion handler.
+ */
+typedef struct {
+	lck_spin_t_ex lock;
+	unsigned pending;
+} ntfs_mft_commit;
+
+/*
+ * An mft record to be written by ntfs_mft_records_commit() together with the
+ * waiter it belongs to so that a write error is only reported to that waiter.
+ * For the first of several identical records, which is the one actually
+ * written, @commit and @err track the asynchronous write.
+ */
+typedef struct {
+	ino64_t mft_no;
+	ntfs_mft_sync_waiter *w;
+	ntfs_mft_commit *commit;
+	errno_t err;
+} ntfs_mft_sync_record;
+
+/**
+ * ntfs_mft_record_write_done - complete a write of ntfs_mft_records_commit()
+ * @arg:	the ntfs_mft_sync_record the write was issued for
+ * @err:	result of the write
+ *
+ * Called by the i/o completion handler of $MFT/$DATA, ntfs_buf_iodone(), and
+ * by ntfs_vnop_strategy() when it fails the i/o before issuing it, for each
+ * buffer written by ntfs_mft_records_commit().  Record the result of the write
+ * and wake up the committer once all its writes have completed.
+ *
+ * This is called from i/o completion context thus must not block.
+ */
+void ntfs_mft_record_write_done(void *arg, errno_t err)
+{
+	ntfs_mft_sync_record *rec = arg;
+	ntfs_mft_commit *commit = rec->commit;
+
+	lck_spin_lock(&commit->lock);
+	rec->err = err;
+	if (!--commit->pending)
+		wakeup(commit);
+	lck_spin_unlock(&commit->lock);
+}
+
+static int ntfs_mft_sync_record_cmp(const void *a, const void *b)
+{
+	const ino64_t x = ((const ntfs_mft_sync_record*)a)->mft_no;
+	const ino64_t y = ((const ntfs_mft_sync_record*)b)->mft_no;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * ntfs_mft_records_commit_waiter - write the mft records of one waiter
+ * @w:		waiter whose mft records to write
+ *
+ * Write the base mft record and all the loaded extent mft records of the inode
+ * of the waiter @w one by one via ntfs_mft_record_sync() and set @w->err to
+ * the first error encountered, preferring other errors over ENOMEM.
+ */
+static void ntfs_mft_records_commit_waiter(ntfs_mft_sync_waiter *w)
+{
+	ntfs_inode *base_ni = w->base_ni;
+	unsigned i;
+	errno_t err;
+
+	err = ntfs_mft_record_sync(base_ni);
+	if (err && (!w->err || w->err == ENOMEM))
+		w->err = err;
+	if (!NInoAttrList(base_ni))
+		return;
+	lck_mtx_lock(&base_ni->extent_lock);
+	for (i = 0; i < (unsigned)base_ni->nr_extents; i++) {
+		err = ntfs_mft_record_sync(base_ni->extent_nis[i]);
+		if (err && (!w->err || w->err == ENOMEM))
+			w->err = err;
+	}
+	lck_mtx_unlock(&base_ni->extent_lock);
+}
+
+/**
+ * ntfs_mft_records_commit - write the mft records of a batch of waiters
+ * @vol:	ntfs volume the waiters belong to
+ * @batch:	list of waiters whose mft records to write
+ *
+ * Collect the numbers of all loaded mft records, base and extent, belonging to
+ * the inodes of all waiters in @batch, sort them, and write all the dirty ones
+ * in ascending order so the device sees a single, mostly sequential, stream
+ * of writes to $MFT rather than one write per waiter in arrival order.
+ *
+ * The writes are all issued asynchronously with buf_bawrite() and then waited
+ * for together.  As an asynchronous write releases, and on error invalidates,
+ * the buffer on completion, the buffer cannot be used to obtain the result.
+ * Instead each buffer carries the ntfs_mft_sync_record it is written for in
+ * its file system private pointer, which ntfs_vnop_strategy() passes on to
+ * the i/o completion handler, which in turn records the result of the write
+ * via ntfs_mft_record_write_done().
+ *
+ * The result is returned in the @err field of each waiter.  A write error is
+ * only reported to the waiters whose inodes own the failed mft record.
+ *
+ * If mft records are smaller than sectors, or if we cannot allocate memory to
+ * sort the records, fall back to writing the records of each waiter in turn
+ * via ntfs_mft_record_sync().
+ */
+static void ntfs_mft_records_commit(ntfs_volume *vol,
+		ntfs_mft_sync_waiter *batch)
+{
+	ntfs_inode *mft_ni = vol->mft_ni;
+	ntfs_mft_sync_waiter *w;
+	ntfs_mft_sync_record *recs;
+	ntfs_mft_commit commit;
+	buf_t buf;
+	unsigned nr, alloc, i, j, k;
+	errno_t err;
+
+	for (w = batch; w; w = w->next)
+		w->err = 0;
+	/*
+	 * If mft records are smaller than sectors each mft record sync needs
+	 * to merge the record into its sector buffer so do it the old way.
+	 */
+	if (vol->mft_record_size < vol->sector_size)
+		goto per_waiter;
+	/* Gather the mft record numbers of all the waiters. */
+	alloc = 0;
+	for (w = batch; w; w = w->next) {
+		alloc++;
+		if (NInoAttrList(w->base_ni)) {
+			lck_mtx_lock(&w->base_ni->extent_lock);
+			if (w->base_ni->nr_extents > 0)
+				alloc += w->base_ni->nr_extents;
+			lck_mtx_unlock(&w->base_ni->extent_lock);
+		}
+	}
+	recs = IOMallocData(alloc * sizeof(ntfs_mft_sync_record));
+	if (!recs) {
+		ntfs_debug("Not enough memory to sort %u mft records, "
+				"writing them one by one.", alloc);
+		goto per_waiter;
+	}
+	nr = 0;
+	for (w = batch; w && nr < alloc; w = w->next) {
+		recs[nr++] = (ntfs_mft_sync_record) {
+			.mft_no = w->base_ni->mft_no,
+			.w = w,
+			.commit = &commit,
+		};
+		if (!NInoAttrList(w->base_ni))
+			continue;
+		lck_mtx_lock(&w->base_ni->extent_lock);
+		for (i = 0; i < (unsigned)w->base_ni->nr_extents &&
+				nr < alloc; i++)
+			recs[nr++] = (ntfs_mft_sync_record) {
+				.mft_no = w->base_ni->extent_nis[i]->mft_no,
+				.w = w,
+				.commit = &commit,
+			};
+		lck_mtx_unlock(&w->base_ni->extent_lock);
+	}
+	qsort(recs, nr, sizeof(ntfs_mft_sync_record),
+			ntfs_mft_sync_record_cmp);
+	ntfs_debug("Committing %u mft records.", nr);
+	err = vnode_get(mft_ni->vn);
+	if (err) {
+		ntfs_error(vol->mp, "Failed to get vnode for $MFT.");
+		for (w = batch; w; w = w->next)
+			w->err = err;
+		goto free_err;
+	}
+	/*
+	 * Issue the writes of the dirty mft records in ascending order.  The
+	 * same mft record can appear more than once if several callers are
+	 * syncing the same inode so write each record once.
+	 */
+	lck_spin_init(&commit.lock, ntfs_lock_grp, ntfs_lock_attr);
+	commit.pending = 0;
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr && recs[j].mft_no == recs[i].mft_no;
+				j++)
+			;
+		lck_rw_lock_shared(&mft_ni->lock);
+		buf = buf_getblk(mft_ni->vn, recs[i].mft_no,
+				vol->mft_record_size, 0, 0,
+				BLK_META | BLK_ONLYVALID);
+		lck_rw_unlock_shared(&mft_ni->lock);
+		if (!buf)
+			continue;
+		if (!(buf_flags(buf) & B_DELWRI)) {
+			buf_brelse(buf);
+			continue;
+		}
+		lck_spin_lock(&commit.lock);
+		commit.pending++;
+		lck_spin_unlock(&commit.lock);
+		buf_setfsprivate(buf, &recs[i]);
+		(void)buf_bawrite(buf);
+	}
+	/* Wait for all the writes to complete. */
+	lck_spin_lock(&commit.lock);
+	while (commit.pending)
+		(void)lck_spin_sleep(&commit.lock, LCK_SLEEP_DEFAULT, &commit,
+				THREAD_UNINT);
+	lck_spin_unlock(&commit.lock);
+	lck_spin_destroy(&commit.lock, ntfs_lock_grp);
+	(void)vnode_put(mft_ni->vn);
+	/*
+	 * Report the result of each write to all the waiters the mft record
+	 * belongs to.
+	 */
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr && recs[j].mft_no == recs[i].mft_no;
+				j++)
+			;
+		err = recs[i].err;
+		if (!err)
+			continue;
+		ntfs_error(vol->mp, "Failed to write mft record 0x%llx (error "
+				"%d).", (unsigned long long)recs[i].mft_no,
+				err);
+		for (k = i; k < j; k++) {
+			if (!recs[k].w->err)
+				recs[k].w->err = err;
+		}
+	}
+free_err:
+	IOFreeData(recs, alloc * sizeof(ntfs_mft_sync_record));
+	return;
+per_waiter:
+	for (w = batch; w; w = w->next)
+		ntfs_mft_records_commit_waiter(w);
+}
+
+/**
+ * ntfs_mft_records_group_sync - write all loaded mft records of an inode
+ * @base_ni:	base ntfs inode whose loaded mft records to write
+ *
+ * Write all dirty mft records, i.e. the base mft record and all the attached
+ * extent mft records, of the base ntfs inode @base_ni to disk and wait for the
+ * writes to complete.
+ *
+ * Concurrent callers are group committed: the first caller to arrive becomes
+ * the leader and writes the records of all callers that are queued at that
+ * time in one sorted batch via ntfs_mft_records_commit().  Callers arriving
+ * whilst a commit is in progress queue up and the first of them becomes the
+ * leader of the next batch once the current one is done.  Thus a burst of
+ * fsync()s results in a single pass over $MFT in ascending record order
+ * instead of writes in arrival order, and a record synced by several callers
+ * is written only once.
+ *
+ * Return 0 on success and errno on error.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @base_ni.
+ *	    - The mft records of @base_ni must not be mapped.
+ */
+errno_t ntfs_mft_records_group_sync(ntfs_inode *base_ni)
+{
+	ntfs_volume *vol = base_ni->vol;
+	ntfs_mft_sync_waiter w, *batch, *next;
+
+	if (NInoAttr(base_ni))
+		panic("%s(): Called for attribute inode.\n", __FUNCTION__);
+	if (!vol->mft_ni) {
+		ntfs_warning(vol->mp, "$MFT inode is missing from volume.");
+		return ENOTSUP;
+	}
+	ntfs_debug("Entering for inode 0x%llx.",
+			(unsigned long long)base_ni->mft_no);
+	w = (ntfs_mft_sync_waiter) {
+		.base_ni = base_ni,
+	};
+	lck_mtx_lock(&vol->mft_sync_lock);
+	*vol->mft_sync_tail = &w;
+	vol->mft_sync_tail = &w.next;
+	while (!w.done) {
+		if (vol->mft_sync_active) {
+			(void)msleep(&w, &vol->mft_sync_lock, PINOD,
+					__FUNCTION__, 0);
+			continue;
+		}
+		/*
+		 * Nobody is committing at present so become the leader and
+		 * commit everything queued so far, including ourselves.
+		 */
+		batch = vol->mft_sync_queue;
+		vol->mft_sync_queue = NULL;
+		vol->mft_sync_tail = &vol->mft_sync_queue;
+		vol->mft_sync_active = TRUE;
+		lck_mtx_unlock(&vol->mft_sync_lock);
+		ntfs_mft_records_commit(vol, batch);
+		lck_mtx_lock(&vol->mft_sync_lock);
+		for (; batch; batch = next) {
+			next = batch->next;
+			batch->done = TRUE;
+			if (batch != &w)
+				wakeup(batch);
+		}
+		vol->mft_sync_active = FALSE;
+		/*
+		 * Wake up the first of the callers that queued whilst we were
+		 * committing so it becomes the leader of the next batch.
+		 */
+		if (vol->mft_sync_queue)
+			wakeup(vol->mft_sync_queue);
+	}
+	lck_mtx_unlock(&vol->mft_sync_lock);
+	ntfs_debug("Done (error %d).", w.err);
+	return w.err;
+}
+
 /**
  * ntfs_mft_mirror_sync - synchronize an mft record to the mft mirror
  * @vol:	ntfs volume on which the mft record to synchronize resides
@@ -104,6 +104,10 @@ static inline void ntfs_extent_mft_record_unmap(ntfs_inode *ni)
 
 __private_extern__ errno_t ntfs_mft_record_sync(ntfs_inode *ni);
 
+__private_extern__ errno_t ntfs_mft_records_group_sync(ntfs_inode *base_ni);
+
+__private_extern__ void ntfs_mft_record_write_done(void *arg, errno_t err);
+
 __private_extern__ errno_t ntfs_mft_mirror_sync(ntfs_volume *vol,
 		const s64 rec_no, const MFT_RECORD *m, const BOOL sync);
 
@@ -338,26 +338,36 @@ err:
 }
 
 /**
- * ntfs_page_map_ext - map a page of a vnode into memory
- * @ni:		ntfs inode of which to map a page
- * @ofs:	byte offset into @ni of which to map a page
- * @upl:	destination page list for the page
- * @pl:		destination array of pages containing the page itself
- * @kaddr:	destination pointer for the address of the mapped page contents
- * @uptodate:	if true return an uptodate page and if false return it as is
- * @rw:		if true we intend to modify the page and if false we do not
+ * ntfs_page_map_range_ext - map a range of pages of a vnode into memory
+ * @ni:		ntfs inode of which to map a range of pages
+ * @ofs:	byte offset into @ni at which the range starts
+ * @size:	on entry the wanted size of the range, on return the mapped size
+ * @upl:	destination page list for the range
+ * @pl:		destination array of pages containing the range
+ * @kaddr:	destination pointer for the address of the mapped range
+ * @uptodate:	if true return uptodate pages and if false return them as is
+ * @rw:		if true we intend to modify the pages and if false we do not
  *
- * Map the page corresponding to byte offset @ofs into the ntfs inode @ni into
- * memory and return the page list in @upl, the array of pages containing the
- * page in @pl and the address of the mapped page contents in @kaddr.
+ * Map up to *@size bytes worth of pages starting at byte offset @ofs into the
+ * ntfs inode @ni into memory and return the page list in @upl, the array of
+ * pages in @pl and the address of the mapped, virtually contiguous, range in
+ * @kaddr.  The range is truncated to the last page containing data of @ni and
+ * the number of bytes actually mapped is returned in *@size.  This is always a
+ * multiple of PAGE_SIZE.
  *
- * If @uptodate is true the page is returned uptodate, i.e. if the page is
- * currently not valid, it will be brought uptodate via a call to ntfs_pagein()
- * before it is returned.  And if @uptodate is false, the page is just returned
- * ignoring its state.  This means the page may or may not be uptodate.
+ * This allows callers walking large metadata attributes, such as the cluster
+ * and mft bitmaps, to set up and tear down a single page list for a window of
+ * many pages rather than one for each page.  Callers should not map more than
+ * a few hundred kiB at a time as all the pages in the range are kept busy
+ * until the range is unmapped with ntfs_page_unmap_range().
  *
- * The caller must set @rw to true if the page is going to be modified and to
- * false otherwise.
+ * If @uptodate is true the pages are returned uptodate, i.e. any pages that
+ * are currently not valid will be brought uptodate via ntfs_pagein() before
+ * they are returned.  If @uptodate is false, the pages are returned ignoring
+ * their state.
+ *
+ * The caller must set @rw to true if the pages are going to be modified and
+ * to false otherwise.
  *
  * Note: @ofs must be page aligned.
  *
@@ -366,65 +376,88 @@ err:
  *
  * Return 0 on success and errno on error in which case *@upl is set to NULL.
  */
-errno_t ntfs_page_map_ext(ntfs_inode *ni, s64 ofs, upl_t *upl,
-		upl_page_info_array_t *pl, u8 **kaddr, const BOOL uptodate,
-		const BOOL rw)
+errno_t ntfs_page_map_range_ext(ntfs_inode *ni, s64 ofs, u32 *size,
+		upl_t *upl, upl_page_info_array_t *pl, u8 **kaddr,
+		const BOOL uptodate, const BOOL rw)
 {
-	s64 size;
+	s64 attr_size;
 	kern_return_t kerr;
+	u32 len, start, end, nr_pages, i;
 	int abort_flags;
 	errno_t err;
 
-	ntfs_debug("Entering for inode 0x%llx, offset 0x%llx, rw is %s.",
-			(unsigned long long)ni->mft_no,
-			(unsigned long long)ofs,
+	ntfs_debug("Entering for inode 0x%llx, offset 0x%llx, size 0x%x, rw "
+			"is %s.", (unsigned long long)ni->mft_no,
+			(unsigned long long)ofs, *size,
 			rw ? "true" : "false");
 	if (ofs & PAGE_MASK)
 		panic("%s() called with non page aligned offset (0x%llx).",
 				__FUNCTION__, (unsigned long long)ofs);
 	lck_spin_lock(&ni->size_lock);
-	size = ubc_getsize(ni->vn);
-	if (size > ni->data_size)
-		size = ni->data_size;
+	attr_size = ubc_getsize(ni->vn);
+	if (attr_size > ni->data_size)
+		attr_size = ni->data_size;
 	lck_spin_unlock(&ni->size_lock);
 
     // It seems that regular files can have zero size
-    bool isZeroRegFile = (ofs == 0) && (size == 0) && (vnode_isreg(ni->vn));
+    bool isZeroRegFile = (ofs == 0) && (attr_size == 0) && (vnode_isreg(ni->vn));
     
-	if ((ofs >= size) && (!isZeroRegFile)) {
+	if ((ofs >= attr_size) && (!isZeroRegFile)) {
 		ntfs_error(ni->vol->mp, "Offset 0x%llx is outside the end of "
 				"the attribute (0x%llx).",
 				(unsigned long long)ofs,
-				(unsigned long long)size);
+				(unsigned long long)attr_size);
 		err = EINVAL;
 		goto err;
 	}
-	/* Create a page list for the wanted page. */
-	kerr = ubc_create_upl(ni->vn, ofs, PAGE_SIZE, upl, pl, UPL_SET_LITE |
+	/* Do not map pages beyond the last page containing attribute data. */
+	len = (*size + PAGE_MASK) & ~PAGE_MASK;
+	if (!len)
+		len = PAGE_SIZE;
+	attr_size = ((attr_size + PAGE_MASK_64) & ~PAGE_MASK_64) - ofs;
+	if (len > attr_size)
+		len = isZeroRegFile ? PAGE_SIZE : (u32)attr_size;
+	nr_pages = len >> PAGE_SHIFT;
+	/* Create a page list for the wanted range. */
+	kerr = ubc_create_upl(ni->vn, ofs, len, upl, pl, UPL_SET_LITE |
 			(rw ? UPL_WILL_MODIFY : 0));
 	if (kerr != KERN_SUCCESS)
 		panic("%s(): Failed to get page (error %d).\n", __FUNCTION__,
 				(int)kerr);
 	/*
-	 * If the page is not valid, need to read it in from the vnode now thus
-	 * making it valid.
+	 * If any pages are not valid, need to read them in from the vnode now
+	 * thus making them valid.  We read each run of consecutive invalid
+	 * pages with a single call to ntfs_pagein().
 	 *
 	 * We set UPL_NESTED_PAGEOUT to let ntfs_pagein() know that we already
 	 * have the inode locked (@ni->lock is held by the caller).
 	 */
-	if (uptodate && !upl_valid_page(*pl, 0)) {
-		ntfs_debug("Reading page as it was not valid.");
-		err = ntfs_pagein(ni, ofs, PAGE_SIZE, *upl, 0, UPL_IOSYNC |
-				UPL_NOCOMMIT | UPL_NESTED_PAGEOUT);
-		if (err) {
-			ntfs_error(ni->vol->mp, "Failed to read page (error "
-					"%d).", err);
-			goto pagein_err;
+	if (uptodate) {
+		for (start = 0; start < nr_pages; start = end) {
+			if (upl_valid_page(*pl, start)) {
+				end = start + 1;
+				continue;
+			}
+			for (end = start + 1; end < nr_pages &&
+					!upl_valid_page(*pl, end); end++)
+				;
+			ntfs_debug("Reading %u pages as they were not valid.",
+					end - start);
+			err = ntfs_pagein(ni, ofs + ((s64)start << PAGE_SHIFT),
+					(end - start) << PAGE_SHIFT, *upl,
+					start << PAGE_SHIFT, UPL_IOSYNC |
+					UPL_NOCOMMIT | UPL_NESTED_PAGEOUT);
+			if (err) {
+				ntfs_error(ni->vol->mp, "Failed to read page "
+						"(error %d).", err);
+				goto pagein_err;
+			}
 		}
 	}
-	/* Map the page into the kernel's address space. */
+	/* Map the range into the kernel's address space. */
 	kerr = ubc_upl_map(*upl, (vm_offset_t*)kaddr);
 	if (kerr == KERN_SUCCESS) {
+		*size = len;
 		ntfs_debug("Done.");
 		return 0;
 	}
@@ -432,81 +465,103 @@ errno_t ntfs_page_map_ext(ntfs_inode *ni, s64 ofs, upl_t *upl,
 			(int)kerr);
 	err = EIO;
 pagein_err:
-	abort_flags = UPL_ABORT_FREE_ON_EMPTY;
-	if (!upl_valid_page(*pl, 0) ||
-			(vnode_isnocache(ni->vn) && !upl_dirty_page(*pl, 0)))
-		abort_flags |= UPL_ABORT_DUMP_PAGES;
-	ubc_upl_abort_range(*upl, 0, PAGE_SIZE, abort_flags);
+	for (i = 0; i < nr_pages; i++) {
+		abort_flags = UPL_ABORT_FREE_ON_EMPTY;
+		if (!upl_valid_page(*pl, i) || (vnode_isnocache(ni->vn) &&
+				!upl_dirty_page(*pl, i)))
+			abort_flags |= UPL_ABORT_DUMP_PAGES;
+		ubc_upl_abort_range(*upl, i << PAGE_SHIFT, PAGE_SIZE,
+				abort_flags);
+	}
 err:
 	*upl = NULL;
 	return err;
 }
 
 /**
- * ntfs_page_unmap - unmap a page belonging to a vnode from memory
- * @ni:		ntfs inode to which the page belongs
- * @upl:	page list of the page
- * @pl:		array of pages containing the page itself
- * @mark_dirty:	mark the page dirty
+ * ntfs_page_unmap_range_ext - unmap a range of pages of a vnode from memory
+ * @ni:		ntfs inode to which the pages belong
+ * @upl:	page list of the range
+ * @pl:		array of pages containing the range
+ * @size:	size in bytes of the range as returned by the map function
+ * @mark_dirty:	mark all the pages in the range dirty
+ * @dirty_pages: bit mask of the pages in the range to mark dirty
  *
- * Unmap the page belonging to the ntfs inode @ni from memory releasing it back
- * to the vm.
+ * Unmap the range of @size bytes of pages belonging to the ntfs inode @ni
+ * from memory releasing it back to the vm.
  *
- * The page is described by the page list @upl, the array of pages containing
- * the page @pl and the address of the mapped page contents @kaddr.
+ * The range is described by the page list @upl and the array of pages @pl as
+ * returned by ntfs_page_map_range_ext().
  *
- * If @mark_dirty is TRUE, tell the vm to mark the page dirty when releasing
- * the page.
+ * If @mark_dirty is TRUE, tell the vm to mark all the pages dirty when
+ * releasing them.  Otherwise, tell the vm to mark dirty each page whose bit is
+ * set in @dirty_pages, where bit 0 is the first page of the range.  This
+ * allows callers walking a window of pages to only dirty the pages they
+ * actually modified.  As @dirty_pages only has 64 bits, it must be zero when
+ * the range is larger than 64 pages.  If any pages are marked dirty, put @ni
+ * on the dirty inode list of its volume.  The dirty state of all other pages
+ * is preserved.
  *
  * Locking: Caller must hold an iocount reference on the vnode of @ni.
  */
-void ntfs_page_unmap(ntfs_inode *ni, upl_t upl, upl_page_info_array_t pl,
-		const BOOL mark_dirty)
+void ntfs_page_unmap_range_ext(ntfs_inode *ni, upl_t upl,
+		upl_page_info_array_t pl, u32 size, const BOOL mark_dirty,
+		const u64 dirty_pages)
 {
 	kern_return_t kerr;
-	BOOL was_valid, was_dirty;
+	u32 i, nr_pages;
+	BOOL was_valid, was_dirty, make_dirty;
 
-	was_valid = upl_valid_page(pl, 0);
-	/* The page dirty bit is only valid if the page was valid. */
-	was_dirty = (was_valid && upl_dirty_page(pl, 0));
-	ntfs_debug("Entering for inode 0x%llx, page was %svalid %s %sdirty%s.",
-			(unsigned long long)ni->mft_no,
-			was_valid ? "" : "not ",
-			(int)was_valid ^ (int)was_dirty ? "but" : "and",
-			was_dirty ? "" : "not ",
-			mark_dirty ? ", marking it dirty" : "");
-	/* Unmap the page from the kernel's address space. */
+	nr_pages = size >> PAGE_SHIFT;
+	ntfs_debug("Entering for inode 0x%llx, %u pages%s, dirty_pages "
+			"0x%llx.", (unsigned long long)ni->mft_no, nr_pages,
+			mark_dirty ? ", marking them dirty" : "",
+			(unsigned long long)dirty_pages);
+	if (dirty_pages && nr_pages > 64)
+		panic("%s(): dirty_pages && nr_pages > 64\n", __FUNCTION__);
+	/* Unmap the range from the kernel's address space. */
 	kerr = ubc_upl_unmap(upl);
 	if (kerr != KERN_SUCCESS)
 		ntfs_warning(ni->vol->mp, "ubc_upl_unmap() failed (error %d).",
 				(int)kerr);
-	/*
-	 * If the page was valid and dirty or is being made dirty or if caching
-	 * for the vnode is enabled (as it will usually be the case for all
-	 * metadata files), commit it thus releasing it into the vm taking care
-	 * to preserve the dirty state and marking the page dirty if requested
-	 * when committing the page.
-	 *
-	 * If the page was not valid or was valid but not dirty, it is not
-	 * being marked dirty, and caching is disabled on the vnode, dump the
-	 * page.
-	 */
-	if (was_dirty || mark_dirty || !vnode_isnocache(ni->vn)) {
-		int commit_flags;
+	for (i = 0; i < nr_pages; i++) {
+		was_valid = upl_valid_page(pl, i);
+		/* The page dirty bit is only valid if the page was valid. */
+		was_dirty = (was_valid && upl_dirty_page(pl, i));
+		make_dirty = (mark_dirty || (i < 64 &&
+				(dirty_pages & (1ULL << i))));
+		/*
+		 * If the page was valid and dirty or is being made dirty or if
+		 * caching for the vnode is enabled (as it will usually be the
+		 * case for all metadata files), commit it thus releasing it
+		 * into the vm taking care to preserve the dirty state and
+		 * marking the page dirty if requested when committing the
+		 * page.
+		 *
+		 * If the page was not valid or was valid but not dirty, it is
+		 * not being marked dirty, and caching is disabled on the
+		 * vnode, dump the page.
+		 */
+		if (was_dirty || make_dirty || !vnode_isnocache(ni->vn)) {
+			int commit_flags;
 
-		commit_flags = UPL_COMMIT_FREE_ON_EMPTY |
-				UPL_COMMIT_INACTIVATE;
-		if (!was_valid && !mark_dirty)
-			commit_flags |= UPL_COMMIT_CLEAR_DIRTY;
-		else if (was_dirty || mark_dirty)
-			commit_flags |= UPL_COMMIT_SET_DIRTY;
-		ubc_upl_commit_range(upl, 0, PAGE_SIZE, commit_flags);
-		ntfs_debug("Done (committed page).");
-	} else {
-		ubc_upl_abort_range(upl, 0, PAGE_SIZE, UPL_ABORT_DUMP_PAGES |
-				UPL_ABORT_FREE_ON_EMPTY);
-		ntfs_debug("Done (dumped page).");
+			commit_flags = UPL_COMMIT_FREE_ON_EMPTY |
+					UPL_COMMIT_INACTIVATE;
+			if (!was_valid && !make_dirty)
+				commit_flags |= UPL_COMMIT_CLEAR_DIRTY;
+			else if (was_dirty || make_dirty)
+				commit_flags |= UPL_COMMIT_SET_DIRTY;
+			ubc_upl_commit_range(upl, i << PAGE_SHIFT, PAGE_SIZE,
+					commit_flags);
+		} else
+			ubc_upl_abort_range(upl, i << PAGE_SHIFT, PAGE_SIZE,
+					UPL_ABORT_DUMP_PAGES |
+					UPL_ABORT_FREE_ON_EMPTY);
 	}
+	/* Make sure the next sync writes out the newly dirtied pages. */
+	if (mark_dirty || dirty_pages)
+		ntfs_inode_dirty_list_add(ni);
+	ntfs_debug("Done.");
 }
 
 /**
@@ -47,10 +47,74 @@
 __private_extern__ int ntfs_pagein(ntfs_inode *ni, s64 attr_ofs, unsigned size,
 		upl_t upl, upl_offset_t upl_ofs, int flags);
 
-__private_extern__ errno_t ntfs_page_map_ext(ntfs_inode *ni, s64 ofs,
-		upl_t *upl, upl_page_info_array_t *pl, u8 **kaddr,
+/*
+ * The size of the window used when walking large metadata attributes, e.g. the
+ * cluster bitmap, with ntfs_page_map_range().  This must not be more than 64
+ * pages so the modified pages of a window can be tracked in a u64 bit mask for
+ * ntfs_page_unmap_range_ext().
+ */
+#define NTFS_PAGE_WINDOW_SIZE	(256 * 1024)
+
+__private_extern__ errno_t ntfs_page_map_range_ext(ntfs_inode *ni, s64 ofs,
+		u32 *size, upl_t *upl, upl_page_info_array_t *pl, u8 **kaddr,
 		const BOOL uptodate, const BOOL rw);
 
+/**
+ * ntfs_page_map_ext - map a page of a vnode into memory
+ * @ni:		ntfs inode of which to map a page
+ * @ofs:	byte offset into @ni of which to map a page
+ * @upl:	destination page list for the page
+ * @pl:		destination array of pages containing the page itself
+ * @kaddr:	destination pointer for the address of the mapped page contents
+ * @uptodate:	if true return an uptodate page and if false return it as is
+ * @rw:		if true we intend to modify the page and if false we do not
+ *
+ * Map the page corresponding to byte offset @ofs into the ntfs inode @ni into
+ * memory.  This is ntfs_page_map_range_ext() for a single page.  See there for
+ * details.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @ni.
+ *	    - Caller must hold @ni->lock for reading or writing.
+ *
+ * Return 0 on success and errno on error in which case *@upl is set to NULL.
+ */
+static inline errno_t ntfs_page_map_ext(ntfs_inode *ni, s64 ofs, upl_t *upl,
+		upl_page_info_array_t *pl, u8 **kaddr, const BOOL uptodate,
+		const BOOL rw)
+{
+	u32 size = PAGE_SIZE;
+
+	return ntfs_page_map_range_ext(ni, ofs, &size, upl, pl, kaddr,
+			uptodate, rw);
+}
+
+/**
+ * ntfs_page_map_range - map a range of pages of a vnode into memory
+ * @ni:		ntfs inode of which to map a range of pages
+ * @ofs:	byte offset into @ni at which the range starts
+ * @size:	on entry the wanted size of the range, on return the mapped size
+ * @upl:	destination page list for the range
+ * @pl:		destination array of pages containing the range
+ * @kaddr:	destination pointer for the address of the mapped range
+ * @rw:		if true we intend to modify the pages and if false we do not
+ *
+ * Map up to *@size bytes worth of pages starting at byte offset @ofs into the
+ * ntfs inode @ni into memory.  The pages are returned uptodate.  See
+ * ntfs_page_map_range_ext() for details.
+ *
+ * Note: @ofs must be page aligned.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @ni.
+ *	    - Caller must hold @ni->lock for reading or writing.
+ */
+static inline errno_t ntfs_page_map_range(ntfs_inode *ni, s64 ofs, u32 *size,
+		upl_t *upl, upl_page_info_array_t *pl, u8 **kaddr,
+		const BOOL rw)
+{
+	return ntfs_page_map_range_ext(ni, ofs, size, upl, pl, kaddr, TRUE,
+			rw);
+}
+
 /**
  * ntfs_page_map - map a page of a vnode into memory
  * @ni:		ntfs inode of which to map a page
@@ -110,8 +174,49 @@ static inline errno_t ntfs_page_grab(ntfs_inode *ni, s64 ofs, upl_t *upl,
 	return ntfs_page_map_ext(ni, ofs, upl, pl, kaddr, FALSE, rw);
 }
 
-__private_extern__ void ntfs_page_unmap(ntfs_inode *ni, upl_t upl,
-		upl_page_info_array_t pl, const BOOL mark_dirty);
+__private_extern__ void ntfs_page_unmap_range_ext(ntfs_inode *ni, upl_t upl,
+		upl_page_info_array_t pl, u32 size, const BOOL mark_dirty,
+		const u64 dirty_pages);
+
+/**
+ * ntfs_page_unmap_range - unmap a range of pages of a vnode from memory
+ * @ni:		ntfs inode to which the pages belong
+ * @upl:	page list of the range
+ * @pl:		array of pages containing the range
+ * @size:	size in bytes of the range as returned by the map function
+ * @mark_dirty:	mark all the pages in the range dirty
+ *
+ * Unmap the range of @size bytes of pages belonging to the ntfs inode @ni
+ * from memory releasing it back to the vm.  This is
+ * ntfs_page_unmap_range_ext() without a mask of individual pages to mark
+ * dirty.  See there for details.
+ *
+ * Locking: Caller must hold an iocount reference on the vnode of @ni.
+ */
+static inline void ntfs_page_unmap_range(ntfs_inode *ni, upl_t upl,
+		upl_page_info_array_t pl, u32 size, const BOOL mark_dirty)
+{
+	ntfs_page_unmap_range_ext(ni, upl, pl, size, mark_dirty, 0);
+}
+
+/**
+ * ntfs_page_unmap - unmap a page belonging to a vnode from memory
+ * @ni:		ntfs inode to which the page belongs
+ * @upl:	page list of the page
+ * @pl:		array of pages containing the page itself
+ * @mark_dirty:	mark the page dirty
+ *
+ * Unmap the page belonging to the ntfs inode @ni from memory releasing it back
+ * to the vm.  If @mark_dirty is TRUE, tell the vm to mark the page dirty when
+ * releasing the page.
+ *
+ * Locking: Caller must hold an iocount reference on the vnode of @ni.
+ */
+static inline void ntfs_page_unmap(ntfs_inode *ni, upl_t upl,
+		upl_page_info_array_t pl, const BOOL mark_dirty)
+{
+	ntfs_page_unmap_range(ni, upl, pl, PAGE_SIZE, mark_dirty);
+}
 
 __private_extern__ void ntfs_page_dump(ntfs_inode *ni, upl_t upl,
 		upl_page_info_array_t pl);
@@ -38,6 +38,8 @@
 
 #include <sys/buf.h>
 #include <sys/errno.h>
+#include <sys/mount.h>
+#include <sys/vnode.h>
 
 #include <string.h>
 
@@ -2346,14 +2348,277 @@ err:
 	return EIO;
 }
 
+/*
+ * Shared fill buffers used by ntfs_dev_set() for the two by far most common
+ * fill values, zero (when zeroing allocated space) and 0xff (when emptying
+ * $LogFile).  They are never modified after initialization so any number of
+ * concurrent writes can use them at the same time.
+ */
+static u8 *ntfs_dev_set_zero_buf;
+static u8 *ntfs_dev_set_ff_buf;
+
+/**
+ * ntfs_dev_set_init - allocate the shared fill buffers of ntfs_dev_set()
+ *
+ * Return 0 on success and ENOMEM on error.
+ */
+errno_t ntfs_dev_set_init(void)
+{
+	ntfs_dev_set_zero_buf = IOMallocData(NTFS_DEV_SET_BUF_SIZE);
+	ntfs_dev_set_ff_buf = IOMallocData(NTFS_DEV_SET_BUF_SIZE);
+	if (!ntfs_dev_set_zero_buf || !ntfs_dev_set_ff_buf) {
+		ntfs_dev_set_deinit();
+		return ENOMEM;
+	}
+	bzero(ntfs_dev_set_zero_buf, NTFS_DEV_SET_BUF_SIZE);
+	memset(ntfs_dev_set_ff_buf, 0xff, NTFS_DEV_SET_BUF_SIZE);
+	return 0;
+}
+
+/**
+ * ntfs_dev_set_deinit - free the shared fill buffers of ntfs_dev_set()
+ */
+void ntfs_dev_set_deinit(void)
+{
+	if (ntfs_dev_set_zero_buf) {
+		IOFreeData(ntfs_dev_set_zero_buf, NTFS_DEV_SET_BUF_SIZE);
+		ntfs_dev_set_zero_buf = NULL;
+	}
+	if (ntfs_dev_set_ff_buf) {
+		IOFreeData(ntfs_dev_set_ff_buf, NTFS_DEV_SET_BUF_SIZE);
+		ntfs_dev_set_ff_buf = NULL;
+	}
+}
+
+/**
+ * ntfs_dev_io - transfer a buffer to or from the device hosting a volume
+ * @vol:	ntfs volume whose device to access
+ * @pos:	byte offset on the device at which to start the transfer
+ * @cnt:	number of bytes to transfer
+ * @data:	buffer containing the data to write or receiving the data read
+ * @data_size:	size of @data in bytes if it is to be repeated or 0 if not
+ * @is_read:	if true read from the device, otherwise write to it
+ *
+ * Write @cnt bytes starting at byte offset @pos on the device hosting the ntfs
+ * volume @vol, or read them into @data if @is_read is true.  If @data_size is
+ * zero, @data contains all @cnt bytes to transfer.  Otherwise @data is a
+ * pattern buffer of @data_size bytes which is written repeatedly, i.e. every
+ * i/o starts at the beginning of @data.  @data_size must be zero for reads.
+ *
+ * The i/os bypass the buffer cache of the device vnode and are issued
+ * straight to the device in the largest chunks the device accepts, keeping up
+ * to NTFS_DEV_SET_MAX_IOS of them in flight at the same time.
+ *
+ * Return 0 on success and errno on error.
+ */
+static errno_t ntfs_dev_io(ntfs_volume *vol, s64 pos, s64 cnt, const u8 *data,
+		const unsigned data_size, const BOOL is_read)
+{
+	buf_t bufs[NTFS_DEV_SET_MAX_IOS];
+	struct vfsioattr ia;
+	vnode_t dev_vn = vol->dev_vn;
+	unsigned io_size, max_cnt, nr_bufs;
+	errno_t err, err2;
+
+	if ((pos | cnt) & vol->sector_size_mask)
+		panic("%s(): Region is not sector aligned.\n", __FUNCTION__);
+	if (is_read && data_size)
+		panic("%s(): Cannot read into a pattern buffer.\n",
+				__FUNCTION__);
+	/* Do not exceed the maximum i/o size supported by the device. */
+	io_size = data_size ? data_size : NTFS_DEV_SET_BUF_SIZE;
+	vfs_ioattr(vol->mp, &ia);
+	max_cnt = is_read ? ia.io_maxreadcnt : ia.io_maxwritecnt;
+	if (max_cnt && io_size > max_cnt)
+		io_size = max_cnt & ~vol->sector_size_mask;
+	if (!io_size)
+		io_size = vol->sector_size;
+	nr_bufs = 0;
+	err = 0;
+	while ((cnt > 0 && !err) || nr_bufs) {
+		buf_t buf;
+		unsigned size;
+
+		/*
+		 * Wait for the oldest i/o to complete if the maximum number of
+		 * i/os is in flight, if there is nothing left to issue, or if
+		 * an error occured and we are winding down.
+		 */
+		if (nr_bufs == NTFS_DEV_SET_MAX_IOS || cnt <= 0 || err) {
+			buf = bufs[0];
+			err2 = buf_biowait(buf);
+			buf_free(buf);
+			if (err2 && !err) {
+				ntfs_error(vol->mp, "Failed to %s data "
+						"(error %d).", is_read ?
+						"read" : "write", err2);
+				err = err2;
+			}
+			nr_bufs--;
+			memmove(bufs, bufs + 1, nr_bufs * sizeof(buf_t));
+			continue;
+		}
+		size = io_size;
+		if ((s64)size > cnt)
+			size = (unsigned)cnt;
+		buf = buf_alloc(dev_vn);
+		if (!buf) {
+			err = ENOMEM;
+			continue;
+		}
+		buf_setflags(buf, B_NOCACHE | (is_read ? B_READ : 0));
+		buf_setblkno(buf, pos >> vol->sector_size_shift);
+		buf_setlblkno(buf, pos >> vol->sector_size_shift);
+		buf_setcount(buf, size);
+		buf_setsize(buf, size);
+		buf_setdataptr(buf, (uintptr_t)data);
+		if (!is_read)
+			vnode_startwrite(dev_vn);
+		err = VNOP_STRATEGY(buf);
+		if (err) {
+			ntfs_error(vol->mp, "Failed to issue i/o (error %d).",
+					err);
+			buf_free(buf);
+			continue;
+		}
+		bufs[nr_bufs++] = buf;
+		pos += size;
+		cnt -= size;
+		if (!data_size)
+			data += size;
+	}
+	return err;
+}
+
+/**
+ * ntfs_dev_set - fill a region of the device hosting a volume with a value
+ * @vol:	ntfs volume whose device to write to
+ * @pos:	byte offset on the device at which to start filling
+ * @cnt:	number of bytes to fill
+ * @val:	value to fill each byte with
+ *
+ * Fill @cnt bytes starting at byte offset @pos on the device hosting the ntfs
+ * volume @vol with the value @val.
+ *
+ * The writes bypass the buffer cache of the device vnode and are issued
+ * straight to the device in the largest chunks the device accepts from a
+ * pre-filled buffer, keeping up to NTFS_DEV_SET_MAX_IOS of them in flight at
+ * the same time.  This makes filling large regions run at device speed.
+ *
+ * Note the buffer cache of the device vnode is only used for attribute list
+ * attribute data (see ntfs_rl_read() and ntfs_rl_write()) which is never
+ * filled thus there cannot be any cached buffers that need invalidating.  It
+ * is up to the caller to deal with any pages cached in the UBC of the inode
+ * the clusters belong to.
+ *
+ * @pos and @cnt must be multiples of the sector size of the volume.
+ *
+ * Return 0 on success and errno on error.
+ */
+errno_t ntfs_dev_set(ntfs_volume *vol, s64 pos, s64 cnt, const u8 val)
+{
+	u8 *fbuf;
+	unsigned fbuf_size;
+	errno_t err;
+
+	ntfs_debug("Entering for pos 0x%llx, cnt 0x%llx, val 0x%x.",
+			(unsigned long long)pos, (unsigned long long)cnt,
+			(unsigned)val);
+	if ((pos | cnt) & vol->sector_size_mask)
+		panic("%s(): Region is not sector aligned.\n", __FUNCTION__);
+	if (cnt <= 0)
+		return 0;
+	fbuf_size = NTFS_DEV_SET_BUF_SIZE;
+	if (!val)
+		fbuf = ntfs_dev_set_zero_buf;
+	else if (val == 0xff)
+		fbuf = ntfs_dev_set_ff_buf;
+	else {
+		if ((s64)fbuf_size > cnt)
+			fbuf_size = (unsigned)cnt;
+		fbuf = IOMallocData(fbuf_size);
+		if (!fbuf) {
+			ntfs_error(vol->mp, "Failed to allocate fill buffer.");
+			return ENOMEM;
+		}
+		memset(fbuf, val, fbuf_size);
+	}
+	err = ntfs_dev_io(vol, pos, cnt, fbuf, fbuf_size, FALSE);
+	if (fbuf != ntfs_dev_set_zero_buf && fbuf != ntfs_dev_set_ff_buf)
+		IOFreeData(fbuf, fbuf_size);
+	ntfs_debug("Done (error %d).", err);
+	return err;
+}
+
+/**
+ * ntfs_dev_write - write a buffer to the device hosting a volume
+ * @vol:	ntfs volume whose device to write to
+ * @pos:	byte offset on the device at which to start writing
+ * @cnt:	number of bytes to write
+ * @data:	buffer containing the @cnt bytes of data to write
+ *
+ * Write the @cnt bytes of data in @data to the device hosting the ntfs volume
+ * @vol starting at byte offset @pos.  This is the same as ntfs_dev_set() except
+ * that the data comes from the caller supplied buffer @data.  The same caveats
+ * about caching apply.
+ *
+ * @pos and @cnt must be multiples of the sector size of the volume.
+ *
+ * Return 0 on success and errno on error.
+ */
+errno_t ntfs_dev_write(ntfs_volume *vol, s64 pos, s64 cnt, const u8 *data)
+{
+	errno_t err;
+
+	ntfs_debug("Entering for pos 0x%llx, cnt 0x%llx.",
+			(unsigned long long)pos, (unsigned long long)cnt);
+	if (cnt <= 0)
+		return 0;
+	err = ntfs_dev_io(vol, pos, cnt, data, 0, FALSE);
+	ntfs_debug("Done (error %d).", err);
+	return err;
+}
+
+/**
+ * ntfs_dev_read - read from the device hosting a volume into a buffer
+ * @vol:	ntfs volume whose device to read from
+ * @pos:	byte offset on the device at which to start reading
+ * @cnt:	number of bytes to read
+ * @data:	buffer of at least @cnt bytes in which to return the data
+ *
+ * Read @cnt bytes starting at byte offset @pos on the device hosting the ntfs
+ * volume @vol into the caller supplied buffer @data.  This is the counterpart
+ * of ntfs_dev_write() and the same caveats about caching apply, i.e. any data
+ * cached in the UBC of the inode the clusters belong to is not looked at.
+ *
+ * @pos and @cnt must be multiples of the sector size of the volume.
+ *
+ * Return 0 on success and errno on error.
+ */
+errno_t ntfs_dev_read(ntfs_volume *vol, s64 pos, s64 cnt, u8 *data)
+{
+	errno_t err;
+
+	ntfs_debug("Entering for pos 0x%llx, cnt 0x%llx.",
+			(unsigned long long)pos, (unsigned long long)cnt);
+	if (cnt <= 0)
+		return 0;
+	err = ntfs_dev_io(vol, pos, cnt, data, 0, TRUE);
+	ntfs_debug("Done (error %d).", err);
+	return err;
+}
+
 /**
  * ntfs_rl_set - fill data on disk as described by an runlist with a value
  * @vol:	ntfs volume to which to write
  * @rl:		runlist describing clusters to fill with value
+ * @end_vcn:	vcn at which to stop filling or -1 to fill the whole runlist
  * @val:	value to fill each byte in the clusters with
  *
  * Walk the runlist elements in at @rl and fill all bytes in all clusters @rl
- * describes with the value @val.
+ * describes up to but not including @end_vcn with the value @val.  Each run
+ * is written with a single call to ntfs_dev_set() thus large runs go straight
+ * to disk in large i/os.
  *
  * Return 0 on success and errno on error.
  *
@@ -2363,28 +2628,26 @@ err:
  * Locking: - The caller must have locked the runlist for writing.
  *	    - The runlist is not modified.
  */
-errno_t ntfs_rl_set(ntfs_volume *vol, const ntfs_rl_element *rl, const u8 val)
+errno_t ntfs_rl_set(ntfs_volume *vol, const ntfs_rl_element *rl,
+		const VCN end_vcn, const u8 val)
 {
-	VCN vcn;
 	errno_t err;
-	unsigned block_size, shift;
 
-	ntfs_debug("Entering (val 0x%x).", (unsigned)val);
+	ntfs_debug("Entering (end_vcn 0x%llx, val 0x%x).",
+			(unsigned long long)end_vcn, (unsigned)val);
 	if (!vol || !rl || !rl->length) {
         ntfs_error((vol ? vol->mp : NULL), "Received invalid arguments.");
 		return EINVAL;
 	}
-    vnode_t dev_vn = vol->dev_vn;
-	block_size = vol->sector_size;
-	shift = vol->cluster_size_shift - vol->sector_size_shift;
-	/* Write the clusters specified by the runlist one at a time. */
+	/* Write the clusters specified by the runlist one run at a time. */
 	do {
+		s64 len;
 		LCN lcn;
-		daddr64_t block, end_block;
 
-		vcn = rl->vcn;
-		if (vcn < 0)
+		if (rl->vcn < 0)
 			panic("%s(): vcn < 0\n", __FUNCTION__);
+		if (end_vcn >= 0 && rl->vcn >= end_vcn)
+			break;
 		lcn = rl->lcn;
 		if (lcn < 0) {
 			if (lcn == LCN_HOLE || lcn == LCN_RL_NOT_MAPPED)
@@ -2393,44 +2656,13 @@ errno_t ntfs_rl_set(ntfs_volume *vol, const ntfs_rl_element *rl, const u8 val)
 					(long long)lcn);
 			return EIO;
 		}
-		/* Write to the device in chunks of sectors. */
-		block = lcn << shift;
-		end_block = (lcn + rl->length) << shift;
-		ntfs_debug("end_block 0x%llx.", (unsigned long long)end_block);
-		do {
-			buf_t buf;
-			u8 *dst;
-
-			ntfs_debug("Setting block 0x%llx.",
-					(unsigned long long)block);
-			/* Obtain the buffer, possibly not uptodate. */
-			buf = buf_getblk(dev_vn, block, block_size, 0, 0,
-					BLK_META);
-			if (!buf)
-				panic("%s(): !buf\n", __FUNCTION__);
-			err = buf_map(buf, (caddr_t*)&dst);
-			if (err) {
-				ntfs_error(vol->mp, "buf_map() failed (error "
-						"%d).", err);
-				buf_brelse(buf);
-				return err;
-			}
-			/*
-			 * Set the bytes in the buffer to @val and write it
-			 * synchronously.
-			 */
-			memset(dst, val, block_size);
-			err = buf_unmap(buf);
-			if (err)
-				ntfs_error(vol->mp, "buf_unmap() failed "
-						"(error %d).", err);
-			err = buf_bwrite(buf);
-			if (err) {
-				ntfs_error(vol->mp, "buf_bwrite() failed "
-						"(error %d).", err);
-				return err;
-			}
-		} while (++block < end_block);
+		len = rl->length;
+		if (end_vcn >= 0 && rl->vcn + len > end_vcn)
+			len = end_vcn - rl->vcn;
+		err = ntfs_dev_set(vol, lcn << vol->cluster_size_shift,
+				len << vol->cluster_size_shift, val);
+		if (err)
+			return err;
 	} while ((++rl)->length);
 	ntfs_debug("Done.");
 	return 0;
@@ -177,8 +177,28 @@ __private_extern__ errno_t ntfs_rl_read(ntfs_volume *vol, ntfs_runlist *rl,
 __private_extern__ errno_t ntfs_rl_write(ntfs_volume *vol, u8 *src,
 		const s64 size, ntfs_runlist *runlist, s64 ofs, const s64 cnt);
 
+/*
+ * Size of the shared fill buffers used by ntfs_dev_set() and the maximum
+ * number of i/os ntfs_dev_set(), ntfs_dev_write(), and ntfs_dev_read() keep
+ * in flight at the same time.
+ */
+#define NTFS_DEV_SET_BUF_SIZE	(256 * 1024)
+#define NTFS_DEV_SET_MAX_IOS	8
+
+__private_extern__ errno_t ntfs_dev_set_init(void);
+__private_extern__ void ntfs_dev_set_deinit(void);
+
+__private_extern__ errno_t ntfs_dev_set(ntfs_volume *vol, s64 pos, s64 cnt,
+		const u8 val);
+
+__private_extern__ errno_t ntfs_dev_write(ntfs_volume *vol, s64 pos, s64 cnt,
+		const u8 *data);
+
+__private_extern__ errno_t ntfs_dev_read(ntfs_volume *vol, s64 pos, s64 cnt,
+		u8 *data);
+
 __private_extern__ errno_t ntfs_rl_set(ntfs_volume *vol,
-		const ntfs_rl_element *rl, const u8 val);
+		const ntfs_rl_element *rl, const VCN end_vcn, const u8 val);
 
 __private_extern__ s64 ntfs_rl_get_nr_real_clusters(ntfs_runlist *runlist,
 		const VCN start_vcn, s64 cnt);
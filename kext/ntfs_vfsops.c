@@ -80,6 +80,7 @@
 #include "ntfs_mst.h"
 #include "ntfs_page.h"
 #include "ntfs_quota.h"
+#include "ntfs_runlist.h"
 #include "ntfs_secure.h"
 #include "ntfs_time.h"
 #include "ntfs_unistr.h"
@@ -3242,6 +3243,7 @@ static errno_t ntfs_get_nr_set_bits(vnode_t vn, const s64 nr_bits, s64 *res)
 {
 	s64 max_ofs, ofs, nr_set;
 	ntfs_inode *ni = NTFS_I(vn);
+	u32 size;
 	errno_t err;
 
 	ntfs_debug("Entering.");
@@ -3253,18 +3255,26 @@ static errno_t ntfs_get_nr_set_bits(vnode_t vn, const s64 nr_bits, s64 *res)
 	/* Convert the number of bits into bytes rounded up. */
 	max_ofs = (nr_bits + 7) >> 3;
 	ntfs_debug("Reading bitmap, max_ofs %lld.", (long long)max_ofs);
-	for (nr_set = ofs = 0; ofs < max_ofs; ofs += PAGE_SIZE) {
+	for (nr_set = ofs = 0; ofs < max_ofs; ofs += size) {
 		upl_t upl;
 		upl_page_info_array_t pl;
 		u32 *p;
-		int i;
+		unsigned i;
 
-		/* Map the page. */
-		err = ntfs_page_map(ni, ofs, &upl, &pl, (u8**)&p, FALSE);
+		/*
+		 * Map a window of the bitmap so we only need to set up and
+		 * tear down one page list for every NTFS_PAGE_WINDOW_SIZE
+		 * bytes rather than for every page.
+		 */
+		size = NTFS_PAGE_WINDOW_SIZE;
+		if (size > ((max_ofs - ofs + PAGE_MASK_64) & ~PAGE_MASK_64))
+			size = (max_ofs - ofs + PAGE_MASK_64) & ~PAGE_MASK_64;
+		err = ntfs_page_map_range(ni, ofs, &size, &upl, &pl, (u8**)&p,
+				FALSE);
 		if (err) {
-			ntfs_debug("Failed to map page from bitmap (offset "
-					"%lld, size %d, error %d).  Skipping "
-					"page.", (long long)ofs, PAGE_SIZE,
+			ntfs_debug("Failed to map pages from bitmap (offset "
+					"%lld, size %u, error %d).  Skipping "
+					"pages.", (long long)ofs, size,
 					(int)err);
 			/* Count the whole buffer contents as set bits only if I/O fails, otherwise bail out */
 			if (err != EIO) {
@@ -3272,7 +3282,7 @@ static errno_t ntfs_get_nr_set_bits(vnode_t vn, const s64 nr_bits, s64 *res)
 				vnode_put(vn);
 				return err;
 			}
-			nr_set += PAGE_SIZE * 8;
+			nr_set += (s64)size * 8;
 			continue;
 		}
 		/*
@@ -3280,13 +3290,13 @@ static errno_t ntfs_get_nr_set_bits(vnode_t vn, const s64 nr_bits, s64 *res)
 		 * is the last block and it is partial we do not really care as
 		 * it just means we do a little extra work but it will not
 		 * affect the result as all out of range bytes are set to zero
-		 * by ntfs_page_map().
+		 * by ntfs_page_map_range().
 		 *
-		 * Use multiples of 4 bytes, thus max size is PAGE_SIZE / 4.
+		 * Use multiples of 4 bytes, thus max size is @size / 4.
 		 */
-	  	for (i = 0; i < (PAGE_SIZE / 4); i++)
+		for (i = 0; i < (size / 4); i++)
 			nr_set += ntfs_popcount32(p[i]);
-		ntfs_page_unmap(ni, upl, pl, FALSE);
+		ntfs_page_unmap_range(ni, upl, pl, size, FALSE);
 	}
 	/*
 	 * Release the iocount reference on the bitmap vnode.  We can ignore
@@ -3605,6 +3615,8 @@ void ntfs_do_postponed_release(ntfs_volume *vol)
 	lck_rw_destroy(&vol->secure_lock, ntfs_lock_grp);
 	lck_spin_destroy(&vol->security_id_lock, ntfs_lock_grp);
 	lck_mtx_destroy(&vol->inodes_lock, ntfs_lock_grp);
+	lck_mtx_destroy(&vol->dirty_inodes_lock, ntfs_lock_grp);
+	lck_mtx_destroy(&vol->mft_sync_lock, ntfs_lock_grp);
 	/* Finally, free the ntfs volume. */
 	IOFree(vol, sizeof(ntfs_volume));
 	OSKextReleaseKextWithLoadTag(OSKextGetCurrentLoadTag());
@@ -3809,6 +3821,8 @@ no_mft:
 	lck_rw_destroy(&vol->secure_lock, ntfs_lock_grp);
 	lck_spin_destroy(&vol->security_id_lock, ntfs_lock_grp);
 	lck_mtx_destroy(&vol->inodes_lock, ntfs_lock_grp);
+	lck_mtx_destroy(&vol->dirty_inodes_lock, ntfs_lock_grp);
+	lck_mtx_destroy(&vol->mft_sync_lock, ntfs_lock_grp);
 	/* Finally, free the ntfs volume. */
 	IOFree(vol, sizeof(ntfs_volume));
 unload:
@@ -3863,7 +3877,7 @@ static int ntfs_sync_callback(vnode_t vn, void *arg)
 		 * Sync the inode data to disk and sync the ntfs inode to the
 		 * mft record(s) but do not write the mft record(s) to disk.
 		 */
-		err = ntfs_inode_sync(ni, args->sync, TRUE);
+		err = ntfs_inode_sync(ni, args->sync, TRUE, NULL);
 		/*
 		 * Only record the first error that is not ENOTSUP or record
 		 * ENOTSUP if that is the only error.
@@ -3878,6 +3892,158 @@ static int ntfs_sync_callback(vnode_t vn, void *arg)
 	return VNODE_RETURNED;
 }
 
+/**
+ * ntfs_sync_entry - an inode taken off the dirty inode list by ntfs_sync()
+ * @mft_no:	mft record number of the inode, the sort key
+ * @vn:		vnode of the inode
+ * @vn_id:	vnode id of @vn at the time the inode was taken off the list
+ */
+typedef struct {
+	ino64_t mft_no;
+	vnode_t vn;
+	uint32_t vn_id;
+} ntfs_sync_entry;
+
+static int ntfs_sync_entry_cmp(const void *a, const void *b)
+{
+	const ino64_t x = ((const ntfs_sync_entry*)a)->mft_no;
+	const ino64_t y = ((const ntfs_sync_entry*)b)->mft_no;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * ntfs_sync_dirty - sync the inodes on the dirty inode list of a volume
+ * @vol:	ntfs volume whose dirty inodes to sync
+ * @args:	pointer to an ntfs_sync_args structure
+ *
+ * Take all the inodes off the dirty inode list of the ntfs volume @vol and
+ * sync each of them in the same way as ntfs_sync_callback() does, in order of
+ * mft record number so that the mft records that get updated are visited in
+ * on-disk order.
+ *
+ * The updates of the directory index entries pointing to the inodes are not
+ * done one inode at a time but gathered into a batch which is applied once all
+ * inodes have been synced, visiting each parent directory once and walking
+ * its index in collation order (see ntfs_dirent_update_batch_apply()).  This
+ * turns one B+tree descent per name into about one per index leaf node when
+ * many files in the same directory are dirty.
+ *
+ * The vnode id of each inode is recorded whilst holding the dirty_inodes_lock
+ * so that we can safely get a reference on the vnode after dropping the lock
+ * and skip it if it has been recycled in the mean time, in which case
+ * ntfs_vnop_inactive() will have synced it already.
+ *
+ * An inode goes back on the list if it cannot be synced yet, i.e. it does not
+ * have a vnode yet, if syncing it failed, or if it is mapped writable as its
+ * pages can be dirtied at any time without us noticing.
+ *
+ * Any errors are returned in @args->err.
+ *
+ * Return 0 on success and ENOMEM if the list could not be taken, in which case
+ * the caller has to sync all vnodes instead.
+ */
+static errno_t ntfs_sync_dirty(ntfs_volume *vol, struct ntfs_sync_args *args)
+{
+	ntfs_inode_tailq_head keep;
+	ntfs_dirent_update_batch batch;
+	ntfs_sync_entry *entries;
+	ntfs_inode *ni;
+	u32 alloc_nr, taken, nr, i;
+	errno_t err;
+
+	lck_mtx_lock(&vol->dirty_inodes_lock);
+	alloc_nr = vol->nr_dirty_inodes;
+	lck_mtx_unlock(&vol->dirty_inodes_lock);
+	if (!alloc_nr)
+		return 0;
+	entries = IOMallocData(alloc_nr * sizeof(ntfs_sync_entry));
+	if (!entries)
+		return ENOMEM;
+	TAILQ_INIT(&keep);
+	taken = nr = 0;
+	lck_mtx_lock(&vol->dirty_inodes_lock);
+	/*
+	 * Inodes dirtied after we sampled the number of dirty inodes stay on
+	 * the list for the next sync.
+	 */
+	while (taken < alloc_nr && (ni = TAILQ_FIRST(&vol->dirty_inodes))) {
+		TAILQ_REMOVE(&vol->dirty_inodes, ni, dirty);
+		vol->nr_dirty_inodes--;
+		taken++;
+		if (!ni->vn) {
+			TAILQ_INSERT_TAIL(&keep, ni, dirty);
+			continue;
+		}
+		NInoClearOnDirtyList(ni);
+		/*
+		 * Skip the inodes for $MFT and $MFTMirr.  They are done
+		 * separately as the last ones to be synced.
+		 */
+		if (ni == vol->mft_ni || ni == vol->mftmirr_ni)
+			continue;
+		entries[nr].mft_no = ni->mft_no;
+		entries[nr].vn = ni->vn;
+		entries[nr].vn_id = vnode_vid(ni->vn);
+		nr++;
+	}
+	while ((ni = TAILQ_FIRST(&keep))) {
+		TAILQ_REMOVE(&keep, ni, dirty);
+		TAILQ_INSERT_TAIL(&vol->dirty_inodes, ni, dirty);
+		vol->nr_dirty_inodes++;
+	}
+	lck_mtx_unlock(&vol->dirty_inodes_lock);
+	qsort(entries, nr, sizeof(ntfs_sync_entry), ntfs_sync_entry_cmp);
+	batch = (ntfs_dirent_update_batch) { NULL, 0, 0 };
+	for (i = 0; i < nr; i++) {
+		if (vnode_getwithvid(entries[i].vn, entries[i].vn_id)) {
+			entries[i].vn = NULL;
+			continue;
+		}
+		ni = NTFS_I(entries[i].vn);
+		if (!ni) {
+			vnode_put(entries[i].vn);
+			entries[i].vn = NULL;
+			continue;
+		}
+		/*
+		 * Gather the directory index entry updates into @batch.  We
+		 * keep the iocount reference on the vnode until the batch has
+		 * been applied.
+		 */
+		err = ntfs_inode_sync(ni, args->sync, TRUE, &batch);
+		/*
+		 * Only record the first error that is not ENOTSUP or record
+		 * ENOTSUP if that is the only error.
+		 *
+		 * Skip deleted inodes.  Retry on the next sync if anything
+		 * else went wrong, unless the error is ENOTSUP which will not
+		 * go away by retrying.
+		 */
+		if (err && err != ENOENT) {
+			if (!args->err || args->err == ENOTSUP)
+				args->err = err;
+		}
+		if ((err && err != ENOENT && err != ENOTSUP) ||
+				NInoMmapWritable(ni))
+			ntfs_inode_dirty_list_add(ni);
+	}
+	/*
+	 * Update the directory index entries of all the inodes we synced, one
+	 * parent directory at a time and in index order.
+	 */
+	err = ntfs_dirent_update_batch_apply(vol, &batch);
+	if (err && (!args->err || args->err == ENOTSUP))
+		args->err = err;
+	ntfs_dirent_update_batch_free(&batch);
+	for (i = 0; i < nr; i++) {
+		if (entries[i].vn)
+			vnode_put(entries[i].vn);
+	}
+	IOFreeData(entries, alloc_nr * sizeof(ntfs_sync_entry));
+	return 0;
+}
+
 /**
  * ntfs_sync_helper - helper for ntfs_sync()
  * @ni:				ntfs inode the helper is invoked for
@@ -3902,7 +4068,7 @@ static void ntfs_sync_helper(ntfs_inode *ni, struct ntfs_sync_args *args,
 				(int)err);
 		goto err;
 	}
-	err = ntfs_inode_sync(ni, args->sync, skip_mft_record_sync);
+	err = ntfs_inode_sync(ni, args->sync, skip_mft_record_sync, NULL);
 	vnode_put(ni->vn);
 	/* Skip deleted inodes. */
 	if (err && err != ENOENT) {
@@ -3929,6 +4095,10 @@ err:
  *
  * If @waitfor is MNT_WAIT, wait for all i/o to complete before returning.
  *
+ * Only the inodes on the dirty inode list of the volume are synced (see
+ * ntfs_sync_dirty()), thus the cost of a sync is proportional to the number of
+ * modified inodes rather than to the number of vnodes in memory.
+ *
  * Return 0 on success and errno on error.
  *
  * Note this function is only called for r/w mounted volumes so no need to
@@ -3946,8 +4116,21 @@ static int ntfs_sync(struct mount *mp, int waitfor,
 	ntfs_debug("Entering.");
 	args.sync = (waitfor == MNT_WAIT) ? IO_SYNC : 0;
 	args.err = 0;
-	/* Iterate over all vnodes and run ntfs_inode_sync() on each of them. */
-	(void)vnode_iterate(mp, 0, ntfs_sync_callback, (void*)&args);
+	/*
+	 * Run ntfs_inode_sync() on each inode on the dirty inode list.  If we
+	 * cannot allocate the memory for that iterate over all vnodes instead.
+	 */
+	if (ntfs_sync_dirty(vol, &args))
+		(void)vnode_iterate(mp, 0, ntfs_sync_callback, (void*)&args);
+	else {
+		/*
+		 * Applying the batched directory index entry updates dirtied
+		 * index pages of the parent directories and thus put their
+		 * index inodes on the dirty inode list.  Go over the list
+		 * once more so the index pages are written by this sync.
+		 */
+		(void)ntfs_sync_dirty(vol, &args);
+	}
 	/*
 	 * Finally, sync the inodes for $MFT and $MFTMirr to disk.  Note we do
 	 * the sync twice to ensure that any interdependent changes that are
@@ -4288,6 +4471,10 @@ static int ntfs_mount(mount_t mp, vnode_t dev_vn, user_addr_t data,
 	lck_rw_init(&vol->secure_lock, ntfs_lock_grp, ntfs_lock_attr);
 	lck_spin_init(&vol->security_id_lock, ntfs_lock_grp, ntfs_lock_attr);
 	lck_mtx_init(&vol->inodes_lock, ntfs_lock_grp, ntfs_lock_attr);
+	TAILQ_INIT(&vol->dirty_inodes);
+	lck_mtx_init(&vol->dirty_inodes_lock, ntfs_lock_grp, ntfs_lock_attr);
+	lck_mtx_init(&vol->mft_sync_lock, ntfs_lock_grp, ntfs_lock_attr);
+	vol->mft_sync_tail = &vol->mft_sync_queue;
 	vfs_setfsprivate(mp, vol);
 	if (vfs_isrdonly(mp))
 		NVolSetReadOnly(vol);
@@ -4692,22 +4879,40 @@ err:
 static int ntfs_getattr(mount_t mp, struct vfs_attr *fsa,
 		vfs_context_t context __unused)
 {
-	u64 nr_clusters, nr_free_clusters, nr_used_mft_records;
+	u64 nr_clusters, nr_free_clusters, nr_mft_records, nr_used_mft_records;
 	u64 nr_free_mft_records;
+	s64 nr_free;
 	ntfs_volume *vol = NTFS_MP(mp);
 	struct vfsstatfs *sfs = vfs_statfs(mp);
 	ntfs_inode *ni;
 
 	ntfs_debug("Entering.");
-	/* Get a fully consistent snapshot of this point in time. */
-	lck_rw_lock_shared(&vol->mftbmp_lock);
-	lck_rw_lock_shared(&vol->lcnbmp_lock);
+	/*
+	 * Get a snapshot of this point in time.  We do not take the bitmap
+	 * locks as statfs() is called at a high rate by monitoring software
+	 * and it would then contend with the cluster and mft record
+	 * allocators which hold the locks for writing.  The counters are read
+	 * individually so whilst allocations are in progress they may not
+	 * quite agree with each other, thus clamp them so the derived values
+	 * are always sane.  The allocators may also briefly store a negative
+	 * free count before correcting it, so read the free counts as signed
+	 * values and clamp them at zero first.
+	 */
 	nr_clusters = vol->nr_clusters;
-	nr_free_clusters = vol->nr_free_clusters;
-	lck_rw_unlock_shared(&vol->lcnbmp_lock);
-	nr_free_mft_records = vol->nr_free_mft_records;
-	nr_used_mft_records = vol->nr_mft_records - nr_free_mft_records;
-	lck_rw_unlock_shared(&vol->mftbmp_lock);
+	nr_free = ntfs_vol_counter_read(&vol->nr_free_clusters);
+	if (nr_free < 0)
+		nr_free = 0;
+	nr_free_clusters = nr_free;
+	if (nr_free_clusters > nr_clusters)
+		nr_free_clusters = nr_clusters;
+	nr_mft_records = ntfs_vol_counter_read(&vol->nr_mft_records);
+	nr_free = ntfs_vol_counter_read(&vol->nr_free_mft_records);
+	if (nr_free < 0)
+		nr_free = 0;
+	nr_free_mft_records = nr_free;
+	if (nr_free_mft_records > nr_mft_records)
+		nr_free_mft_records = nr_mft_records;
+	nr_used_mft_records = nr_mft_records - nr_free_mft_records;
 	/* Number of file system objects on volume (at this point in time). */
 	VFSATTR_RETURN(fsa, f_objcount, nr_used_mft_records);
 	/*
@@ -5641,6 +5846,9 @@ lck_err:
 	err = ntfs_inode_hash_init();
 	if (err)
 		goto hash_err;
+	err = ntfs_dev_set_init();
+	if (err)
+		goto dev_set_err;
 	vfe = (struct vfs_fsentry) {
 		.vfe_vfsops	= &ntfs_vfsops,
 		.vfe_vopcnt	= 1,	/* For now we just use one set of vnode
@@ -5660,6 +5868,8 @@ lck_err:
 		return KERN_SUCCESS;
 	}
 	ntfs_error(NULL, "vfs_fsadd() failed (error %d).", (int)err);
+	ntfs_dev_set_deinit();
+dev_set_err:
 	ntfs_inode_hash_deinit();
 hash_err:
 	IOFree(ntfs_file_sds_entry, 0x60 * 4);
@@ -5705,6 +5915,7 @@ kern_return_t ntfs_module_stop(kmod_info_t *ki __unused, void *data __unused)
 					"%d).\n", err);
 		return KERN_FAILURE;
 	}
+	ntfs_dev_set_deinit();
 	ntfs_inode_hash_deinit();
 	IOFree(ntfs_file_sds_entry, 0x60 * 4);
 	ntfs_file_sds_entry = NULL;
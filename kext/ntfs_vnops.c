@@ -38,9 +38,13 @@
 #include <sys/attr.h>
 #include <sys/buf.h>
 #include <sys/errno.h>
+#include <sys/fsctl.h>
+#include <sys/kauth.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/syslimits.h>
+#include <sys/systm.h>
 #include <sys/time.h>
 #include <sys/ubc.h>
 #include <sys/ucred.h>
@@ -76,6 +80,7 @@
 #include "ntfs_mft.h"
 #include "ntfs_mst.h"
 #include "ntfs_page.h"
+#include "ntfs_runlist.h"
 #include "ntfs_sfm.h"
 #include "ntfs_time.h"
 #include "ntfs_unistr.h"
@@ -207,13 +212,16 @@ err:
 /**
  * ntfs_buf_iodone - remove the MST fixups when i/o is complete on a buffer
  * @buf:	buffer for which to remove the MST fixups
- * @arg:	unused, always NULL
+ * @arg:	write tracking cookie of ntfs_mft_records_commit() or NULL
  *
  * ntfs_buf_iodone() is an i/o completion handler which is called when i/o is
  * completed on a buffer belonging to $MFT/$DATA.  It removes the MST fixups
  * and returns after which the buffer busy state (BL_BUSY flag) is cleared and
  * others can access the buffer again.
  *
+ * If @arg is not NULL the write was issued by ntfs_mft_records_commit() and
+ * the result of the i/o is passed to ntfs_mft_record_write_done().
+ *
  * ntfs_buf_iodone() is called both when the i/o was successful and when it
  * failed thus we have to deal with that as appropriate.
  *
@@ -225,7 +233,7 @@ err:
  * thus it may not look up nor use the ntfs_volume structure to which the inode
  * belongs.
  */
-static void ntfs_buf_iodone(buf_t buf, void *arg __unused)
+static void ntfs_buf_iodone(buf_t buf, void *arg)
 {
 	s64 ofs, data_size, init_size;
 	vnode_t vn;
@@ -317,11 +325,15 @@ static void ntfs_buf_iodone(buf_t buf, void *arg __unused)
 			goto err;
 		}
 	}
+	if (arg)
+		ntfs_mft_record_write_done(arg, buf_error(buf));
 	ntfs_debug("Done.");
 	return;
 err:
 	if (!buf_error(buf))
 		buf_seterror(buf, err);
+	if (arg)
+		ntfs_mft_record_write_done(arg, buf_error(buf));
 	ntfs_debug("Failed.");
 	return;
 }
@@ -353,7 +365,7 @@ static int ntfs_vnop_strategy(struct vnop_strategy_args *a)
 	ntfs_inode *ni;
 	ntfs_volume *vol;
 	void (*old_iodone)(buf_t, void *);
-	void *old_transact;
+	void *old_transact, *commit_rec;
 	unsigned b_flags;
 	errno_t err, err2;
 	BOOL do_fixup;
@@ -362,6 +374,18 @@ static int ntfs_vnop_strategy(struct vnop_strategy_args *a)
 	if (!vn || vnode_ischr(vn) || vnode_isblk(vn))
 		panic("%s(): !vn || vnode_ischr(vn) || vnode_isblk(vn)\n",
 				__FUNCTION__);
+	/*
+	 * If this is a write of an mft record issued by
+	 * ntfs_mft_records_commit(), take the write tracking cookie off the
+	 * buffer so it can be handed to our i/o completion handler.  Buffers
+	 * from cluster_io() never carry one.
+	 */
+	commit_rec = NULL;
+	if (!(buf_flags(buf) & B_CLUSTER)) {
+		commit_rec = buf_fsprivate(buf);
+		if (commit_rec)
+			buf_setfsprivate(buf, NULL);
+	}
 	ni = NTFS_I(vn);
 	if (!ni) {
 		err = EIO;
@@ -552,8 +576,8 @@ static int ntfs_vnop_strategy(struct vnop_strategy_args *a)
 	 * case it is BL_BUSY and thus cannot be accessed by anyone so it is
 	 * safe to have the MST fixups applied whilst i/o is in flight.
 	 */
-	if (do_fixup) {
-		buf_setfilter(buf, ntfs_buf_iodone, NULL, &old_iodone,
+	if (do_fixup || commit_rec) {
+		buf_setfilter(buf, ntfs_buf_iodone, commit_rec, &old_iodone,
 				&old_transact);
 		if (old_iodone || old_transact)
 			panic("%s(): Buffer for $MFT/$DATA already had an i/o "
@@ -576,6 +600,8 @@ unm_err:
 err:
 	buf_seterror(buf, err);
 	buf_biodone(buf);
+	if (commit_rec)
+		ntfs_mft_record_write_done(commit_rec, err);
 	return err;
 }
 
@@ -2236,7 +2262,7 @@ static int ntfs_vnop_setattr(struct vnop_setattr_args *a)
 	}
 	/*
 	 * Unlock the attribute inode as we do not need it any more and so we
-	 * cannot deadlock with the call to ntfs_inode_afpinfo_write() below.
+	 * cannot deadlock with the call to ntfs_inode_afpinfo_update() below.
 	 */
 	if (ni != base_ni)
 		lck_rw_unlock_exclusive(&ni->lock);
@@ -2412,10 +2438,11 @@ static int ntfs_vnop_setattr(struct vnop_setattr_args *a)
 		NInoSetValidBackupTime(base_ni);
 		NInoSetDirtyBackupTime(base_ni);
 		/*
-		 * Now write (if needed creating) the AFP_AfpInfo attribute
-		 * with the specified backup time.
+		 * Now update (if needed creating) the AFP_AfpInfo attribute
+		 * with the specified backup time, possibly deferring it to
+		 * the next sync.
 		 */
-		err = ntfs_inode_afpinfo_write(base_ni);
+		err = ntfs_inode_afpinfo_update(base_ni);
 		if (err) {
 			ntfs_error(vol->mp, "Failed to write/create "
 					"AFP_AfpInfo attribute in inode "
@@ -3595,6 +3622,11 @@ recheck_deleted:
 	 */
 	ntfs_page_unmap(ni, upl, pl, TRUE);
 done:
+	/*
+	 * The written data is dirty in the vm page cache so make sure the next
+	 * sync gets to it.
+	 */
+	ntfs_inode_dirty_list_add(ni);
 	/*
 	 * If the write went past the end of the initialized size update it
 	 * both in the ntfs inode and in the base attribute record.
@@ -3782,7 +3814,7 @@ skip_truncate:
 		if (!err && ioflags & IO_SYNC) {
 			/* Mask out undersired @ioflags. */
 			ioflags &= ~(IO_UNIT | IO_APPEND | IO_DEFWRITE);
-			err = ntfs_inode_sync(ni, ioflags, FALSE);
+			err = ntfs_inode_sync(ni, ioflags, FALSE, NULL);
 		}
 	}
 	return err;
@@ -3855,16 +3887,210 @@ static int ntfs_vnop_write(struct vnop_write_args *a)
 }
 
 /**
- * ntfs_vnop_ioctl -
+ * ntfs_vnop_ioctl_defrag - defragment the data of a vnode
+ * @vn:		vnode to defragment
+ * @args:	defragmentation request (in) and result (out)
+ * @context:	vfs context of the caller
  *
+ * Handle the NTFS_IOC_DEFRAG fsctl for the vnode @vn by calling
+ * ntfs_attr_defrag() for it.  Only regular files and named streams can be
+ * defragmented and moving data requires write access to @vn.  Counting the
+ * extents only requires read access.
+ *
+ * Return 0 on success and errno on error.
  */
-static int ntfs_vnop_ioctl(struct vnop_ioctl_args *a __attribute__((unused)))
+static errno_t ntfs_vnop_ioctl_defrag(vnode_t vn, ntfs_defrag_args *args,
+		vfs_context_t context)
 {
+	ntfs_inode *ni = NTFS_I(vn);
 	errno_t err;
+	BOOL count_only;
 
-	ntfs_debug("Entering.");
-	// TODO:
-	err = ENOTSUP;
+	if ((args->flags & ~NTFS_DEFRAG_COUNT_ONLY) || args->reserved)
+		return EINVAL;
+	count_only = (args->flags & NTFS_DEFRAG_COUNT_ONLY) ? TRUE : FALSE;
+	/* Do not allow moving system files and mst protected attributes. */
+	if (vnode_issystem(vn) || NInoMstProtected(ni) ||
+			(!S_ISREG(ni->mode) && !(NInoAttr(ni) &&
+			ni->type == AT_DATA))) {
+		if (S_ISDIR(ni->mode))
+			return EISDIR;
+		return EPERM;
+	}
+	if (!count_only && NVolReadOnly(ni->vol))
+		return EROFS;
+	err = vnode_authorize(vn, NULL, count_only ? KAUTH_VNODE_READ_DATA :
+			KAUTH_VNODE_WRITE_DATA, context);
+	if (err)
+		return err;
+	return ntfs_attr_defrag(ni, count_only, &args->nr_extents,
+			&args->new_nr_extents);
+}
+
+/**
+ * ntfs_vnop_ioctl_get_extents - return the physical layout of a vnode
+ * @vn:		vnode whose extents to return
+ * @args:	extents request (in) and result (out)
+ * @context:	vfs context of the caller
+ *
+ * Handle the NTFS_IOC_GET_EXTENTS fsctl for the vnode @vn.  The extents are
+ * gathered in batches of NTFS_EXTENTS_BATCH by ntfs_attr_extents_get() and
+ * copied out to the user space array described by @args after dropping the
+ * inode and runlist locks so that we cannot deadlock if the array is in a
+ * page of @vn itself.  Only regular files and named streams have extents and
+ * getting them requires read access to @vn.
+ *
+ * Return 0 on success and errno on error.
+ */
+static errno_t ntfs_vnop_ioctl_get_extents(vnode_t vn,
+		ntfs_extents_args *args, vfs_context_t context)
+{
+	s64 ofs, end;
+	ntfs_inode *ni = NTFS_I(vn);
+	ntfs_extent *buf;
+	user_addr_t uaddr;
+	u32 batch, max_nr, nr;
+	errno_t err;
+
+	if ((args->flags & ~NTFS_EXTENTS_SYNC) || args->reserved ||
+			args->start < 0 || args->length < 0)
+		return EINVAL;
+	if (!S_ISREG(ni->mode) && !(NInoAttr(ni) && ni->type == AT_DATA)) {
+		if (S_ISDIR(ni->mode))
+			return EISDIR;
+		return EPERM;
+	}
+	err = vnode_authorize(vn, NULL, KAUTH_VNODE_READ_DATA, context);
+	if (err)
+		return err;
+	if (args->flags & NTFS_EXTENTS_SYNC) {
+		err = ubc_msync(vn, 0, ubc_getsize(vn), NULL,
+				UBC_PUSHDIRTY | UBC_SYNC);
+		if (err) {
+			ntfs_error(ni->vol->mp, "ubc_msync() of data for "
+					"mft_no 0x%llx failed (error %d).",
+					(unsigned long long)ni->mft_no, err);
+			return err;
+		}
+	}
+	ofs = args->start;
+	/* Clip the end on overflow, the length is usually "to the end". */
+	if (args->length > (s64)NTFS_MAX_ATTRIBUTE_SIZE - ofs)
+		end = NTFS_MAX_ATTRIBUTE_SIZE;
+	else
+		end = ofs + args->length;
+	args->nr_extents = 0;
+	/* If no array was supplied, only count the extents. */
+	if (!args->extent_count)
+		return ntfs_attr_extents_get(ni, &ofs, end, NULL, 0,
+				&args->nr_extents);
+	batch = args->extent_count;
+	if (batch > NTFS_EXTENTS_BATCH)
+		batch = NTFS_EXTENTS_BATCH;
+	buf = IOMallocData(batch * sizeof(ntfs_extent));
+	if (!buf)
+		return ENOMEM;
+	uaddr = (user_addr_t)args->extents;
+	do {
+		max_nr = args->extent_count - args->nr_extents;
+		if (max_nr > batch)
+			max_nr = batch;
+		err = ntfs_attr_extents_get(ni, &ofs, end, buf, max_nr, &nr);
+		if (err)
+			break;
+		if (!nr)
+			break;
+		err = copyout(buf, uaddr, nr * sizeof(ntfs_extent));
+		if (err)
+			break;
+		uaddr += nr * sizeof(ntfs_extent);
+		args->nr_extents += nr;
+	} while (nr == max_nr && args->nr_extents < args->extent_count);
+	IOFreeData(buf, batch * sizeof(ntfs_extent));
+	return err;
+}
+
+/**
+ * ntfs_vnop_ioctl_seek - find the next data or hole in a vnode
+ * @vn:		vnode to search
+ * @ofs:	byte offset at which to start searching (in) and result (out)
+ * @data:	if true find the next data and if false find the next hole
+ *
+ * Handle the FSIOC_FIOSEEKDATA and FSIOC_FIOSEEKHOLE ioctls which is how
+ * lseek(2) implements SEEK_DATA and SEEK_HOLE, respectively, by calling
+ * ntfs_attr_seek_data_hole() for the vnode @vn.
+ *
+ * Return 0 on success and errno on error.
+ */
+static errno_t ntfs_vnop_ioctl_seek(vnode_t vn, off_t *ofs, const BOOL data)
+{
+	ntfs_inode *ni = NTFS_I(vn);
+	s64 pos;
+	errno_t err;
+
+	if (!S_ISREG(ni->mode) && !(NInoAttr(ni) && ni->type == AT_DATA)) {
+		if (S_ISDIR(ni->mode))
+			return EISDIR;
+		return ENOTSUP;
+	}
+	pos = *ofs;
+	err = ntfs_attr_seek_data_hole(ni, &pos, data);
+	if (!err)
+		*ofs = pos;
+	return err;
+}
+
+/**
+ * ntfs_vnop_ioctl - ntfs specific fsctl(2) commands
+ * @a:		arguments to ioctl function
+ *
+ * @a contains:
+ *	vnode_t a_vp;		vnode the fsctl is for
+ *	u_long a_command;	fsctl command
+ *	caddr_t a_data;		in kernel copy of the fsctl argument
+ *	int a_fflag;		fsctl(2) options
+ *	vfs_context_t a_context;
+ *
+ * The fsctl(2) system call has already copied in the argument for us and
+ * copies it back out on success.  The NTFS specific commands are defined in
+ * ntfs.h.  We also get called by lseek(2) for SEEK_HOLE and SEEK_DATA with
+ * the FSIOC_FIOSEEKHOLE and FSIOC_FIOSEEKDATA commands and a pointer to the
+ * offset.
+ *
+ * Return 0 on success and errno on error.  Unknown commands return ENOTSUP.
+ */
+static int ntfs_vnop_ioctl(struct vnop_ioctl_args *a)
+{
+	vnode_t vn = a->a_vp;
+	ntfs_inode *ni = NTFS_I(vn);
+	errno_t err;
+
+	if (!ni) {
+		ntfs_debug("Entered with NULL ntfs_inode, aborting.");
+		return EINVAL;
+	}
+	ntfs_debug("Entering for mft_no 0x%llx, command 0x%lx.",
+			(unsigned long long)ni->mft_no,
+			(unsigned long)a->a_command);
+	switch (a->a_command) {
+	case NTFS_IOC_DEFRAG:
+		err = ntfs_vnop_ioctl_defrag(vn, (ntfs_defrag_args*)a->a_data,
+				a->a_context);
+		break;
+	case NTFS_IOC_GET_EXTENTS:
+		err = ntfs_vnop_ioctl_get_extents(vn,
+				(ntfs_extents_args*)a->a_data, a->a_context);
+		break;
+	case FSIOC_FIOSEEKHOLE:
+		err = ntfs_vnop_ioctl_seek(vn, (off_t*)a->a_data, FALSE);
+		break;
+	case FSIOC_FIOSEEKDATA:
+		err = ntfs_vnop_ioctl_seek(vn, (off_t*)a->a_data, TRUE);
+		break;
+	default:
+		err = ENOTSUP;
+		break;
+	}
 	ntfs_debug("Done (error %d).", (int)err);
 	return err;
 }
@@ -3945,17 +4171,22 @@ static int ntfs_vnop_exchange(
  */
 static int ntfs_vnop_mmap(struct vnop_mmap_args *a)
 {
-#ifdef DEBUG
 	ntfs_inode *ni = NTFS_I(a->a_vp);
 
-	if (ni)
-		ntfs_debug("Mapping mft_no 0x%llx, type 0x%x, name_len 0x%x, "
-				"mapping flags 0x%x.",
-				(unsigned long long)ni->mft_no,
-				le32_to_cpu(ni->type), (unsigned)ni->name_len,
-				a->a_fflags);
-#endif
-	/* Nothing to do. */
+	if (!ni)
+		return 0;
+	ntfs_debug("Mapping mft_no 0x%llx, type 0x%x, name_len 0x%x, "
+			"mapping flags 0x%x.", (unsigned long long)ni->mft_no,
+			le32_to_cpu(ni->type), (unsigned)ni->name_len,
+			a->a_fflags);
+	/*
+	 * Writes through a writable mapping dirty pages without us noticing
+	 * so keep the inode on the dirty inode list until it is unmapped.
+	 */
+	if (a->a_fflags & PROT_WRITE) {
+		NInoSetMmapWritable(ni);
+		ntfs_inode_dirty_list_add(ni);
+	}
 	return 0;
 }
 
@@ -3982,15 +4213,22 @@ static int ntfs_vnop_mmap(struct vnop_mmap_args *a)
  */
 static int ntfs_vnop_mnomap(struct vnop_mnomap_args *a)
 {
-#ifdef DEBUG
 	ntfs_inode *ni = NTFS_I(a->a_vp);
 
-	if (ni)
-		ntfs_debug("Unmapping mft_no 0x%llx, type 0x%x, name_len "
-				"0x%x.", (unsigned long long)ni->mft_no,
-				le32_to_cpu(ni->type), (unsigned)ni->name_len);
-#endif
-	/* Nothing to do. */
+	if (!ni)
+		return 0;
+	ntfs_debug("Unmapping mft_no 0x%llx, type 0x%x, name_len 0x%x.",
+			(unsigned long long)ni->mft_no,
+			le32_to_cpu(ni->type), (unsigned)ni->name_len);
+	/*
+	 * The inode no longer needs to stay on the dirty inode list but pages
+	 * dirtied through the mapping may not have been synced yet so make
+	 * sure the next sync gets to them.
+	 */
+	if (NInoMmapWritable(ni)) {
+		NInoClearMmapWritable(ni);
+		ntfs_inode_dirty_list_add(ni);
+	}
 	return 0;
 }
 
@@ -4033,7 +4271,7 @@ static int ntfs_vnop_fsync(struct vnop_fsync_args *a)
 	 * We need to allow ENOENT errors since the unlink system call can call
 	 * VNOP_FSYNC() during vclean().
 	 */
-	err = ntfs_inode_sync(ni, sync, FALSE);
+	err = ntfs_inode_sync(ni, sync, FALSE, NULL);
 	if (err == ENOENT)
 		err = 0;
 	ntfs_debug("Done (error %d).", err);
@@ -7304,7 +7542,8 @@ sync:
 		 */
 		err = 0;
 		if (!NVolReadOnly(vol))
-			err = ntfs_inode_sync(ni, IO_SYNC | IO_CLOSE, FALSE);
+			err = ntfs_inode_sync(ni, IO_SYNC | IO_CLOSE, FALSE,
+					NULL);
 		if (!err)
 			ntfs_debug("Done.");
 		else
@@ -7974,6 +8213,136 @@ static int ntfs_vnop_pagein(struct vnop_pagein_args *a)
 	return err;
 }
 
+/*
+ * Maximum number of physically discontiguous pieces ntfs_mst_pageout_direct()
+ * will write.  Anything more fragmented than that is left to the cluster
+ * layer.
+ */
+#define NTFS_MST_PAGEOUT_MAX_EXTENTS	8
+
+/**
+ * ntfs_mst_pageout_direct - write mst protected records via a bounce buffer
+ * @ni:		ntfs inode whose records to write
+ * @kaddr:	mapped page list contents at the first record to write
+ * @attr_ofs:	byte offset in the inode of the first record to write
+ * @nr_recs:	number of records to write
+ * @magic:	magic of the records to which to apply the mst fixups
+ *
+ * Copy the @nr_recs records at @kaddr into a bounce buffer, apply the mst
+ * fixups to the copies and write the bounce buffer straight to the device
+ * with one i/o per physically contiguous piece of the attribute.
+ *
+ * This means the pages in the page cache are never modified so, unlike when
+ * going via cluster_pageout_ext(), we do not need to remap the page list to
+ * remove the fixups again and a failed write cannot leave records with
+ * applied fixups behind in memory.
+ *
+ * Any unmapped parts of the runlist are mapped as needed (which may upgrade
+ * the runlist lock).  Return 0 on success and errno on error.  EAGAIN means
+ * that the records could not be written this way and the caller should fall
+ * back to writing the page list in place.  Nothing has been written in this
+ * case.  This happens when:
+ *	- part of the range is a hole or lies beyond the allocated size,
+ *	- mapping the runlist failed, e.g. due to lack of memory or a corrupt
+ *	  mapping pairs array,
+ *	- the range is split into more than NTFS_MST_PAGEOUT_MAX_EXTENTS
+ *	  physically contiguous pieces,
+ *	- the device position or size of a piece is not sector aligned, or
+ *	- there was not enough memory for the bounce buffer.
+ *
+ * Locking: - Caller must hold an iocount reference on the vnode of @ni.
+ *	    - Caller must not hold @ni->rl.lock.
+ */
+static errno_t ntfs_mst_pageout_direct(ntfs_inode *ni, const u8 *kaddr,
+		s64 attr_ofs, unsigned nr_recs, NTFS_RECORD_TYPE magic)
+{
+	struct {
+		s64 pos;
+		s64 size;
+	} ext[NTFS_MST_PAGEOUT_MAX_EXTENTS];
+	ntfs_volume *vol = ni->vol;
+	u8 *bbuf;
+	s64 ofs, end, clusters, bytes, bbuf_ofs;
+	LCN lcn;
+	unsigned rec_size, rec_shift, nr_ext, i;
+	errno_t err;
+
+	rec_size = ni->block_size;
+	rec_shift = ni->block_size_shift;
+	ofs = attr_ofs;
+	end = attr_ofs + ((s64)nr_recs << rec_shift);
+	/*
+	 * Work out where on the device the records live, mapping the runlist
+	 * as needed.  Give up and let the caller use the cluster layer if
+	 * mapping the runlist fails, there is a hole, or the range is too
+	 * fragmented or not sector aligned.
+	 */
+	nr_ext = 0;
+	lck_rw_lock_shared(&ni->rl.lock);
+	while (ofs < end) {
+		lcn = ntfs_attr_vcn_to_lcn_nolock(ni,
+				ofs >> vol->cluster_size_shift, FALSE,
+				&clusters);
+		if (lcn < 0 || nr_ext >= NTFS_MST_PAGEOUT_MAX_EXTENTS) {
+			lck_rw_unlock_shared(&ni->rl.lock);
+			return EAGAIN;
+		}
+		bytes = (clusters << vol->cluster_size_shift) -
+				(ofs & vol->cluster_size_mask);
+		if (bytes > end - ofs)
+			bytes = end - ofs;
+		ext[nr_ext].pos = (lcn << vol->cluster_size_shift) +
+				(ofs & vol->cluster_size_mask);
+		ext[nr_ext].size = bytes;
+		if ((ext[nr_ext].pos | bytes) & vol->sector_size_mask) {
+			lck_rw_unlock_shared(&ni->rl.lock);
+			return EAGAIN;
+		}
+		nr_ext++;
+		ofs += bytes;
+	}
+	lck_rw_unlock_shared(&ni->rl.lock);
+	bytes = end - attr_ofs;
+	bbuf = IOMallocData(bytes);
+	if (!bbuf)
+		return EAGAIN;
+	memcpy(bbuf, kaddr, bytes);
+	/* Apply the mst fixups to the records in the bounce buffer. */
+	for (i = 0; i < nr_recs; i++) {
+		NTFS_RECORD *rec = (NTFS_RECORD*)(bbuf + (i << rec_shift));
+		if (__ntfs_is_magic(rec->magic, magic)) {
+			err = ntfs_mst_fixup_pre_write(rec, rec_size);
+			if (err) {
+				ntfs_error(vol->mp, "Failed to apply mst "
+						"fixups (mft_no 0x%llx, type "
+						"0x%x, offset 0x%llx).",
+						(unsigned long long)ni->mft_no,
+						(unsigned)le32_to_cpu(ni->type),
+						(unsigned long long)attr_ofs +
+						(i << rec_shift));
+				goto out;
+			}
+		}
+	}
+	/* Write the bounce buffer one contiguous piece at a time. */
+	OSIncrementAtomic(&ni->data_write_gen);
+	err = 0;
+	for (i = bbuf_ofs = 0; i < nr_ext; bbuf_ofs += ext[i++].size) {
+		err = ntfs_dev_write(vol, ext[i].pos, ext[i].size,
+				bbuf + bbuf_ofs);
+		if (err) {
+			ntfs_error(vol->mp, "Failed to write records of "
+					"mft_no 0x%llx, type 0x%x (error %d).",
+					(unsigned long long)ni->mft_no,
+					(unsigned)le32_to_cpu(ni->type), err);
+			break;
+		}
+	}
+out:
+	IOFreeData(bbuf, bytes);
+	return err;
+}
+
 // TODO: Move to ntfs_page.[hc].
 static int ntfs_mst_pageout(ntfs_inode *ni, upl_t upl, upl_offset_t upl_ofs,
 		unsigned size, s64 attr_ofs, s64 attr_size, int flags)
@@ -8052,6 +8421,30 @@ static int ntfs_mst_pageout(ntfs_inode *ni, upl_t upl, upl_offset_t upl_ofs,
 		err = EIO;
 		goto err;
 	}
+	/*
+	 * Try to write the records from a bounce buffer first so the pages
+	 * are left untouched and the whole range goes out in as few i/os as
+	 * possible.  Only if that is not possible, apply the fixups in place
+	 * and go through the cluster layer.
+	 */
+	err = ntfs_mst_pageout_direct(ni, kaddr + upl_ofs, attr_ofs, nr_recs,
+			magic);
+	if (err != EAGAIN) {
+		kerr = ubc_upl_unmap(upl);
+		if (kerr != KERN_SUCCESS)
+			ntfs_error(vol->mp, "ubc_upl_unmap() failed (error "
+					"%d).", (int)kerr);
+		if (err)
+			goto err;
+		if (do_commit) {
+			/* Commit the page range we wrote out. */
+			ubc_upl_commit_range(upl, upl_ofs, size,
+					UPL_COMMIT_FREE_ON_EMPTY |
+					UPL_COMMIT_CLEAR_DIRTY);
+		}
+		ntfs_debug("Done (direct).");
+		return 0;
+	}
 	/*
 	 * Loop over the records in the page list and for each apply the mst
 	 * fixups.  On any fixup errors, remove all the applied fixups and
@@ -8176,8 +8569,11 @@ err:
  * For non-resident, non-compressed attributes we use cluster_pageout_ext()
  * which deals with both normal and multi sector transfer protected attributes.
  *
- * In the case of multi sector transfer protected attributes we apply the
- * fixups and then submit the i/o synchronously by setting the UPL_IOSYNC flag.
+ * In the case of multi sector transfer protected attributes we copy the
+ * records to a bounce buffer, apply the fixups there and write the bounce
+ * buffer directly to the device (see ntfs_mst_pageout_direct()).  If that is
+ * not possible we apply the fixups in place and then submit the i/o
+ * synchronously by setting the UPL_IOSYNC flag.
  *
  * For resident attributes and non-resident, compressed attributes we write the
  * data ourselves by mapping the page list, and in the resident case, mapping
@@ -9240,10 +9636,11 @@ static int ntfs_vnop_setxattr(struct vnop_setxattr_args *a)
 					ntfs_utc_current_time();
 			NInoSetDirtyTimes(ni);
 			/*
-			 * Now write (if needed creating) the AFP_AfpInfo
-			 * attribute with the specified Finder Info.
+			 * Now update (if needed creating) the AFP_AfpInfo
+			 * attribute with the specified Finder Info, possibly
+			 * deferring it to the next sync.
 			 */
-			err = ntfs_inode_afpinfo_write(ni);
+			err = ntfs_inode_afpinfo_update(ni);
 			if (err)
 				ntfs_error(vol->mp, "Failed to write/create "
 						"AFP_AfpInfo attribute in "
@@ -9615,8 +10012,8 @@ static int ntfs_vnop_removexattr(struct vnop_removexattr_args *a)
 		ni->last_mft_change_time = ni->last_data_change_time =
 				ntfs_utc_current_time();
 		NInoSetDirtyTimes(ni);
-		/* Now write (if needed deleting) the AFP_AfpInfo attribute. */
-		err = ntfs_inode_afpinfo_write(ni);
+		/* Now update (if needed deleting) the AFP_AfpInfo attribute. */
+		err = ntfs_inode_afpinfo_update(ni);
 		if (!err)
 			ntfs_debug("Deleted Finder info from mft_no 0x%llx.",
 					(unsigned long long)ni->mft_no);
@@ -10413,7 +10810,13 @@ eof:
 	/*
 	 * Convert the vcn to the corresponding lcn and obtain the number of
 	 * contiguous clusters starting at the vcn.
+	 *
+	 * If this is a write, bump the data write generation first so that
+	 * ntfs_attr_defrag() notices that the clusters may have changed
+	 * underneath its copy.
 	 */
+	if (is_write)
+		OSIncrementAtomic(&ni->data_write_gen);
 	lck_rw_lock_shared(&ni->rl.lock);
 	lcn = ntfs_attr_vcn_to_lcn_nolock(ni, vcn, FALSE,
 			a->a_run ? &clusters : 0);
@@ -47,6 +47,7 @@
 
 /* Forward declaration. */
 typedef struct _ntfs_volume ntfs_volume;
+typedef struct _ntfs_mft_sync_waiter ntfs_mft_sync_waiter;
 
 #include "ntfs_inode.h"
 #include "ntfs_layout.h"
@@ -131,7 +132,16 @@ struct _ntfs_volume {
 					   number of bits in mft bitmap. */
 	s64 nr_free_mft_records;	/* Number of free mft records on volume
 					   == number of zero bits in mft
-					   bitmap. */
+					   bitmap.  Use ntfs_vol_counter_read()
+					   to read it and @nr_mft_records
+					   without holding @mftbmp_lock. */
+	lck_mtx_t_ex mft_sync_lock;	/* Lock protecting the below. */
+	ntfs_mft_sync_waiter *mft_sync_queue;/* Callers of
+					   ntfs_mft_records_group_sync()
+					   waiting for the next commit. */
+	ntfs_mft_sync_waiter **mft_sync_tail;/* Tail of @mft_sync_queue. */
+	BOOL mft_sync_active;		/* True whilst a commit of mft records
+					   is in progress. */
 
 	ntfs_inode *mftmirr_ni;		/* The ntfs inode of $MFTMirr. */
 	unsigned mftmirr_size;		/* Relevant size of mft mirror in mft
@@ -149,7 +159,9 @@ struct _ntfs_volume {
 	LCN nr_clusters;		/* Volume size in clusters == number of
 					   bits in lcn bitmap. */
 	LCN nr_free_clusters;		/* Number of free clusters on volume ==
-					   number of zero bits in lcn bitmap. */
+					   number of zero bits in lcn bitmap.
+					   Use ntfs_vol_counter_read() to read
+					   it without holding @lcnbmp_lock. */
 
 	ntfs_inode *vol_ni;		/* The ntfs inode of $Volume. */
 	VOLUME_FLAGS vol_flags;		/* Volume flags. */
@@ -202,6 +214,13 @@ struct _ntfs_volume {
 	ntfs_inode_list_head inodes;	/* List of all loaded ntfs_inodes. */
 	lck_mtx_t_ex inodes_lock;		/* Lock protecting access to inodes
 					   list. */
+	ntfs_inode_tailq_head dirty_inodes;/* List of ntfs_inodes that may
+					   need syncing, in the order they were
+					   dirtied. */
+	u32 nr_dirty_inodes;		/* Number of inodes on @dirty_inodes. */
+	lck_mtx_t_ex dirty_inodes_lock;	/* Lock protecting access to
+					   @dirty_inodes and
+					   @nr_dirty_inodes. */
 };
 
 /*
@@ -261,4 +280,19 @@ DEFINE_NVOL_BIT_OPS(UseSDAttr)
 DEFINE_NVOL_BIT_OPS(PostponedRelease)
 DEFINE_NVOL_BIT_OPS(HasGUID)
 
+/**
+ * ntfs_vol_counter_read - read a volume counter without taking its lock
+ * @counter:	counter to read
+ *
+ * The free cluster and mft record counters are kept exact by the allocators
+ * which modify them with @lcnbmp_lock or @mftbmp_lock, respectively, held for
+ * writing.  They are aligned 64-bit values thus statistics gathering can read
+ * them without taking the lock and without ever seeing a torn value.  The
+ * value may of course be stale by the time the caller looks at it.
+ */
+static inline s64 ntfs_vol_counter_read(const s64 *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
 #endif /* !_OSX_NTFS_VOLUME_H */
@@ -37,6 +37,7 @@
 #include "compat.h"
 #include "attrib.h"
 #include "attrlist.h"
+#include "compress.h"
 #include "device.h"
 #include "mft.h"
 #include "debug.h"
@@ -525,6 +526,7 @@ void ntfs_attr_close(ntfs_attr *na)
 		return;
 	if (NAttrNonResident(na) && na->rl)
 		free(na->rl);
+	free(na->cb_cache);
 	/* Don't release if using an internal constant. */
 	if (na->name != AT_UNNAMED && na->name != NTFS_INDEX_I30
 				&& na->name != STREAM_SDS)
@@ -854,11 +856,8 @@ static s64 ntfs_attr_pread_i(ntfs_attr *na, const s64 pos, s64 count, void *b)
 
 	/* Sanity checking arguments is done in ntfs_attr_pread(). */
 	
-	if ((na->data_flags & ATTR_COMPRESSION_MASK) && NAttrNonResident(na)) {
-		/* compression not supported */
-		errno = EOPNOTSUPP;
-		return -1;
-	}
+	if ((na->data_flags & ATTR_COMPRESSION_MASK) && NAttrNonResident(na))
+		return ntfs_compressed_attr_pread(na, pos, count, b);
 	/*
 	 * Encrypted non-resident attributes are not supported.  We return
 	 * access denied, which is what Windows NT4 does, too.
@@ -5673,6 +5672,8 @@ int ntfs_attr_truncate(ntfs_attr *na, const s64 newsize)
 {
 	int r;
 
+	/* The cached compression block may no longer be valid. */
+	na->cb_cache_pos = -1;
 	r = ntfs_attr_truncate_i(na, newsize, HOLES_OK);
 	NAttrClearDataAppending(na);
 	NAttrClearBeingNonResident(na);
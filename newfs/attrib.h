@@ -111,6 +111,8 @@ extern ATTR_DEF *ntfs_attr_find_in_attrdef(const ntfs_volume *vol,
  * @compression_block_size:		size of a compression block (cb)
  * @compression_block_size_bits:	log2 of the size of a cb
  * @compression_block_clusters:		number of clusters per cb
+ * @cb_cache:		last decompressed cb or NULL (see compress.c)
+ * @cb_cache_pos:	byte offset of the cb in @cb_cache in the attribute
  *
  * This structure exists purely to provide a mechanism of caching the runlist
  * of an attribute. If you want to operate on a particular attribute extent,
@@ -154,6 +156,8 @@ struct _ntfs_attr {
 	u8 compression_block_size_bits;
 	u8 compression_block_clusters;
 	s8 unused_runs; /* pre-reserved entries available */
+	u8 *cb_cache;
+	s64 cb_cache_pos;
 };
 
 /**
@@ -159,6 +159,8 @@ static struct bootcamp_formatter_options {
 	                                 * smaller than one sector.
 	                                 * TRUE = MFT record size must be
 	                                 * minimum one sector. */
+	BOOL force;                     /* Allow formatting a regular file as
+	                                 * a volume image. */
 } opts;
 
 /*
@@ -2985,7 +2987,7 @@ static BOOL bootcamp_formatter_open_partition(ntfs_volume *vol)
 		goto done;
 	}
 
-	if (!S_ISBLK(sbuf.st_mode)) {
+	if (!S_ISBLK(sbuf.st_mode) && !(opts.force && S_ISREG(sbuf.st_mode))) {
 		ntfs_log_error("%s is not a block device.\n", vol->dev->d_name);
 		goto err;
 	}
@@ -4445,7 +4447,10 @@ __attribute__ ((noreturn)) static void usage(void)
 			EXEC_NAME);
 	fprintf(stderr, "Copyright (C) 2015 Tuxera Inc.\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "usage: %s [-v <volume_name>] <device>\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-F] [-v <volume_name>] <device>\n", EXEC_NAME);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "    -F  Format <device> even if it is a regular file, "
+			"creating a volume image.\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -4462,13 +4467,17 @@ int main(int argc, char *argv[])
 {
 	char *device;
 	BOOL mft_rec_size_align_sec = FALSE;
+	BOOL force = FALSE;
 	char *label = NULL;
 	int ret;
 	int ch;
 	
-	while ((ch = getopt(argc, argv, "mv:")) != -1)
+	while ((ch = getopt(argc, argv, "Fmv:")) != -1)
 	{
 		switch (ch) {
+			case 'F':
+				force = TRUE;
+				break;
 			case 'm':
 				mft_rec_size_align_sec = TRUE;
 				break;
@@ -4499,6 +4508,7 @@ int main(int argc, char *argv[])
 	}
 	opts.dev_name = device;
 	opts.mft_rec_size_align_sec = mft_rec_size_align_sec;
+	opts.force = force;
 
 	ret = bootcamp_formatter_redirect(&opts);
 	if(!ret) {
@@ -13,6 +13,7 @@
 
 #include "types.h"
 #include "layout.h"
+#include "volume.h"
 
 /**
  * ntfs_boot_sector_is_ntfs - check a boot sector for describing an ntfs volume
@@ -23,5 +24,8 @@
  */
 extern BOOL ntfs_boot_sector_is_ntfs(NTFS_BOOT_SECTOR *b);
 
+extern int ntfs_boot_sector_parse(ntfs_volume *vol,
+		const NTFS_BOOT_SECTOR *bs);
+
 #endif /* defined _NTFS_BOOTSECT_H */
 
@@ -0,0 +1,717 @@
+/**
+ * bulkread.c - Bulk reader of many files in the order of their clusters.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * Reading many files one after the other makes the disk seek from file to
+ * file, and within fragmented files.  Instead, the runlists of all the files
+ * are mapped up front and cut into pieces, and the pieces with data are read
+ * in the order of their clusters, physically contiguous pieces in a single
+ * read, so the disk is read mostly sequentially.  Each piece is handed to the
+ * callback as soon as it is read.
+ *
+ * When the caller wants the pieces of each file in order, pieces which arrive
+ * ahead of an earlier piece of their file are held back in memory.  To bound
+ * the memory, once too much is held back, the missing pieces of the file
+ * holding back the most are read out of cluster order to release it.
+ *
+ * Resident, compressed and encrypted data is not read from the device
+ * directly: resident and compressed data is read through the library as the
+ * files are mapped, and encrypted files fail with EACCES.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "types.h"
+#include "attrib.h"
+#include "bulkread.h"
+#include "device.h"
+#include "inode.h"
+#include "layout.h"
+#include "logging.h"
+#include "misc.h"
+
+/* Default most bytes read from the device at a time. */
+#define BULK_READ_DEFAULT_READ_SIZE	(1024 * 1024)
+
+/* Default most bytes held back waiting for earlier pieces. */
+#define BULK_READ_DEFAULT_MAX_BUFFER	(64 * 1024 * 1024)
+
+/**
+ * struct ntfs_bulk_read_piece - a piece of a file to deliver
+ * @file:	index of the file in ntfs_bulk_read_ctx.files
+ * @pos:	byte position of the piece in the file
+ * @len:	byte size of the piece
+ * @lcn:	first cluster of the data, LCN_HOLE if it reads as zeroes
+ * @held:	the data if it is held back, else NULL
+ * @done:	the piece has been delivered
+ */
+typedef struct {
+	s64 file;
+	s64 pos;
+	s64 len;
+	LCN lcn;
+	u8 *held;
+	BOOL done;
+} ntfs_bulk_read_piece;
+
+/**
+ * struct ntfs_bulk_read_file - a file to deliver
+ * @mref:	mft reference of the file
+ * @size:	data size of the file
+ * @first:	index of its first piece in ntfs_bulk_read_ctx.pieces
+ * @nr:		number of its pieces, in order of position
+ * @next:	number of its pieces delivered in order so far, if ordered
+ * @nr_left:	number of its pieces not delivered yet
+ * @held:	bytes of its pieces held back
+ */
+typedef struct {
+	MFT_REF mref;
+	s64 size;
+	s64 first;
+	s64 nr;
+	s64 next;
+	s64 nr_left;
+	s64 held;
+} ntfs_bulk_read_file;
+
+/**
+ * struct ntfs_bulk_read_ctx - state of a bulk read
+ * @vol:	the volume
+ * @opts:	parameters of the read
+ * @read_size:	most bytes read at a time, a multiple of the cluster size
+ * @max_buffer:	most bytes held back
+ * @files:	the files
+ * @nr_files:	number of elements in @files
+ * @pieces:	the pieces of all the files, those of each file together
+ * @nr_pieces:	number of elements in @pieces
+ * @size:	allocated number of elements in @pieces
+ * @held:	bytes held back in all
+ * @buf:	buffer for reads in cluster order
+ * @force_buf:	buffer for reads out of cluster order
+ * @aborted:	the callback failed
+ * @stats:	statistics of the read
+ */
+typedef struct {
+	ntfs_volume *vol;
+	const ntfs_bulk_read_opts *opts;
+	u32 read_size;
+	s64 max_buffer;
+	ntfs_bulk_read_file *files;
+	s64 nr_files;
+	ntfs_bulk_read_piece *pieces;
+	s64 nr_pieces;
+	s64 size;
+	s64 held;
+	u8 *buf;
+	u8 *force_buf;
+	BOOL aborted;
+	ntfs_bulk_read_stats stats;
+} ntfs_bulk_read_ctx;
+
+/**
+ * ntfs_bulk_read_deliver - hand a piece to the callback
+ * @ctx:	state of the bulk read
+ * @p:		the piece
+ * @buf:	its data, NULL if it reads as zeroes
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_deliver(ntfs_bulk_read_ctx *ctx,
+		ntfs_bulk_read_piece *p, const u8 *buf)
+{
+	ntfs_bulk_read_file *f = ctx->files + p->file;
+	ntfs_bulk_read_chunk c;
+
+	c.index = p->file;
+	c.mref = f->mref;
+	c.pos = p->pos;
+	c.len = p->len;
+	c.buf = buf;
+	c.size = f->size;
+	c.last = !--f->nr_left;
+	c.err = 0;
+	p->done = TRUE;
+	if (c.last)
+		ctx->stats.nr_files++;
+	if (ctx->opts->fn(&c, ctx->opts->data)) {
+		ctx->aborted = TRUE;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_fail - report a file which could not be read
+ * @ctx:	state of the bulk read
+ * @index:	index of the file
+ * @mref:	mft reference of the file
+ * @err:	why it could not be read
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_fail(ntfs_bulk_read_ctx *ctx, s64 index,
+		MFT_REF mref, int err)
+{
+	ntfs_bulk_read_chunk c;
+
+	memset(&c, 0, sizeof(c));
+	c.index = index;
+	c.mref = mref;
+	c.last = TRUE;
+	c.err = err;
+	ctx->stats.nr_failed++;
+	if (ctx->opts->fn(&c, ctx->opts->data)) {
+		ctx->aborted = TRUE;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_add - add a piece to a file
+ * @ctx:	state of the bulk read
+ * @file:	index of the file, the last one with pieces
+ * @pos:	byte position of the piece in the file
+ * @len:	byte size of the piece
+ * @lcn:	first cluster of the data, LCN_HOLE if it reads as zeroes or
+ *		LCN_ENOENT if it is read through the library
+ *
+ * Adjacent pieces reading as zeroes are merged.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_add(ntfs_bulk_read_ctx *ctx, s64 file, s64 pos,
+		s64 len, LCN lcn)
+{
+	ntfs_bulk_read_file *f = ctx->files + file;
+	ntfs_bulk_read_piece *p;
+
+	if (f->nr && lcn == LCN_HOLE) {
+		p = ctx->pieces + ctx->nr_pieces - 1;
+		if (p->lcn == LCN_HOLE) {
+			p->len += len;
+			return 0;
+		}
+	}
+	if (ctx->nr_pieces == ctx->size) {
+		s64 size = ctx->size ? 2 * ctx->size : 1024;
+
+		p = realloc(ctx->pieces, size * sizeof(*p));
+		if (!p) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ctx->pieces = p;
+		ctx->size = size;
+	}
+	p = ctx->pieces + ctx->nr_pieces++;
+	p->file = file;
+	p->pos = pos;
+	p->len = len;
+	p->lcn = lcn;
+	p->held = NULL;
+	p->done = FALSE;
+	f->nr++;
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_map - cut the data of a file into pieces
+ * @ctx:	state of the bulk read
+ * @file:	index of the file
+ * @na:		its unnamed $DATA attribute
+ *
+ * Data past the initialized size reads as zeroes, like holes, and data runs
+ * are cut so no piece is larger than the read size.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_map(ntfs_bulk_read_ctx *ctx, s64 file,
+		ntfs_attr *na)
+{
+	const u8 bits = ctx->vol->cluster_size_bits;
+	const runlist_element *rl;
+	s64 pos = 0;
+
+	if (ntfs_attr_map_whole_runlist(na))
+		return -1;
+	for (rl = na->rl; rl->length && pos < na->data_size; rl++) {
+		s64 end = (rl->vcn + rl->length) << bits;
+
+		if (end > na->data_size)
+			end = na->data_size;
+		if (rl->lcn < 0) {
+			if (rl->lcn != LCN_HOLE) {
+				errno = EIO;
+				return -1;
+			}
+			if (ntfs_bulk_read_add(ctx, file, pos, end - pos,
+					LCN_HOLE))
+				return -1;
+			pos = end;
+			continue;
+		}
+		while (pos < end) {
+			s64 len = end - pos;
+
+			if (pos >= na->initialized_size) {
+				if (ntfs_bulk_read_add(ctx, file, pos, len,
+						LCN_HOLE))
+					return -1;
+				pos = end;
+				break;
+			}
+			if (len > na->initialized_size - pos)
+				len = na->initialized_size - pos;
+			if (len > ctx->read_size)
+				len = ctx->read_size;
+			if (ntfs_bulk_read_add(ctx, file, pos, len, rl->lcn +
+					((pos >> bits) - rl->vcn)))
+				return -1;
+			pos += len;
+		}
+	}
+	/* The runlist should cover the data size, but be safe. */
+	if (pos < na->data_size)
+		return ntfs_bulk_read_add(ctx, file, pos, na->data_size - pos,
+				LCN_HOLE);
+	if (!ctx->files[file].nr)
+		return ntfs_bulk_read_add(ctx, file, 0, 0, LCN_HOLE);
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_library - deliver a file by reading it through the library
+ * @ctx:	state of the bulk read
+ * @file:	index of the file
+ * @na:		its unnamed $DATA attribute
+ *
+ * For resident and compressed data, which cannot be read from the device
+ * directly.  The file is delivered right away, in order.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_library(ntfs_bulk_read_ctx *ctx, s64 file,
+		ntfs_attr *na)
+{
+	ntfs_bulk_read_file *f = ctx->files + file;
+	s64 pos;
+
+	for (pos = 0; pos < na->data_size; pos += ctx->read_size) {
+		s64 len = na->data_size - pos;
+
+		if (len > ctx->read_size)
+			len = ctx->read_size;
+		if (ntfs_bulk_read_add(ctx, file, pos, len, LCN_ENOENT))
+			return -1;
+	}
+	if (!f->nr && ntfs_bulk_read_add(ctx, file, 0, 0, LCN_HOLE))
+		return -1;
+	f->nr_left = f->nr;
+	for (; f->next < f->nr; f->next++) {
+		ntfs_bulk_read_piece *p = ctx->pieces + f->first + f->next;
+		s64 br;
+
+		if (p->lcn == LCN_HOLE) {
+			if (ntfs_bulk_read_deliver(ctx, p, NULL))
+				return -1;
+			continue;
+		}
+		br = ntfs_attr_pread(na, p->pos, p->len, ctx->buf);
+		if (br != p->len) {
+			if (br >= 0)
+				errno = EIO;
+			return -1;
+		}
+		if (ntfs_bulk_read_deliver(ctx, p, ctx->buf))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_open - map the pieces of a file
+ * @ctx:	state of the bulk read
+ * @file:	index of the file
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_open(ntfs_bulk_read_ctx *ctx, s64 file)
+{
+	ntfs_bulk_read_file *f = ctx->files + file;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	int err = 0;
+
+	ni = ntfs_inode_open(ctx->vol, f->mref);
+	if (!ni)
+		return -1;
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na) {
+		err = errno;
+		goto close;
+	}
+	f->size = na->data_size;
+	if (na->data_flags & ATTR_IS_ENCRYPTED)
+		err = EACCES;
+	else if (!NAttrNonResident(na) ||
+			(na->data_flags & ATTR_COMPRESSION_MASK)) {
+		if (ntfs_bulk_read_library(ctx, file, na))
+			err = errno;
+	} else if (ntfs_bulk_read_map(ctx, file, na))
+		err = errno;
+	else
+		f->nr_left = f->nr;
+	ntfs_attr_close(na);
+close:
+	ntfs_inode_close(ni);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_open_all - map the pieces of all the files
+ * @ctx:	state of the bulk read
+ * @mrefs:	the files
+ *
+ * Files which cannot be opened or read are reported to the callback and
+ * left without pieces.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_open_all(ntfs_bulk_read_ctx *ctx,
+		const MFT_REF *mrefs)
+{
+	s64 i;
+
+	for (i = 0; i < ctx->nr_files; i++) {
+		ntfs_bulk_read_file *f = ctx->files + i;
+		int err;
+
+		f->mref = mrefs[i];
+		f->first = ctx->nr_pieces;
+		if (!ntfs_bulk_read_open(ctx, i))
+			continue;
+		/* Errors of the callback end the read. */
+		if (ctx->aborted)
+			return -1;
+		err = errno;
+		ntfs_log_debug("Failed to read inode %llu: %s\n",
+				(unsigned long long)MREF(f->mref),
+				strerror(err));
+		ctx->nr_pieces = f->first;
+		f->nr = f->nr_left = f->next = 0;
+		if (ntfs_bulk_read_fail(ctx, i, f->mref, err))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_advance - deliver the pieces of a file that are next in order
+ * @ctx:	state of the bulk read
+ * @f:		the file
+ *
+ * Deliver pieces reading as zeroes and pieces held back, until a piece which
+ * has not been read yet.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_advance(ntfs_bulk_read_ctx *ctx,
+		ntfs_bulk_read_file *f)
+{
+	while (f->next < f->nr) {
+		ntfs_bulk_read_piece *p = ctx->pieces + f->first + f->next;
+		int err;
+
+		if (p->lcn == LCN_HOLE)
+			err = ntfs_bulk_read_deliver(ctx, p, NULL);
+		else if (p->held) {
+			err = ntfs_bulk_read_deliver(ctx, p, p->held);
+			free(p->held);
+			p->held = NULL;
+			f->held -= p->len;
+			ctx->held -= p->len;
+		} else
+			break;
+		if (err)
+			return -1;
+		f->next++;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_force - release the file holding back the most
+ * @ctx:	state of the bulk read
+ *
+ * Read the pieces of the file holding back the most which are missing before
+ * the ones held back, out of cluster order.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_force(ntfs_bulk_read_ctx *ctx)
+{
+	const s64 csize = ctx->vol->cluster_size;
+	ntfs_bulk_read_file *f = ctx->files;
+	s64 i;
+
+	for (i = 1; i < ctx->nr_files; i++)
+		if (ctx->files[i].held > f->held)
+			f = ctx->files + i;
+	while (f->held) {
+		ntfs_bulk_read_piece *p = ctx->pieces + f->first + f->next;
+		const s64 count = (p->len + csize - 1) & ~(csize - 1);
+		s64 br;
+
+		br = ntfs_pread(ctx->vol->dev, p->lcn <<
+				ctx->vol->cluster_size_bits, count,
+				ctx->force_buf);
+		if (br != count) {
+			if (br >= 0)
+				errno = EIO;
+			return -1;
+		}
+		ctx->stats.nr_forced++;
+		ctx->stats.bytes_read += br;
+		if (ntfs_bulk_read_deliver(ctx, p, ctx->force_buf))
+			return -1;
+		f->next++;
+		if (ntfs_bulk_read_advance(ctx, f))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_got - deliver or hold back a piece just read
+ * @ctx:	state of the bulk read
+ * @p:		the piece
+ * @buf:	its data
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_got(ntfs_bulk_read_ctx *ctx,
+		ntfs_bulk_read_piece *p, const u8 *buf)
+{
+	ntfs_bulk_read_file *f = ctx->files + p->file;
+
+	if (!ctx->opts->ordered)
+		return ntfs_bulk_read_deliver(ctx, p, buf);
+	if (p - ctx->pieces == f->first + f->next) {
+		if (ntfs_bulk_read_deliver(ctx, p, buf))
+			return -1;
+		f->next++;
+		return ntfs_bulk_read_advance(ctx, f);
+	}
+	p->held = ntfs_malloc(p->len);
+	if (!p->held)
+		return -1;
+	memcpy(p->held, buf, p->len);
+	f->held += p->len;
+	ctx->held += p->len;
+	if (ctx->held > ctx->stats.max_held)
+		ctx->stats.max_held = ctx->held;
+	while (ctx->held > ctx->max_buffer)
+		if (ntfs_bulk_read_force(ctx))
+			return -1;
+	return 0;
+}
+
+static const ntfs_bulk_read_piece *ntfs_bulk_read_sort_pieces;
+
+/**
+ * ntfs_bulk_read_cmp - order pieces by cluster
+ */
+static int ntfs_bulk_read_cmp(const void *p1, const void *p2)
+{
+	const ntfs_bulk_read_piece *a = ntfs_bulk_read_sort_pieces +
+			*(const s64*)p1;
+	const ntfs_bulk_read_piece *b = ntfs_bulk_read_sort_pieces +
+			*(const s64*)p2;
+
+	if (a->lcn != b->lcn)
+		return a->lcn < b->lcn ? -1 : 1;
+	return 0;
+}
+
+/**
+ * ntfs_bulk_read_run - read the pieces with data in cluster order
+ * @ctx:	state of the bulk read
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_bulk_read_run(ntfs_bulk_read_ctx *ctx)
+{
+	const u8 bits = ctx->vol->cluster_size_bits;
+	const s64 csize = ctx->vol->cluster_size;
+	s64 *order, nr = 0, i, j, k, count;
+	int ret = -1;
+
+	order = ntfs_malloc((ctx->nr_pieces + 1) * sizeof(*order));
+	if (!order)
+		return -1;
+	for (i = 0; i < ctx->nr_pieces; i++) {
+		ntfs_bulk_read_piece *p = ctx->pieces + i;
+
+		if (p->lcn >= 0 && !p->done)
+			order[nr++] = i;
+	}
+	/* The sort is not thread safe, but neither is the rest. */
+	ntfs_bulk_read_sort_pieces = ctx->pieces;
+	qsort(order, nr, sizeof(*order), ntfs_bulk_read_cmp);
+	for (i = 0; i < nr; i = j) {
+		ntfs_bulk_read_piece *p = ctx->pieces + order[i];
+		s64 start = p->lcn << bits, end, br;
+
+		if (p->done) {
+			j = i + 1;
+			continue;
+		}
+		/* Read physically contiguous pieces in one go. */
+		end = start + p->len;
+		for (j = i + 1; j < nr; j++) {
+			ntfs_bulk_read_piece *q = ctx->pieces + order[j];
+			s64 ofs = q->lcn << bits;
+
+			if (q->done || ofs != ((end + csize - 1) & ~(csize - 1))
+					|| ofs + q->len - start > ctx->read_size)
+				break;
+			end = ofs + q->len;
+		}
+		/* Raw devices only read whole sectors. */
+		count = ((end + csize - 1) & ~(csize - 1)) - start;
+		br = ntfs_pread(ctx->vol->dev, start, count, ctx->buf);
+		if (br != count) {
+			if (br >= 0)
+				errno = EIO;
+			ntfs_log_perror("Failed to read clusters %lld-%lld",
+					(long long)(start >> bits),
+					(long long)((end - 1) >> bits));
+			goto out;
+		}
+		ctx->stats.nr_reads++;
+		ctx->stats.bytes_read += br;
+		for (k = i; k < j; k++) {
+			p = ctx->pieces + order[k];
+			/* Delivering a piece may force later ones. */
+			if (p->done)
+				continue;
+			if (ntfs_bulk_read_got(ctx, p, ctx->buf +
+					((p->lcn << bits) - start)))
+				goto out;
+		}
+	}
+	ret = 0;
+out:
+	free(order);
+	return ret;
+}
+
+/**
+ * ntfs_bulk_read - read the data of many files in the order of their clusters
+ * @vol:	mounted ntfs volume to read from
+ * @mrefs:	mft references of the files to read
+ * @nr:		number of elements in @mrefs
+ * @opts:	parameters of the read
+ * @stats:	if not NULL, statistics of the read are returned here
+ *
+ * Deliver the unnamed $DATA attribute of each file in @mrefs to @opts->fn, in
+ * pieces of at most @opts->read_size bytes, except for holes which are
+ * delivered whole.  All the runlists are mapped first, then the pieces are
+ * read in the order of their clusters.  If @opts->ordered is true, the pieces
+ * of each file are delivered in order of position, holding back at most
+ * about @opts->max_buffer bytes of pieces that arrive early, else they are
+ * delivered as they are read.
+ *
+ * The pieces are read straight from the device, so any changes to the files
+ * should be synced first.
+ *
+ * Files that cannot be read, e.g. because they do not exist or have no
+ * unnamed $DATA attribute, are reported to @opts->fn with an error and do not
+ * end the read.
+ *
+ * Return 0 on success and -1 with errno set on error, including when
+ * @opts->fn fails, in which case some files may have been delivered partially.
+ */
+int ntfs_bulk_read(ntfs_volume *vol, const MFT_REF *mrefs, s64 nr,
+		const ntfs_bulk_read_opts *opts, ntfs_bulk_read_stats *stats)
+{
+	ntfs_bulk_read_ctx ctx;
+	s64 i;
+	int ret = -1;
+
+	if (!vol || (!mrefs && nr) || nr < 0 || !opts || !opts->fn) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.vol = vol;
+	ctx.opts = opts;
+	ctx.read_size = opts->read_size ? opts->read_size :
+			BULK_READ_DEFAULT_READ_SIZE;
+	ctx.read_size &= ~(vol->cluster_size - 1);
+	if (!ctx.read_size)
+		ctx.read_size = vol->cluster_size;
+	ctx.max_buffer = opts->max_buffer ? opts->max_buffer :
+			BULK_READ_DEFAULT_MAX_BUFFER;
+	ctx.files = ntfs_calloc((nr + 1) * sizeof(*ctx.files));
+	ctx.buf = ntfs_malloc(ctx.read_size);
+	ctx.force_buf = ntfs_malloc(ctx.read_size);
+	if (!ctx.files || !ctx.buf || !ctx.force_buf)
+		goto out;
+	ctx.nr_files = nr;
+	if (ntfs_bulk_read_open_all(&ctx, mrefs))
+		goto out;
+	/* Deliver what needs no reading. */
+	for (i = 0; i < nr; i++) {
+		ntfs_bulk_read_file *f = ctx.files + i;
+		s64 n;
+
+		if (f->next == f->nr)
+			continue;
+		if (opts->ordered) {
+			if (ntfs_bulk_read_advance(&ctx, f))
+				goto out;
+			continue;
+		}
+		for (n = 0; n < f->nr; n++) {
+			ntfs_bulk_read_piece *p = ctx.pieces + f->first + n;
+
+			if (p->lcn == LCN_HOLE &&
+					ntfs_bulk_read_deliver(&ctx, p, NULL))
+				goto out;
+		}
+	}
+	if (ntfs_bulk_read_run(&ctx))
+		goto out;
+	ret = 0;
+out:
+	for (i = 0; i < ctx.nr_pieces; i++)
+		free(ctx.pieces[i].held);
+	free(ctx.pieces);
+	free(ctx.files);
+	free(ctx.buf);
+	free(ctx.force_buf);
+	if (stats)
+		*stats = ctx.stats;
+	return ret;
+}
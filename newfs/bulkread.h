@@ -0,0 +1,96 @@
+/*
+ * bulkread.h - Exports for the extent ordered bulk file reader.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ */
+
+#ifndef _NTFS_BULKREAD_H
+#define _NTFS_BULKREAD_H
+
+#include "types.h"
+#include "layout.h"
+#include "volume.h"
+
+/**
+ * struct ntfs_bulk_read_chunk - a piece of the data of a file
+ * @index:	index of the file in the list passed to ntfs_bulk_read()
+ * @mref:	mft reference of the file
+ * @pos:	byte position of the piece in the unnamed $DATA attribute
+ * @len:	byte size of the piece
+ * @buf:	the data, NULL if the piece is a hole or lies beyond the
+ *		initialized size, i.e. reads as zeroes
+ * @size:	data size of the file
+ * @last:	no more pieces of the file follow
+ * @err:	errno if the file could not be read, in which case this is its
+ *		last piece, with a @len of 0 and @last set
+ *
+ * Every byte of a file up to its data size is delivered exactly once.  A file
+ * of size 0 is delivered as a single piece of length 0.
+ */
+typedef struct {
+	s64 index;
+	MFT_REF mref;
+	s64 pos;
+	s64 len;
+	const u8 *buf;
+	s64 size;
+	BOOL last;
+	int err;
+} ntfs_bulk_read_chunk;
+
+/**
+ * ntfs_bulk_read_fn - callback invoked for each piece of a file
+ * @c:		the piece
+ * @data:	ntfs_bulk_read_opts.data
+ *
+ * Called on the thread running ntfs_bulk_read().  @c and the data it points
+ * to are only valid for the duration of the call.
+ *
+ * Return 0 to continue or -1 with errno set to abort the read.
+ */
+typedef int (*ntfs_bulk_read_fn)(const ntfs_bulk_read_chunk *c, void *data);
+
+/**
+ * struct ntfs_bulk_read_opts - parameters of a bulk read
+ * @read_size:	most bytes read from the device at a time (0 means a default
+ *		of 1MiB), rounded down to a multiple of the cluster size
+ * @max_buffer:	most bytes held back while waiting for earlier pieces of
+ *		their file when @ordered (0 means a default of 64MiB)
+ * @ordered:	deliver the pieces of each file in order of position, else
+ *		they are delivered in the order they are read
+ * @fn:		callback invoked for each piece
+ * @data:	passed to @fn
+ */
+typedef struct {
+	u32 read_size;
+	s64 max_buffer;
+	BOOL ordered;
+	ntfs_bulk_read_fn fn;
+	void *data;
+} ntfs_bulk_read_opts;
+
+/**
+ * struct ntfs_bulk_read_stats - what a bulk read did
+ * @nr_files:	files delivered
+ * @nr_failed:	files which could not be read, see ntfs_bulk_read_chunk.err
+ * @nr_reads:	reads issued to the device, in cluster order
+ * @nr_forced:	reads issued out of cluster order to release held back
+ *		pieces, see ntfs_bulk_read_opts.max_buffer
+ * @bytes_read:	bytes read from the device
+ * @max_held:	most bytes held back at any time
+ */
+typedef struct {
+	s64 nr_files;
+	s64 nr_failed;
+	s64 nr_reads;
+	s64 nr_forced;
+	s64 bytes_read;
+	s64 max_held;
+} ntfs_bulk_read_stats;
+
+extern int ntfs_bulk_read(ntfs_volume *vol, const MFT_REF *mrefs, s64 nr,
+		const ntfs_bulk_read_opts *opts, ntfs_bulk_read_stats *stats);
+
+#endif /* defined _NTFS_BULKREAD_H */
@@ -0,0 +1,505 @@
+/**
+ * compress.c - Compressed attribute handling code.
+ *
+ * Copyright (c) 2004-2005 Anton Altaparmakov
+ * Copyright (c) 2004-2006 Szabolcs Szakacsits
+ * Copyright (c)      2005 Yura Pakhuchiy
+ * Copyright (c) 2008-2012 Tuxera Inc.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * Only reading is supported.  The decompression engine is the one used by
+ * the kernel driver (see kext/ntfs_compress.c), without the page list
+ * handling which only makes sense in the kernel.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "compat.h"
+#include "types.h"
+#include "attrib.h"
+#include "debug.h"
+#include "volume.h"
+#include "runlist.h"
+#include "compress.h"
+#include "logging.h"
+#include "misc.h"
+
+/**
+ * enum ntfs_compression_constants - constants used in the compression code
+ */
+typedef enum {
+	/* Compression block (cb) types. */
+	NTFS_CB_SPARSE		= -1,
+	NTFS_CB_COMPRESSED	= -2,
+	NTFS_CB_UNCOMPRESSED	= -3,
+
+	/* Compression sub-block (sb) constants. */
+	NTFS_SB_SIZE_MASK	= 0x0fff,
+	NTFS_SB_SIZE		= 0x1000,
+	NTFS_SB_IS_COMPRESSED	= 0x8000,
+
+	/* Token types and access mask. */
+	NTFS_SYMBOL_TOKEN	= 0,
+	NTFS_PHRASE_TOKEN	= 1,
+	NTFS_TOKEN_MASK		= 1,
+} ntfs_compression_constants;
+
+/**
+ * ntfs_decompress - decompress a compression block into a destination buffer
+ * @dest:	destination buffer for the uncompressed data
+ * @dest_size:	size of the destination buffer, normally the size of a cb
+ * @cb_start:	compressed data of the compression block
+ * @cb_size:	size of the compression block @cb_start
+ *
+ * Decompress the compression block @cb_start of size @cb_size into the
+ * destination buffer @dest of size @dest_size.
+ *
+ * Each compression block (cb) is 2^compression_unit clusters in size and is
+ * divided into 4kiB sub-blocks (sb), each starting with a 16 bit header.  The
+ * lower twelve bits of the header are the length of the sb minus three and
+ * the most significant bit is set if the sb is compressed.  An uncompressed sb
+ * is simply copied.  A compressed sb consists of token groups, each a tag byte
+ * followed by eight tokens, the bits of the tag, least significant first,
+ * giving the type of each token.  A symbol token is a literal byte.  A phrase
+ * token is a little endian 16 bit value holding a back pointer into the
+ * decompressed data in its upper bits and a length in its lower bits.  The
+ * split between the two depends on the current position within the sb.  See
+ * kext/ntfs_compress.c for the full description of the format.
+ *
+ * Return 0 on success or -1 on error with errno set to EOVERFLOW if the
+ * compressed data is corrupt.
+ */
+int ntfs_decompress(u8 *dest, const u32 dest_size, u8 *const cb_start,
+		const u32 cb_size)
+{
+	/*
+	 * Pointers into the compressed data, i.e. the compression block (cb),
+	 * and the therein contained sub-blocks (sb).
+	 */
+	u8 *cb_end = cb_start + cb_size; /* End of cb. */
+	u8 *cb = cb_start;	/* Current position in cb. */
+	u8 *cb_sb_start;	/* Beginning of the current sb in the cb. */
+	u8 *cb_sb_end;		/* End of current sb / beginning of next sb. */
+	/* Variables for uncompressed data / destination. */
+	u8 *dest_end = dest + dest_size;	/* End of dest buffer. */
+	u8 *dest_sb_start;	/* Start of current sub-block in dest. */
+	u8 *dest_sb_end;	/* End of current sb in dest. */
+	/* Variables for tag and token parsing. */
+	u8 tag;			/* Current tag. */
+	int token;		/* Loop counter for the eight tokens in tag. */
+
+	ntfs_log_trace("Entering, cb_size = 0x%x.\n", (unsigned)cb_size);
+do_next_sb:
+	ntfs_log_debug("Beginning sub-block at offset = %d in the cb.\n",
+			(int)(cb - cb_start));
+	/*
+	 * Have we reached the end of the compression block or the end of the
+	 * decompressed data?  The latter can happen for example if the current
+	 * position in the compression block is one byte before its end so the
+	 * first two checks do not detect it.
+	 */
+	if (cb == cb_end || !le16_to_cpup((le16*)cb) || dest == dest_end) {
+		/* Do not return uninitialized data. */
+		if (dest < dest_end)
+			memset(dest, 0, dest_end - dest);
+		ntfs_log_debug("Completed. Returning success (0).\n");
+		return 0;
+	}
+	/* Setup offset for the current sub-block destination. */
+	dest_sb_start = dest;
+	dest_sb_end = dest + NTFS_SB_SIZE;
+	/* Check that we are still within allowed boundaries. */
+	if (dest_sb_end > dest_end)
+		goto return_overflow;
+	/* Does the minimum size of a compressed sb overflow valid range? */
+	if (cb + 6 > cb_end)
+		goto return_overflow;
+	/* Setup the current sub-block source pointers and validate range. */
+	cb_sb_start = cb;
+	cb_sb_end = cb_sb_start + (le16_to_cpup((le16*)cb) & NTFS_SB_SIZE_MASK)
+			+ 3;
+	if (cb_sb_end > cb_end)
+		goto return_overflow;
+	/* Now, we are ready to process the current sub-block (sb). */
+	if (!(le16_to_cpup((le16*)cb) & NTFS_SB_IS_COMPRESSED)) {
+		ntfs_log_debug("Found uncompressed sub-block.\n");
+		/* This sb is not compressed, just copy it into destination. */
+		/* Advance source position to first data byte. */
+		cb += 2;
+		/* An uncompressed sb must be full size. */
+		if (cb_sb_end - cb != NTFS_SB_SIZE)
+			goto return_overflow;
+		/* Copy the block and advance the source position. */
+		memcpy(dest, cb, NTFS_SB_SIZE);
+		cb += NTFS_SB_SIZE;
+		/* Advance destination position to next sub-block. */
+		dest += NTFS_SB_SIZE;
+		goto do_next_sb;
+	}
+	ntfs_log_debug("Found compressed sub-block.\n");
+	/* This sb is compressed, decompress it into destination. */
+	/* Forward to the first tag in the sub-block. */
+	cb += 2;
+do_next_tag:
+	if (cb == cb_sb_end) {
+		/* Check if the decompressed sub-block was not full-length. */
+		if (dest < dest_sb_end) {
+			int nr_bytes = dest_sb_end - dest;
+
+			ntfs_log_debug("Filling incomplete sub-block with "
+					"zeroes.\n");
+			/* Zero remainder and update destination position. */
+			memset(dest, 0, nr_bytes);
+			dest += nr_bytes;
+		}
+		/* We have finished the current sub-block. */
+		goto do_next_sb;
+	}
+	/* Check we are still in range. */
+	if (cb > cb_sb_end || dest > dest_sb_end)
+		goto return_overflow;
+	/* Get the next tag and advance to first token. */
+	tag = *cb++;
+	/* Parse the eight tokens described by the tag. */
+	for (token = 0; token < 8; token++, tag >>= 1) {
+		unsigned lg, u, pt, length, max_non_overlap;
+		u8 *dest_back_addr;
+
+		/* Check if we are done / still in range. */
+		if (cb >= cb_sb_end || dest > dest_sb_end)
+			break;
+		/* Determine token type and parse appropriately.*/
+		if ((tag & NTFS_TOKEN_MASK) == NTFS_SYMBOL_TOKEN) {
+			/*
+			 * We have a symbol token, copy the symbol across, and
+			 * advance the source and destination positions.
+			 */
+			*dest++ = *cb++;
+			/* Continue with the next token. */
+			continue;
+		}
+		/*
+		 * We have a phrase token. Make sure it is not the first tag in
+		 * the sb as this is illegal and would confuse the code below.
+		 */
+		if (dest == dest_sb_start)
+			goto return_overflow;
+		/*
+		 * Determine the number of bytes to go back (p) and the number
+		 * of bytes to copy (l).  We first calculate log2(current
+		 * destination position in sb), which allows determination of
+		 * l and p in O(1) rather than O(n).
+		 */
+		lg = 0;
+		for (u = dest - dest_sb_start - 1; u >= 0x10; u >>= 1)
+			lg++;
+		/* Get the phrase token into i. */
+		pt = le16_to_cpup((le16*)cb);
+		/*
+		 * Calculate starting position of the byte sequence in the
+		 * destination using the fact that p = (pt >> (12 - lg)) + 1
+		 * and make sure we don't go too far back.
+		 */
+		dest_back_addr = dest - (pt >> (12 - lg)) - 1;
+		if (dest_back_addr < dest_sb_start)
+			goto return_overflow;
+		/* Now calculate the length of the byte sequence. */
+		length = (pt & (0xfff >> lg)) + 3;
+		/* Verify destination is in range. */
+		if (dest + length > dest_sb_end)
+			goto return_overflow;
+		/* The number of non-overlapping bytes. */
+		max_non_overlap = dest - dest_back_addr;
+		if (length <= max_non_overlap) {
+			/* The byte sequence doesn't overlap, just copy it. */
+			memcpy(dest, dest_back_addr, length);
+			/* Advance destination pointer. */
+			dest += length;
+		} else {
+			/*
+			 * The byte sequence does overlap, copy non-overlapping
+			 * part and then do a slow byte by byte copy for the
+			 * overlapping part. Also, advance the destination
+			 * pointer.
+			 */
+			memcpy(dest, dest_back_addr, max_non_overlap);
+			dest += max_non_overlap;
+			dest_back_addr += max_non_overlap;
+			length -= max_non_overlap;
+			while (length--)
+				*dest++ = *dest_back_addr++;
+		}
+		/* Advance source position and continue with the next token. */
+		cb += 2;
+	}
+	/* No tokens left in the current tag. Continue with the next tag. */
+	goto do_next_tag;
+return_overflow:
+	errno = EOVERFLOW;
+	ntfs_log_perror("Failed to decompress file");
+	return -1;
+}
+
+/**
+ * ntfs_cb_seek - find the runlist element containing a vcn
+ * @na:		compressed ntfs attribute whose runlist to search
+ * @rl:		runlist element at which to start searching or NULL
+ * @vcn:	vcn to find
+ *
+ * Compression blocks are read in ascending order so we keep a cursor into
+ * the runlist and only walk forward from it, falling back to
+ * ntfs_attr_find_vcn() which maps the runlist as needed if @rl is NULL, is
+ * beyond @vcn or we reach an unmapped region.
+ *
+ * Return the runlist element or NULL on error with errno set.
+ */
+static runlist_element *ntfs_cb_seek(ntfs_attr *na, runlist_element *rl,
+		const VCN vcn)
+{
+	if (rl && rl->vcn <= vcn) {
+		while (rl->length && rl[1].vcn <= vcn)
+			rl++;
+		if (rl->length && rl->lcn >= LCN_HOLE)
+			return rl;
+	}
+	rl = ntfs_attr_find_vcn(na, vcn);
+	if (!rl && errno == ENOENT)
+		errno = EIO;
+	return rl;
+}
+
+/**
+ * ntfs_get_cb_type - determine the type of a compression block
+ * @na:		compressed ntfs attribute to which the compression block belongs
+ * @prl:	runlist cursor (see ntfs_cb_seek())
+ * @vcn:	first vcn of the compression block
+ *
+ * Determine whether the compression block is sparse, compressed, or
+ * uncompressed by looking at the runlist in the same way as the kernel
+ * driver does:  if the first cluster of the compression block is sparse the
+ * whole compression block is sparse, if the last cluster is sparse it is
+ * compressed, otherwise it is not compressed.
+ *
+ * Return the compression block type (< 0) or 0 on error with errno set.
+ */
+static int ntfs_get_cb_type(ntfs_attr *na, runlist_element **prl,
+		const VCN vcn)
+{
+	const VCN end_vcn = vcn + na->compression_block_clusters;
+	runlist_element *rl;
+
+	rl = ntfs_cb_seek(na, *prl, vcn);
+	if (!rl)
+		return 0;
+	*prl = rl;
+	if (rl->lcn == LCN_HOLE)
+		return NTFS_CB_SPARSE;
+	if (rl[1].vcn >= end_vcn)
+		return NTFS_CB_UNCOMPRESSED;
+	rl = ntfs_cb_seek(na, rl, end_vcn - 1);
+	if (!rl)
+		return 0;
+	if (rl->lcn == LCN_HOLE)
+		return NTFS_CB_COMPRESSED;
+	return NTFS_CB_UNCOMPRESSED;
+}
+
+/**
+ * ntfs_cb_read - read raw data of a compressed attribute
+ * @na:		compressed ntfs attribute to read from
+ * @prl:	runlist cursor (see ntfs_cb_seek())
+ * @pos:	byte offset in the attribute to read from
+ * @count:	number of bytes to read
+ * @b:		destination buffer
+ *
+ * Read @count bytes of on disk data of the attribute @na starting at byte
+ * offset @pos into @b with a single i/o for each run, zeroing sparse runs.
+ *
+ * Return 0 on success or -1 on error with errno set.
+ */
+static int ntfs_cb_read(ntfs_attr *na, runlist_element **prl, s64 pos,
+		s64 count, u8 *b)
+{
+	ntfs_volume *vol = na->ni->vol;
+	runlist_element *rl;
+	s64 ofs, to_read, br;
+
+	while (count) {
+		rl = ntfs_cb_seek(na, *prl, pos >> vol->cluster_size_bits);
+		if (!rl)
+			return -1;
+		*prl = rl;
+		ofs = pos - (rl->vcn << vol->cluster_size_bits);
+		to_read = min(count, (rl->length << vol->cluster_size_bits) -
+				ofs);
+		if (rl->lcn == LCN_HOLE)
+			memset(b, 0, to_read);
+		else {
+			br = ntfs_pread(vol->dev, (rl->lcn <<
+					vol->cluster_size_bits) + ofs, to_read,
+					b);
+			if (br != to_read) {
+				if (br >= 0)
+					errno = EIO;
+				ntfs_log_perror("%s: ntfs_pread failed",
+						__FUNCTION__);
+				return -1;
+			}
+		}
+		pos += to_read;
+		count -= to_read;
+		b += to_read;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_compressed_attr_pread - read from a compressed attribute
+ * @na:		ntfs attribute to read from
+ * @pos:	byte position in the attribute to begin reading from
+ * @count:	number of bytes to read
+ * @b:		output data buffer
+ *
+ * NOTE:  You probably want to be using attrib.c::ntfs_attr_pread() instead.
+ *
+ * This function will read @count bytes starting at offset @pos from the
+ * compressed ntfs attribute @na into the data buffer @b.
+ *
+ * Sparse compression blocks are zeroed and uncompressed ones are read
+ * straight into @b.  Compressed compression blocks are read with one i/o per
+ * run and decompressed straight into @b if the read covers the whole
+ * compression block.  Otherwise they are decompressed into a per attribute
+ * buffer which is kept so that small sequential reads only decompress each
+ * compression block once.
+ *
+ * On success, return the number of successfully read bytes.  If this number
+ * is lower than @count this means that the read reached end of file or that
+ * an error was encountered during the read so that the read is partial.
+ * 0 means end of file or nothing was read (also return 0 when @count is 0).
+ *
+ * On error and nothing has been read, return -1 with errno set appropriately
+ * to the return code of ntfs_pread(), or to EINVAL in case of invalid
+ * arguments.
+ */
+s64 ntfs_compressed_attr_pread(ntfs_attr *na, s64 pos, s64 count, void *b)
+{
+	s64 total, total2, cb_pos, ofs, to_read;
+	ntfs_volume *vol;
+	runlist_element *rl;
+	u8 *dest, *cb;
+	u32 cb_size;
+	int cb_type;
+
+	if (!na || !NAttrNonResident(na) || !na->ni || !na->ni->vol || !b ||
+			pos < 0 || count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	ntfs_log_trace("Entering for inode %lld, attr 0x%x, pos %lld, count "
+			"%lld.\n", (unsigned long long)na->ni->mft_no,
+			le32_to_cpu(na->type), (long long)pos,
+			(long long)count);
+	/* Only the standard compression format is supported. */
+	if ((na->data_flags & ATTR_COMPRESSION_MASK) != ATTR_IS_COMPRESSED ||
+			!na->compression_block_size) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	vol = na->ni->vol;
+	/* Truncate reads beyond end of attribute. */
+	if (pos + count > na->data_size) {
+		if (pos >= na->data_size)
+			return 0;
+		count = na->data_size - pos;
+	}
+	total = total2 = 0;
+	/* Zero out reads beyond initialized size. */
+	if (pos + count > na->initialized_size) {
+		if (pos >= na->initialized_size) {
+			memset(b, 0, count);
+			return count;
+		}
+		total2 = pos + count - na->initialized_size;
+		count -= total2;
+		memset((u8*)b + count, 0, total2);
+	}
+	cb_size = na->compression_block_size;
+	dest = b;
+	cb = NULL;
+	rl = NULL;
+	while (count) {
+		cb_pos = pos & ~(s64)(cb_size - 1);
+		ofs = pos - cb_pos;
+		to_read = min(count, cb_size - ofs);
+		/* Reuse the last decompressed compression block if we can. */
+		if (na->cb_cache && na->cb_cache_pos == cb_pos) {
+			memcpy(dest, na->cb_cache + ofs, to_read);
+			goto next_cb;
+		}
+		cb_type = ntfs_get_cb_type(na, &rl, cb_pos >>
+				vol->cluster_size_bits);
+		if (!cb_type)
+			goto err_out;
+		if (cb_type == NTFS_CB_SPARSE) {
+			ntfs_log_debug("Found sparse compression block.\n");
+			memset(dest, 0, to_read);
+			goto next_cb;
+		}
+		if (cb_type == NTFS_CB_UNCOMPRESSED) {
+			ntfs_log_debug("Found uncompressed compression "
+					"block.\n");
+			if (ntfs_cb_read(na, &rl, pos, to_read, dest))
+				goto err_out;
+			goto next_cb;
+		}
+		ntfs_log_debug("Found compressed compression block.\n");
+		if (!cb) {
+			cb = ntfs_malloc(cb_size);
+			if (!cb)
+				goto err_out;
+		}
+		if (ntfs_cb_read(na, &rl, cb_pos, cb_size, cb))
+			goto err_out;
+		/* Decompress straight into @b if it takes the whole cb. */
+		if (to_read == cb_size) {
+			if (ntfs_decompress(dest, cb_size, cb, cb_size))
+				goto err_out;
+			goto next_cb;
+		}
+		if (!na->cb_cache) {
+			na->cb_cache = ntfs_malloc(cb_size);
+			if (!na->cb_cache)
+				goto err_out;
+		}
+		na->cb_cache_pos = -1;
+		if (ntfs_decompress(na->cb_cache, cb_size, cb, cb_size))
+			goto err_out;
+		na->cb_cache_pos = cb_pos;
+		memcpy(dest, na->cb_cache + ofs, to_read);
+next_cb:
+		pos += to_read;
+		count -= to_read;
+		dest += to_read;
+		total += to_read;
+	}
+	free(cb);
+	return total + total2;
+err_out:
+	free(cb);
+	if (total)
+		return total;
+	return -1;
+}
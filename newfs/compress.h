@@ -0,0 +1,22 @@
+/*
+ * compress.h - Exports for compressed attribute handling.
+ *
+ * Copyright (c) 2004 Anton Altaparmakov
+ * Copyright (c) 2008-2012 Tuxera Inc.
+ *
+ * See LICENSE file for licensing information.
+ */
+
+#ifndef _NTFS_COMPRESS_H
+#define _NTFS_COMPRESS_H
+
+#include "types.h"
+#include "attrib.h"
+
+extern int ntfs_decompress(u8 *dest, const u32 dest_size, u8 *const cb_start,
+		const u32 cb_size);
+
+extern s64 ntfs_compressed_attr_pread(ntfs_attr *na, s64 pos, s64 count,
+		void *b);
+
+#endif /* defined _NTFS_COMPRESS_H */
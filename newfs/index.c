@@ -84,6 +84,16 @@ static int ntfs_ib_write(ntfs_index_context *icx, INDEX_BLOCK *ib)
 	return STATUS_OK;
 }
 
+static int ntfs_icx_ib_write(ntfs_index_context *icx)
+{
+	if (ntfs_ib_write(icx, icx->ib))
+		return STATUS_ERROR;
+	
+	icx->ib_dirty = FALSE;
+	
+	return STATUS_OK;
+}
+
 /**
  * ntfs_index_ctx_get - allocate and initialize a new index context
  * @ni:		ntfs inode with which to initialize the context
@@ -210,6 +220,48 @@ static INDEX_ENTRY *ntfs_ie_get_by_pos(INDEX_HEADER *ih, int pos)
 	return ie;
 }
 
+static INDEX_ENTRY *ntfs_ie_prev(INDEX_HEADER *ih, INDEX_ENTRY *ie)
+{
+	INDEX_ENTRY *ie_prev = NULL;
+	INDEX_ENTRY *tmp;
+	
+	ntfs_log_trace("Entering\n");
+	
+	tmp = ntfs_ie_get_first(ih);
+	
+	while (tmp != ie) {
+		ie_prev = tmp;
+		tmp = ntfs_ie_get_next(tmp);
+	}
+	
+	return ie_prev;
+}
+
+static int ntfs_ih_numof_entries(INDEX_HEADER *ih)
+{
+	int n;
+	INDEX_ENTRY *ie;
+	u8 *end;
+	
+	ntfs_log_trace("Entering\n");
+	
+	end = ntfs_ie_get_end(ih);
+	ie = ntfs_ie_get_first(ih);
+	for (n = 0; !ntfs_ie_end(ie) && (u8 *)ie < end; n++)
+		ie = ntfs_ie_get_next(ie);
+	return n;
+}
+
+static int ntfs_ih_one_entry(INDEX_HEADER *ih)
+{
+	return (ntfs_ih_numof_entries(ih) == 1);
+}
+
+static int ntfs_ih_zero_entry(INDEX_HEADER *ih)
+{
+	return (ntfs_ih_numof_entries(ih) == 0);
+}
+
 static void ntfs_ie_set_vcn(INDEX_ENTRY *ie, VCN vcn)
 {
 	*ntfs_ie_get_vcn_addr(ie) = cpu_to_le64(vcn);
@@ -230,6 +282,21 @@ static void ntfs_ie_insert(INDEX_HEADER *ih, INDEX_ENTRY *ie, INDEX_ENTRY *pos)
 	memcpy(pos, ie, ie_size);
 }
 
+/**
+ *  Delete @ie index entry from @ih. Used @ih values are updated.
+ */
+static void ntfs_ie_delete(INDEX_HEADER *ih, INDEX_ENTRY *ie)
+{
+	u32 new_size;
+	
+	ntfs_log_trace("Entering\n");
+	
+	new_size = le32_to_cpu(ih->index_length) - le16_to_cpu(ie->length);
+	ih->index_length = cpu_to_le32(new_size);
+	memmove(ie, (u8 *)ie + le16_to_cpu(ie->length),
+		new_size - ((u8 *)ie - (u8 *)ih));
+}
+
 static INDEX_ENTRY *ntfs_ie_dup(INDEX_ENTRY *ie)
 {
 	INDEX_ENTRY *dup;
@@ -243,6 +310,25 @@ static INDEX_ENTRY *ntfs_ie_dup(INDEX_ENTRY *ie)
 	return dup;
 }
 
+static INDEX_ENTRY *ntfs_ie_dup_novcn(INDEX_ENTRY *ie)
+{
+	INDEX_ENTRY *dup;
+	int size = le16_to_cpu(ie->length);
+	
+	ntfs_log_trace("Entering\n");
+	
+	if (ie->ie_flags & INDEX_ENTRY_NODE)
+		size -= sizeof(VCN);
+	
+	dup = ntfs_malloc(size);
+	if (dup) {
+		memcpy(dup, ie, size);
+		dup->ie_flags &= ~INDEX_ENTRY_NODE;
+		dup->length = cpu_to_le16(size);
+	}
+	return dup;
+}
+
 static int ntfs_ia_check(ntfs_index_context *icx, INDEX_BLOCK *ib, VCN vcn)
 {
 	u32 ib_size = (unsigned)le32_to_cpu(ib->index.allocated_size) + 0x18;
@@ -1301,3 +1387,480 @@ static int ntfs_ib_split(ntfs_index_context *icx, INDEX_BLOCK *ib)
 	
 	return ret;
 }
+
+/**
+ * ntfs_index_ctx_reinit - reinitialize an index context
+ * @icx:	index context to reinitialize
+ *
+ * Release the resources held by @icx and set it up again to describe the
+ * same index, ready for another ntfs_index_lookup().
+ */
+static void ntfs_index_ctx_reinit(ntfs_index_context *icx)
+{
+	ntfs_log_trace("Entering\n");
+
+	ntfs_index_ctx_free(icx);
+	*icx = (ntfs_index_context) {
+		.ni = icx->ni,
+		.name = icx->name,
+		.name_len = icx->name_len,
+	};
+}
+
+/**
+ * ntfs_ie_add - add an index entry to an index
+ * @icx:	index context describing the index
+ * @ie:		index entry to add
+ *
+ * Make room for @ie at its place in the index, splitting index blocks and
+ * moving the index root to an index block as needed, and insert it there.
+ *
+ * Return STATUS_OK on success and STATUS_ERROR with errno set on error.
+ */
+static int ntfs_ie_add(ntfs_index_context *icx, INDEX_ENTRY *ie)
+{
+	INDEX_HEADER *ih;
+	int allocated_size, new_size;
+	int ret = STATUS_ERROR;
+
+	ntfs_log_trace("Entering\n");
+
+	while (1) {
+		if (!ntfs_index_lookup(&ie->key, le16_to_cpu(ie->key_length),
+				icx)) {
+			errno = EEXIST;
+			ntfs_log_perror("Index already has such an entry");
+			goto err_out;
+		}
+		if (errno != ENOENT) {
+			ntfs_log_perror("Failed to find place for new entry");
+			goto err_out;
+		}
+
+		if (icx->is_in_root)
+			ih = &icx->ir->index;
+		else
+			ih = &icx->ib->index;
+
+		allocated_size = le32_to_cpu(ih->allocated_size);
+		new_size = le32_to_cpu(ih->index_length) +
+				le16_to_cpu(ie->length);
+
+		if (new_size <= allocated_size)
+			break;
+
+		ntfs_log_trace("index block sizes: allocated: %d  needed: %d\n",
+				allocated_size, new_size);
+
+		if (icx->is_in_root) {
+			if (ntfs_ir_make_space(icx, new_size) == STATUS_ERROR)
+				goto err_out;
+		} else {
+			if (ntfs_ib_split(icx, icx->ib) == STATUS_ERROR)
+				goto err_out;
+		}
+
+		ntfs_inode_mark_dirty(icx->actx->ntfs_ino);
+		ntfs_index_ctx_reinit(icx);
+	}
+
+	ntfs_ie_insert(ih, ie, icx->entry);
+	ntfs_index_entry_mark_dirty(icx);
+
+	ret = STATUS_OK;
+err_out:
+	ntfs_log_trace("%s\n", ret ? "Failed" : "Done");
+	return ret;
+}
+
+/**
+ * ntfs_index_add_filename - add a file name to a directory index
+ * @ni:		directory inode to add the file name to
+ * @fn:		$FILE_NAME attribute value of the file name
+ * @mref:	mft reference of the file the name belongs to
+ *
+ * Insert an index entry for @fn referring to @mref into the $I30 index of
+ * the directory @ni.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+int ntfs_index_add_filename(ntfs_inode *ni, FILE_NAME_ATTR *fn, MFT_REF mref)
+{
+	INDEX_ENTRY *ie;
+	ntfs_index_context *icx;
+	int fn_size, ie_size, err, ret = -1;
+
+	ntfs_log_trace("Entering\n");
+
+	if (!ni || !fn) {
+		ntfs_log_error("Invalid arguments.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	fn_size = (fn->file_name_length * sizeof(ntfschar)) +
+			sizeof(FILE_NAME_ATTR);
+	ie_size = (sizeof(INDEX_ENTRY_HEADER) + fn_size + 7) & ~7;
+
+	ie = ntfs_calloc(ie_size);
+	if (!ie)
+		return -1;
+
+	ie->indexed_file = cpu_to_le64(mref);
+	ie->length = cpu_to_le16(ie_size);
+	ie->key_length = cpu_to_le16(fn_size);
+	memcpy(&ie->key, fn, fn_size);
+
+	icx = ntfs_index_ctx_get(ni, NTFS_INDEX_I30, 4);
+	if (!icx)
+		goto out;
+
+	ret = ntfs_ie_add(icx, ie);
+	err = errno;
+	ntfs_index_ctx_put(icx);
+	errno = err;
+out:
+	free(ie);
+	return ret;
+}
+
+static int ntfs_ih_takeout(ntfs_index_context *icx, INDEX_HEADER *ih,
+			   INDEX_ENTRY *ie, INDEX_BLOCK *ib)
+{
+	INDEX_ENTRY *ie_roam;
+	int freed_space;
+	BOOL full;
+	int ret = STATUS_ERROR;
+	
+	ntfs_log_trace("Entering\n");
+	
+	full = ih->index_length == ih->allocated_size;
+	ie_roam = ntfs_ie_dup_novcn(ie);
+	if (!ie_roam)
+		return STATUS_ERROR;
+
+	ntfs_ie_delete(ih, ie);
+
+	if (ntfs_icx_parent_vcn(icx) == VCN_INDEX_ROOT_PARENT) {
+		/*
+		 * Recover the space which may have been freed
+		 * while deleting an entry from root index
+		 */
+		freed_space = le32_to_cpu(ih->allocated_size)
+				- le32_to_cpu(ih->index_length);
+		if (full && (freed_space > 0) && !(freed_space & 7)) {
+			ntfs_ir_truncate(icx, le32_to_cpu(ih->index_length));
+			/* do nothing if truncation fails */
+		}
+		ntfs_inode_mark_dirty(icx->actx->ntfs_ino);
+	} else
+		if (ntfs_ib_write(icx, ib))
+			goto out;
+	
+	ntfs_index_ctx_reinit(icx);
+
+	ret = ntfs_ie_add(icx, ie_roam);
+out:
+	free(ie_roam);
+	return ret;
+}
+
+/**
+ *  Used if an empty index block to be deleted has END entry as the parent
+ *  in the INDEX_ROOT which is the only one there.
+ */
+static void ntfs_ir_leafify(ntfs_index_context *icx, INDEX_HEADER *ih)
+{
+	INDEX_ENTRY *ie;
+	
+	ntfs_log_trace("Entering\n");
+	
+	ie = ntfs_ie_get_first(ih);
+	ie->ie_flags &= ~INDEX_ENTRY_NODE;
+	ie->length = cpu_to_le16(le16_to_cpu(ie->length) - sizeof(VCN));
+	
+	ih->index_length = cpu_to_le32(le32_to_cpu(ih->index_length) -
+			sizeof(VCN));
+	ih->ih_flags &= ~LARGE_INDEX;
+	
+	/* Not fatal error */
+	ntfs_ir_truncate(icx, le32_to_cpu(ih->index_length));
+}
+
+/**
+ *  Used if an empty index block to be deleted has END entry as the parent 
+ *  in the INDEX_ROOT which is not the only one there.
+ */
+static int ntfs_ih_reparent_end(ntfs_index_context *icx, INDEX_HEADER *ih,
+				INDEX_BLOCK *ib)
+{
+	INDEX_ENTRY *ie, *ie_prev;
+	
+	ntfs_log_trace("Entering\n");
+	
+	ie = ntfs_ie_get_by_pos(ih, ntfs_icx_parent_pos(icx));
+	ie_prev = ntfs_ie_prev(ih, ie);
+	
+	ntfs_ie_set_vcn(ie, ntfs_ie_get_vcn(ie_prev));
+	
+	return ntfs_ih_takeout(icx, ih, ie_prev, ib);
+}
+
+static int ntfs_index_rm_leaf(ntfs_index_context *icx)
+{
+	INDEX_BLOCK *ib = NULL;
+	INDEX_HEADER *parent_ih;
+	INDEX_ENTRY *ie;
+	int ret = STATUS_ERROR;
+	
+	ntfs_log_trace("pindex: %d\n", icx->pindex);
+	
+	if (ntfs_icx_parent_dec(icx))
+		return STATUS_ERROR;
+
+	if (ntfs_ibm_clear(icx, icx->parent_vcn[icx->pindex + 1]))
+		return STATUS_ERROR;
+	
+	if (ntfs_icx_parent_vcn(icx) == VCN_INDEX_ROOT_PARENT)
+		parent_ih = &icx->ir->index;
+	else {
+		ib = ntfs_malloc(icx->block_size);
+		if (!ib)
+			return STATUS_ERROR;
+		
+		if (ntfs_ib_read(icx, ntfs_icx_parent_vcn(icx), ib))
+			goto out;
+	
+		parent_ih = &ib->index;
+	}
+	
+	ie = ntfs_ie_get_by_pos(parent_ih, ntfs_icx_parent_pos(icx));
+	if (!ntfs_ie_end(ie)) {
+		ret = ntfs_ih_takeout(icx, parent_ih, ie, ib);
+		goto out;
+	}
+		
+	if (ntfs_ih_zero_entry(parent_ih)) {
+		
+		if (ntfs_icx_parent_vcn(icx) == VCN_INDEX_ROOT_PARENT) {
+			ntfs_ir_leafify(icx, parent_ih);
+			goto ok;
+		}
+		
+		ret = ntfs_index_rm_leaf(icx);
+		goto out;
+	}
+		
+	if (ntfs_ih_reparent_end(icx, parent_ih, ib))
+		goto out;
+ok:	
+	ret = STATUS_OK;
+out:
+	free(ib);
+	return ret;
+}
+
+static int ntfs_index_rm_node(ntfs_index_context *icx)
+{
+	int entry_pos, pindex;
+	VCN vcn;
+	INDEX_BLOCK *ib = NULL;
+	INDEX_ENTRY *ie_succ, *ie, *entry = icx->entry;
+	INDEX_HEADER *ih;
+	u32 new_size;
+	int delta, ret = STATUS_ERROR;
+
+	ntfs_log_trace("Entering\n");
+	
+	if (!icx->ia_na) {
+		icx->ia_na = ntfs_ia_open(icx, icx->ni);
+		if (!icx->ia_na)
+			return STATUS_ERROR;
+	}
+
+	ib = ntfs_malloc(icx->block_size);
+	if (!ib)
+		return STATUS_ERROR;
+	
+	ie_succ = ntfs_ie_get_next(icx->entry);
+	entry_pos = icx->parent_pos[icx->pindex]++;
+	pindex = icx->pindex;
+descend:
+	vcn = ntfs_ie_get_vcn(ie_succ);
+	if (ntfs_ib_read(icx, vcn, ib))
+		goto out;
+	
+	ie_succ = ntfs_ie_get_first(&ib->index);
+
+	if (ntfs_icx_parent_inc(icx))
+		goto out;
+	
+	icx->parent_vcn[icx->pindex] = vcn;
+	icx->parent_pos[icx->pindex] = 0;
+
+	if ((ib->index.ih_flags & NODE_MASK) == INDEX_NODE)
+		goto descend;
+
+	if (ntfs_ih_zero_entry(&ib->index)) {
+		errno = EIO;
+		ntfs_log_perror("Empty index block");
+		goto out;
+	}
+
+	ie = ntfs_ie_dup(ie_succ);
+	if (!ie)
+		goto out;
+	
+	if (ntfs_ie_add_vcn(&ie))
+		goto out2;
+
+	ntfs_ie_set_vcn(ie, ntfs_ie_get_vcn(icx->entry));
+
+	if (icx->is_in_root)
+		ih = &icx->ir->index;
+	else
+		ih = &icx->ib->index;
+
+	delta = le16_to_cpu(ie->length) - le16_to_cpu(icx->entry->length);
+	new_size = le32_to_cpu(ih->index_length) + delta;
+	if (delta > 0) {
+		if (icx->is_in_root) {
+			ret = ntfs_ir_make_space(icx, new_size);
+			if (ret != STATUS_OK)
+				goto out2;
+			
+			ih = &icx->ir->index;
+			entry = ntfs_ie_get_by_pos(ih, entry_pos);
+			
+		} else if (new_size > le32_to_cpu(ih->allocated_size)) {
+			icx->pindex = pindex;
+			ret = ntfs_ib_split(icx, icx->ib);
+			if (ret == STATUS_OK)
+				ret = STATUS_KEEP_SEARCHING;
+			goto out2;
+		}
+	}
+
+	ntfs_ie_delete(ih, entry);
+	ntfs_ie_insert(ih, ie, entry);
+	
+	if (icx->is_in_root) {
+		if (ntfs_ir_truncate(icx, new_size))
+			goto out2;
+	} else
+		if (ntfs_icx_ib_write(icx))
+			goto out2;
+	
+	ntfs_ie_delete(&ib->index, ie_succ);
+	
+	if (ntfs_ih_zero_entry(&ib->index)) {
+		if (ntfs_index_rm_leaf(icx))
+			goto out2;
+	} else 
+		if (ntfs_ib_write(icx, ib))
+			goto out2;
+
+	ret = STATUS_OK;
+out2:
+	free(ie);
+out:
+	free(ib);
+	return ret;
+}
+
+/**
+ * ntfs_index_rm - remove entry from the index
+ * @icx:	index context describing entry to delete
+ *
+ * Delete entry described by @icx from the index. Index context is always 
+ * reinitialized after use of this function, so it can be used for index 
+ * lookup once again.
+ *
+ * Return 0 on success or -1 on error with errno set to the error code.
+ */
+int ntfs_index_rm(ntfs_index_context *icx)
+{
+	INDEX_HEADER *ih;
+	int err, ret = STATUS_OK;
+
+	ntfs_log_trace("Entering\n");
+	
+	if (!icx || (!icx->ib && !icx->ir) || ntfs_ie_end(icx->entry)) {
+		ntfs_log_error("Invalid arguments.\n");
+		errno = EINVAL;
+		goto err_out;
+	}
+	if (icx->is_in_root)
+		ih = &icx->ir->index;
+	else
+		ih = &icx->ib->index;
+	
+	if (icx->entry->ie_flags & INDEX_ENTRY_NODE) {
+		
+		ret = ntfs_index_rm_node(icx);
+
+	} else if (icx->is_in_root || !ntfs_ih_one_entry(ih)) {
+		
+		ntfs_ie_delete(ih, icx->entry);
+		
+		if (icx->is_in_root) {
+			err = ntfs_ir_truncate(icx, le32_to_cpu(ih->index_length));
+			if (err != STATUS_OK)
+				goto err_out;
+		} else
+			if (ntfs_icx_ib_write(icx))
+				goto err_out;
+	} else {
+		if (ntfs_index_rm_leaf(icx))
+			goto err_out;
+	}
+out:
+	return ret;
+err_out:
+	ret = STATUS_ERROR;
+	goto out;
+}
+
+/**
+ * ntfs_index_remove - remove an entry from a directory index
+ * @dir_ni:	directory inode to remove the entry from
+ * @key:	$FILE_NAME attribute value of the entry to remove
+ * @keylen:	byte size of @key
+ *
+ * Look up @key in the $I30 index of the directory @dir_ni and remove the
+ * index entry found, restructuring the index as needed.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+int ntfs_index_remove(ntfs_inode *dir_ni, const void *key, const int keylen)
+{
+	int ret = STATUS_ERROR;
+	ntfs_index_context *icx;
+
+	icx = ntfs_index_ctx_get(dir_ni, NTFS_INDEX_I30, 4);
+	if (!icx)
+		return -1;
+
+	while (1) {
+		if (ntfs_index_lookup(key, keylen, icx))
+			goto err_out;
+
+		ret = ntfs_index_rm(icx);
+		if (ret == STATUS_ERROR)
+			goto err_out;
+		else if (ret == STATUS_OK)
+			break;
+		
+		ntfs_inode_mark_dirty(icx->actx->ntfs_ino);
+		ntfs_index_ctx_reinit(icx);
+	}
+
+	ntfs_inode_mark_dirty(icx->actx->ntfs_ino);
+out:	
+	ntfs_index_ctx_put(icx);
+	return ret;
+err_out:
+	ret = STATUS_ERROR;
+	ntfs_log_perror("Delete failed");
+	goto out;
+}
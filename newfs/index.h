@@ -132,4 +132,10 @@ extern VCN ntfs_ie_get_vcn(INDEX_ENTRY *ie);
 
 extern void ntfs_index_entry_mark_dirty(ntfs_index_context *ictx);
 
+extern int ntfs_index_add_filename(ntfs_inode *ni, FILE_NAME_ATTR *fn,
+		MFT_REF mref);
+extern int ntfs_index_rm(ntfs_index_context *icx);
+extern int ntfs_index_remove(ntfs_inode *dir_ni, const void *key,
+		const int keylen);
+
 #endif /* _NTFS_INDEX_H */
@@ -383,37 +383,224 @@ err:
 }
 
 /*
- *		Open an inode
+ *		Inode cache
+ *
+ *	Every inode opened with ntfs_inode_open() is hashed by its mft
+ *	record number on its volume and reference counted, so opening an
+ *	inode which is already open returns the same ntfs_inode, and
+ *	there is never more than one copy of a mft record in memory.
  *
- *	When possible, an entry recorded in the cache is reused
+ *	When the last reference is dropped the inode is written out if it
+ *	is dirty and then kept on a lru list, up to CACHE_NIDATA_SIZE
+ *	inodes, so reopening it only costs a hash lookup.  The least
+ *	recently closed inode is evicted when the list is full.
  *
- *	**NEVER REOPEN** an inode, this can lead to a duplicated
- * 	cache entry (hard to detect), and to an obsolete one being
- *	reused. System files are however protected from being cached.
+ *	Inodes created with ntfs_inode_allocate() are not hashed and are
+ *	released on close.  Inodes whose mft record is no longer in use are
+ *	unhashed on the first close after the record was freed, whatever
+ *	the number of references, and released on their final close.
+ */
+
+static inline ntfs_inode **ntfs_inode_hash(ntfs_volume *vol, u64 mft_no)
+{
+	return &vol->inode_hash[mft_no & (CACHE_NIDATA_HASH - 1)];
+}
+
+static void ntfs_inode_do_hash(ntfs_inode *ni)
+{
+	ntfs_inode **pni = ntfs_inode_hash(ni->vol, ni->mft_no);
+
+	ni->hash_next = *pni;
+	*pni = ni;
+	NInoSetHashed(ni);
+}
+
+static void ntfs_inode_unhash(ntfs_inode *ni)
+{
+	ntfs_inode **pni;
+
+	for (pni = ntfs_inode_hash(ni->vol, ni->mft_no); *pni;
+			pni = &(*pni)->hash_next) {
+		if (*pni == ni) {
+			*pni = ni->hash_next;
+			break;
+		}
+	}
+	ni->hash_next = NULL;
+	NInoClearHashed(ni);
+}
+
+static void ntfs_inode_lru_del(ntfs_inode *ni)
+{
+	ntfs_volume *vol = ni->vol;
+
+	if (ni->lru_prev)
+		ni->lru_prev->lru_next = ni->lru_next;
+	else
+		vol->inode_lru_head = ni->lru_next;
+	if (ni->lru_next)
+		ni->lru_next->lru_prev = ni->lru_prev;
+	else
+		vol->inode_lru_tail = ni->lru_prev;
+	ni->lru_prev = ni->lru_next = NULL;
+	vol->nr_cached_inodes--;
+}
+
+static void ntfs_inode_lru_add(ntfs_inode *ni)
+{
+	ntfs_volume *vol = ni->vol;
+
+	ni->lru_prev = NULL;
+	ni->lru_next = vol->inode_lru_head;
+	if (vol->inode_lru_head)
+		vol->inode_lru_head->lru_prev = ni;
+	else
+		vol->inode_lru_tail = ni;
+	vol->inode_lru_head = ni;
+	vol->nr_cached_inodes++;
+}
+
+/*
+ *		Evict a closed inode from the cache and release it
+ *
+ *	Returns 0 if successful or -1 with errno set if the inode could not
+ *	be written out, in which case it is left in the cache.
+ */
+
+static int ntfs_inode_evict(ntfs_inode *ni)
+{
+	ntfs_inode_lru_del(ni);
+	ntfs_inode_unhash(ni);
+	if (ntfs_inode_real_close(ni)) {
+		ntfs_log_perror("Failed to evict inode %lld",
+				(long long)ni->mft_no);
+		ntfs_inode_do_hash(ni);
+		ntfs_inode_lru_add(ni);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_inode_cache_flush - release all closed inodes kept in the cache
+ * @vol:	volume whose inode cache to flush
+ *
+ * Inodes which are still open are not affected.  This is called when the
+ * volume is unmounted.
+ *
+ * Return 0 on success or -1 on error with errno set to the error code of the
+ * first failure.
+ */
+int ntfs_inode_cache_flush(ntfs_volume *vol)
+{
+	int err = 0;
+
+	while (vol->inode_lru_tail) {
+		if (ntfs_inode_evict(vol->inode_lru_tail)) {
+			if (!err)
+				err = errno;
+			/* Do not retry the same inode for ever. */
+			break;
+		}
+	}
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *		Open an inode
+ *
+ *	If the inode is already open or still in the cache, the cached
+ *	ntfs_inode is reused, otherwise it is read from disk and hashed.
  */
 
 ntfs_inode *ntfs_inode_open(ntfs_volume *vol, const MFT_REF mref)
 {
 	ntfs_inode *ni;
+
+	if (!vol) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (ni = *ntfs_inode_hash(vol, MREF(mref)); ni; ni = ni->hash_next) {
+		if (ni->mft_no != MREF(mref))
+			continue;
+		if (MSEQNO(mref) && MSEQNO(mref) !=
+				le16_to_cpu(ni->mrec->sequence_number)) {
+			ntfs_log_debug("Sequence number mismatch for inode "
+					"%lld (%d != %d)\n",
+					(long long)MREF(mref), MSEQNO(mref),
+					le16_to_cpu(ni->mrec->sequence_number));
+			errno = EIO;
+			return NULL;
+		}
+		if (!ni->nr_opens++)
+			ntfs_inode_lru_del(ni);
+		return ni;
+	}
 	ni = ntfs_inode_real_open(vol, mref);
-	return (ni);
+	if (ni) {
+		ni->nr_opens = 1;
+		ntfs_inode_do_hash(ni);
+	}
+	return ni;
 }
 
 /*
  *		Close an inode entry
  *
- *	If cacheing is in use, the entry is synced and kept available
- *	in cache for further use.
- *
- *	System files (inode < 16 or having the IS_4 flag) are protected
- *	against being cached.
+ *	Dropping the last reference writes the inode out if it is dirty and
+ *	then keeps it in the cache for further use.  Returns 0 if successful
+ *	or -1 with errno set if the inode could not be written out, in which
+ *	case the reference is kept and ntfs_inode_close() may be called again.
  */
 
 int ntfs_inode_close(ntfs_inode *ni)
 {
-	int res;
-	res = ntfs_inode_real_close(ni);
-	return (res);
+	ntfs_volume *vol;
+
+	if (!ni)
+		return 0;
+	if (NInoHashed(ni) && !(ni->mrec->flags & MFT_RECORD_IN_USE)) {
+		/*
+		 * The mft record has been freed, unhash the inode straight
+		 * away even if it is still open elsewhere, so a later open
+		 * cannot return it, possibly for a reused record.  It is
+		 * released when the last reference is dropped.
+		 */
+		ntfs_inode_unhash(ni);
+		if (ni->nr_opens > 1) {
+			ni->nr_opens--;
+			return 0;
+		}
+		if (ntfs_inode_real_close(ni)) {
+			ntfs_inode_do_hash(ni);
+			return -1;
+		}
+		return 0;
+	}
+	if (ni->nr_opens > 1) {
+		ni->nr_opens--;
+		return 0;
+	}
+	if (!NInoHashed(ni))
+		return ntfs_inode_real_close(ni);
+	if ((NInoDirty(ni) || NInoAttrListDirty(ni)) && ntfs_inode_sync(ni)) {
+		if (errno != EIO)
+			errno = EBUSY;
+		return -1;
+	}
+	ni->nr_opens = 0;
+	vol = ni->vol;
+	ntfs_inode_lru_add(ni);
+	while (vol->nr_cached_inodes > CACHE_NIDATA_SIZE) {
+		if (ntfs_inode_evict(vol->inode_lru_tail))
+			break;
+	}
+	return 0;
 }
 
 /**
@@ -734,7 +921,8 @@ static int ntfs_inode_sync_file_name(ntfs_inode *ni, ntfs_inode *dir_ni)
 			ntfs_log_perror("Index lookup failed, inode %lld",
 					(long long)index_ni->mft_no);
 			ntfs_index_ctx_put(ictx);
-			if (ni != index_ni && ntfs_inode_close(index_ni) && !err)
+			if ((ni != index_ni) && !dir_ni
+			    && ntfs_inode_close(index_ni) && !err)
 				err = errno;
 			continue;
 		}
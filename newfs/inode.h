@@ -40,6 +40,7 @@ typedef enum {
 	NI_v3_Extensions,	/* 1: JPA v3.x extensions present. */
 	NI_TimesSet,		/* 1: Use times which were set */
 	NI_KnownSize,		/* 1: Set if sizes are meaningful */
+	NI_Hashed,		/* 1: Inode is in the inode cache of its volume. */
 } ntfs_inode_state_bits;
 
 #define  test_nino_flag(ni, flag)	   test_bit(NI_##flag, (ni)->state)
@@ -77,6 +78,10 @@ typedef enum {
 #define NInoAttrListTestAndSetDirty(ni)	    test_and_set_nino_al_flag(ni, Dirty)
 #define NInoAttrListTestAndClearDirty(ni) test_and_clear_nino_al_flag(ni, Dirty)
 
+#define NInoHashed(ni)				  test_nino_flag(ni, Hashed)
+#define NInoSetHashed(ni)			   set_nino_flag(ni, Hashed)
+#define NInoClearHashed(ni)			 clear_nino_flag(ni, Hashed)
+
 #define NInoFileNameDirty(ni)                 test_nino_flag(ni, FileNameDirty)
 #define NInoFileNameSetDirty(ni)               set_nino_flag(ni, FileNameDirty)
 #define NInoFileNameClearDirty(ni)           clear_nino_flag(ni, FileNameDirty)
@@ -152,6 +157,17 @@ struct _ntfs_inode {
 	le32 security_id;
 	le64 quota_charged;
 	le64 usn;
+
+	/*
+	 * Inode cache support, only valid if NI_Hashed is set in state or
+	 * the inode was unhashed because its mft record was freed whilst it
+	 * was still open.  Closed inodes (nr_opens == 0) are kept on the lru
+	 * list of the volume until they are reopened or evicted.
+	 */
+	s32 nr_opens;		/* Number of ntfs_inode_open() references. */
+	ntfs_inode *hash_next;	/* Next inode in the same hash chain. */
+	ntfs_inode *lru_prev;	/* More recently closed cached inode. */
+	ntfs_inode *lru_next;	/* Less recently closed cached inode. */
 };
 
 typedef enum {
@@ -171,6 +187,8 @@ extern ntfs_inode *ntfs_inode_open(ntfs_volume *vol, const MFT_REF mref);
 
 extern int ntfs_inode_close(ntfs_inode *ni);
 
+extern int ntfs_inode_cache_flush(ntfs_volume *vol);
+
 extern ntfs_inode *ntfs_extent_inode_open(ntfs_inode *base_ni,
 		const MFT_REF mref);
 
@@ -2647,4 +2647,56 @@ typedef struct {
 	} __attribute__((__packed__));
 } __attribute__((__packed__)) INTX_FILE;
 
+/*
+ * Log file restart page header.  The first two pages of $LogFile, each of the
+ * system page size, are restart pages beginning with this header.  They are
+ * multi sector transfer protected.
+ */
+typedef struct {
+/*  0*/	NTFS_RECORD_TYPE magic;	/* The magic is "RSTR" or "CHKD". */
+/*  4*/	le16 usa_ofs;		/* See NTFS_RECORD definition. */
+/*  6*/	le16 usa_count;		/* See NTFS_RECORD definition. */
+/*  8*/	leLSN chkdsk_lsn;	/* The last log file sequence number found by
+				   chkdsk.  Only used when the magic is
+				   "CHKD", otherwise zero. */
+/* 16*/	le32 system_page_size;	/* Byte size of the system pages.  Has to be
+				   >= 512 and a power of 2. */
+/* 20*/	le32 log_page_size;	/* Byte size of log file pages.  Has to be
+				   >= 512 and a power of 2. */
+/* 24*/	le16 restart_area_offset;/* Byte offset from the start of this header
+				   to the RESTART_AREA. */
+/* 26*/	sle16 minor_ver;	/* Log file minor version. */
+/* 28*/	sle16 major_ver;	/* Log file major version. */
+/* sizeof() = 30 (0x1e) bytes */
+} __attribute__((__packed__)) RESTART_PAGE_HEADER;
+
+/* Log client index meaning there are no client records in a client array. */
+#define LOGFILE_NO_CLIENT	const_cpu_to_le16(0xffff)
+
+/* The RESTART_AREA flags. */
+enum {
+	RESTART_VOLUME_IS_CLEAN	= const_cpu_to_le16(0x0002),
+	RESTART_SPACE_FILLER	= const_cpu_to_le16(0xffff), /* gcc: Force enum bit width to 16. */
+} __attribute__((__packed__));
+
+typedef le16 RESTART_AREA_FLAGS;
+
+/*
+ * Log file restart area record, found at restart_area_offset bytes into a
+ * restart page.  Only the leading fields, which are all that is needed to
+ * decide whether the volume was shut down cleanly, are defined here.
+ */
+typedef struct {
+/*  0*/	leLSN current_lsn;	/* The current, i.e. last, LSN inside the log
+				   when the restart area was last written. */
+/*  8*/	le16 log_clients;	/* Number of log client records. */
+/* 10*/	le16 client_free_list;	/* Index of the first free log client record
+				   or LOGFILE_NO_CLIENT. */
+/* 12*/	le16 client_in_use_list;/* Index of the first in-use log client record
+				   or LOGFILE_NO_CLIENT.  If this is not
+				   LOGFILE_NO_CLIENT the log file is open. */
+/* 14*/	RESTART_AREA_FLAGS flags;/* RESTART_VOLUME_IS_CLEAN is set by Windows
+				   when the volume was shut down cleanly. */
+} __attribute__((__packed__)) RESTART_AREA;
+
 #endif /* defined _NTFS_LAYOUT_H */
@@ -0,0 +1,578 @@
+/**
+ * mftscan.c - Parallel scanner of all the records of the mft.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * The calling thread reads $MFT in large chunks, following its runlist, into
+ * a ring of buffers.  Worker threads take the chunks in order, apply the mst
+ * fixups to the records in them, parse them and invoke the callback for each
+ * record in use.  The callback appends its output to the chunk, and the
+ * calling thread writes the output of the chunks out in mft order, so the
+ * output of a scan does not depend on the number of threads.
+ *
+ * The records are read from disk, not from the inodes the library has open,
+ * so any changes to those should be synced before scanning.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STDARG_H
+#include <stdarg.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <pthread.h>
+
+#include "types.h"
+#include "attrib.h"
+#include "layout.h"
+#include "mftscan.h"
+#include "mst.h"
+#include "logging.h"
+#include "misc.h"
+
+/* Default number of bytes of $MFT read at a time. */
+#define MFT_SCAN_DEFAULT_CHUNK_SIZE	(4 * 1024 * 1024)
+
+/* Initial size of the output buffer of a chunk. */
+#define MFT_SCAN_OUT_SIZE		(64 * 1024)
+
+/* States of a chunk in the ring. */
+typedef enum {
+	MFT_SCAN_CHUNK_FREE,	/* Buffer available for reading into. */
+	MFT_SCAN_CHUNK_READ,	/* Records read, waiting for a worker. */
+	MFT_SCAN_CHUNK_BUSY,	/* A worker is parsing the records. */
+	MFT_SCAN_CHUNK_DONE,	/* Parsed, output waiting to be written. */
+} ntfs_mft_scan_chunk_state;
+
+/**
+ * struct ntfs_mft_scan_chunk - a chunk of consecutive mft records
+ * @state:	where in its life cycle the chunk is
+ * @first:	number of the first mft record in @buf
+ * @nr:		number of mft records in @buf
+ * @buf:	the mft records
+ * @out:	output produced by the callback for the records in @buf
+ * @stats:	statistics of the records in @buf
+ * @err:	errno if the callback failed, else 0
+ */
+typedef struct {
+	ntfs_mft_scan_chunk_state state;
+	u64 first;
+	u32 nr;
+	u8 *buf;
+	ntfs_mft_scan_out out;
+	ntfs_mft_scan_stats stats;
+	int err;
+} ntfs_mft_scan_chunk;
+
+/**
+ * struct ntfs_mft_scan_ctx - state shared between the scanner threads
+ * @vol:	volume being scanned
+ * @opts:	parameters of the scan
+ * @lock:	protects the fields below and the chunk states
+ * @cond:	broadcast whenever a chunk changes state or the scan ends
+ * @chunks:	ring of chunks, chunk number n lives in @chunks[n % @nr_chunks]
+ * @nr_chunks:	number of chunks in the ring
+ * @nr_read:	number of chunks read so far
+ * @next:	number of the next chunk for a worker to parse
+ * @stop:	set when there is nothing left for the workers to do
+ */
+typedef struct {
+	ntfs_volume *vol;
+	const ntfs_mft_scan_opts *opts;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	ntfs_mft_scan_chunk *chunks;
+	int nr_chunks;
+	s64 nr_read;
+	s64 next;
+	BOOL stop;
+} ntfs_mft_scan_ctx;
+
+/**
+ * ntfs_mft_scan_reserve - make room in the output of a chunk
+ * @out:	output to make room in
+ * @count:	number of bytes needed after the current end of @out
+ *
+ * Return 0 on success and -1 with errno set to ENOMEM on error.
+ */
+static int ntfs_mft_scan_reserve(ntfs_mft_scan_out *out, size_t count)
+{
+	size_t size = out->size ? out->size : MFT_SCAN_OUT_SIZE;
+	char *buf;
+
+	if (out->len + count <= out->size)
+		return 0;
+	while (size < out->len + count)
+		size <<= 1;
+	buf = realloc(out->buf, size);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+	out->buf = buf;
+	out->size = size;
+	return 0;
+}
+
+/**
+ * ntfs_mft_scan_write - append data to the output of a chunk
+ * @out:	output to append to
+ * @b:		data to append
+ * @count:	number of bytes in @b
+ *
+ * Return 0 on success and -1 with errno set to ENOMEM on error.
+ */
+int ntfs_mft_scan_write(ntfs_mft_scan_out *out, const void *b, size_t count)
+{
+	if (ntfs_mft_scan_reserve(out, count))
+		return -1;
+	memcpy(out->buf + out->len, b, count);
+	out->len += count;
+	return 0;
+}
+
+/**
+ * ntfs_mft_scan_printf - append formatted text to the output of a chunk
+ * @out:	output to append to
+ * @fmt:	printf() format
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+int ntfs_mft_scan_printf(ntfs_mft_scan_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	size_t avail;
+	int len;
+
+	avail = out->size - out->len;
+	va_start(ap, fmt);
+	len = vsnprintf(avail ? out->buf + out->len : NULL, avail, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return -1;
+	if ((size_t)len >= avail) {
+		if (ntfs_mft_scan_reserve(out, len + 1))
+			return -1;
+		va_start(ap, fmt);
+		vsnprintf(out->buf + out->len, len + 1, fmt, ap);
+		va_end(ap);
+	}
+	out->len += len;
+	return 0;
+}
+
+/**
+ * ntfs_mft_scan_record_parse - parse an mst deprotected mft record
+ * @vol:	volume the mft record belongs to
+ * @m:		the mft record
+ * @r:		scanner record to fill in
+ *
+ * Fill @r from the attributes in @m, which must be in use.  The attributes
+ * are checked to lie within the record, as nothing else validated them.
+ *
+ * Return 0 on success and -1 if @m is corrupt.
+ */
+static int ntfs_mft_scan_record_parse(const ntfs_volume *vol,
+		const MFT_RECORD *m, ntfs_mft_scan_record *r)
+{
+	const ATTR_RECORD *a;
+	u32 ofs, end;
+
+	if (le32_to_cpu(m->bytes_allocated) != vol->mft_record_size)
+		return -1;
+	end = le32_to_cpu(m->bytes_in_use);
+	ofs = le16_to_cpu(m->attrs_offset);
+	if (end > vol->mft_record_size || ofs & 7 || ofs >= end)
+		return -1;
+	r->seq_no = le16_to_cpu(m->sequence_number);
+	r->flags = m->flags;
+	r->base_mref = le64_to_cpu(m->base_mft_record);
+	r->m = m;
+	for (;; ofs += le32_to_cpu(a->length)) {
+		const u8 *val;
+		u32 len;
+
+		a = (const ATTR_RECORD*)((const u8*)m + ofs);
+		if (ofs + sizeof(a->type) > end)
+			return -1;
+		if (a->type == AT_END)
+			break;
+		if (ofs + offsetof(ATTR_RECORD, resident_end) > end ||
+				le32_to_cpu(a->length) < offsetof(ATTR_RECORD,
+				resident_end) ||
+				le32_to_cpu(a->length) > end - ofs)
+			return -1;
+		if (a->non_resident) {
+			if (le32_to_cpu(a->length) < offsetof(ATTR_RECORD,
+					compressed_size))
+				return -1;
+			if (a->type == AT_DATA && !a->name_length) {
+				r->data = a;
+				if (!a->lowest_vcn) {
+					r->data_size = sle64_to_cpu(
+							a->data_size);
+					r->allocated_size = sle64_to_cpu(
+							a->allocated_size);
+					r->initialized_size = sle64_to_cpu(
+							a->initialized_size);
+				}
+			}
+			continue;
+		}
+		len = le32_to_cpu(a->value_length);
+		if (le16_to_cpu(a->value_offset) + len >
+				le32_to_cpu(a->length))
+			return -1;
+		val = (const u8*)a + le16_to_cpu(a->value_offset);
+		if (a->type == AT_STANDARD_INFORMATION) {
+			const STANDARD_INFORMATION *si =
+					(const STANDARD_INFORMATION*)val;
+
+			if (len < offsetof(STANDARD_INFORMATION,
+					maximum_versions))
+				return -1;
+			r->creation_time = si->creation_time;
+			r->last_data_change_time = si->last_data_change_time;
+			r->last_mft_change_time = si->last_mft_change_time;
+			r->last_access_time = si->last_access_time;
+			r->file_attributes = si->file_attributes;
+		} else if (a->type == AT_FILE_NAME) {
+			const FILE_NAME_ATTR *fn = (const FILE_NAME_ATTR*)val;
+
+			if (len < sizeof(FILE_NAME_ATTR) || len <
+					sizeof(FILE_NAME_ATTR) +
+					fn->file_name_length *
+					sizeof(ntfschar))
+				return -1;
+			r->nr_names++;
+			if (!r->name || (r->name_type == FILE_NAME_DOS &&
+					fn->file_name_type != FILE_NAME_DOS)) {
+				r->parent_mref = le64_to_cpu(
+						fn->parent_directory);
+				r->name = fn->file_name;
+				r->name_len = fn->file_name_length;
+				r->name_type = fn->file_name_type;
+			}
+		} else if (a->type == AT_DATA && !a->name_length) {
+			r->data = a;
+			r->data_size = r->initialized_size = len;
+			r->allocated_size = (len + 7) & ~7;
+		}
+	}
+	return 0;
+}
+
+/**
+ * ntfs_mft_scan_chunk_parse - parse the mft records of a chunk
+ * @ctx:	scanner state
+ * @c:		chunk to parse
+ *
+ * Deprotect and parse the records in @c and invoke the callback for each of
+ * them which is in use, and for the corrupt ones if the caller asked for
+ * them.  On error, @c->err is set and the rest of the chunk
+ * is skipped.
+ */
+static void ntfs_mft_scan_chunk_parse(ntfs_mft_scan_ctx *ctx,
+		ntfs_mft_scan_chunk *c)
+{
+	const ntfs_mft_scan_opts *opts = ctx->opts;
+	ntfs_volume *vol = ctx->vol;
+	u32 i;
+
+	c->out.len = 0;
+	memset(&c->stats, 0, sizeof(c->stats));
+	c->stats.nr_records = c->nr;
+	c->stats.bytes_read = (s64)c->nr << vol->mft_record_size_bits;
+	for (i = 0; i < c->nr; i++) {
+		MFT_RECORD *m = (MFT_RECORD*)(c->buf +
+				((size_t)i << vol->mft_record_size_bits));
+		ntfs_mft_scan_record r;
+
+		memset(&r, 0, sizeof(r));
+		r.mft_no = c->first + i;
+		r.m = m;
+		/* Never used records are zero, they just get skipped. */
+		if (!ntfs_is_file_record(m->magic)) {
+			if (!m->magic)
+				continue;
+			ntfs_log_verbose("Record %llu has no FILE magic.\n",
+					(unsigned long long)r.mft_no);
+			r.corrupt = TRUE;
+		} else if (ntfs_mst_post_read_fixup_warn((NTFS_RECORD*)m,
+				vol->mft_record_size, FALSE)) {
+			ntfs_log_verbose("Record %llu failed the multi sector "
+					"transfer fixups.\n",
+					(unsigned long long)r.mft_no);
+			r.corrupt = TRUE;
+		} else {
+			if (!(m->flags & MFT_RECORD_IN_USE))
+				continue;
+			c->stats.nr_in_use++;
+			if (ntfs_mft_scan_record_parse(vol, m, &r)) {
+				ntfs_log_verbose("Record %llu is corrupt.\n",
+						(unsigned long long)r.mft_no);
+				r.corrupt = TRUE;
+			}
+		}
+		if (r.corrupt) {
+			c->stats.nr_bad++;
+			if (!opts->corrupt)
+				continue;
+			/* Throw away whatever the parser got to. */
+			memset(&r, 0, sizeof(r));
+			r.mft_no = c->first + i;
+			r.flags = m->flags;
+			r.m = m;
+			r.corrupt = TRUE;
+		} else if (r.base_mref) {
+			c->stats.nr_extents++;
+			if (!opts->extents)
+				continue;
+		}
+		if (opts->fn && opts->fn(&r, &c->out, opts->data)) {
+			c->err = errno ? errno : EIO;
+			return;
+		}
+	}
+}
+
+/**
+ * ntfs_mft_scan_worker - body of a worker thread
+ * @arg:	scanner state
+ *
+ * Parse chunks in the order they were read until told to stop.
+ */
+static void *ntfs_mft_scan_worker(void *arg)
+{
+	ntfs_mft_scan_ctx *ctx = arg;
+	ntfs_mft_scan_chunk *c;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (;;) {
+		while (!ctx->stop && ctx->next == ctx->nr_read)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		if (ctx->next == ctx->nr_read)
+			break;
+		c = &ctx->chunks[ctx->next++ % ctx->nr_chunks];
+		c->state = MFT_SCAN_CHUNK_BUSY;
+		pthread_mutex_unlock(&ctx->lock);
+		ntfs_mft_scan_chunk_parse(ctx, c);
+		pthread_mutex_lock(&ctx->lock);
+		c->state = MFT_SCAN_CHUNK_DONE;
+		pthread_cond_broadcast(&ctx->cond);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
+}
+
+/**
+ * ntfs_mft_scan_flush - write out the output of a chunk
+ * @fd:		file descriptor to write to
+ * @out:	output to write
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int ntfs_mft_scan_flush(int fd, const ntfs_mft_scan_out *out)
+{
+	size_t done = 0;
+
+	while (done < out->len) {
+		ssize_t n = write(fd, out->buf + done, out->len - done);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_mft_scan - scan all the records of the mft of a volume
+ * @vol:	mounted ntfs volume to scan
+ * @opts:	parameters of the scan
+ * @stats:	if not NULL, statistics of the scan are returned here
+ *
+ * Read the whole initialized part of $MFT of @vol, @opts->chunk_size bytes
+ * at a time, and invoke @opts->fn for every base mft record in use, and for
+ * every extent mft record in use as well if @opts->extents is true.  The
+ * callbacks run on @opts->nr_threads worker threads, and what they append to
+ * their output is written to @opts->out_fd, or handed to @opts->out_fn, in mft
+ * record order.
+ *
+ * Records which fail the mst fixups or are otherwise corrupt are counted in
+ * @stats and, unless @opts->corrupt is true, skipped.
+ *
+ * Return 0 on success and -1 with errno set on error, in which case the
+ * output may have been written partially.
+ */
+int ntfs_mft_scan(ntfs_volume *vol, const ntfs_mft_scan_opts *opts,
+		ntfs_mft_scan_stats *stats)
+{
+	ntfs_mft_scan_ctx ctx;
+	pthread_t *threads;
+	s64 nr_records, nr_chunks, nr_written;
+	u32 chunk_records;
+	int i, nr_threads, nr_started, err = 0;
+
+	if (!vol || !vol->mft_na || !opts) {
+		errno = EINVAL;
+		return -1;
+	}
+	nr_threads = opts->nr_threads;
+	if (nr_threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_threads = cpus > 0 ? cpus : 1;
+	}
+	chunk_records = (opts->chunk_size ? opts->chunk_size :
+			MFT_SCAN_DEFAULT_CHUNK_SIZE) >>
+			vol->mft_record_size_bits;
+	if (!chunk_records)
+		chunk_records = 1;
+	nr_records = vol->mft_na->initialized_size >>
+			vol->mft_record_size_bits;
+	nr_chunks = (nr_records + chunk_records - 1) / chunk_records;
+	ntfs_log_trace("Scanning %lld mft records with %d threads.\n",
+			(long long)nr_records, nr_threads);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.vol = vol;
+	ctx.opts = opts;
+	/* Two chunks per worker keep the reads ahead of the parsing. */
+	ctx.nr_chunks = 2 * nr_threads + 1;
+	ctx.chunks = ntfs_calloc(ctx.nr_chunks * sizeof(*ctx.chunks));
+	threads = ntfs_calloc(nr_threads * sizeof(*threads));
+	if (!ctx.chunks || !threads) {
+		free(ctx.chunks);
+		free(threads);
+		return -1;
+	}
+	for (i = 0; i < ctx.nr_chunks; i++) {
+		ctx.chunks[i].buf = ntfs_malloc((size_t)chunk_records <<
+				vol->mft_record_size_bits);
+		if (!ctx.chunks[i].buf) {
+			err = errno;
+			goto free_chunks;
+		}
+	}
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	for (nr_started = 0; nr_started < nr_threads; nr_started++) {
+		err = pthread_create(&threads[nr_started], NULL,
+				ntfs_mft_scan_worker, &ctx);
+		if (err) {
+			ntfs_log_error("Failed to start worker thread: %s\n",
+					strerror(err));
+			break;
+		}
+	}
+	/* Carry on with fewer workers if at least one started. */
+	if (nr_started)
+		err = 0;
+
+	nr_written = 0;
+	pthread_mutex_lock(&ctx.lock);
+	while (!err && nr_written < nr_chunks) {
+		ntfs_mft_scan_chunk *c;
+		s64 ofs, count, br;
+
+		c = &ctx.chunks[nr_written % ctx.nr_chunks];
+		if (c->state == MFT_SCAN_CHUNK_DONE) {
+			pthread_mutex_unlock(&ctx.lock);
+			if (c->err)
+				err = c->err;
+			else if (opts->out_fn) {
+				if (opts->out_fn(&c->out, opts->data))
+					err = errno ? errno : EIO;
+			} else if (opts->out_fd >= 0 &&
+					ntfs_mft_scan_flush(opts->out_fd,
+					&c->out))
+				err = errno;
+			if (stats) {
+				stats->nr_records += c->stats.nr_records;
+				stats->nr_in_use += c->stats.nr_in_use;
+				stats->nr_extents += c->stats.nr_extents;
+				stats->nr_bad += c->stats.nr_bad;
+				stats->bytes_read += c->stats.bytes_read;
+			}
+			pthread_mutex_lock(&ctx.lock);
+			c->state = MFT_SCAN_CHUNK_FREE;
+			nr_written++;
+			continue;
+		}
+		c = &ctx.chunks[ctx.nr_read % ctx.nr_chunks];
+		if (ctx.nr_read == nr_chunks || c->state !=
+				MFT_SCAN_CHUNK_FREE) {
+			pthread_cond_wait(&ctx.cond, &ctx.lock);
+			continue;
+		}
+		/* Only this thread touches free chunks, read unlocked. */
+		pthread_mutex_unlock(&ctx.lock);
+		c->first = ctx.nr_read * chunk_records;
+		c->nr = chunk_records;
+		if (c->first + c->nr > (u64)nr_records)
+			c->nr = nr_records - c->first;
+		c->err = 0;
+		ofs = c->first << vol->mft_record_size_bits;
+		count = (s64)c->nr << vol->mft_record_size_bits;
+		br = ntfs_attr_pread(vol->mft_na, ofs, count, c->buf);
+		if (br != count) {
+			if (br >= 0)
+				errno = EIO;
+			err = errno;
+			ntfs_log_perror("Failed to read $MFT at offset %lld",
+					(long long)ofs);
+		}
+		pthread_mutex_lock(&ctx.lock);
+		if (!err) {
+			c->state = MFT_SCAN_CHUNK_READ;
+			ctx.nr_read++;
+			pthread_cond_broadcast(&ctx.cond);
+		}
+	}
+	ctx.stop = TRUE;
+	/* On error, make sure the workers do not pick up any more chunks. */
+	if (err)
+		ctx.nr_read = ctx.next;
+	pthread_cond_broadcast(&ctx.cond);
+	pthread_mutex_unlock(&ctx.lock);
+	while (nr_started > 0)
+		pthread_join(threads[--nr_started], NULL);
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+free_chunks:
+	for (i = 0; i < ctx.nr_chunks; i++) {
+		free(ctx.chunks[i].buf);
+		free(ctx.chunks[i].out.buf);
+	}
+	free(ctx.chunks);
+	free(threads);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * mftscan.h - Exports for the parallel mft scanner.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ */
+
+#ifndef _NTFS_MFTSCAN_H
+#define _NTFS_MFTSCAN_H
+
+#include "types.h"
+#include "layout.h"
+#include "ntfstime.h"
+#include "volume.h"
+
+/**
+ * struct ntfs_mft_scan_record - what the scanner found in one mft record
+ * @mft_no:		number of the mft record
+ * @seq_no:		sequence number of the mft record
+ * @flags:		MFT_RECORD_FLAGS of the mft record (little endian)
+ * @base_mref:		base mft record if this is an extent record, else 0
+ * @parent_mref:	parent directory of the file name in @name
+ * @name:		file name, pointing into @m (NULL if none)
+ * @name_len:		length of @name in Unicode characters
+ * @name_type:		namespace of @name
+ * @nr_names:		number of $FILE_NAME attributes in the mft record
+ * @file_attributes:	file attributes from $STANDARD_INFORMATION
+ * @creation_time:	times from $STANDARD_INFORMATION, in NTFS time
+ * @last_data_change_time:
+ * @last_mft_change_time:
+ * @last_access_time:
+ * @data_size:		sizes of the unnamed $DATA attribute, valid if @data
+ * @allocated_size:	is resident or is the first extent of the attribute
+ * @initialized_size:
+ * @data:		unnamed $DATA attribute record in @m (NULL if none)
+ * @m:			the mst deprotected mft record
+ * @corrupt:		the mft record failed the mst fixups or is corrupt, only
+ *			@mft_no, @flags and @m are valid, see
+ *			ntfs_mft_scan_opts.corrupt
+ *
+ * Everything is taken from the single mft record @m.  When a file has an
+ * attribute list, some of its attributes live in extent records which are
+ * reported separately, see ntfs_mft_scan_opts.extents.  If a file has more
+ * than one name, @name is a Win32 or POSIX name in preference to a DOS one.
+ */
+typedef struct {
+	u64 mft_no;
+	u16 seq_no;
+	MFT_RECORD_FLAGS flags;
+	MFT_REF base_mref;
+	MFT_REF parent_mref;
+	const ntfschar *name;
+	u8 name_len;
+	FILE_NAME_TYPE_FLAGS name_type;
+	int nr_names;
+	FILE_ATTR_FLAGS file_attributes;
+	ntfs_time creation_time;
+	ntfs_time last_data_change_time;
+	ntfs_time last_mft_change_time;
+	ntfs_time last_access_time;
+	s64 data_size;
+	s64 allocated_size;
+	s64 initialized_size;
+	const ATTR_RECORD *data;
+	const MFT_RECORD *m;
+	BOOL corrupt;
+} ntfs_mft_scan_record;
+
+/**
+ * struct ntfs_mft_scan_out - output produced for a chunk of mft records
+ * @buf:	the output
+ * @len:	number of bytes in @buf
+ * @size:	allocated size of @buf
+ *
+ * Append to it with ntfs_mft_scan_write() and ntfs_mft_scan_printf().
+ */
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} ntfs_mft_scan_out;
+
+/**
+ * ntfs_mft_scan_fn - callback invoked for each mft record found
+ * @r:		the record
+ * @out:	output of the chunk of mft records @r belongs to
+ * @data:	ntfs_mft_scan_opts.data
+ *
+ * Called on one of the worker threads, concurrently with the other workers,
+ * so it must not call into the library except for the functions that only
+ * look at their arguments, like ntfs_mapping_pairs_decompress() and
+ * ntfs_ucstombs().  @r and everything it points to are only valid for the
+ * duration of the call.
+ *
+ * Return 0 to continue or -1 with errno set to abort the scan.
+ */
+typedef int (*ntfs_mft_scan_fn)(const ntfs_mft_scan_record *r,
+		ntfs_mft_scan_out *out, void *data);
+
+/**
+ * ntfs_mft_scan_out_fn - callback consuming the output of a chunk
+ * @out:	output of a chunk of mft records
+ * @data:	ntfs_mft_scan_opts.data
+ *
+ * Called on the thread running the scan, for one chunk after the other in
+ * mft order.  @out is only valid for the duration of the call.
+ *
+ * Return 0 to continue or -1 with errno set to abort the scan.
+ */
+typedef int (*ntfs_mft_scan_out_fn)(const ntfs_mft_scan_out *out,
+		void *data);
+
+/**
+ * struct ntfs_mft_scan_opts - parameters of a scan
+ * @nr_threads:	number of worker threads (0 means one per online cpu)
+ * @chunk_size:	bytes of $MFT read at a time (0 means a default of 4MiB)
+ * @extents:	also report mft records which are extents of another record
+ * @corrupt:	also report mft records which are corrupt, in use or not
+ * @out_fd:	file descriptor the output is written to (-1 for none)
+ * @fn:		callback invoked for each mft record
+ * @out_fn:	if not NULL, invoked with the output instead of writing it to
+ *		@out_fd
+ * @data:	passed to @fn and @out_fn
+ */
+typedef struct {
+	int nr_threads;
+	u32 chunk_size;
+	BOOL extents;
+	BOOL corrupt;
+	int out_fd;
+	ntfs_mft_scan_fn fn;
+	ntfs_mft_scan_out_fn out_fn;
+	void *data;
+} ntfs_mft_scan_opts;
+
+/**
+ * struct ntfs_mft_scan_stats - what a scan came across
+ * @nr_records:	mft records read
+ * @nr_in_use:	mft records in use
+ * @nr_extents:	in use mft records which are extent records
+ * @nr_bad:	mft records which failed the mst fixups or are corrupt
+ * @bytes_read:	bytes read from $MFT
+ */
+typedef struct {
+	s64 nr_records;
+	s64 nr_in_use;
+	s64 nr_extents;
+	s64 nr_bad;
+	s64 bytes_read;
+} ntfs_mft_scan_stats;
+
+extern int ntfs_mft_scan_write(ntfs_mft_scan_out *out, const void *b,
+		size_t count);
+extern int ntfs_mft_scan_printf(ntfs_mft_scan_out *out, const char *fmt, ...)
+		__attribute__((format(printf, 2, 3)));
+
+extern int ntfs_mft_scan(ntfs_volume *vol, const ntfs_mft_scan_opts *opts,
+		ntfs_mft_scan_stats *stats);
+
+#endif /* defined _NTFS_MFTSCAN_H */
@@ -19,6 +19,15 @@
 	/* maximum cluster size for allowing compression for new files */
 #define MAX_COMPRESSION_CLUSTER_SIZE 4096
 
+/*
+ *		Parameters for the inode cache
+ */
+
+	/* number of closed inodes kept in the cache, 0 to disable */
+#define CACHE_NIDATA_SIZE 64
+	/* number of hash chains of open and cached inodes (power of 2) */
+#define CACHE_NIDATA_HASH 256
+
 /*
  *		Parameters for runlists
  */
@@ -353,6 +353,287 @@ ntfschar *ntfs_ucsndup(const ntfschar *s, u32 maxlen)
 	return dst;
 }
 
+/*
+ * Return the number of bytes in UTF-8 needed (without the terminating null) to
+ * store the given UTF-16LE string.
+ *
+ * On error, -1 is returned, and errno is set to the error code. The following
+ * error codes can be expected:
+ *	EILSEQ		The input string is not valid UTF-16LE (illegal
+ *			surrogates or surrogate pairs).
+ *	ENAMETOOLONG	The converted string would be longer than @outs_len.
+ */
+static int utf16_to_utf8_size(const ntfschar *ins, const int ins_len,
+		int outs_len)
+{
+	int i, ret = -1;
+	int count = 0;
+	BOOL surrog;
+
+	surrog = FALSE;
+	for (i = 0; i < ins_len && ins[i]; i++) {
+		unsigned short c = le16_to_cpu(ins[i]);
+		if (surrog) {
+			if ((c >= 0xdc00) && (c < 0xe000)) {
+				surrog = FALSE;
+				count += 4;
+			} else 
+				goto fail;
+		} else
+			if (c < 0x80)
+				count++;
+			else if (c < 0x800)
+				count += 2;
+			else if (c < 0xd800)
+				count += 3;
+			else if (c < 0xdc00)
+				surrog = TRUE;
+#if NOREVBOM
+			else if ((c >= 0xe000) && (c < 0xfffe))
+#else
+			else if (c >= 0xe000)
+#endif
+				count += 3;
+			else 
+				goto fail;
+		if (count > outs_len) {
+			errno = ENAMETOOLONG;
+			goto out;
+		}
+	}
+	if (surrog) 
+		goto fail;
+
+	ret = count;
+out:
+	return ret;
+fail:
+	errno = EILSEQ;
+	goto out;
+}
+
+/**
+ * ntfs_utf16_to_utf8 - convert a little endian UTF16LE string to an UTF-8 string
+ * @ins:	input utf16 string buffer
+ * @ins_len:	length of input string in utf16 characters
+ * @outs:	on return contains the (allocated) output multibyte string
+ * @outs_len:	length of output buffer in bytes
+ *
+ * Return -1 with errno set if string has invalid byte sequence or too long.
+ */
+static int ntfs_utf16_to_utf8(const ntfschar *ins, const int ins_len,
+			      char **outs, int outs_len)
+{
+	char *t;
+	int i, size, ret = -1;
+	int halfpair;
+
+	halfpair = 0;
+	if (!*outs)
+		outs_len = PATH_MAX;
+
+	size = utf16_to_utf8_size(ins, ins_len, outs_len);
+
+	if (size < 0)
+		goto out;
+
+	if (!*outs) {
+		outs_len = size + 1;
+		*outs = ntfs_malloc(outs_len);
+		if (!*outs)
+			goto out;
+	}
+
+	t = *outs;
+
+	for (i = 0; i < ins_len && ins[i]; i++) {
+		unsigned short c = le16_to_cpu(ins[i]);
+			/* size not double-checked */
+		if (halfpair) {
+			if ((c >= 0xdc00) && (c < 0xe000)) {
+				*t++ = 0xf0 + (((halfpair + 64) >> 8) & 7);
+				*t++ = 0x80 + (((halfpair + 64) >> 2) & 63);
+				*t++ = 0x80 + ((c >> 6) & 15) +
+						((halfpair & 3) << 4);
+				*t++ = 0x80 + (c & 63);
+				halfpair = 0;
+			} else 
+				goto fail;
+		} else if (c < 0x80) {
+			*t++ = c;
+		} else {
+			if (c < 0x800) {
+				*t++ = (0xc0 | ((c >> 6) & 0x3f));
+				*t++ = 0x80 | (c & 0x3f);
+			} else if (c < 0xd800) {
+				*t++ = 0xe0 | (c >> 12);
+				*t++ = 0x80 | ((c >> 6) & 0x3f);
+				*t++ = 0x80 | (c & 0x3f);
+			} else if (c < 0xdc00)
+				halfpair = c;
+			else if (c >= 0xe000) {
+				*t++ = 0xe0 | (c >> 12);
+				*t++ = 0x80 | ((c >> 6) & 0x3f);
+				*t++ = 0x80 | (c & 0x3f);
+			} else 
+				goto fail;
+		}
+	}
+	*t = '\0';
+
+#if defined(__APPLE__) || defined(__DARWIN__)
+#ifdef ENABLE_NFCONV
+	if(nfconvert_utf8 && (t - *outs) > 0) {
+		char *new_outs = NULL;
+		int new_outs_len = ntfs_macosx_normalize_utf8(*outs, &new_outs, 0); // Normalize to decomposed form
+		if(new_outs_len >= 0 && new_outs != NULL) {
+			if(outs_len < new_outs_len + 1) {
+				/* The caller's buffer is too small, give up. */
+				free(new_outs);
+				errno = ENAMETOOLONG;
+				goto out;
+			}
+			memcpy(*outs, new_outs, new_outs_len + 1);
+			t = *outs + new_outs_len;
+			free(new_outs);
+		}
+		else
+			ntfs_log_error("Failed to normalize NTFS string to UTF-8 NFD: %s\n", *outs);
+	}
+#endif /* ENABLE_NFCONV */
+#endif /* defined(__APPLE__) || defined(__DARWIN__) */
+	
+	ret = t - *outs;
+out:
+	return ret;
+fail:
+	errno = EILSEQ;
+	goto out;
+}
+
+/**
+ * ntfs_ucstombs - convert a little endian Unicode string to a multibyte string
+ * @ins:	input Unicode string buffer
+ * @ins_len:	length of input string in Unicode characters
+ * @outs:	on return contains the (allocated) output multibyte string
+ * @outs_len:	length of output buffer in bytes
+ *
+ * Convert the input little endian, 2-byte Unicode string @ins, of length
+ * @ins_len into the multibyte string format dictated by the current locale.
+ *
+ * If *@outs is NULL, the function allocates the string and the caller is
+ * responsible for calling free(*@outs); when finished with it.
+ *
+ * On success the function returns the number of bytes written to the output
+ * string *@outs (>= 0), not counting the terminating NULL byte. If the output
+ * string buffer was allocated, *@outs is set to it.
+ *
+ * On error, -1 is returned, and errno is set to the error code. The following
+ * error codes can be expected:
+ *	EINVAL		Invalid arguments (e.g. @ins or @outs is NULL).
+ *	EILSEQ		The input string cannot be represented as a multibyte
+ *			sequence according to the current locale.
+ *	ENAMETOOLONG	Destination buffer is too small for input string.
+ *	ENOMEM		Not enough memory to allocate destination buffer.
+ */
+int ntfs_ucstombs(const ntfschar *ins, const int ins_len, char **outs,
+		int outs_len)
+{
+	char *mbs;
+	int mbs_len;
+#ifdef MB_CUR_MAX
+	wchar_t wc;
+	int i, o;
+	int cnt = 0;
+#ifdef HAVE_MBSINIT
+	mbstate_t mbstate;
+#endif
+#endif /* MB_CUR_MAX */
+
+	if (!ins || !outs) {
+		errno = EINVAL;
+		return -1;
+	}
+	mbs = *outs;
+	mbs_len = outs_len;
+	if (mbs && !mbs_len) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (use_utf8)
+		return ntfs_utf16_to_utf8(ins, ins_len, outs, outs_len);
+#ifdef MB_CUR_MAX
+	if (!mbs) {
+		mbs_len = (ins_len + 1) * MB_CUR_MAX;
+		mbs = ntfs_malloc(mbs_len);
+		if (!mbs)
+			return -1;
+	}
+#ifdef HAVE_MBSINIT
+	memset(&mbstate, 0, sizeof(mbstate));
+#else
+	wctomb(NULL, 0);
+#endif
+	for (i = o = 0; i < ins_len; i++) {
+		/* Reallocate memory if necessary or abort. */
+		if ((int)(o + MB_CUR_MAX) > mbs_len) {
+			char *tc;
+			if (mbs == *outs) {
+				errno = ENAMETOOLONG;
+				return -1;
+			}
+			tc = ntfs_malloc((mbs_len + 64) & ~63);
+			if (!tc)
+				goto err_out;
+			memcpy(tc, mbs, mbs_len);
+			mbs_len = (mbs_len + 64) & ~63;
+			free(mbs);
+			mbs = tc;
+		}
+		/* Convert the LE Unicode character to a CPU wide character. */
+		wc = (wchar_t)le16_to_cpu(ins[i]);
+		if (!wc)
+			break;
+		/* Convert the CPU endian wide character to multibyte. */
+#ifdef HAVE_MBSINIT
+		cnt = wcrtomb(mbs + o, wc, &mbstate);
+#else
+		cnt = wctomb(mbs + o, wc);
+#endif
+		if (cnt == -1)
+			goto err_out;
+		if (cnt <= 0) {
+			ntfs_log_debug("Eeek. cnt <= 0, cnt = %i\n", cnt);
+			errno = EINVAL;
+			goto err_out;
+		}
+		o += cnt;
+	}
+#ifdef HAVE_MBSINIT
+	/* Make sure we are back in the initial state. */
+	if (!mbsinit(&mbstate)) {
+		ntfs_log_debug("Eeek. mbstate not in initial state!\n");
+		errno = EILSEQ;
+		goto err_out;
+	}
+#endif
+	/* Now write the NULL character. */
+	mbs[o] = '\0';
+	if (*outs != mbs)
+		*outs = mbs;
+	return o;
+err_out:
+	if (mbs != *outs) {
+		int eo = errno;
+		free(mbs);
+		errno = eo;
+	}
+#else /* MB_CUR_MAX */
+	errno = EILSEQ;
+#endif /* MB_CUR_MAX */
+	return -1;
+}
+
 /* 
  * Return the amount of 16-bit elements in UTF-16LE needed 
  * (without the terminating null) to store given UTF-8 string.
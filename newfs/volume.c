@@ -47,12 +47,14 @@
 #include "volume.h"
 #include "attrib.h"
 #include "mft.h"
+#include "mst.h"
 #include "bootsect.h"
 #include "device.h"
 #include "debug.h"
 #include "inode.h"
 #include "runlist.h"
 #include "dir.h"
+#include "index.h"
 #include "logging.h"
 #include "misc.h"
 
@@ -71,13 +73,62 @@ ntfs_volume *ntfs_volume_alloc(void)
 	return ntfs_calloc(sizeof(ntfs_volume));
 }
 
+#if !defined(HAVE_MNTENT_H) && (defined(__APPLE__) || defined(__DARWIN__))
+
+/**
+ * ntfs_mntinfo_check - check if a device is mounted using getmntinfo()
+ * @file:	device file to check
+ * @mnt_flags:	pointer into which to return the ntfs mount flags
+ *
+ * Raw device names (/dev/rdiskN) are matched against the mounted block device
+ * (/dev/diskN) as that is what the mount table records.
+ *
+ * Return 0 on success with *@mnt_flags set or -1 on error with errno set.
+ */
+static int ntfs_mntinfo_check(const char *file, unsigned long *mnt_flags)
+{
+	struct statfs *mnts;
+	char *real_file, *dev;
+	int i, nr_mnts;
+
+	real_file = ntfs_malloc(PATH_MAX + 1);
+	if (!real_file)
+		return -1;
+	if (!realpath(file, real_file))
+		strncpy(real_file, file, PATH_MAX);
+	real_file[PATH_MAX] = '\0';
+	dev = real_file;
+	if (!strncmp(dev, "/dev/r", 6))
+		memmove(dev + 5, dev + 6, strlen(dev + 6) + 1);
+	nr_mnts = getmntinfo(&mnts, MNT_NOWAIT);
+	if (!nr_mnts) {
+		free(real_file);
+		return -1;
+	}
+	for (i = 0; i < nr_mnts; i++) {
+		if (strcmp(mnts[i].f_mntfromname, dev))
+			continue;
+		*mnt_flags = NTFS_MF_MOUNTED;
+		if (!strcmp(mnts[i].f_mntonname, "/"))
+			*mnt_flags |= NTFS_MF_ISROOT;
+		if (mnts[i].f_flags & MNT_RDONLY)
+			*mnt_flags |= NTFS_MF_READONLY;
+		break;
+	}
+	free(real_file);
+	return 0;
+}
+
+#endif
+
 /**
  * ntfs_check_if_mounted - check if an ntfs volume is currently mounted
  * @file:	device file to check
  * @mnt_flags:	pointer into which to return the ntfs mount flags (see volume.h)
  *
  * If the running system does not support the {set,get,end}mntent() calls,
- * just return 0 and set *@mnt_flags to zero.
+ * fall back to getmntinfo() on Mac OS X, elsewhere just return 0 and set
+ * *@mnt_flags to zero.
  *
  * When the system does support the calls, ntfs_check_if_mounted() first tries
  * to find the device @file in /etc/mtab (or wherever this is kept on the
@@ -102,7 +153,1049 @@ int ntfs_check_if_mounted(const char *file __attribute__((unused)),
 	*mnt_flags = 0;
 #ifdef HAVE_MNTENT_H
 	return ntfs_mntent_check(file, mnt_flags);
+#elif defined(__APPLE__) || defined(__DARWIN__)
+	return ntfs_mntinfo_check(file, mnt_flags);
 #else
 	return 0;
 #endif
 }
+
+/**
+ * __ntfs_volume_release - Destroy an NTFS volume object
+ * @v:		volume to release
+ *
+ * Release the inodes kept in the inode cache, sync and close all the system
+ * inodes and attributes attached to @v, close and free its device and release
+ * all the memory used by it.
+ *
+ * Return 0 on success or -1 on error with errno set to the error code of the
+ * first failure.  @v is freed even on error.
+ */
+static int __ntfs_volume_release(ntfs_volume *v)
+{
+	int err = 0;
+
+	/* Release the closed inodes while they can still be written out. */
+	if (ntfs_inode_cache_flush(v) && !err)
+		err = errno;
+	if (v->vol_ni && ntfs_inode_close(v->vol_ni) && !err)
+		err = errno;
+	/*
+	 * The system inodes must be synced before their attributes are
+	 * closed, writing the mft records goes through @v->mft_na.
+	 */
+	if (v->lcnbmp_ni && NInoDirty(v->lcnbmp_ni) &&
+			ntfs_inode_sync(v->lcnbmp_ni) && !err)
+		err = errno;
+	if (v->lcnbmp_na)
+		ntfs_attr_close(v->lcnbmp_na);
+	if (v->lcnbmp_ni && ntfs_inode_close(v->lcnbmp_ni) && !err)
+		err = errno;
+	if (v->mftmirr_ni && NInoDirty(v->mftmirr_ni) &&
+			ntfs_inode_sync(v->mftmirr_ni) && !err)
+		err = errno;
+	if (v->mftmirr_na)
+		ntfs_attr_close(v->mftmirr_na);
+	if (v->mftmirr_ni && ntfs_inode_close(v->mftmirr_ni) && !err)
+		err = errno;
+	if (v->mft_ni && NInoDirty(v->mft_ni) && ntfs_inode_sync(v->mft_ni) &&
+			!err)
+		err = errno;
+	if (v->mftbmp_na)
+		ntfs_attr_close(v->mftbmp_na);
+	if (v->mft_na)
+		ntfs_attr_close(v->mft_na);
+	if (v->mft_ni) {
+		/* Nothing can be written back any more, just drop it. */
+		NInoClearDirty(v->mft_ni);
+		if (ntfs_inode_close(v->mft_ni) && !err)
+			err = errno;
+	}
+	/*
+	 * The system inodes closed above are clean and now sit in the inode
+	 * cache, release them.
+	 */
+	if (ntfs_inode_cache_flush(v) && !err)
+		err = errno;
+	if (v->dev) {
+		struct ntfs_device *dev = v->dev;
+
+		if (NDevOpen(dev)) {
+			if (dev->d_ops->sync(dev) && !err)
+				err = errno;
+			if (dev->d_ops->close(dev) && !err)
+				err = errno;
+		}
+		ntfs_device_free(dev);
+	}
+	free(v->vol_name);
+	free(v->upcase);
+	free(v->locase);
+	free(v->attrdef);
+	free(v);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * ntfs_mft_load - load the $MFT/$DATA's runlist into memory
+ * @vol:	ntfs volume whose $MFT/$DATA runlist to load
+ *
+ * Load $MFT/$DATA's runlist into memory and return 0 on success or -1 on
+ * error with errno set to the error code.  This cannot go through
+ * ntfs_inode_open() as that reads the mft record via @vol->mft_na.
+ */
+static int ntfs_mft_load(ntfs_volume *vol)
+{
+	VCN next_vcn, last_vcn, highest_vcn;
+	s64 l;
+	MFT_RECORD *mb = NULL;
+	ntfs_attr_search_ctx *ctx = NULL;
+	ATTR_RECORD *a;
+	int eo;
+
+	/* Manually setup an ntfs_inode. */
+	vol->mft_ni = ntfs_inode_allocate(vol);
+	mb = ntfs_malloc(vol->mft_record_size);
+	if (!vol->mft_ni || !mb) {
+		ntfs_log_perror("Error allocating memory for $MFT");
+		goto error_exit;
+	}
+	vol->mft_ni->mft_no = 0;
+	vol->mft_ni->mrec = mb;
+	/* Can't use any of the higher level functions yet! */
+	l = ntfs_pread(vol->dev, vol->mft_lcn << vol->cluster_size_bits,
+			vol->mft_record_size, mb);
+	if (l != vol->mft_record_size) {
+		if (l != -1)
+			errno = EIO;
+		ntfs_log_perror("Error reading $MFT");
+		goto error_exit;
+	}
+	if (ntfs_mst_post_read_fixup_warn((NTFS_RECORD*)mb,
+			vol->mft_record_size, TRUE)) {
+		ntfs_log_error("$MFT record 0 is corrupt.\n");
+		errno = EIO;
+		goto error_exit;
+	}
+	if (ntfs_mft_record_check(vol, 0, mb))
+		goto error_exit;
+
+	ctx = ntfs_attr_get_search_ctx(vol->mft_ni, NULL);
+	if (!ctx)
+		goto error_exit;
+
+	/* Find the $ATTRIBUTE_LIST attribute in $MFT if present. */
+	if (ntfs_attr_lookup(AT_ATTRIBUTE_LIST, AT_UNNAMED, 0, 0, 0, NULL, 0,
+			ctx)) {
+		if (errno != ENOENT) {
+			ntfs_log_error("$MFT has corrupt attribute list.\n");
+			goto io_error_exit;
+		}
+		goto mft_has_no_attr_list;
+	}
+	NInoSetAttrList(vol->mft_ni);
+	l = ntfs_get_attribute_value_length(ctx->attr);
+	if (l <= 0 || l > 0x40000) {
+		ntfs_log_error("$MFT/$ATTR_LIST invalid length (%lld).\n",
+			       (long long)l);
+		goto io_error_exit;
+	}
+	vol->mft_ni->attr_list_size = l;
+	vol->mft_ni->attr_list = ntfs_malloc(l);
+	if (!vol->mft_ni->attr_list)
+		goto error_exit;
+
+	l = ntfs_get_attribute_value(vol, ctx->attr, vol->mft_ni->attr_list);
+	if (l != vol->mft_ni->attr_list_size) {
+		ntfs_log_error("Failed to get value of $MFT/$ATTR_LIST.\n");
+		goto io_error_exit;
+	}
+
+mft_has_no_attr_list:
+	/* Get an ntfs attribute for $MFT/$DATA and set it up, too. */
+	vol->mft_na = ntfs_attr_open(vol->mft_ni, AT_DATA, AT_UNNAMED, 0);
+	if (!vol->mft_na) {
+		ntfs_log_perror("Failed to open ntfs attribute");
+		goto error_exit;
+	}
+	/* Read all extents from the $DATA attribute in $MFT. */
+	ntfs_attr_reinit_search_ctx(ctx);
+	last_vcn = vol->mft_na->allocated_size >> vol->cluster_size_bits;
+	highest_vcn = next_vcn = 0;
+	a = NULL;
+	while (!ntfs_attr_lookup(AT_DATA, AT_UNNAMED, 0, 0, next_vcn, NULL, 0,
+			ctx)) {
+		runlist_element *nrl;
+
+		a = ctx->attr;
+		/* $MFT must be non-resident. */
+		if (!a->non_resident) {
+			ntfs_log_error("$MFT must be non-resident.\n");
+			goto io_error_exit;
+		}
+		/* $MFT must be uncompressed and unencrypted. */
+		if (a->flags & ATTR_COMPRESSION_MASK ||
+				a->flags & ATTR_IS_ENCRYPTED) {
+			ntfs_log_error("$MFT must be uncompressed and "
+				       "unencrypted.\n");
+			goto io_error_exit;
+		}
+		/*
+		 * Decompress the mapping pairs array of this extent and merge
+		 * the result into the existing runlist.  No need for locking
+		 * as we have exclusive access to the inode at this time and
+		 * we are a mount in progress task, too.
+		 */
+		nrl = ntfs_mapping_pairs_decompress(vol, a, vol->mft_na->rl);
+		if (!nrl) {
+			ntfs_log_perror("ntfs_mapping_pairs_decompress() "
+					"failed");
+			goto error_exit;
+		}
+		vol->mft_na->rl = nrl;
+
+		/* Get the lowest vcn for the next extent. */
+		highest_vcn = sle64_to_cpu(a->highest_vcn);
+		next_vcn = highest_vcn + 1;
+
+		/* Only one extent or error, which we catch below. */
+		if (next_vcn <= 0)
+			break;
+
+		/* Avoid endless loops due to corruption. */
+		if (next_vcn < sle64_to_cpu(a->lowest_vcn)) {
+			ntfs_log_error("$MFT has corrupt attribute list.\n");
+			goto io_error_exit;
+		}
+	}
+	if (!a) {
+		ntfs_log_error("$MFT/$DATA attribute not found.\n");
+		goto io_error_exit;
+	}
+	if (highest_vcn && highest_vcn != last_vcn - 1) {
+		ntfs_log_error("Failed to load runlist for $MFT/$DATA.\n");
+		ntfs_log_error("highest_vcn = 0x%llx, last_vcn - 1 = 0x%llx\n",
+			       (long long)highest_vcn,
+			       (long long)last_vcn - 1);
+		goto io_error_exit;
+	}
+	/* Done with the $Mft mft record. */
+	ntfs_attr_put_search_ctx(ctx);
+	ctx = NULL;
+
+	/* Update the size fields in the inode. */
+	vol->mft_ni->data_size = vol->mft_na->data_size;
+	vol->mft_ni->allocated_size = vol->mft_na->allocated_size;
+	set_nino_flag(vol->mft_ni, KnownSize);
+
+	/*
+	 * The volume is now setup so we can use all read access functions.
+	 */
+	vol->mftbmp_na = ntfs_attr_open(vol->mft_ni, AT_BITMAP, AT_UNNAMED, 0);
+	if (!vol->mftbmp_na) {
+		ntfs_log_perror("Failed to open $MFT/$BITMAP");
+		goto error_exit;
+	}
+	return 0;
+io_error_exit:
+	errno = EIO;
+error_exit:
+	eo = errno;
+	if (ctx)
+		ntfs_attr_put_search_ctx(ctx);
+	if (vol->mft_na) {
+		ntfs_attr_close(vol->mft_na);
+		vol->mft_na = NULL;
+	}
+	if (vol->mft_ni) {
+		ntfs_inode_close(vol->mft_ni);
+		vol->mft_ni = NULL;
+	} else
+		free(mb);
+	errno = eo;
+	return -1;
+}
+
+/**
+ * ntfs_mftmirr_load - load the $MFTMirr/$DATA's runlist into memory
+ * @vol:	ntfs volume whose $MFTMirr/$DATA runlist to load
+ *
+ * Load $MFTMirr/$DATA's runlist into memory and return 0 on success or -1 on
+ * error with errno set to the error code.
+ */
+static int ntfs_mftmirr_load(ntfs_volume *vol)
+{
+	int err;
+
+	vol->mftmirr_ni = ntfs_inode_open(vol, FILE_MFTMirr);
+	if (!vol->mftmirr_ni) {
+		ntfs_log_perror("Failed to open inode $MFTMirr");
+		return -1;
+	}
+	vol->mftmirr_na = ntfs_attr_open(vol->mftmirr_ni, AT_DATA, AT_UNNAMED,
+			0);
+	if (!vol->mftmirr_na) {
+		ntfs_log_perror("Failed to open $MFTMirr/$DATA");
+		goto error_exit;
+	}
+	if (ntfs_attr_map_runlist(vol->mftmirr_na, 0) < 0) {
+		ntfs_log_perror("Failed to map runlist of $MFTMirr/$DATA");
+		goto error_exit;
+	}
+	return 0;
+error_exit:
+	err = errno;
+	if (vol->mftmirr_na) {
+		ntfs_attr_close(vol->mftmirr_na);
+		vol->mftmirr_na = NULL;
+	}
+	ntfs_inode_close(vol->mftmirr_ni);
+	vol->mftmirr_ni = NULL;
+	errno = err;
+	return -1;
+}
+
+/**
+ * ntfs_volume_setup_zones - initialize the cluster and mft allocator zones
+ * @vol:	ntfs volume whose allocator zones to set up
+ *
+ * Reserve the mft zone following $MFT/$DATA as the NTFS driver does and set
+ * the current allocation position of each zone to its start.
+ */
+static void ntfs_volume_setup_zones(ntfs_volume *vol)
+{
+	s64 mft_zone_size, mft_lcn;
+
+	/* Determine the size of the MFT zone. */
+	mft_zone_size = vol->nr_clusters;
+	switch (vol->mft_zone_multiplier) {  /* % of volume size in clusters */
+	case 4:
+		mft_zone_size >>= 1;			/* 50%   */
+		break;
+	case 3:
+		mft_zone_size = mft_zone_size * 3 >> 3;	/* 37.5% */
+		break;
+	case 2:
+		mft_zone_size >>= 2;			/* 25%   */
+		break;
+	/* case 1: */
+	default:
+		mft_zone_size >>= 3;			/* 12.5% */
+		break;
+	}
+
+	/* Setup the mft zone. */
+	vol->mft_zone_start = vol->mft_zone_pos = vol->mft_lcn;
+	ntfs_log_debug("mft_zone_pos = %lld\n", (long long)vol->mft_zone_pos);
+
+	/*
+	 * Calculate the mft_lcn for an unmodified NTFS volume (see mkntfs
+	 * source) and if the actual mft_lcn is in the expected place or even
+	 * further to the front of the volume, extend the mft_zone to cover the
+	 * beginning of the volume as well.  This is in order to protect the
+	 * area reserved for the mft bitmap as well within the mft_zone itself.
+	 * On non-standard volumes we don't protect it as the overhead would be
+	 * higher than the speed increase we would get by doing it.
+	 */
+	mft_lcn = (8192 + 2 * vol->cluster_size - 1) / vol->cluster_size;
+	if (mft_lcn * vol->cluster_size < 16 * 1024)
+		mft_lcn = (16 * 1024 + vol->cluster_size - 1) /
+				vol->cluster_size;
+	if (vol->mft_zone_start <= mft_lcn)
+		vol->mft_zone_start = 0;
+	ntfs_log_debug("mft_zone_start = %lld\n",
+			(long long)vol->mft_zone_start);
+
+	/*
+	 * Need to cap the mft zone on non-standard volumes so that it does
+	 * not point outside the boundaries of the volume.  We do this by
+	 * halving the zone size until we are inside the volume.
+	 */
+	vol->mft_zone_end = vol->mft_lcn + mft_zone_size;
+	while (vol->mft_zone_end >= vol->nr_clusters) {
+		mft_zone_size >>= 1;
+		vol->mft_zone_end = vol->mft_lcn + mft_zone_size;
+	}
+	ntfs_log_debug("mft_zone_end = %lld\n", (long long)vol->mft_zone_end);
+
+	/*
+	 * Set the current position within each data zone to the start of the
+	 * respective zone.
+	 */
+	vol->data1_zone_pos = vol->mft_zone_end;
+	ntfs_log_debug("data1_zone_pos = %lld\n",
+			(long long)vol->data1_zone_pos);
+	vol->data2_zone_pos = 0;
+	ntfs_log_debug("data2_zone_pos = %lld\n",
+			(long long)vol->data2_zone_pos);
+
+	/* Set the mft data allocation position to mft record 24. */
+	vol->mft_data_pos = 24;
+}
+
+/**
+ * ntfs_attr_get_free_bits - count the clear bits of a bitmap attribute
+ * @na:		open bitmap attribute to scan
+ * @nr_bits:	number of bits at the start of @na to consider
+ *
+ * Return the number of clear bits among the first @nr_bits bits of @na or -1
+ * on error with errno set to the error code.
+ */
+static s64 ntfs_attr_get_free_bits(ntfs_attr *na, s64 nr_bits)
+{
+	u8 *buf;
+	s64 pos, nr_free;
+
+	buf = ntfs_malloc(NTFS_BUF_SIZE);
+	if (!buf)
+		return -1;
+	nr_free = 0;
+	for (pos = 0; pos < nr_bits; pos += NTFS_BUF_SIZE * 8) {
+		s64 br, i, bits;
+
+		br = ntfs_attr_pread(na, pos >> 3, NTFS_BUF_SIZE, buf);
+		if (br <= 0) {
+			if (!br)
+				errno = EIO;
+			free(buf);
+			return -1;
+		}
+		bits = br << 3;
+		if (bits > nr_bits - pos)
+			bits = nr_bits - pos;
+		for (i = 0; i < bits; i++)
+			if (!(buf[i >> 3] & (1 << (i & 7))))
+				nr_free++;
+		if (br < NTFS_BUF_SIZE)
+			break;
+	}
+	free(buf);
+	return nr_free;
+}
+
+/**
+ * ntfs_volume_load_free_space - initialize the free cluster and mft counters
+ * @vol:	ntfs volume to initialize
+ *
+ * The cluster and mft record allocators only adjust @vol->free_clusters and
+ * @vol->free_mft_records, so work out their initial values from $Bitmap and
+ * $MFT/$BITMAP.  Return 0 on success or -1 on error with errno set.
+ */
+static int ntfs_volume_load_free_space(ntfs_volume *vol)
+{
+	s64 nr_free, nr_records;
+
+	nr_free = ntfs_attr_get_free_bits(vol->lcnbmp_na, vol->nr_clusters);
+	if (nr_free < 0) {
+		ntfs_log_perror("Failed to read $Bitmap");
+		return -1;
+	}
+	vol->free_clusters = nr_free;
+	nr_records = vol->mft_na->initialized_size >>
+			vol->mft_record_size_bits;
+	nr_free = ntfs_attr_get_free_bits(vol->mftbmp_na, nr_records);
+	if (nr_free < 0) {
+		ntfs_log_perror("Failed to read $MFT/$BITMAP");
+		return -1;
+	}
+	/* Records allocated to $MFT/$DATA but not initialized yet are free. */
+	vol->free_mft_records = nr_free + ((vol->mft_na->allocated_size -
+			vol->mft_na->initialized_size) >>
+			vol->mft_record_size_bits);
+	return 0;
+}
+
+/* The name of the Windows hibernation file in the root directory. */
+static ntfschar hiberfil[] = { const_cpu_to_le16('h'),
+		const_cpu_to_le16('i'), const_cpu_to_le16('b'),
+		const_cpu_to_le16('e'), const_cpu_to_le16('r'),
+		const_cpu_to_le16('f'), const_cpu_to_le16('i'),
+		const_cpu_to_le16('l'), const_cpu_to_le16('.'),
+		const_cpu_to_le16('s'), const_cpu_to_le16('y'),
+		const_cpu_to_le16('s') };
+
+#define NTFS_HIBERFIL_HEADER_SIZE	4096
+
+/**
+ * ntfs_volume_check_hiberfile - check if the volume is hibernated
+ * @vol:	ntfs volume to check
+ *
+ * Windows leaves "hiberfil.sys" in the root directory of the system volume.
+ * When Windows is hibernated, which includes the "fast startup" shutdown, the
+ * file starts with a non-zero header, usually with the magic "hibr".  When
+ * Windows resumes it zeroes the header.  Writing to a hibernated volume
+ * causes corruption once Windows resumes so treat the volume as hibernated
+ * unless the file does not exist or its header is all zeroes.  This is the
+ * same test the kernel driver performs on mount.
+ *
+ * Return 0 if the volume is not hibernated and -1 with errno set to the error
+ * code otherwise.  errno is EPERM if the volume is hibernated.
+ */
+static int ntfs_volume_check_hiberfile(ntfs_volume *vol)
+{
+	ntfs_inode *root_ni, *ni;
+	ntfs_index_context *icx;
+	FILE_NAME_ATTR *fn;
+	ntfs_attr *na;
+	le32 *buf, *p;
+	MFT_REF mref;
+	s64 br;
+	int fn_len, err;
+
+	root_ni = ntfs_inode_open(vol, FILE_root);
+	if (!root_ni) {
+		ntfs_log_perror("Failed to open the root directory");
+		return -1;
+	}
+	fn_len = sizeof(FILE_NAME_ATTR) + sizeof(hiberfil);
+	fn = ntfs_calloc(fn_len);
+	if (!fn) {
+		err = errno;
+		goto close_root;
+	}
+	fn->file_name_length = sizeof(hiberfil) / sizeof(ntfschar);
+	fn->file_name_type = FILE_NAME_WIN32;
+	memcpy(fn->file_name, hiberfil, sizeof(hiberfil));
+	icx = ntfs_index_ctx_get(root_ni, NTFS_INDEX_I30, 4);
+	if (!icx) {
+		err = errno;
+		free(fn);
+		goto close_root;
+	}
+	if (ntfs_index_lookup(fn, fn_len, icx)) {
+		err = errno;
+		ntfs_index_ctx_put(icx);
+		free(fn);
+		ntfs_inode_close(root_ni);
+		if (err == ENOENT)
+			return 0;
+		ntfs_log_error("Failed to look up hiberfil.sys: %s\n",
+				strerror(err));
+		errno = err;
+		return -1;
+	}
+	mref = le64_to_cpu(icx->entry->indexed_file);
+	ntfs_index_ctx_put(icx);
+	free(fn);
+	ntfs_inode_close(root_ni);
+	ni = ntfs_inode_open(vol, mref);
+	if (!ni) {
+		ntfs_log_perror("Failed to open hiberfil.sys");
+		return -1;
+	}
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na) {
+		err = errno;
+		ntfs_log_perror("Failed to open the $DATA attribute of "
+				"hiberfil.sys");
+		goto close_ni;
+	}
+	/*
+	 * A hibernation file too small to hold a header has been truncated
+	 * and is thus in an unknown state, treat the volume as hibernated.
+	 */
+	if (na->data_size < NTFS_HIBERFIL_HEADER_SIZE) {
+		ntfs_attr_close(na);
+		ntfs_inode_close(ni);
+		errno = EPERM;
+		return -1;
+	}
+	buf = ntfs_malloc(NTFS_HIBERFIL_HEADER_SIZE);
+	if (!buf) {
+		err = errno;
+		ntfs_attr_close(na);
+		goto close_ni;
+	}
+	br = ntfs_attr_pread(na, 0, NTFS_HIBERFIL_HEADER_SIZE, buf);
+	err = errno;
+	ntfs_attr_close(na);
+	ntfs_inode_close(ni);
+	if (br != NTFS_HIBERFIL_HEADER_SIZE) {
+		if (br >= 0)
+			err = EIO;
+		free(buf);
+		ntfs_log_error("Failed to read hiberfil.sys: %s\n",
+				strerror(err));
+		errno = err;
+		return -1;
+	}
+	/* Any non-zero header, including the "hibr" magic, is in use. */
+	err = 0;
+	for (p = buf; p < buf + NTFS_HIBERFIL_HEADER_SIZE / sizeof(*buf);
+			p++) {
+		if (*p) {
+			err = EPERM;
+			break;
+		}
+	}
+	free(buf);
+	if (!err)
+		return 0;
+	errno = err;
+	return -1;
+close_ni:
+	ntfs_inode_close(ni);
+	errno = err;
+	return -1;
+close_root:
+	ntfs_inode_close(root_ni);
+	errno = err;
+	return -1;
+}
+
+/**
+ * ntfs_volume_read_restart_page - read and verify a $LogFile restart page
+ * @na:		$DATA attribute of $LogFile
+ * @pos:	byte offset of the restart page in $LogFile
+ * @size:	system page size, i.e. the size of the restart page
+ *
+ * Read the restart page at @pos, apply the multi sector transfer fixups and
+ * sanity check the restart area it contains.
+ *
+ * Return the allocated restart page on success and NULL if there is no valid
+ * restart page at @pos.  The caller has to free() the returned buffer.
+ */
+static RESTART_PAGE_HEADER *ntfs_volume_read_restart_page(ntfs_attr *na,
+		s64 pos, u32 size)
+{
+	RESTART_PAGE_HEADER *rp;
+	u16 ra_ofs;
+
+	rp = ntfs_malloc(size);
+	if (!rp)
+		return NULL;
+	if (ntfs_attr_pread(na, pos, size, rp) != size)
+		goto err_out;
+	if (!ntfs_is_rstr_record(rp->magic) &&
+			!ntfs_is_chkd_record(rp->magic))
+		goto err_out;
+	if (ntfs_mst_post_read_fixup_warn((NTFS_RECORD*)rp, size, FALSE))
+		goto err_out;
+	ra_ofs = le16_to_cpu(rp->restart_area_offset);
+	if (ra_ofs & 7 || ra_ofs < sizeof(RESTART_PAGE_HEADER) ||
+			ra_ofs + sizeof(RESTART_AREA) > size)
+		goto err_out;
+	return rp;
+err_out:
+	free(rp);
+	return NULL;
+}
+
+/**
+ * ntfs_volume_check_logfile - check if the $LogFile was closed cleanly
+ * @vol:	ntfs volume to check
+ *
+ * Windows does not flush its metadata changes to their final location before
+ * recording them in the $LogFile.  If the volume was not shut down cleanly,
+ * the $LogFile still contains changes Windows will replay on the next mount
+ * so modifying the volume now would corrupt it.  Look at the most recent of
+ * the two restart pages and treat the volume as unclean if the log file is
+ * still open and not marked clean.  This is the same test the kernel driver
+ * performs on mount.
+ *
+ * An empty $LogFile, i.e. one whose first restart page is filled with 0xff
+ * bytes as left behind by chkdsk, is clean.
+ *
+ * Return 0 if the $LogFile is clean and -1 with errno set to the error code
+ * otherwise.  errno is EPERM if the $LogFile is not clean.
+ */
+static int ntfs_volume_check_logfile(ntfs_volume *vol)
+{
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	RESTART_PAGE_HEADER *rp, *rp2;
+	RESTART_AREA *ra;
+	u8 *buf;
+	u32 size;
+	int i, err;
+
+	ni = ntfs_inode_open(vol, FILE_LogFile);
+	if (!ni) {
+		ntfs_log_perror("Failed to open inode FILE_LogFile");
+		return -1;
+	}
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na) {
+		err = errno;
+		ntfs_log_perror("Failed to open $LogFile/$DATA");
+		ntfs_inode_close(ni);
+		errno = err;
+		return -1;
+	}
+	/*
+	 * Both restart pages have the size of the system page size of the
+	 * machine that wrote them which is recorded in the first one.
+	 */
+	err = EIO;
+	size = NTFS_BLOCK_SIZE;
+	buf = ntfs_malloc(size);
+	if (!buf) {
+		err = errno;
+		goto out;
+	}
+	if (ntfs_attr_pread(na, 0, size, buf) != size) {
+		free(buf);
+		ntfs_log_error("Failed to read $LogFile.\n");
+		goto out;
+	}
+	for (i = 0; i < (int)size && buf[i] == 0xff; i++)
+		;
+	if (i == (int)size) {
+		/* The first restart page is empty so the $LogFile is. */
+		free(buf);
+		err = 0;
+		goto out;
+	}
+	size = le32_to_cpu(((RESTART_PAGE_HEADER*)buf)->system_page_size);
+	free(buf);
+	if (size < NTFS_BLOCK_SIZE || size > 65536 || size & (size - 1) ||
+			2 * (s64)size > na->data_size)
+		size = 4096;
+	rp = ntfs_volume_read_restart_page(na, 0, size);
+	rp2 = ntfs_volume_read_restart_page(na, size, size);
+	if (rp2 && (!rp || sle64_to_cpu(((RESTART_AREA*)((u8*)rp2 +
+			le16_to_cpu(rp2->restart_area_offset)))->current_lsn) >
+			sle64_to_cpu(((RESTART_AREA*)((u8*)rp +
+			le16_to_cpu(rp->restart_area_offset)))->current_lsn))) {
+		free(rp);
+		rp = rp2;
+	} else
+		free(rp2);
+	if (!rp) {
+		ntfs_log_error("$LogFile has no valid restart page.\n");
+		goto out;
+	}
+	ra = (RESTART_AREA*)((u8*)rp + le16_to_cpu(rp->restart_area_offset));
+	if (ra->client_in_use_list != LOGFILE_NO_CLIENT &&
+			!(ra->flags & RESTART_VOLUME_IS_CLEAN))
+		err = EPERM;
+	else
+		err = 0;
+	free(rp);
+out:
+	ntfs_attr_close(na);
+	ntfs_inode_close(ni);
+	if (!err)
+		return 0;
+	errno = err;
+	return -1;
+}
+
+/**
+ * ntfs_device_mount - open ntfs volume
+ * @dev:	device to open
+ * @flags:	optional mount flags
+ *
+ * This function mounts an ntfs volume.  @dev should describe the device which
+ * to mount as the ntfs volume.
+ *
+ * @flags is an optional second parameter.  The same flags are used as for
+ * the mount system call (man 2 mount).  Currently only the following flags
+ * are implemented:
+ *	MS_RDONLY	- mount volume read-only
+ *	MS_RECOVER	- mount the volume read-write even if it is marked dirty
+ *			  or its $LogFile was not closed cleanly
+ *	MS_IGNORE_HIBERFILE - mount the volume read-write even if Windows is
+ *			  hibernated on it
+ *
+ * The function opens the device @dev and verifies that it contains a valid
+ * bootsector.  Then, it allocates an ntfs_volume structure and initializes
+ * some of the values inside the structure from the information stored in the
+ * bootsector.  It proceeds to load the necessary system files and completes
+ * setting up the structure.
+ *
+ * Return the allocated volume structure on success and NULL on error with
+ * errno set to the error code.  On error @dev has been freed.
+ */
+ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, unsigned long flags)
+{
+	NTFS_BOOT_SECTOR *bs;
+	ntfs_volume *vol;
+	ntfs_inode *ni;
+	ntfs_attr_search_ctx *ctx;
+	VOLUME_INFORMATION *vinf;
+	ATTR_RECORD *a;
+	s64 br;
+	int err;
+
+	if (!dev) {
+		errno = EINVAL;
+		return NULL;
+	}
+	vol = ntfs_volume_alloc();
+	if (!vol) {
+		ntfs_device_free(dev);
+		return NULL;
+	}
+	vol->dev = dev;
+	vol->mft_zone_multiplier = 1;
+	if (flags & MS_RDONLY)
+		NVolSetReadOnly(vol);
+	if (dev->d_ops->open(dev, NVolReadOnly(vol) ? O_RDONLY : O_RDWR)) {
+		ntfs_log_perror("Error opening '%s'", dev->d_name);
+		goto error_exit;
+	}
+
+	/* Read and validate the boot sector. */
+	bs = ntfs_malloc(sizeof(NTFS_BOOT_SECTOR));
+	if (!bs)
+		goto error_exit;
+	br = ntfs_pread(dev, 0, sizeof(NTFS_BOOT_SECTOR), bs);
+	if (br != sizeof(NTFS_BOOT_SECTOR)) {
+		if (br != -1)
+			errno = EINVAL;
+		if (!br)
+			ntfs_log_error("Failed to read bootsector (size=0)\n");
+		else
+			ntfs_log_perror("Error reading bootsector");
+		free(bs);
+		goto error_exit;
+	}
+	if (!ntfs_boot_sector_is_ntfs(bs)) {
+		free(bs);
+		errno = EINVAL;
+		goto error_exit;
+	}
+	if (ntfs_boot_sector_parse(vol, bs) < 0) {
+		free(bs);
+		goto error_exit;
+	}
+	free(bs);
+	if (ntfs_device_block_size_set(vol->dev, vol->sector_size) &&
+			errno != EINVAL)
+		ntfs_log_debug("Failed to set the device block size to the "
+			       "sector size.  This may affect performance.\n");
+
+	ntfs_volume_setup_zones(vol);
+
+	/* Load $MFT/$DATA and $MFTMirr/$DATA. */
+	if (ntfs_mft_load(vol) < 0) {
+		ntfs_log_perror("Failed to load $MFT");
+		goto error_exit;
+	}
+	if (ntfs_mftmirr_load(vol) < 0) {
+		ntfs_log_perror("Failed to load $MFTMirr");
+		goto error_exit;
+	}
+
+	/* Load $Bitmap. */
+	vol->lcnbmp_ni = ntfs_inode_open(vol, FILE_Bitmap);
+	if (!vol->lcnbmp_ni) {
+		ntfs_log_perror("Failed to open inode FILE_Bitmap");
+		goto error_exit;
+	}
+	vol->lcnbmp_na = ntfs_attr_open(vol->lcnbmp_ni, AT_DATA, AT_UNNAMED, 0);
+	if (!vol->lcnbmp_na) {
+		ntfs_log_perror("Failed to open ntfs attribute");
+		goto error_exit;
+	}
+	if (vol->lcnbmp_na->data_size > vol->lcnbmp_na->allocated_size ||
+			(vol->nr_clusters + 7) >> 3 >
+			vol->lcnbmp_na->data_size) {
+		ntfs_log_error("Corrupt cluster map size (%lld > %lld)\n",
+				(long long)vol->lcnbmp_na->data_size,
+				(long long)vol->lcnbmp_na->allocated_size);
+		errno = EIO;
+		goto error_exit;
+	}
+
+	/* Load $UpCase. */
+	ni = ntfs_inode_open(vol, FILE_UpCase);
+	if (!ni) {
+		ntfs_log_perror("Failed to open inode FILE_UpCase");
+		goto error_exit;
+	}
+	vol->upcase = ntfs_attr_readall(ni, AT_DATA, AT_UNNAMED, 0, &br);
+	err = errno;
+	ntfs_inode_close(ni);
+	if (!vol->upcase) {
+		errno = err;
+		ntfs_log_perror("Failed to read $UpCase");
+		goto error_exit;
+	}
+	if (br != 0x10000 * sizeof(ntfschar)) {
+		ntfs_log_error("Upcase table is invalid (want size=%d got "
+			       "%lld).\n", 0x10000 * (int)sizeof(ntfschar),
+			       (long long)br);
+		errno = EIO;
+		goto error_exit;
+	}
+	vol->upcase_len = br >> 1;
+
+	/* Load $Volume and get the ntfs version and the volume flags. */
+	vol->vol_ni = ntfs_inode_open(vol, FILE_Volume);
+	if (!vol->vol_ni) {
+		ntfs_log_perror("Failed to open inode FILE_Volume");
+		goto error_exit;
+	}
+	ctx = ntfs_attr_get_search_ctx(vol->vol_ni, NULL);
+	if (!ctx)
+		goto error_exit;
+	if (ntfs_attr_lookup(AT_VOLUME_INFORMATION, AT_UNNAMED, 0, 0, 0, NULL,
+			0, ctx)) {
+		ntfs_log_perror("$VOLUME_INFORMATION attribute not found in "
+				"$Volume");
+		ntfs_attr_put_search_ctx(ctx);
+		goto error_exit;
+	}
+	a = ctx->attr;
+	if (a->non_resident || le32_to_cpu(a->value_length) <
+			sizeof(VOLUME_INFORMATION) ||
+			le16_to_cpu(a->value_offset) +
+			le32_to_cpu(a->value_length) >
+			le32_to_cpu(a->length)) {
+		ntfs_log_error("Attribute $VOLUME_INFORMATION in $Volume is "
+			       "corrupt.\n");
+		ntfs_attr_put_search_ctx(ctx);
+		errno = EIO;
+		goto error_exit;
+	}
+	vinf = (VOLUME_INFORMATION*)((u8*)a + le16_to_cpu(a->value_offset));
+	vol->major_ver = vinf->major_ver;
+	vol->minor_ver = vinf->minor_ver;
+	vol->flags = vinf->flags;
+	ntfs_log_debug("NTFS v%i.%i\n", vol->major_ver, vol->minor_ver);
+	/* Get the volume name, it is optional. */
+	ntfs_attr_reinit_search_ctx(ctx);
+	if (!ntfs_attr_lookup(AT_VOLUME_NAME, AT_UNNAMED, 0, 0, 0, NULL, 0,
+			ctx) && !ctx->attr->non_resident) {
+		a = ctx->attr;
+		if (ntfs_ucstombs((ntfschar*)((u8*)a +
+				le16_to_cpu(a->value_offset)),
+				le32_to_cpu(a->value_length) / 2,
+				&vol->vol_name, 0) < 0) {
+			ntfs_log_perror("Volume name could not be converted "
+					"to current locale");
+			vol->vol_name = NULL;
+		}
+	}
+	ntfs_attr_put_search_ctx(ctx);
+	if (!vol->vol_name) {
+		vol->vol_name = strdup("");
+		if (!vol->vol_name)
+			goto error_exit;
+	}
+	if (!NVolReadOnly(vol) && (vol->flags & VOLUME_IS_DIRTY) &&
+			!(flags & MS_RECOVER)) {
+		ntfs_log_error("The volume is marked dirty, run chkdsk on it "
+			       "before mounting it read-write.\n");
+		errno = EPERM;
+		goto error_exit;
+	}
+
+	/* Load $AttrDef. */
+	ni = ntfs_inode_open(vol, FILE_AttrDef);
+	if (!ni) {
+		ntfs_log_perror("Failed to open inode FILE_AttrDef");
+		goto error_exit;
+	}
+	vol->attrdef = ntfs_attr_readall(ni, AT_DATA, AT_UNNAMED, 0, &br);
+	err = errno;
+	ntfs_inode_close(ni);
+	if (!vol->attrdef) {
+		errno = err;
+		ntfs_log_perror("Failed to read $AttrDef");
+		goto error_exit;
+	}
+	if (br <= 0 || br > 0x10000) {
+		ntfs_log_error("Attribute definition table is invalid (size "
+			       "%lld).\n", (long long)br);
+		errno = EIO;
+		goto error_exit;
+	}
+	vol->attrdef_len = br;
+
+	/*
+	 * Like the kernel driver, refuse to write to a volume on which Windows
+	 * is hibernated or which Windows did not shut down cleanly as Windows
+	 * would overwrite our changes, corrupting the volume, when it resumes
+	 * or replays its $LogFile.
+	 */
+	if (!NVolReadOnly(vol) && !(flags & MS_IGNORE_HIBERFILE) &&
+			ntfs_volume_check_hiberfile(vol)) {
+		if (errno == EPERM)
+			ntfs_log_error("Windows is hibernated on the volume, "
+				       "resume and shut down Windows fully "
+				       "(not with fast startup) before "
+				       "mounting it read-write.\n");
+		goto error_exit;
+	}
+	if (!NVolReadOnly(vol) && !(flags & MS_RECOVER) &&
+			ntfs_volume_check_logfile(vol)) {
+		if (errno == EPERM)
+			ntfs_log_error("The volume was not shut down cleanly, "
+				       "boot Windows and shut it down fully "
+				       "or run chkdsk on it before mounting "
+				       "it read-write.\n");
+		goto error_exit;
+	}
+
+	if (ntfs_volume_load_free_space(vol))
+		goto error_exit;
+	ntfs_log_debug("Mounted %s, %lld of %lld clusters free.\n",
+			dev->d_name, (long long)vol->free_clusters,
+			(long long)vol->nr_clusters);
+	return vol;
+error_exit:
+	err = errno;
+	__ntfs_volume_release(vol);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * ntfs_mount - open ntfs volume
+ * @name:	name of device/file to open
+ * @flags:	optional mount flags
+ *
+ * This function mounts an ntfs volume.  @name should contain the name of the
+ * device/file to mount as the ntfs volume.  See ntfs_device_mount() for the
+ * supported @flags.
+ *
+ * Return the allocated volume structure on success and NULL on error with
+ * errno set to the error code.
+ */
+ntfs_volume *ntfs_mount(const char *name, unsigned long flags)
+{
+	struct ntfs_device *dev;
+
+	if (!name) {
+		errno = EINVAL;
+		return NULL;
+	}
+	/* Allocate an ntfs_device structure. */
+	dev = ntfs_device_alloc(name, 0, &ntfs_device_default_io_ops, NULL);
+	if (!dev)
+		return NULL;
+	/* Call ntfs_device_mount() to do the actual mount. */
+	return ntfs_device_mount(dev, flags);
+}
+
+/**
+ * ntfs_umount - close ntfs volume
+ * @vol:	address of ntfs_volume structure of volume to close
+ * @force:	if true force close the volume even if it is busy
+ *
+ * Deallocate all structures (including @vol itself) associated with the ntfs
+ * volume @vol.
+ *
+ * Return 0 on success.  On error return -1 with errno set appropriately
+ * (most likely to one of EAGAIN, EBUSY or EINVAL).  The EAGAIN error means
+ * an operation is in progress and if you try the close later the operation
+ * might be completed and the close succeed.
+ *
+ * If @force is true (i.e. not zero) this function will close the volume even
+ * if this means that data might be lost.  @vol is always freed in that case.
+ */
+int ntfs_umount(ntfs_volume *vol, const BOOL force __attribute__((unused)))
+{
+	if (!vol) {
+		errno = EINVAL;
+		return -1;
+	}
+	return __ntfs_volume_release(vol);
+}
@@ -246,10 +246,22 @@ struct _ntfs_volume {
 	BOOL efs_raw;		/* volume is mounted for raw access to
 				   efs-encrypted files */
 
+	ntfs_inode *inode_hash[CACHE_NIDATA_HASH]; /* Open and cached inodes
+				   hashed by mft record number. */
+	ntfs_inode *inode_lru_head; /* Most recently closed cached inode. */
+	ntfs_inode *inode_lru_tail; /* Least recently closed cached inode,
+				   the first one to be evicted. */
+	int nr_cached_inodes;	/* Number of closed inodes in the cache. */
+
 };
 
 extern const char *ntfs_home;
 
 extern ntfs_volume *ntfs_volume_alloc(void);
 
+extern ntfs_volume *ntfs_device_mount(struct ntfs_device *dev,
+		unsigned long flags);
+extern ntfs_volume *ntfs_mount(const char *name, unsigned long flags);
+extern int ntfs_umount(ntfs_volume *vol, const BOOL force);
+
 #endif /* defined _NTFS_VOLUME_H */
@@ -0,0 +1,1073 @@
+/**
+ * paths_ntfs - Print the full path of every file of an unmounted NTFS volume.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility resolves the full paths of all the files of an unmounted NTFS
+ * volume (or volume image) from a single sequential scan of the mft, instead
+ * of looking up the parent directory of every file on disk, which costs a
+ * random read per path component.  The records are parsed on several threads
+ * (see newfs/mftscan.c), which pack the names and named streams they find
+ * into compact entries.  These are copied, in mft order, into an arena of
+ * large blocks, and the paths are then put together in memory from a sorted
+ * table of the directories.  Every hard link of a file gets its own path,
+ * and its named streams are listed after its first one.
+ *
+ * The memory used is about 30 bytes plus the UTF-8 name for every file, 12
+ * more bytes for every additional name or stream and 8 bytes per directory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+
+#include "types.h"
+#include "device.h"
+#include "layout.h"
+#include "logging.h"
+#include "mftscan.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "paths_ntfs";
+
+/* Room for a file or stream name converted to UTF-8. */
+#define PATHS_NAME_BUF_SIZE	(4 * 255 + 1)
+
+/*
+ * Room for a path.  NTFS paths are at most 32767 UTF-16 characters, each of
+ * which is at most three bytes of UTF-8.
+ */
+#define PATHS_PATH_SIZE		(128 * 1024)
+
+/* Room for the "<mft_no>/" an unreachable directory is printed as. */
+#define PATHS_ORPHAN_SIZE	32
+
+/* Size of the blocks of the arena the entries are kept in. */
+#define PATHS_BLOCK_SIZE	(64 * 1024 * 1024)
+
+/* Size of the output buffer. */
+#define PATHS_OUT_BUF_SIZE	(1024 * 1024)
+
+typedef enum {
+	PATHS_FORMAT_CSV,
+	PATHS_FORMAT_JSON,
+	PATHS_FORMAT_TEXT,
+} paths_format;
+
+/* Types of entries. */
+enum {
+	PATHS_FILE = 1,		/* A file, from its base mft record. */
+	PATHS_LINK,		/* Another name of a file. */
+	PATHS_STREAM,		/* A named $DATA attribute of a file. */
+};
+
+/* Entry flags. */
+#define PATHS_DIR	0x01	/* The file is a directory. */
+#define PATHS_STRAY	0x02	/* Found in an extent mft record. */
+
+/**
+ * struct paths_file - a file, from its base mft record
+ * @type:	PATHS_FILE
+ * @flags:	PATHS_DIR for a directory
+ * @name_len:	bytes of the UTF-8 name following the entry, 0 if the base mft
+ *		record has no $FILE_NAME attribute
+ * @mref:	mft reference of the file
+ * @parent:	mft reference of the directory the name is in
+ * @size:	data size of the unnamed $DATA attribute
+ *
+ * The name is a Win32 or POSIX one in preference to a DOS one.  Entries for
+ * the other names and the named streams in the base mft record follow.
+ */
+typedef struct {
+	u8 type;
+	u8 flags;
+	u16 name_len;
+	u64 mref;
+	u64 parent;
+	s64 size;
+} __attribute__((__packed__)) paths_file;
+
+/**
+ * struct paths_attr - another name or a named stream of a file
+ * @type:	PATHS_LINK or PATHS_STREAM
+ * @flags:	0
+ * @name_len:	bytes of the UTF-8 name following the entry
+ * @value:	mft reference of the directory the name is in for a link, data
+ *		size of the stream for a stream
+ *
+ * Belongs to the paths_file entry it follows.
+ */
+typedef struct {
+	u8 type;
+	u8 flags;
+	u16 name_len;
+	u64 value;
+} __attribute__((__packed__)) paths_attr;
+
+/**
+ * struct paths_stray - a name or a stream found in an extent mft record
+ * @a:		the name or stream, with PATHS_STRAY set in its flags
+ * @owner:	mft reference of the base mft record
+ *
+ * A stream without a name is the unnamed $DATA attribute, whose size the
+ * base mft record did not have.
+ */
+typedef struct {
+	paths_attr a;
+	u64 owner;
+} __attribute__((__packed__)) paths_stray;
+
+/**
+ * struct paths_block - a block of the arena
+ * @next:	next block in mft order
+ * @len:	bytes of entries in @data
+ * @size:	byte size of @data
+ * @data:	the entries
+ */
+typedef struct paths_block {
+	struct paths_block *next;
+	size_t len;
+	size_t size;
+	u8 data[];
+} paths_block;
+
+/**
+ * struct paths_stray_ref - an entry of the table of stray entries
+ * @e:		the paths_stray entry
+ * @nr:		order in which it was found, to keep the sort stable
+ */
+typedef struct {
+	const paths_stray *e;
+	s64 nr;
+} paths_stray_ref;
+
+/**
+ * struct paths_ctx - state of the export
+ * @blocks:		the arena, in mft order
+ * @last:		last block of @blocks
+ * @arena_size:		total byte size of the blocks
+ * @dirs:		the paths_file entries of the directories, in mft order
+ * @nr_dirs:		number of elements in @dirs
+ * @dirs_size:		allocated number of elements in @dirs
+ * @strays:		the paths_stray entries, sorted by owner once the scan
+ *			is done
+ * @nr_strays:		number of elements in @strays
+ * @strays_size:	allocated number of elements in @strays
+ * @group:		entries of the file being printed
+ * @group_size:		allocated number of elements in @group
+ * @path:		buffer the path of a directory is put together at the
+ *			end of
+ * @cache_dir:		directory whose path is in @cache_path, 0 if none
+ * @cache_path:		path of @cache_dir, ending with a slash
+ * @cache_len:		length of @cache_path
+ * @cache_orphan:	@cache_dir could not be followed up to the root
+ * @line:		buffer the full path of a name is put together in
+ * @out:		where the paths are written to
+ * @nr_files:		number of files printed
+ * @nr_links:		number of paths printed
+ * @nr_streams:		number of named streams printed
+ * @nr_orphans:		number of paths not leading up to the root
+ * @nr_nameless:	number of base mft records in use without a name
+ */
+typedef struct {
+	paths_block *blocks;
+	paths_block *last;
+	s64 arena_size;
+	const paths_file **dirs;
+	s64 nr_dirs;
+	s64 dirs_size;
+	paths_stray_ref *strays;
+	s64 nr_strays;
+	s64 strays_size;
+	const u8 **group;
+	s64 group_size;
+	char *path;
+	MFT_REF cache_dir;
+	char *cache_path;
+	int cache_len;
+	BOOL cache_orphan;
+	char *line;
+	FILE *out;
+	s64 nr_files;
+	s64 nr_links;
+	s64 nr_streams;
+	s64 nr_orphans;
+	s64 nr_nameless;
+} paths_ctx;
+
+static struct {
+	char *device;
+	char *output;
+	paths_format format;
+	int nr_threads;
+	u32 chunk_size;
+	BOOL stats;
+} opts;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - print the full path of every file of an NTFS "
+			"volume.\n\n", EXEC_NAME);
+	fprintf(stderr, "usage: %s [-s] [-c KiB] [-f csv|json|text] "
+			"[-o file] [-t threads] <device>\n\n", EXEC_NAME);
+	fprintf(stderr, "    -c KiB      Read the mft this many KiB at a "
+			"time.\n");
+	fprintf(stderr, "    -f format   Output format (default csv).\n");
+	fprintf(stderr, "    -o file     Write the output to file instead of "
+			"standard output.\n");
+	fprintf(stderr, "    -s          Print statistics to standard "
+			"error.\n");
+	fprintf(stderr, "    -t threads  Number of threads parsing the mft "
+			"(default one per cpu).\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	char *end;
+	long n;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:f:o:st:")) != -1) {
+		switch (ch) {
+		case 'c':
+			errno = 0;
+			n = strtol(optarg, &end, 0);
+			if (errno || *end || n <= 0 || n > 1024 * 1024)
+				usage();
+			opts.chunk_size = n * 1024;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				opts.format = PATHS_FORMAT_CSV;
+			else if (!strcmp(optarg, "json"))
+				opts.format = PATHS_FORMAT_JSON;
+			else if (!strcmp(optarg, "text"))
+				opts.format = PATHS_FORMAT_TEXT;
+			else
+				usage();
+			break;
+		case 'o':
+			opts.output = optarg;
+			break;
+		case 's':
+			opts.stats = TRUE;
+			break;
+		case 't':
+			errno = 0;
+			n = strtol(optarg, &end, 0);
+			if (errno || *end || n <= 0 || n > 1024)
+				usage();
+			opts.nr_threads = n;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	opts.device = argv[0];
+}
+
+/**
+ * paths_entry_size - byte size of an entry, including its name
+ * @e:		the entry
+ */
+static inline size_t paths_entry_size(const u8 *e)
+{
+	const paths_attr *a = (const paths_attr*)e;
+
+	if (a->type == PATHS_FILE)
+		return sizeof(paths_file) + a->name_len;
+	if (a->flags & PATHS_STRAY)
+		return sizeof(paths_stray) + a->name_len;
+	return sizeof(paths_attr) + a->name_len;
+}
+
+/**
+ * paths_entry_name - the name of an entry
+ * @e:		the entry
+ *
+ * The name is not NUL terminated, its length is in the entry.
+ */
+static inline const char *paths_entry_name(const u8 *e)
+{
+	const paths_attr *a = (const paths_attr*)e;
+
+	if (a->type == PATHS_FILE)
+		return (const char*)e + sizeof(paths_file);
+	if (a->flags & PATHS_STRAY)
+		return (const char*)e + sizeof(paths_stray);
+	return (const char*)e + sizeof(paths_attr);
+}
+
+/**
+ * paths_name - convert a name to UTF-8 for an entry
+ * @uname:	the name
+ * @ulen:	length of @uname in Unicode characters
+ * @buf:	buffer of PATHS_NAME_BUF_SIZE bytes to convert into
+ *
+ * A name which cannot be converted comes out as "?".
+ *
+ * Return the byte length of the converted name.
+ */
+static int paths_name(const ntfschar *uname, int ulen, char *buf)
+{
+	int len;
+
+	if (!ulen)
+		return 0;
+	len = ntfs_ucstombs(uname, ulen, &buf, PATHS_NAME_BUF_SIZE);
+	if (len < 0) {
+		buf[0] = '?';
+		len = 1;
+	}
+	return len;
+}
+
+/**
+ * paths_emit - append a name or a stream to the output of a chunk
+ * @out:	output of the chunk
+ * @r:		mft record the name or stream is in
+ * @type:	PATHS_LINK or PATHS_STREAM
+ * @value:	see struct paths_attr
+ * @uname:	the name
+ * @ulen:	length of @uname in Unicode characters
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int paths_emit(ntfs_mft_scan_out *out, const ntfs_mft_scan_record *r,
+		u8 type, u64 value, const ntfschar *uname, int ulen)
+{
+	char name[PATHS_NAME_BUF_SIZE];
+	paths_stray s;
+	int len = paths_name(uname, ulen, name);
+
+	s.a.type = type;
+	s.a.flags = r->base_mref ? PATHS_STRAY : 0;
+	s.a.name_len = len;
+	s.a.value = value;
+	s.owner = r->base_mref;
+	if (ntfs_mft_scan_write(out, &s, r->base_mref ? sizeof(s) :
+			sizeof(s.a)))
+		return -1;
+	return ntfs_mft_scan_write(out, name, len);
+}
+
+/**
+ * paths_record - pack the names and streams of an mft record, called by the
+ *		  scanner
+ * @r:		the mft record
+ * @out:	output of the chunk of mft records @r belongs to
+ * @data:	unused
+ *
+ * DOS names are skipped, as every file with one also has a Win32 name.  The
+ * scanner checked that the attributes lie within the record, but not their
+ * names.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int paths_record(const ntfs_mft_scan_record *r, ntfs_mft_scan_out *out,
+		void *data __attribute__((unused)))
+{
+	const MFT_RECORD *m = r->m;
+	const ATTR_RECORD *a;
+	const BOOL stray = r->base_mref != 0;
+
+	if (!stray) {
+		char name[PATHS_NAME_BUF_SIZE];
+		paths_file f;
+
+		f.type = PATHS_FILE;
+		f.flags = r->flags & MFT_RECORD_IS_DIRECTORY ? PATHS_DIR : 0;
+		f.name_len = r->name ? paths_name(r->name, r->name_len, name) :
+				0;
+		f.mref = MK_MREF(r->mft_no, r->seq_no);
+		f.parent = r->name ? r->parent_mref : 0;
+		f.size = r->data_size;
+		if (ntfs_mft_scan_write(out, &f, sizeof(f)) ||
+				ntfs_mft_scan_write(out, name, f.name_len))
+			return -1;
+	}
+	for (a = (const ATTR_RECORD*)((const u8*)m +
+			le16_to_cpu(m->attrs_offset)); a->type != AT_END;
+			a = (const ATTR_RECORD*)((const u8*)a +
+			le32_to_cpu(a->length))) {
+		if (a->type == AT_FILE_NAME && !a->non_resident) {
+			const FILE_NAME_ATTR *fn = (const FILE_NAME_ATTR*)
+					((const u8*)a +
+					le16_to_cpu(a->value_offset));
+
+			if (fn->file_name_type == FILE_NAME_DOS ||
+					(!stray && fn->file_name == r->name))
+				continue;
+			if (paths_emit(out, r, PATHS_LINK,
+					le64_to_cpu(fn->parent_directory),
+					fn->file_name, fn->file_name_length))
+				return -1;
+		} else if (a->type == AT_DATA && (a->name_length || stray)) {
+			/* Only the first extent has the sizes. */
+			if (a->non_resident && a->lowest_vcn)
+				continue;
+			if (le16_to_cpu(a->name_offset) + a->name_length *
+					sizeof(ntfschar) >
+					le32_to_cpu(a->length))
+				continue;
+			if (paths_emit(out, r, PATHS_STREAM, a->non_resident ?
+					sle64_to_cpu(a->data_size) :
+					le32_to_cpu(a->value_length),
+					(const ntfschar*)((const u8*)a +
+					le16_to_cpu(a->name_offset)),
+					a->name_length))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * paths_grow - make room for one more element in an array
+ * @array:	pointer to the array
+ * @nr:		number of elements in the array
+ * @size:	allocated number of elements in the array
+ * @elem_size:	byte size of an element
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int paths_grow(void *array, s64 nr, s64 *size, size_t elem_size)
+{
+	void **p = array;
+	s64 new_size;
+	void *a;
+
+	if (nr < *size)
+		return 0;
+	new_size = *size ? 2 * *size : 1024;
+	a = realloc(*p, new_size * elem_size);
+	if (!a) {
+		errno = ENOMEM;
+		return -1;
+	}
+	*p = a;
+	*size = new_size;
+	return 0;
+}
+
+/**
+ * paths_out - copy the entries of a chunk into the arena, called by the
+ *	       scanner
+ * @out:	output of the chunk
+ * @data:	state of the export
+ *
+ * Runs on the thread running the scan, one chunk after the other, so the
+ * arena ends up in mft order and the directories come out sorted.
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int paths_out(const ntfs_mft_scan_out *out, void *data)
+{
+	paths_ctx *ctx = data;
+	paths_block *b = ctx->last;
+	const u8 *e, *end;
+
+	if (!out->len)
+		return 0;
+	if (!b || b->size - b->len < out->len) {
+		size_t size = out->len > PATHS_BLOCK_SIZE ? out->len :
+				PATHS_BLOCK_SIZE;
+
+		b = malloc(sizeof(*b) + size);
+		if (!b) {
+			errno = ENOMEM;
+			return -1;
+		}
+		b->next = NULL;
+		b->len = 0;
+		b->size = size;
+		if (ctx->last)
+			ctx->last->next = b;
+		else
+			ctx->blocks = b;
+		ctx->last = b;
+		ctx->arena_size += sizeof(*b) + size;
+	}
+	e = b->data + b->len;
+	memcpy(b->data + b->len, out->buf, out->len);
+	b->len += out->len;
+	for (end = b->data + b->len; e < end; e += paths_entry_size(e)) {
+		const paths_attr *a = (const paths_attr*)e;
+
+		if (a->type == PATHS_FILE && a->flags & PATHS_DIR) {
+			if (paths_grow(&ctx->dirs, ctx->nr_dirs,
+					&ctx->dirs_size, sizeof(*ctx->dirs)))
+				return -1;
+			ctx->dirs[ctx->nr_dirs++] = (const paths_file*)e;
+		} else if (a->flags & PATHS_STRAY) {
+			if (paths_grow(&ctx->strays, ctx->nr_strays,
+					&ctx->strays_size,
+					sizeof(*ctx->strays)))
+				return -1;
+			ctx->strays[ctx->nr_strays].e = (const paths_stray*)e;
+			ctx->strays[ctx->nr_strays].nr = ctx->nr_strays;
+			ctx->nr_strays++;
+		}
+	}
+	return 0;
+}
+
+/**
+ * paths_mref_cmp - order mft references by mft record number
+ */
+static inline int paths_mref_cmp(MFT_REF a, MFT_REF b)
+{
+	if (MREF(a) != MREF(b))
+		return MREF(a) < MREF(b) ? -1 : 1;
+	if (MSEQNO(a) != MSEQNO(b))
+		return MSEQNO(a) < MSEQNO(b) ? -1 : 1;
+	return 0;
+}
+
+static int paths_stray_cmp(const void *p1, const void *p2)
+{
+	const paths_stray_ref *s1 = p1, *s2 = p2;
+	int cmp = paths_mref_cmp(s1->e->owner, s2->e->owner);
+
+	if (cmp)
+		return cmp;
+	return s1->nr < s2->nr ? -1 : s1->nr > s2->nr;
+}
+
+/**
+ * paths_strays_find - find the stray entries of a file
+ * @ctx:	state of the export
+ * @mref:	mft reference of the file
+ *
+ * Return the index of the first element of @ctx->strays belonging to @mref,
+ * or of the element it would go before if there are none.
+ */
+static s64 paths_strays_find(paths_ctx *ctx, MFT_REF mref)
+{
+	s64 lo = 0, hi = ctx->nr_strays;
+
+	while (lo < hi) {
+		const s64 mid = lo + (hi - lo) / 2;
+
+		if (paths_mref_cmp(ctx->strays[mid].e->owner, mref) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * paths_dir_find - find the entry of a directory
+ * @ctx:	state of the export
+ * @mref:	mft reference of the directory
+ *
+ * Return the entry, or NULL if there is no directory in use with the mft
+ * record number and sequence number of @mref.
+ */
+static const paths_file *paths_dir_find(paths_ctx *ctx, MFT_REF mref)
+{
+	s64 lo = 0, hi = ctx->nr_dirs;
+
+	while (lo < hi) {
+		const s64 mid = lo + (hi - lo) / 2;
+		const paths_file *d = ctx->dirs[mid];
+
+		if (MREF(d->mref) == MREF(mref))
+			return d->mref == mref ? d : NULL;
+		if (MREF(d->mref) < MREF(mref))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/**
+ * paths_dir_name - the name and parent of a directory
+ * @ctx:	state of the export
+ * @d:		the directory
+ * @parent:	the parent directory is returned here
+ *
+ * Return the entry holding the name of @d, which is @d itself unless the
+ * name is in an extent mft record, or NULL if @d has no name.
+ */
+static const u8 *paths_dir_name(paths_ctx *ctx, const paths_file *d,
+		MFT_REF *parent)
+{
+	s64 i;
+
+	if (d->name_len) {
+		*parent = d->parent;
+		return (const u8*)d;
+	}
+	for (i = paths_strays_find(ctx, d->mref); i < ctx->nr_strays &&
+			ctx->strays[i].e->owner == d->mref; i++) {
+		const paths_stray *s = ctx->strays[i].e;
+
+		if (s->a.type == PATHS_LINK && s->a.name_len) {
+			*parent = s->a.value;
+			return (const u8*)s;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * paths_dir_path - the full path of a directory
+ * @ctx:	state of the export
+ * @dir:	mft reference of the directory
+ * @len:	the length of the path is returned here
+ *
+ * The path is put together backwards at the end of @ctx->path, following the
+ * parents up to the root, and ends with a slash.  A directory which cannot be
+ * found, has no name or leads into a loop is printed as "<mft_no>/", and
+ * @ctx->cache_orphan is set.  The path of the last directory is cached, as
+ * the files of a directory tend to be close together in the mft.
+ *
+ * Return the path, which is valid until the next call.
+ */
+static const char *paths_dir_path(paths_ctx *ctx, MFT_REF dir, int *len)
+{
+	char *p = ctx->path + PATHS_PATH_SIZE;
+	MFT_REF mref = dir;
+
+	if (ctx->cache_path && dir == ctx->cache_dir) {
+		*len = ctx->cache_len;
+		return ctx->cache_path;
+	}
+	ctx->cache_orphan = FALSE;
+	*--p = '/';
+	while (MREF(mref) != FILE_root) {
+		const paths_file *d = paths_dir_find(ctx, mref);
+		const u8 *e = d ? paths_dir_name(ctx, d, &mref) : NULL;
+		const int name_len = e ? ((const paths_attr*)e)->name_len : 0;
+
+		/* Every name takes up room, so a loop runs out of it. */
+		if (!e || p - ctx->path < name_len + 1 + PATHS_ORPHAN_SIZE) {
+			char orphan[PATHS_ORPHAN_SIZE];
+			const int n = snprintf(orphan, sizeof(orphan), "<%llu>",
+					(unsigned long long)MREF(d ? d->mref :
+					mref));
+
+			p -= n;
+			memcpy(p, orphan, n);
+			ctx->cache_orphan = TRUE;
+			break;
+		}
+		p -= name_len;
+		memcpy(p, paths_entry_name(e), name_len);
+		*--p = '/';
+	}
+	ctx->cache_dir = dir;
+	ctx->cache_path = p;
+	ctx->cache_len = ctx->path + PATHS_PATH_SIZE - p;
+	*len = ctx->cache_len;
+	return p;
+}
+
+/**
+ * paths_put_csv - print a CSV field
+ * @f:		stream to print to
+ * @s:		the field
+ * @len:	byte length of @s
+ *
+ * The field is quoted only if it needs to be.
+ */
+static void paths_put_csv(FILE *f, const char *s, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (s[i] == ',' || s[i] == '"' || s[i] == '\r' ||
+				s[i] == '\n')
+			break;
+	if (i == len) {
+		fwrite(s, 1, len, f);
+		return;
+	}
+	putc('"', f);
+	for (i = 0; i < len; i++) {
+		if (s[i] == '"')
+			putc('"', f);
+		putc(s[i], f);
+	}
+	putc('"', f);
+}
+
+/**
+ * paths_put_json - print a JSON string
+ * @f:		stream to print to
+ * @s:		the string
+ * @len:	byte length of @s
+ */
+static void paths_put_json(FILE *f, const char *s, int len)
+{
+	int i;
+
+	putc('"', f);
+	for (i = 0; i < len; i++) {
+		const unsigned char c = s[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			putc(c, f);
+	}
+	putc('"', f);
+}
+
+/**
+ * paths_print - print a path
+ * @ctx:	state of the export
+ * @f:		the file
+ * @nr_links:	number of names of the file
+ * @parent:	directory the name is in
+ * @name:	entry holding the name
+ * @stream:	entry of the stream, NULL for the unnamed data
+ * @size:	data size of the unnamed data or of @stream
+ */
+static void paths_print(paths_ctx *ctx, const paths_file *f, int nr_links,
+		MFT_REF parent, const u8 *name, const u8 *stream, s64 size)
+{
+	FILE *out = ctx->out;
+	const char *dir;
+	int len, dir_len;
+
+	if (MREF(f->mref) == FILE_root) {
+		len = snprintf(ctx->line, PATHS_ORPHAN_SIZE, "/");
+	} else {
+		dir = paths_dir_path(ctx, parent, &dir_len);
+		if (ctx->cache_orphan)
+			ctx->nr_orphans++;
+		len = ((const paths_attr*)name)->name_len;
+		memcpy(ctx->line, dir, dir_len);
+		memcpy(ctx->line + dir_len, paths_entry_name(name), len);
+		len += dir_len;
+	}
+	if (stream)
+		ctx->nr_streams++;
+	else
+		ctx->nr_links++;
+	switch (opts.format) {
+	case PATHS_FORMAT_CSV:
+		fprintf(out, "%llu,%u,%d,%d,%lld,",
+				(unsigned long long)MREF(f->mref),
+				MSEQNO(f->mref), f->flags & PATHS_DIR ? 1 : 0,
+				nr_links, (long long)size);
+		paths_put_csv(out, ctx->line, len);
+		putc(',', out);
+		if (stream)
+			paths_put_csv(out, paths_entry_name(stream),
+					((const paths_attr*)stream)->name_len);
+		putc('\n', out);
+		break;
+	case PATHS_FORMAT_JSON:
+		fprintf(out, "{\"mft_no\":%llu,\"seq_no\":%u,\"dir\":%s,"
+				"\"links\":%d,\"size\":%lld,\"path\":",
+				(unsigned long long)MREF(f->mref),
+				MSEQNO(f->mref), f->flags & PATHS_DIR ?
+				"true" : "false", nr_links, (long long)size);
+		paths_put_json(out, ctx->line, len);
+		if (stream) {
+			fputs(",\"stream\":", out);
+			paths_put_json(out, paths_entry_name(stream),
+					((const paths_attr*)stream)->name_len);
+		}
+		fputs("}\n", out);
+		break;
+	case PATHS_FORMAT_TEXT:
+		fwrite(ctx->line, 1, len, out);
+		if (stream) {
+			putc(':', out);
+			fwrite(paths_entry_name(stream), 1,
+					((const paths_attr*)stream)->name_len,
+					out);
+		}
+		putc('\n', out);
+		break;
+	}
+}
+
+/**
+ * paths_print_file - print the paths of a file
+ * @ctx:	state of the export
+ * @f:		the file
+ * @end:	end of the block @f is in
+ * @stray:	index of the first element of @ctx->strays not before @f
+ *
+ * The file is printed once for every name, with its named streams after its
+ * first name.  Records without a name, like the reserved ones of the mft,
+ * are not printed.
+ *
+ * Return the entry following those of @f on success and NULL with errno set
+ * on error.
+ */
+static const u8 *paths_print_file(paths_ctx *ctx, const paths_file *f,
+		const u8 *end, s64 *stray)
+{
+	const u8 *e = (const u8*)f + paths_entry_size((const u8*)f);
+	const u8 *first = NULL;
+	MFT_REF first_parent = 0;
+	s64 size = f->size, nr = 0, i;
+	int nr_links = 0;
+
+	/* Gather the entries of the file from the arena and the strays. */
+	if (f->name_len) {
+		if (paths_grow(&ctx->group, nr, &ctx->group_size,
+				sizeof(*ctx->group)))
+			return NULL;
+		ctx->group[nr++] = (const u8*)f;
+	}
+	for (; e < end && *e != PATHS_FILE; e += paths_entry_size(e)) {
+		if (((const paths_attr*)e)->flags & PATHS_STRAY)
+			continue;
+		if (paths_grow(&ctx->group, nr, &ctx->group_size,
+				sizeof(*ctx->group)))
+			return NULL;
+		ctx->group[nr++] = e;
+	}
+	while (*stray < ctx->nr_strays && paths_mref_cmp(
+			ctx->strays[*stray].e->owner, f->mref) < 0)
+		(*stray)++;
+	for (; *stray < ctx->nr_strays && ctx->strays[*stray].e->owner ==
+			f->mref; (*stray)++) {
+		if (paths_grow(&ctx->group, nr, &ctx->group_size,
+				sizeof(*ctx->group)))
+			return NULL;
+		ctx->group[nr++] = (const u8*)ctx->strays[*stray].e;
+	}
+	for (i = 0; i < nr; i++) {
+		const paths_attr *a = (const paths_attr*)ctx->group[i];
+
+		if (a->type == PATHS_STREAM && !a->name_len)
+			size = a->value;
+		else if (a->type != PATHS_STREAM) {
+			if (!nr_links++) {
+				first = ctx->group[i];
+				first_parent = a->type == PATHS_FILE ?
+						f->parent : a->value;
+			}
+		}
+	}
+	if (!nr_links) {
+		ctx->nr_nameless++;
+		return e;
+	}
+	ctx->nr_files++;
+	paths_print(ctx, f, nr_links, first_parent, first, NULL, size);
+	for (i = 0; i < nr; i++) {
+		const paths_attr *a = (const paths_attr*)ctx->group[i];
+
+		if (a->type == PATHS_STREAM && a->name_len)
+			paths_print(ctx, f, nr_links, first_parent, first,
+					ctx->group[i], a->value);
+	}
+	for (i = 0; i < nr; i++) {
+		const paths_attr *a = (const paths_attr*)ctx->group[i];
+
+		if (a->type == PATHS_LINK && ctx->group[i] != first)
+			paths_print(ctx, f, nr_links, a->value,
+					ctx->group[i], NULL, size);
+	}
+	return e;
+}
+
+/**
+ * paths_print_all - print the paths of all the files
+ * @ctx:	state of the export
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int paths_print_all(paths_ctx *ctx)
+{
+	static const char csv_header[] = "mft_no,seq_no,dir,links,size,path,"
+			"stream\n";
+	const paths_block *b;
+	s64 stray = 0;
+
+	qsort(ctx->strays, ctx->nr_strays, sizeof(*ctx->strays),
+			paths_stray_cmp);
+	if (opts.format == PATHS_FORMAT_CSV)
+		fputs(csv_header, ctx->out);
+	for (b = ctx->blocks; b; b = b->next) {
+		const u8 *e = b->data, *end = b->data + b->len;
+
+		while (e < end) {
+			if (*e != PATHS_FILE) {
+				/* Strays are printed with their file. */
+				e += paths_entry_size(e);
+				continue;
+			}
+			e = paths_print_file(ctx, (const paths_file*)e, end,
+					&stray);
+			if (!e)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  Success, the program worked
+ *	    1  Error, something went wrong
+ */
+int main(int argc, char *argv[])
+{
+	ntfs_mft_scan_opts scan_opts;
+	ntfs_mft_scan_stats stats;
+	struct timeval start, scanned, end;
+	unsigned long mnt_flags;
+	ntfs_volume *vol;
+	paths_ctx ctx;
+	paths_block *b;
+	int ret = EXIT_FAILURE;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	if (ntfs_check_if_mounted(opts.device, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.path = malloc(PATHS_PATH_SIZE);
+	ctx.line = malloc(PATHS_PATH_SIZE + PATHS_NAME_BUF_SIZE);
+	if (!ctx.path || !ctx.line) {
+		ntfs_log_error("Failed to allocate memory.\n");
+		goto free;
+	}
+	vol = ntfs_mount(opts.device, MS_RDONLY);
+	if (!vol) {
+		ntfs_log_perror("Failed to mount %s", opts.device);
+		goto free;
+	}
+	ctx.out = stdout;
+	if (opts.output) {
+		ctx.out = fopen(opts.output, "w");
+		if (!ctx.out) {
+			ntfs_log_perror("Failed to open %s", opts.output);
+			goto umount;
+		}
+	}
+	setvbuf(ctx.out, NULL, _IOFBF, PATHS_OUT_BUF_SIZE);
+	memset(&scan_opts, 0, sizeof(scan_opts));
+	scan_opts.nr_threads = opts.nr_threads;
+	scan_opts.chunk_size = opts.chunk_size;
+	scan_opts.extents = TRUE;
+	scan_opts.out_fd = -1;
+	scan_opts.fn = paths_record;
+	scan_opts.out_fn = paths_out;
+	scan_opts.data = &ctx;
+	gettimeofday(&start, NULL);
+	if (ntfs_mft_scan(vol, &scan_opts, &stats)) {
+		ntfs_log_perror("Failed to scan the mft of %s", opts.device);
+		goto close;
+	}
+	gettimeofday(&scanned, NULL);
+	if (paths_print_all(&ctx)) {
+		ntfs_log_perror("Failed to print the paths");
+		goto close;
+	}
+	if (fflush(ctx.out) || ferror(ctx.out)) {
+		ntfs_log_perror("Failed to write the output");
+		goto close;
+	}
+	gettimeofday(&end, NULL);
+	if (opts.stats)
+		fprintf(stderr, "%lld records, %lld files, %lld paths, %lld "
+				"streams, %lld orphans, %lld without a name, "
+				"%lld directories, %lld bytes of arena, "
+				"scanned in %.3f seconds, printed in %.3f "
+				"seconds.\n",
+				(long long)stats.nr_records,
+				(long long)ctx.nr_files,
+				(long long)ctx.nr_links,
+				(long long)ctx.nr_streams,
+				(long long)ctx.nr_orphans,
+				(long long)ctx.nr_nameless,
+				(long long)ctx.nr_dirs,
+				(long long)ctx.arena_size,
+				(scanned.tv_sec - start.tv_sec) +
+				(scanned.tv_usec - start.tv_usec) / 1000000.0,
+				(end.tv_sec - scanned.tv_sec) +
+				(end.tv_usec - scanned.tv_usec) / 1000000.0);
+	ret = EXIT_SUCCESS;
+close:
+	if (opts.output && fclose(ctx.out)) {
+		ntfs_log_perror("Failed to close %s", opts.output);
+		ret = EXIT_FAILURE;
+	}
+umount:
+	if (ntfs_umount(vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.device);
+		ret = EXIT_FAILURE;
+	}
+free:
+	while (ctx.blocks) {
+		b = ctx.blocks;
+		ctx.blocks = b->next;
+		free(b);
+	}
+	free(ctx.dirs);
+	free(ctx.strays);
+	free(ctx.group);
+	free(ctx.path);
+	free(ctx.line);
+	return ret;
+}
@@ -0,0 +1,566 @@
+/**
+ * scan_ntfs - List all the files of an unmounted NTFS volume.
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * See LICENSE file for licensing information.
+ *
+ * This utility reads the whole mft of an unmounted NTFS volume (or volume
+ * image) sequentially and prints a line for each file found in it, with its
+ * name, parent directory, sizes, times and optionally the runlist of its
+ * data, as CSV, JSON lines or in a compact binary format.  The records are
+ * parsed on several threads, see newfs/mftscan.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#else
+	extern char *optarg;
+	extern int optind;
+#endif
+
+#include "types.h"
+#include "device.h"
+#include "layout.h"
+#include "logging.h"
+#include "mftscan.h"
+#include "ntfstime.h"
+#include "runlist.h"
+#include "unistr.h"
+#include "utils.h"
+#include "volume.h"
+
+static const char EXEC_NAME[] = "scan_ntfs";
+
+/* Room for a file name converted to UTF-8. */
+#define SCAN_NAME_BUF_SIZE	(4 * 255 + 1)
+
+typedef enum {
+	SCAN_FORMAT_CSV,
+	SCAN_FORMAT_JSON,
+	SCAN_FORMAT_BINARY,
+} scan_format;
+
+/* Magic at the start of the binary output. */
+static const char SCAN_BIN_MAGIC[8] = "NTFSSCAN";
+
+#define SCAN_BIN_VERSION	1
+
+/**
+ * struct scan_bin_header - start of the binary output
+ * @magic:		SCAN_BIN_MAGIC
+ * @version:		SCAN_BIN_VERSION
+ * @cluster_size:	byte size of a cluster of the volume
+ * @mft_record_size:	byte size of an mft record of the volume
+ * @reserved:		zero
+ *
+ * All fields of the binary output are little endian.
+ */
+typedef struct {
+	char magic[8];
+	le32 version;
+	le32 cluster_size;
+	le32 mft_record_size;
+	le32 reserved;
+} __attribute__((__packed__)) scan_bin_header;
+
+/**
+ * struct scan_bin_record - a file in the binary output
+ * @mft_ref:		mft reference (record and sequence number) of the file
+ * @parent_ref:		mft reference of the parent directory
+ * @base_ref:		base mft reference if this is an extent record, else 0
+ * @data_size:		sizes of the unnamed $DATA attribute
+ * @allocated_size:
+ * @initialized_size:
+ * @lowest_vcn:		first vcn of the runs following the record
+ * @times:		creation, data change, mft change and access times,
+ *			in NTFS time
+ * @file_attributes:	FILE_ATTR_FLAGS from $STANDARD_INFORMATION
+ * @flags:		MFT_RECORD_FLAGS of the mft record
+ * @name_type:		namespace of the file name
+ * @name_len:		number of UTF-16 characters following the record
+ * @nr_runs:		number of runs following the name
+ *
+ * The record is followed by the file name in UTF-16LE and then by @nr_runs
+ * pairs of 64-bit lcn (-1 for a hole) and length in clusters.
+ */
+typedef struct {
+	le64 mft_ref;
+	le64 parent_ref;
+	le64 base_ref;
+	sle64 data_size;
+	sle64 allocated_size;
+	sle64 initialized_size;
+	sle64 lowest_vcn;
+	sle64 times[4];
+	le32 file_attributes;
+	le16 flags;
+	u8 name_type;
+	u8 name_len;
+	le32 nr_runs;
+	le32 reserved;
+} __attribute__((__packed__)) scan_bin_record;
+
+static struct {
+	char *device;
+	char *output;
+	scan_format format;
+	int nr_threads;
+	u32 chunk_size;
+	BOOL extents;
+	BOOL runlist;
+	BOOL stats;
+} opts;
+
+static ntfs_volume *vol;
+
+__attribute__ ((noreturn)) static void usage(void)
+{
+	fprintf(stderr, "%s - list all the files of an NTFS volume.\n\n",
+			EXEC_NAME);
+	fprintf(stderr, "usage: %s [-ars] [-c KiB] [-f csv|json|bin] "
+			"[-o file] [-t threads] <device>\n\n", EXEC_NAME);
+	fprintf(stderr, "    -a          Also list mft extent records.\n");
+	fprintf(stderr, "    -c KiB      Read the mft this many KiB at a "
+			"time.\n");
+	fprintf(stderr, "    -f format   Output format (default csv).\n");
+	fprintf(stderr, "    -o file     Write the output to file instead of "
+			"standard output.\n");
+	fprintf(stderr, "    -r          Include the runlist of the data.\n");
+	fprintf(stderr, "    -s          Print statistics to standard "
+			"error.\n");
+	fprintf(stderr, "    -t threads  Number of threads parsing the mft "
+			"(default one per cpu).\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * parse_options - read and validate the program's command line
+ *
+ * Fill in the global @opts, exiting via usage() on invalid input.
+ */
+static void parse_options(int argc, char *argv[])
+{
+	char *end;
+	long n;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "ac:f:o:rst:")) != -1) {
+		switch (ch) {
+		case 'a':
+			opts.extents = TRUE;
+			break;
+		case 'c':
+			errno = 0;
+			n = strtol(optarg, &end, 0);
+			if (errno || *end || n <= 0 || n > 1024 * 1024)
+				usage();
+			opts.chunk_size = n * 1024;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				opts.format = SCAN_FORMAT_CSV;
+			else if (!strcmp(optarg, "json"))
+				opts.format = SCAN_FORMAT_JSON;
+			else if (!strcmp(optarg, "bin"))
+				opts.format = SCAN_FORMAT_BINARY;
+			else
+				usage();
+			break;
+		case 'o':
+			opts.output = optarg;
+			break;
+		case 'r':
+			opts.runlist = TRUE;
+			break;
+		case 's':
+			opts.stats = TRUE;
+			break;
+		case 't':
+			errno = 0;
+			n = strtol(optarg, &end, 0);
+			if (errno || *end || n <= 0 || n > 1024)
+				usage();
+			opts.nr_threads = n;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	opts.device = argv[0];
+}
+
+/**
+ * print_time - append an NTFS time as seconds since the epoch
+ * @out:	output to append to
+ * @t:		NTFS time, little endian
+ * @sep:	separator to print after the time
+ *
+ * The time is printed with its full 100ns resolution.
+ */
+static int print_time(ntfs_mft_scan_out *out, ntfs_time t, char sep)
+{
+	s64 ut = sle64_to_cpu(t) - NTFS_TIME_OFFSET;
+	s64 sec = ut / 10000000, frac = ut % 10000000;
+
+	if (frac < 0) {
+		sec--;
+		frac += 10000000;
+	}
+	return ntfs_mft_scan_printf(out, "%lld.%07lld%c", (long long)sec,
+			(long long)frac, sep);
+}
+
+/**
+ * print_name - append a file name quoted for the output format
+ * @out:	output to append to
+ * @name:	file name in UTF-8
+ *
+ * CSV fields are quoted only if they need to be, JSON strings always are.
+ */
+static int print_name(ntfs_mft_scan_out *out, const char *name)
+{
+	const char *p;
+
+	if (opts.format == SCAN_FORMAT_CSV) {
+		if (!name[strcspn(name, ",\"\r\n")])
+			return ntfs_mft_scan_write(out, name, strlen(name));
+		if (ntfs_mft_scan_write(out, "\"", 1))
+			return -1;
+		for (p = name; *p; p++) {
+			if (*p == '"' && ntfs_mft_scan_write(out, "\"", 1))
+				return -1;
+			if (ntfs_mft_scan_write(out, p, 1))
+				return -1;
+		}
+		return ntfs_mft_scan_write(out, "\"", 1);
+	}
+	if (ntfs_mft_scan_write(out, "\"", 1))
+		return -1;
+	for (p = name; *p; p++) {
+		unsigned char c = *p;
+		int err;
+
+		if (c == '"' || c == '\\')
+			err = ntfs_mft_scan_printf(out, "\\%c", c);
+		else if (c < 0x20)
+			err = ntfs_mft_scan_printf(out, "\\u%04x", c);
+		else
+			err = ntfs_mft_scan_write(out, p, 1);
+		if (err)
+			return -1;
+	}
+	return ntfs_mft_scan_write(out, "\"", 1);
+}
+
+/**
+ * print_runlist - append the runs of the data of a file
+ * @out:	output to append to
+ * @rl:		runlist of the extent of the data in the mft record
+ *
+ * Runs before the extent, which the runlist has as not mapped, are skipped.
+ * CSV prints "lcn:length" pairs separated by spaces, JSON an array of
+ * [lcn, length] arrays.  Holes have an lcn of -1.
+ */
+static int print_runlist(ntfs_mft_scan_out *out, const runlist_element *rl)
+{
+	BOOL first = TRUE;
+
+	if (opts.format == SCAN_FORMAT_JSON &&
+			ntfs_mft_scan_write(out, ",\"runs\":[", 9))
+		return -1;
+	for (; rl && rl->length; rl++) {
+		if (rl->lcn < LCN_HOLE)
+			continue;
+		if (ntfs_mft_scan_printf(out, opts.format == SCAN_FORMAT_CSV ?
+				"%s%lld:%lld" : "%s[%lld,%lld]",
+				first ? "" : opts.format == SCAN_FORMAT_CSV ?
+				" " : ",", (long long)rl->lcn,
+				(long long)rl->length))
+			return -1;
+		first = FALSE;
+	}
+	if (opts.format == SCAN_FORMAT_JSON)
+		return ntfs_mft_scan_write(out, "]", 1);
+	return 0;
+}
+
+/**
+ * print_bin - append a file in the binary format
+ * @out:	output to append to
+ * @r:		the file
+ * @rl:		runlist of the data of the file (NULL if not wanted)
+ */
+static int print_bin(ntfs_mft_scan_out *out, const ntfs_mft_scan_record *r,
+		const runlist_element *rl)
+{
+	scan_bin_record b;
+	const runlist_element *rle;
+	u32 nr_runs = 0;
+
+	for (rle = rl; rle && rle->length; rle++)
+		if (rle->lcn >= LCN_HOLE)
+			nr_runs++;
+	memset(&b, 0, sizeof(b));
+	b.mft_ref = cpu_to_le64(MK_MREF(r->mft_no, r->seq_no));
+	b.parent_ref = cpu_to_le64(r->parent_mref);
+	b.base_ref = cpu_to_le64(r->base_mref);
+	b.data_size = cpu_to_sle64(r->data_size);
+	b.allocated_size = cpu_to_sle64(r->allocated_size);
+	b.initialized_size = cpu_to_sle64(r->initialized_size);
+	if (r->data && r->data->non_resident)
+		b.lowest_vcn = r->data->lowest_vcn;
+	b.times[0] = r->creation_time;
+	b.times[1] = r->last_data_change_time;
+	b.times[2] = r->last_mft_change_time;
+	b.times[3] = r->last_access_time;
+	b.file_attributes = r->file_attributes;
+	b.flags = r->flags;
+	b.name_type = r->name_type;
+	b.name_len = r->name_len;
+	b.nr_runs = cpu_to_le32(nr_runs);
+	if (ntfs_mft_scan_write(out, &b, sizeof(b)) ||
+			ntfs_mft_scan_write(out, r->name, r->name_len *
+			sizeof(ntfschar)))
+		return -1;
+	for (rle = rl; rle && rle->length; rle++) {
+		sle64 run[2];
+
+		if (rle->lcn < LCN_HOLE)
+			continue;
+		run[0] = cpu_to_sle64(rle->lcn);
+		run[1] = cpu_to_sle64(rle->length);
+		if (ntfs_mft_scan_write(out, run, sizeof(run)))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * scan_record - print one file, called by the scanner
+ * @r:		the file
+ * @out:	output of the chunk of mft records @r belongs to
+ * @data:	unused
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int scan_record(const ntfs_mft_scan_record *r, ntfs_mft_scan_out *out,
+		void *data __attribute__((unused)))
+{
+	char name_buf[SCAN_NAME_BUF_SIZE], *name = name_buf;
+	runlist_element *rl = NULL;
+	BOOL csv = opts.format == SCAN_FORMAT_CSV;
+	int err;
+
+	if (opts.runlist && r->data && r->data->non_resident) {
+		rl = ntfs_mapping_pairs_decompress(vol, r->data, NULL);
+		if (!rl) {
+			/* Print the file anyway, just without runs. */
+			ntfs_log_error("Failed to decompress the runlist of "
+					"record %llu.\n",
+					(unsigned long long)r->mft_no);
+		}
+	}
+	if (opts.format == SCAN_FORMAT_BINARY) {
+		err = print_bin(out, r, rl);
+		goto out;
+	}
+	name_buf[0] = '\0';
+	if (r->name && ntfs_ucstombs(r->name, r->name_len, &name,
+			sizeof(name_buf)) < 0)
+		strcpy(name_buf, "?");
+	err = ntfs_mft_scan_printf(out, csv ? "%llu,%u,%llu,%u,%llu," :
+			"{\"mft_no\":%llu,\"seq_no\":%u,\"parent\":%llu,"
+			"\"parent_seq_no\":%u,\"base\":%llu,\"name\":",
+			(unsigned long long)r->mft_no, r->seq_no,
+			(unsigned long long)MREF(r->parent_mref),
+			MSEQNO(r->parent_mref),
+			(unsigned long long)MREF(r->base_mref));
+	if (!err)
+		err = print_name(out, name);
+	if (!err)
+		err = ntfs_mft_scan_printf(out, csv ? ",%u,%s,%lld,%lld,%lld,"
+				"0x%x," : ",\"name_type\":%u,\"dir\":%s,"
+				"\"data_size\":%lld,\"allocated_size\":%lld,"
+				"\"initialized_size\":%lld,\"attributes\":%u,"
+				"\"times\":[", (unsigned)r->name_type,
+				r->flags & MFT_RECORD_IS_DIRECTORY ?
+				(csv ? "1" : "true") : (csv ? "0" : "false"),
+				(long long)r->data_size,
+				(long long)r->allocated_size,
+				(long long)r->initialized_size,
+				(unsigned)le32_to_cpu(r->file_attributes));
+	if (!err)
+		err = print_time(out, r->creation_time, ',') ||
+				print_time(out, r->last_data_change_time,
+				',') ||
+				print_time(out, r->last_mft_change_time,
+				',') ||
+				print_time(out, r->last_access_time,
+				csv ? (opts.runlist ? ',' : '\n') : ']');
+	if (!err && opts.runlist)
+		err = print_runlist(out, rl);
+	if (!err && (!csv || opts.runlist))
+		err = ntfs_mft_scan_write(out, csv ? "\n" : "}\n", csv ? 1 : 2);
+out:
+	free(rl);
+	return err ? -1 : 0;
+}
+
+/**
+ * print_header - write what goes before the files
+ * @fd:		file descriptor to write to
+ *
+ * Return 0 on success and -1 with errno set on error.
+ */
+static int print_header(int fd)
+{
+	static const char csv_header[] = "mft_no,seq_no,parent,parent_seq_no,"
+			"base,name,name_type,dir,data_size,allocated_size,"
+			"initialized_size,attributes,creation_time,"
+			"data_change_time,mft_change_time,access_time";
+	static const char csv_runs[] = ",runs";
+	scan_bin_header h;
+
+	switch (opts.format) {
+	case SCAN_FORMAT_CSV:
+		if (write(fd, csv_header, sizeof(csv_header) - 1) < 0 ||
+				(opts.runlist && write(fd, csv_runs,
+				sizeof(csv_runs) - 1) < 0) ||
+				write(fd, "\n", 1) < 0)
+			return -1;
+		break;
+	case SCAN_FORMAT_BINARY:
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, SCAN_BIN_MAGIC, sizeof(h.magic));
+		h.version = const_cpu_to_le32(SCAN_BIN_VERSION);
+		h.cluster_size = cpu_to_le32(vol->cluster_size);
+		h.mft_record_size = cpu_to_le32(vol->mft_record_size);
+		if (write(fd, &h, sizeof(h)) != sizeof(h))
+			return -1;
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/**
+ * main - Begin here
+ *
+ * Start from here.
+ *
+ * Return:  0  Success, the program worked
+ *	    1  Error, something went wrong
+ */
+int main(int argc, char *argv[])
+{
+	ntfs_mft_scan_opts scan_opts;
+	ntfs_mft_scan_stats stats;
+	struct timeval start, end;
+	unsigned long mnt_flags;
+	int fd = STDOUT_FILENO, ret = EXIT_FAILURE;
+
+	parse_options(argc, argv);
+
+	ntfs_log_set_handler(ntfs_log_handler_outerr);
+	ntfs_log_clear_levels(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_VERBOSE |
+		NTFS_LOG_LEVEL_PROGRESS);
+	utils_set_locale();
+
+	if (ntfs_check_if_mounted(opts.device, &mnt_flags)) {
+		ntfs_log_perror("Failed to determine whether %s is mounted",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	if (mnt_flags & NTFS_MF_MOUNTED) {
+		ntfs_log_error("%s is mounted, unmount it first.\n",
+				opts.device);
+		return EXIT_FAILURE;
+	}
+	vol = ntfs_mount(opts.device, MS_RDONLY);
+	if (!vol) {
+		ntfs_log_perror("Failed to mount %s", opts.device);
+		return EXIT_FAILURE;
+	}
+	if (opts.output) {
+		fd = open(opts.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			ntfs_log_perror("Failed to open %s", opts.output);
+			goto umount;
+		}
+	}
+	if (print_header(fd)) {
+		ntfs_log_perror("Failed to write the output");
+		goto close;
+	}
+	memset(&scan_opts, 0, sizeof(scan_opts));
+	scan_opts.nr_threads = opts.nr_threads;
+	scan_opts.chunk_size = opts.chunk_size;
+	scan_opts.extents = opts.extents;
+	scan_opts.out_fd = fd;
+	scan_opts.fn = scan_record;
+	gettimeofday(&start, NULL);
+	if (ntfs_mft_scan(vol, &scan_opts, &stats)) {
+		ntfs_log_perror("Failed to scan the mft of %s", opts.device);
+		goto close;
+	}
+	gettimeofday(&end, NULL);
+	if (opts.stats) {
+		double secs = (end.tv_sec - start.tv_sec) +
+				(end.tv_usec - start.tv_usec) / 1000000.0;
+
+		fprintf(stderr, "%lld records, %lld in use, %lld extents, "
+				"%lld bad, %lld bytes in %.3f seconds",
+				(long long)stats.nr_records,
+				(long long)stats.nr_in_use,
+				(long long)stats.nr_extents,
+				(long long)stats.nr_bad,
+				(long long)stats.bytes_read, secs);
+		if (secs > 0)
+			fprintf(stderr, ", %.0f records/s",
+					stats.nr_records / secs);
+		fprintf(stderr, ".\n");
+	}
+	ret = EXIT_SUCCESS;
+close:
+	if (opts.output && close(fd)) {
+		ntfs_log_perror("Failed to close %s", opts.output);
+		ret = EXIT_FAILURE;
+	}
+umount:
+	if (ntfs_umount(vol, FALSE)) {
+		ntfs_log_perror("Failed to unmount %s", opts.device);
+		ret = EXIT_FAILURE;
+	}
+	return ret;
+}